@@ -0,0 +1,41 @@
+#ifndef _AGGREGATE_H
+#define _AGGREGATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "common.h"
+#include "table.h"
+
+// rows whose group is resolved before their values are folded in
+#define     AGG_BATCH       256
+
+typedef struct {
+    const char *pKey;               // points into the table dictionary
+    uint32_t count;
+    float min;
+    float max;
+    double sum;
+} Aggregate_Group_t;
+
+/*
+ * Aggregation state. Rows are grouped by their dictionary code, so the
+ * lookup is a direct array index. Kept between queries so the arrays are
+ * only reallocated when the dictionary outgrows them.
+ */
+typedef struct {
+    Aggregate_Group_t *pGroups;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *pSlots;               // per dictionary code, group + 1, 0 is empty
+    uint64_t *pSelect;              // rows passing the index predicates
+    size_t selectWords;
+} Aggregate_t;
+
+// prepare an empty aggregation state
+int aggregate_init(Aggregate_t *pAgg);
+// release the aggregation state
+void aggregate_free(Aggregate_t *pAgg);
+// group the table and accumulate readingValue statistics, request in host byte order
+int aggregate_run(Aggregate_t *pAgg, const Table_t *pTable, const DbProtocol_AggregateReq_t *pReq);
+
+#endif /* _AGGREGATE_H */
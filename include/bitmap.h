@@ -0,0 +1,59 @@
+#ifndef _BITMAP_H
+#define _BITMAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "common.h"
+
+// values in a container above which it switches to a bitset
+#define     BITMAP_ARRAY_MAX        4096
+// 64-bit words in a bitset container, one per 64 values of the low 16 bits
+#define     BITMAP_CONTAINER_WORDS  1024
+
+/*
+ * One 65536 value chunk. Sparse chunks keep a sorted array of the low 16
+ * bits, dense ones a plain bitset. Exactly one of pArray / pBits is set.
+ */
+typedef struct {
+    uint16_t *pArray;
+    uint64_t *pBits;
+    uint32_t key;                   // high 16 bits of every value in the chunk
+    uint32_t cardinality;
+    uint32_t capacity;              // array slots
+} Bitmap_Container_t;
+
+/*
+ * Compressed set of row numbers (roaring layout): containers sorted by key,
+ * empty containers are released.
+ */
+typedef struct {
+    Bitmap_Container_t *pContainers;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t cardinality;
+} Bitmap_t;
+
+// prepare an empty bitmap
+void bitmap_init(Bitmap_t *pBitmap);
+// release a bitmap
+void bitmap_free(Bitmap_t *pBitmap);
+// add a value, STATUS_ERROR on allocation failure
+int bitmap_add(Bitmap_t *pBitmap, uint32_t value);
+// remove a value, STATUS_ERROR on allocation failure
+int bitmap_remove(Bitmap_t *pBitmap, uint32_t value);
+// move every value of pSrc into pDst, leaving pSrc empty, STATUS_ERROR on allocation failure
+int bitmap_merge(Bitmap_t *pDst, Bitmap_t *pSrc);
+// bytes bitmap_save() writes for a bitmap
+size_t bitmap_savedBytes(const Bitmap_t *pBitmap);
+// serialize a bitmap, returns the bytes written
+size_t bitmap_save(const Bitmap_t *pBitmap, uint8_t *pOut);
+// rebuild an empty bitmap from bitmap_save() output, returns the bytes used or 0 if malformed
+size_t bitmap_load(Bitmap_t *pBitmap, const uint8_t *pIn, size_t len);
+// flat bitmap = bitmap, words past the last container are cleared
+void bitmap_copyTo(const Bitmap_t *pBitmap, uint64_t *pWords, size_t words);
+// flat bitmap &= bitmap
+void bitmap_andInto(const Bitmap_t *pBitmap, uint64_t *pWords, size_t words);
+// flat bitmap &= ~bitmap
+void bitmap_andNotInto(const Bitmap_t *pBitmap, uint64_t *pWords, size_t words);
+
+#endif /* _BITMAP_H */
@@ -0,0 +1,33 @@
+#ifndef _BUDGET_H
+#define _BUDGET_H
+
+#include <stdint.h>
+#include "common.h"
+#include "table.h"
+
+// readings each sensor keeps in memory before the budget takes them all
+#define     BUDGET_RING_SAMPLES     1024
+// part of the budget given to the segment buffer cache, one in this many bytes
+#define     BUDGET_CACHE_SHARE      8
+
+/*
+ * Memory budget of the raw reading history. Sensors are visited by a CLOCK
+ * hand: a sensor read since the last visit only loses its referenced bit,
+ * any other one is cut down to its newest BUDGET_RING_SAMPLES readings. If
+ * the budget still does not hold after a full turn, every sensor is cut
+ * down to the readings that are not sealed yet. Evicted readings stay in
+ * the segment files and are read back through the buffer cache.
+ */
+typedef struct {
+    uint64_t limit;                 // bytes for history and cache, 0 is unlimited
+    uint32_t hand;
+} Budget_t;
+
+// prepare a budget, 0 keeps everything in memory
+void budget_init(Budget_t *pBudget, uint64_t limit);
+// bytes of the budget given to the segment buffer cache
+uint64_t budget_cacheBytes(const Budget_t *pBudget);
+// evict history until it fits the budget, returns the bytes released
+uint64_t budget_enforce(Budget_t *pBudget, Table_t *pTable);
+
+#endif /* _BUDGET_H */
@@ -0,0 +1,16 @@
+#ifndef _CHECKSUM_H
+#define _CHECKSUM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "common.h"
+
+// CRC-32C (Castagnoli) of nothing, the seed of a running checksum
+#define     CHECKSUM_SEED       0
+
+// build the lookup tables and pick the SSE4.2 kernel if the CPU has it
+void checksum_init(void);
+// extend a running CRC-32C over len bytes
+uint32_t checksum_crc32c(uint32_t crc, const void *pData, size_t len);
+
+#endif /* _CHECKSUM_H */
@@ -21,7 +21,31 @@ typedef enum {
     MSG_SENSOR_ADD_RESP,
     MSG_SENSOR_DEL_REQ,
     MSG_SENSOR_DEL_RESP,
-    MSG_ERROR
+    MSG_ERROR,
+    MSG_SHM_ATTACH_REQ,
+    MSG_SHM_ATTACH_RESP,
+    MSG_SENSOR_BATCH_ADD_REQ,
+    MSG_SENSOR_BATCH_ADD_RESP,
+    MSG_SENSOR_LIST_PAGE_REQ,
+    MSG_SENSOR_LIST_PAGE_RESP,
+    MSG_QUERY_VIOLATIONS_REQ,
+    MSG_QUERY_VIOLATIONS_RESP,
+    MSG_AGGREGATE_REQ,
+    MSG_AGGREGATE_RESP,
+    MSG_SERIES_REQ,
+    MSG_SERIES_RESP,
+    MSG_SAMPLES_REQ,
+    MSG_SAMPLES_RESP,
+    MSG_QUANTILE_REQ,
+    MSG_QUANTILE_RESP,
+    MSG_SNAPSHOT_REQ,
+    MSG_SNAPSHOT_RESP,
+    MSG_REPLICATE_REQ,
+    MSG_REPLICATE_RESP,
+    MSG_REPL_STATUS_REQ,
+    MSG_REPL_STATUS_RESP,
+    MSG_EXPORT_REQ,
+    MSG_EXPORT_RESP
 } DbProtocol_e;
 
 typedef struct {
@@ -57,4 +81,210 @@ typedef struct {
     char sensorId[64];
 } DbProtocol_SensorDeleteReq_t;
 
-#endif /* _COMMON_H */
\ No newline at end of file
+#define     UDP_MAGIC       0x54454C55
+#define     UDP_DGRAM_MAX   8192
+
+// Header of a fire-and-forget UDP datagram, followed by count readings
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+} DbProtocol_UdpHdr_t;
+
+// Compact fixed-size reading, used by the bulk ingest paths
+typedef struct {
+    char sensorId[64];
+    char sensorType[32];
+    uint32_t timestamp;
+    float readingValue;
+    uint8_t i2cAddr;
+    uint8_t reserved[3];
+} DbProtocol_Reading_t;
+
+// readings that fit in one MSG_SENSOR_BATCH_ADD_REQ frame
+#define     BATCH_MAX_READINGS  ((BUFF_SIZE - sizeof(DbProtocolHdr_t)) / sizeof(DbProtocol_Reading_t))
+
+// records per MSG_SENSOR_LIST_PAGE_RESP
+#define     LIST_PAGE_MAX       256
+
+typedef struct {
+    uint32_t offset;
+    uint32_t limit;
+} DbProtocol_ListPageReq_t;
+
+typedef enum {
+    QUERY_VIOLATIONS,               // readingValue outside [minThreshold, maxThreshold]
+    QUERY_RANGE,                    // readingValue inside [lo, hi]
+    QUERY_MATCH                     // only the type/location/flags predicates
+} DbProtocol_QueryMode_e;
+
+// MSG_QUERY_VIOLATIONS_REQ, answered with one page of matching list records
+typedef struct {
+    uint32_t mode;                  // DbProtocol_QueryMode_e
+    float lo;                       // QUERY_RANGE bounds, inclusive
+    float hi;
+    uint8_t flagsMask;              // rows must also satisfy (flags & flagsMask) == flagsValue
+    uint8_t flagsValue;
+    uint8_t reserved[2];
+    uint32_t offset;                // matches to skip
+    uint32_t limit;                 // capped at LIST_PAGE_MAX
+    char sensorType[32];            // exact match, empty matches any
+    char location[128];             // exact match, empty matches any
+} DbProtocol_QueryReq_t;
+
+typedef enum {
+    AGG_BY_TYPE,
+    AGG_BY_LOCATION
+} DbProtocol_AggGroup_e;
+
+// MSG_AGGREGATE_REQ, statistics of readingValue per group
+typedef struct {
+    uint32_t groupBy;               // DbProtocol_AggGroup_e
+    uint32_t fromTs;                // inclusive timestamp window, both 0 disables it
+    uint32_t toTs;                  // 0 leaves the window open ended
+    uint8_t flagsMask;              // only rows with (flags & flagsMask) == flagsValue
+    uint8_t flagsValue;
+    uint8_t reserved[2];
+    char sensorType[32];            // exact match, empty matches any
+    char location[128];             // exact match, empty matches any
+} DbProtocol_AggregateReq_t;
+
+// MSG_AGGREGATE_RESP carries hdr.len of these, one per group
+typedef struct {
+    char key[128];                  // sensorType or location
+    uint32_t count;
+    float min;
+    float max;
+    float avg;
+    uint64_t sum;                   // IEEE 754 double bits
+} DbProtocol_AggregateResp_t;
+
+// points returned by one series request
+#define     SERIES_MAX_POINTS   4096
+
+// MSG_SERIES_REQ, downsampled readings of one sensor
+typedef struct {
+    char sensorId[64];
+    uint32_t fromTs;                // inclusive
+    uint32_t toTs;                  // inclusive, 0 leaves the range open ended
+    uint32_t points;                // wanted resolution, capped at SERIES_MAX_POINTS
+} DbProtocol_SeriesReq_t;
+
+// MSG_SERIES_RESP carries hdr.len of these, empty buckets are left out
+typedef struct {
+    uint32_t start;                 // bucket covers [start, start + width)
+    uint32_t width;                 // seconds
+    uint32_t count;
+    float min;
+    float max;
+    uint32_t reserved;
+    uint64_t sum;                   // IEEE 754 double bits
+} DbProtocol_SeriesPoint_t;
+
+typedef enum {
+    SAMPLES_LTTB,                   // Largest-Triangle-Three-Buckets
+    SAMPLES_MINMAX                  // min and max of equal time buckets
+} DbProtocol_SamplesMethod_e;
+
+// MSG_SAMPLES_REQ, raw readings of one sensor thinned to at most points samples
+typedef struct {
+    char sensorId[64];
+    uint32_t fromTs;                // inclusive
+    uint32_t toTs;                  // inclusive, 0 leaves the range open ended
+    uint32_t points;                // capped at SERIES_MAX_POINTS
+    uint32_t method;                // DbProtocol_SamplesMethod_e
+} DbProtocol_SamplesReq_t;
+
+// MSG_SAMPLES_RESP carries hdr.len of these in timestamp order
+typedef struct {
+    uint32_t timestamp;
+    float value;
+} DbProtocol_Sample_t;
+
+// quantiles answered by one request
+#define     QUANTILE_MAX        8
+
+// MSG_QUANTILE_REQ, percentiles of the readings of one sensor or of a group of sensors
+typedef struct {
+    char sensorId[64];              // one sensor, empty merges every sensor matching sensorType and location
+    char sensorType[32];            // exact match, empty matches any
+    char location[128];             // exact match, empty matches any
+    uint32_t fromTs;                // inclusive, widened to whole hours
+    uint32_t toTs;                  // inclusive, 0 leaves the range open ended
+    uint32_t count;                 // quantiles used, at most QUANTILE_MAX
+    float quantiles[QUANTILE_MAX];  // each in [0, 1]
+} DbProtocol_QuantileReq_t;
+
+// MSG_QUANTILE_RESP carries one of these
+typedef struct {
+    uint32_t readings;              // readings merged over the range
+    uint32_t sensors;               // sensors with readings in the range
+    float values[QUANTILE_MAX];     // in request order, within 1% relative error
+} DbProtocol_QuantileResp_t;
+
+// MSG_SNAPSHOT_RESP carries one of these, MSG_SNAPSHOT_REQ has no payload
+typedef struct {
+    uint64_t seq;                   // last mutation the snapshot holds
+    uint32_t pid;                   // process writing it, the server logs when it is done
+    uint32_t reserved;
+} DbProtocol_SnapshotResp_t;
+
+/*
+ * One mutation of the primary's log, streamed to replicas exactly as it is
+ * stored in the log file. Every field is in network byte order, checksum is
+ * the CRC-32C of the record with the checksum field zero.
+ */
+typedef struct {
+    uint64_t seq;                   // one higher than the record before it
+    uint32_t type;                  // 1 adds reading, 2 removes reading.sensorId
+    uint32_t checksum;
+    DbProtocol_Reading_t reading;
+    uint8_t reserved[4];
+} DbProtocol_LogRecord_t;
+
+// MSG_REPLICATE_REQ, sent by a replica once after the handshake
+typedef struct {
+    uint64_t afterSeq;              // last record the replica holds
+} DbProtocol_ReplicateReq_t;
+
+// MSG_REPLICATE_RESP, followed by hdr.len DbProtocol_LogRecord_t in log order
+typedef struct {
+    uint64_t headSeq;               // last record the primary had logged when it sent the frame
+} DbProtocol_ReplicateResp_t;
+
+// log records carried by one MSG_REPLICATE_RESP
+#define     REPL_FRAME_RECORDS  ((BUFF_SIZE - sizeof(DbProtocolHdr_t) - sizeof(DbProtocol_ReplicateResp_t)) / sizeof(DbProtocol_LogRecord_t))
+
+typedef enum {
+    REPL_ROLE_PRIMARY,
+    REPL_ROLE_REPLICA
+} DbProtocol_ReplRole_e;
+
+// MSG_REPL_STATUS_RESP carries one of these, MSG_REPL_STATUS_REQ has no payload
+typedef struct {
+    uint64_t seq;                   // last record applied by this server
+    uint64_t primarySeq;            // replica: primary head at the last frame, primary: seq
+    uint32_t role;                  // DbProtocol_ReplRole_e
+    uint32_t peers;                 // primary: replicas attached, replica: 1 while streaming
+} DbProtocol_ReplStatusResp_t;
+
+typedef enum {
+    EXPORT_SNAPSHOT,                // <db>.snapshot, the database as of the last snapshot
+    EXPORT_SNAPSHOT_ROLLUP,         // <db>.snapshot.rollup
+    EXPORT_SNAPSHOT_SKETCH,         // <db>.snapshot.sketch
+    EXPORT_SEGMENT                  // one segment file of reading history
+} DbProtocol_ExportFile_e;
+
+// MSG_EXPORT_REQ, a file the server streams back byte for byte as it is on disk
+typedef struct {
+    uint32_t file;                  // DbProtocol_ExportFile_e
+    uint32_t start;                 // EXPORT_SEGMENT: start of the segment
+} DbProtocol_ExportReq_t;
+
+// MSG_EXPORT_RESP carries one of these, then size raw bytes of the file and nothing else until they are done
+typedef struct {
+    uint64_t size;
+    uint64_t seq;                   // EXPORT_SNAPSHOT: last mutation the snapshot holds, 0 otherwise
+} DbProtocol_ExportResp_t;
+
+#endif /* _COMMON_H */
@@ -0,0 +1,44 @@
+#ifndef _DICT_H
+#define _DICT_H
+
+#include <stdint.h>
+#include "common.h"
+
+// codes are stored as 16 bits in the table and on disk, 0xFFFF marks an unset code
+#define     DICT_MAX_CODES      0xFFFF
+// limit of a dictionary only used as a set of strings, its codes are never stored
+#define     DICT_NO_LIMIT       0x7FFFFFFF
+
+/*
+ * String dictionary. Each distinct string gets a small integer code, in
+ * order of first appearance. Entries are never removed, so codes stay
+ * stable for the lifetime of the table.
+ */
+typedef struct {
+    char *pPool;                    // NUL terminated strings back to back, in code order
+    uint32_t poolLen;
+    uint32_t poolCap;
+    uint32_t *pOffsets;             // per code offset into pPool
+    uint64_t *pHashes;              // per code string hash
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *pSlots;               // open addressing, code + 1, 0 is empty
+    uint32_t slotMask;
+    uint32_t maxLen;                // buffer size the strings came from, longer ones are truncated
+    uint32_t maxCodes;              // codes handed out before the dictionary is full
+} Dict_t;
+
+// prepare an empty dictionary of up to maxCodes strings
+int dict_init(Dict_t *pDict, uint32_t maxLen, uint32_t maxCodes);
+// release a dictionary
+void dict_free(Dict_t *pDict);
+// forget every string, keeping the memory
+void dict_clear(Dict_t *pDict);
+// code of a string, adding it if needed, -1 when the dictionary is full
+int dict_intern(Dict_t *pDict, const char *pStr);
+// code of a string, -1 if unknown
+int dict_find(const Dict_t *pDict, const char *pStr);
+// string of a code
+const char *dict_string(const Dict_t *pDict, uint32_t code);
+
+#endif /* _DICT_H */
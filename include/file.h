@@ -4,11 +4,34 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include "common.h"
 
+// suffix of the next version of a file, renamed over it once it is on disk
+#define FILE_TMP_SUFFIX ".tmp"
+
 // create new database
 int file_createDb(char *pFilename);
 // open existing database
 int file_openDb(char *pFilename);
+// open or create the side file <database><suffix>
+int file_openSide(const char *pFilename, const char *pSuffix, bool truncate);
+// delete the side file <database><suffix> if it exists
+void file_removeSide(const char *pFilename, const char *pSuffix);
+// open or create the side directory <database><suffix>
+int file_openSideDir(const char *pFilename, const char *pSuffix, bool clear);
+// create <database><suffix>.tmp empty, or open an existing one read only, -1 if there is none
+int file_openTemp(const char *pFilename, const char *pSuffix, bool create);
+// rename <database><suffix>.tmp over <database><suffix>
+int file_commitTemp(const char *pFilename, const char *pSuffix);
+// delete <database><suffix>.tmp if it exists
+void file_removeTemp(const char *pFilename, const char *pSuffix);
+// sync the directory holding the database, so renames and new files in it survive a crash
+int file_syncDir(const char *pFilename);
 
 #endif /* _FILE_H */
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef _FILTER_H
+#define _FILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "common.h"
+#include "table.h"
+
+// rows covered by one selection bitmap word
+#define     FILTER_WORD_BITS    64
+
+/*
+ * Column kernels. Each one writes (or for flags, ANDs into) a selection
+ * bitmap with bit i of word i / 64 standing for row i. Bits past count are
+ * left clear.
+ */
+typedef struct {
+    const char *pName;
+    // value < min || value > max, per row thresholds
+    void (*pOutside)(const float *pValue, const float *pMin, const float *pMax, uint32_t count, uint64_t *pBitmap);
+    // lo <= value <= hi
+    void (*pInside)(const float *pValue, float lo, float hi, uint32_t count, uint64_t *pBitmap);
+    // keep rows where (flags & mask) == value
+    void (*pFlags)(const uint8_t *pFlags, uint8_t mask, uint8_t value, uint32_t count, uint64_t *pBitmap);
+} Filter_Kernels_t;
+
+// pick the widest kernels the CPU supports
+void filter_init(void);
+// kernels in use
+const Filter_Kernels_t *filter_kernels(void);
+// bitmap words needed for count rows
+size_t filter_bitmapWords(uint32_t count);
+// rows matching the equality predicates, answered from the bitmap indexes alone
+uint32_t filter_match(const Table_t *pTable, const char *pType, const char *pLocation,
+                      uint8_t flagsMask, uint8_t flagsValue, uint64_t *pBitmap);
+// evaluate a query over the table, returns the number of matching rows
+uint32_t filter_select(const Table_t *pTable, const DbProtocol_QueryReq_t *pQuery, uint64_t *pBitmap);
+
+#endif /* _FILTER_H */
@@ -0,0 +1,57 @@
+#ifndef _HISTORY_H
+#define _HISTORY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "common.h"
+
+typedef struct {
+    uint32_t timestamp;
+    float value;
+} History_Sample_t;
+
+/*
+ * Raw readings of one sensor, sorted by timestamp. The first saved samples
+ * are sealed in the segment files. The samples past saved are the reorder
+ * buffer: readings arriving out of order within the lateness window are
+ * put in place there, and a flush only seals the part older than the
+ * window, so every appended block is sorted. A reading older than sealed
+ * samples is still inserted in place, and is also kept in pLate until the
+ * flush appends it to its segment as a separate block, merged on load.
+ * Under a memory budget the oldest saved samples are evicted and only the
+ * segment files hold what is older than warmFrom.
+ */
+typedef struct {
+    History_Sample_t *pSamples;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t saved;
+    History_Sample_t *pLate;        // readings that missed the window, unsorted
+    uint32_t lateCount;
+    uint32_t lateCapacity;
+    uint32_t warmFrom;              // samples older than this were evicted, 0 when none were
+    bool referenced;                // read since the eviction clock last passed
+} History_Series_t;
+
+// release the samples of a series, leaving it empty
+void history_free(History_Series_t *pSeries);
+// mark the first saved samples and every late reading as stored
+void history_markSaved(History_Series_t *pSeries, uint32_t saved);
+// sort samples by timestamp
+void history_sort(History_Sample_t *pSamples, uint32_t count);
+// insert a reading, STATUS_ERROR on allocation failure
+int history_add(History_Series_t *pSeries, uint32_t timestamp, float value);
+// evict saved samples, keeping the newest keep in memory, returns the bytes released
+uint64_t history_evict(History_Series_t *pSeries, uint32_t keep);
+// heap bytes held by a series
+uint64_t history_bytes(const History_Series_t *pSeries);
+// drop the samples older than cutoff, returns how many
+uint32_t history_expire(History_Series_t *pSeries, uint32_t cutoff);
+// samples with timestamp in [fromTs, toTs], returns how many, first one in *pFirst
+uint32_t history_range(const History_Series_t *pSeries, uint32_t fromTs, uint32_t toTs, uint32_t *pFirst);
+// Largest-Triangle-Three-Buckets selection of at most points samples
+uint32_t history_lttb(const History_Sample_t *pIn, uint32_t count, uint32_t points, History_Sample_t *pOut);
+// smallest and largest sample of equal time buckets, at most points samples
+uint32_t history_minMax(const History_Sample_t *pIn, uint32_t count, uint32_t points, History_Sample_t *pOut);
+
+#endif /* _HISTORY_H */
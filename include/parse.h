@@ -7,27 +7,88 @@
 #include <string.h>
 #include <stdbool.h>
 #include <time.h>
+#include <stddef.h>
 #include "common.h"
+#include "table.h"
+#include "segment.h"
+#include "budget.h"
+#include "wal.h"
 #include <sys/stat.h>
 #include <arpa/inet.h>
 
 
 #define HEADER_MAGIC 0x53454E53
 
+// version 1: Parse_Sensor_t records with inline strings, 16-bit count
+#define DB_VERSION_RECORDS  1
+// version 2: dictionaries followed by Parse_Record_t records
+#define DB_VERSION_DICT     2
+// version 3: version 2 followed by CRC-32C checksums of the dictionaries and each record block
+#define DB_VERSION_BLOCKS   3
+// version 4: version 3 with the last mutation log sequence number the file holds
+#define DB_VERSION_CHECKPOINT 4
+
+// records covered by one checksum, also the unit the loader threads split the file by
+#define PARSE_BLOCK_RECORDS 4096
+// most threads decoding the database at startup
+#define PARSE_LOAD_THREADS  16
+
 typedef enum {
     SENSOR_FLAG_ACTIVE      = 0x01,
     SENSOR_FLAG_ERROR       = 0x02,
     SENSOR_FLAG_CALIBRATED  = 0x04
 } Sensor_Flag_t;
 
+/*
+ * Version 4 file layout:
+ *   Parse_DbHeader_t
+ *   typeBytes of NUL terminated sensorType strings, in code order
+ *   locationBytes of NUL terminated location strings, in code order
+ *   count Parse_Record_t
+ *   uint32_t CRC-32C of both dictionaries, then one per PARSE_BLOCK_RECORDS
+ *   records, the last block may be short
+ * Version 3 is the same with a header ending before checkpointSeq, version
+ * 2 is version 3 without the checksums.
+ */
 typedef struct
 {
   unsigned int magic;
   unsigned short version;
-  unsigned short count;
+  unsigned short reserved;
+  unsigned int count;
   unsigned int filesize;
+  unsigned int typeCount;
+  unsigned int typeBytes;
+  unsigned int locationCount;
+  unsigned int locationBytes;
+  uint64_t checkpointSeq;           // mutation log records up to this one are in the files
 } Parse_DbHeader_t;
 
+// version 1 header, still accepted when opening a database
+typedef struct
+{
+  unsigned int magic;
+  unsigned short version;
+  unsigned short count;
+  unsigned int filesize;
+} Parse_DbHeaderV1_t;
+
+// version 2 record, strings replaced by dictionary codes
+typedef struct
+{
+  char sensorId[64];
+  uint32_t timestamp;
+  float readingValue;
+  float minThreshold;
+  float maxThreshold;
+  uint16_t typeCode;
+  uint16_t locationCode;
+  uint8_t i2cAddr;
+  uint8_t flags;
+  uint8_t reserved[2];
+} Parse_Record_t;
+
+// version 1 record, also the layout used by parse_getSensor()
 typedef struct
 {
   char sensorId[64];
@@ -41,19 +102,283 @@ typedef struct
   float maxThreshold;
 } Parse_Sensor_t;
 
+/*
+ * Header of the rollup and sketch files. Version 1 ends before reserved2,
+ * version 2 names the checkpoint the file was written at, so files written
+ * at different checkpoints are not mixed up.
+ */
+typedef struct
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+  uint32_t sensors;
+  uint32_t reserved2;
+  uint64_t seq;                     // checkpointSeq of the database written with it
+} Parse_SideHeader_t;
+
+// bytes of a version 1 side header
+#define PARSE_SIDE_HEADER_V1 offsetof(Parse_SideHeader_t, reserved2)
+
+#define ROLLUP_MAGIC        0x524F4C4C
+// version 2: the header names the checkpoint it was written at, version 1 ends before reserved2
+#define ROLLUP_VERSION      2
+// suffix of the rollup file kept next to the database
+#define ROLLUP_SUFFIX       ".rollup"
+
+/*
+ * Rollup file layout:
+ *   Parse_RollupHeader_t
+ *   per sensor: Parse_RollupSensor_t, then counts[tier] Parse_RollupBucket_t
+ *   for each tier in Rollup_Tier_e order
+ */
+typedef Parse_SideHeader_t Parse_RollupHeader_t;
+
+typedef struct
+{
+  char sensorId[64];
+  uint32_t counts[ROLLUP_TIERS];
+} Parse_RollupSensor_t;
+
+typedef struct
+{
+  uint32_t start;
+  uint32_t count;
+  float min;
+  float max;
+  uint64_t sum;                     // IEEE 754 double bits
+} Parse_RollupBucket_t;
+
+#define HISTORY_MAGIC       0x48495354
+#define HISTORY_VERSION     1
+// suffix of the single history file of older versions, moved into segments on start
+#define HISTORY_SUFFIX      ".history"
+// block flag: forget the samples loaded so far for this sensor
+#define HISTORY_BLOCK_RESET 0x1
+
+/*
+ * History file layout, append only between compactions:
+ *   Parse_HistoryHeader_t
+ *   any number of Parse_HistoryBlock_t, each followed by count
+ *   Parse_HistorySample_t
+ * Blocks of one sensor are replayed in file order. Segment files use the
+ * same blocks with flags 0, followed by the checkpoint that wrote them.
+ */
+typedef struct
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+} Parse_HistoryHeader_t;
+
+typedef struct
+{
+  char sensorId[64];
+  uint32_t count;
+  uint32_t flags;
+} Parse_HistoryBlock_t;
+
+typedef struct
+{
+  uint32_t timestamp;
+  float value;
+} Parse_HistorySample_t;
+
+#define REORDER_MAGIC       0x524F5244
+#define REORDER_VERSION     1
+// suffix of the file holding the reorder buffers as of the last checkpoint
+#define REORDER_SUFFIX      ".reorder"
+
+/*
+ * Reorder file layout, rewritten at every checkpoint:
+ *   Parse_SideHeader_t, sensors counts the blocks
+ *   per sensor with unsealed readings: Parse_HistoryBlock_t, then count
+ *   Parse_HistorySample_t
+ * Readings the lateness window keeps out of the segments are no longer in
+ * the log once the checkpoint empties it, this file holds them until a
+ * later checkpoint seals them.
+ */
+
+#define SEGMENT_MAGIC       0x5345474D
+// version 2: every block names the checkpoint that wrote it, version 1 blocks are Parse_HistoryBlock_t
+#define SEGMENT_VERSION     2
+// version 1 files are still read and rewritten as version 2 on start
+#define SEGMENT_VERSION_V1  1
+#define SEGMENT_FOOTER_MAGIC 0x5A4F4E45
+// suffix of the directory holding the segment files next to the database
+#define SEGMENT_DIR_SUFFIX  ".segments"
+
+/*
+ * Segment file layout, one file per SEGMENT_WIDTH of timestamps:
+ *   Parse_SegmentHeader_t
+ *   any number of Parse_SegmentBlock_t, each followed by count
+ *   Parse_HistorySample_t
+ *   Parse_SegmentFooter_t
+ * New blocks overwrite the footer and a new one is written after them. A
+ * file without a valid footer was cut short and is scanned block by block.
+ * Blocks are appended before the database of their checkpoint is renamed
+ * into place, on start the blocks of a checkpoint the database does not
+ * hold are dropped, the log and reorder file still have their readings.
+ */
+typedef struct
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+  uint32_t start;
+  uint32_t width;
+} Parse_SegmentHeader_t;
+
+typedef struct
+{
+  Parse_HistoryBlock_t block;
+  uint64_t seq;                     // checkpointSeq of the checkpoint that wrote the block
+} Parse_SegmentBlock_t;
+
+typedef struct
+{
+  uint32_t minTs;
+  uint32_t maxTs;
+  float minValue;
+  float maxValue;
+  uint32_t samples;
+  uint32_t blocks;
+  char minSensorId[64];
+  char maxSensorId[64];
+  uint32_t blocksEnd;               // file offset of this footer
+  uint32_t magic;                   // SEGMENT_FOOTER_MAGIC
+} Parse_SegmentFooter_t;
+
+#define SKETCH_MAGIC        0x534B4348
+// version 2: the header names the checkpoint it was written at, version 1 ends before reserved2
+#define SKETCH_VERSION      2
+// suffix of the quantile sketch file kept next to the database
+#define SKETCH_SUFFIX       ".sketch"
+
+/*
+ * Sketch file layout:
+ *   Parse_SketchHeader_t
+ *   per sensor: Parse_SketchSensor_t, then buckets Parse_SketchBucket_t,
+ *   each followed by positiveBins then negativeBins uint32_t counts
+ */
+typedef Parse_SideHeader_t Parse_SketchHeader_t;
+
+typedef struct
+{
+  char sensorId[64];
+  uint32_t buckets;
+} Parse_SketchSensor_t;
+
+typedef struct
+{
+  uint32_t start;
+  uint32_t count;
+  float min;
+  float max;
+  uint32_t zeroCount;
+  int32_t positiveOffset;
+  uint32_t positiveBins;
+  int32_t negativeOffset;
+  uint32_t negativeBins;
+} Parse_SketchBucket_t;
+
+#define INDEX_MAGIC         0x494E4458
+#define INDEX_VERSION       1
+// suffix of the saved table indexes kept next to the database
+#define INDEX_SUFFIX        ".index"
+
+/*
+ * Index file layout, rewritten with the database at every checkpoint:
+ *   Parse_IndexHeader_t
+ *   bytes of table_saveIndex() output
+ * The file is mapped at startup and only adopted if it was saved for the
+ * same records, which dbDigest and seq check, otherwise the indexes are
+ * rebuilt from the records. Host byte order, the file is a cache.
+ */
+typedef struct
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+  uint32_t count;                   // rows indexed
+  uint32_t capacity;                // table capacity the ID index was sized for
+  uint64_t bytes;                   // payload after the header
+  uint32_t checksum;                // CRC-32C of the payload
+  uint32_t dbDigest;                // CRC-32C of the checksums of the database file
+  uint64_t seq;                     // checkpointSeq of the database file
+} Parse_IndexHeader_t;
+
+// side files written next to the database on every flush
+typedef struct
+{
+  int rollupFd;
+  int sketchFd;
+  int indexFd;
+  int reorderFd;
+  Segment_Store_t segments;
+  Wal_t wal;                        // mutations since the last checkpoint
+} Parse_SideFiles_t;
+
+// keeps row numbers and the doubling table capacity within 32 bits
+#define PARSE_MAX_SENSORS   0x7FFFFFFF
+
 // create database header
 int parse_createDbHeader(int fd, Parse_DbHeader_t **ppHeaderOut);
 // validate if header is valid
 int parse_validateDbHeader(int fd, Parse_DbHeader_t **ppHeaderOut);
 // add new sensor to database
-int parse_addSensor(Parse_DbHeader_t *pDbhdr, Parse_Sensor_t **ppSensors, char *pAddString);
+int parse_addSensor(Parse_DbHeader_t *pDbhdr, Table_t *pTable, char *pAddString);
+// add or update a sensor from a compact reading
+int parse_addReading(Parse_DbHeader_t *pDbhdr, Table_t *pTable, const DbProtocol_Reading_t *pReading);
 // remove sensor data from database
-int parse_removeSensor(Parse_DbHeader_t *pDbhdr, Parse_Sensor_t **ppSensors, char *pRemove);
+int parse_removeSensor(Parse_DbHeader_t *pDbhdr, Table_t *pTable, char *pRemove);
 // list sensor records in database
-void parse_listSensors(Parse_DbHeader_t *pDbhdr, Parse_Sensor_t *pSensors);
-// read sensors in database
-int parse_readSensors(int fd, Parse_DbHeader_t *pDbhdr, Parse_Sensor_t **ppSensorsOut);
+void parse_listSensors(Parse_DbHeader_t *pDbhdr, Table_t *pTable);
+// check a row against its thresholds, updating its ERROR flag and the alert set
+bool parse_checkThresholds(Table_t *pTable, uint32_t row);
+// gather one table row into a file record
+void parse_getSensor(const Table_t *pTable, uint32_t row, Parse_Sensor_t *pOut);
+// read sensors in database, adopting the saved indexes when they match, indexFd may be -1
+int parse_readSensors(int fd, Parse_DbHeader_t *pDbhdr, Table_t *pTable, int indexFd);
 // write database to file
-int parse_outputFile(int fd, Parse_DbHeader_t *pDbhdr, Parse_Sensor_t *pSensors);
+int parse_outputFile(int fd, Parse_DbHeader_t *pDbhdr, Table_t *pTable);
+// save the table indexes for the database just written
+int parse_outputIndex(int fd, int dbfd, const Parse_DbHeader_t *pDbhdr, const Table_t *pTable);
+// log every later mutation to pWal, NULL stops logging
+void parse_attachLog(Wal_t *pWal);
+// apply the records of a log past the checkpoint of the database, returns how many
+int parse_replayLog(Wal_t *pWal, Parse_DbHeader_t *pDbhdr, Table_t *pTable);
+// only create sensors that hash to shard index of count, count 0 creates any
+void parse_setShard(uint32_t index, uint32_t count);
+// apply one log record in host byte order, a replayed or replicated mutation
+int parse_applyRecord(Parse_DbHeader_t *pDbhdr, Table_t *pTable, Wal_Record_t *pRecord);
+// load the rollups of known sensors written at checkpoint seq, an empty file is accepted
+int parse_readRollups(int fd, Table_t *pTable, uint64_t seq);
+// write the rollups of every sensor as of checkpoint seq
+int parse_outputRollups(int fd, const Table_t *pTable, uint64_t seq);
+// replay a history file of an older version, the samples are left unsaved
+int parse_readHistory(int fd, Table_t *pTable);
+// load the segment catalog and replay the readings of known sensors committed up to checkpoint seq
+int parse_readSegments(Segment_Store_t *pStore, Table_t *pTable, Budget_t *pBudget, uint64_t seq);
+// stored readings of one sensor in [fromTs, toTs], appended to a growing buffer and sorted
+int parse_readSamples(Segment_Store_t *pStore, const char *pSensorId, uint32_t fromTs, uint32_t toTs,
+                      History_Sample_t **ppSamples, uint32_t *pCount, uint32_t *pCapacity);
+// write readings older than the lateness window and late readings to their segments for checkpoint seq
+int parse_outputSegments(Segment_Store_t *pStore, Table_t *pTable, uint32_t window, uint64_t seq);
+// load the quantile sketches of known sensors written at checkpoint seq, an empty file is accepted
+int parse_readSketches(int fd, Table_t *pTable, uint64_t seq);
+// write the quantile sketches of every sensor as of checkpoint seq
+int parse_outputSketches(int fd, const Table_t *pTable, uint64_t seq);
+// load the unsealed readings of known sensors written at checkpoint seq, an empty file is accepted
+int parse_readReorder(int fd, Table_t *pTable, uint64_t seq);
+// write the readings of every reorder buffer as of checkpoint seq
+int parse_outputReorder(int fd, const Table_t *pTable, uint64_t seq);
+// write and sync the table and side files at pDbhdr->checkpointSeq, the log may be emptied on STATUS_SUCCESS
+int parse_checkpoint(const char *pDbPath, int dbfd, Parse_DbHeader_t *pDbhdr, Table_t *pTable,
+                     Parse_SideFiles_t *pSide, uint32_t window);
+// finish or drop the temporary files of a checkpoint a crash interrupted, seq from the database header
+void parse_recoverCheckpoint(const char *pDbPath, uint64_t seq);
+// checkpoint a database or side file was written at, pSuffix names the kind, false if it does not say
+bool parse_fileSeq(int fd, const char *pSuffix, uint64_t *pSeq);
 
 #endif /* _PARSE_H */
\ No newline at end of file
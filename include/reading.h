@@ -0,0 +1,13 @@
+#ifndef _READING_H
+#define _READING_H
+
+#include "common.h"
+
+// parse 'sensor_id,sensor_type,i2c_addr,timestamp,reading_value' into a reading
+int reading_fromString(char *pStr, DbProtocol_Reading_t *pOut);
+// convert numeric fields to network byte order
+void reading_hton(DbProtocol_Reading_t *pReading);
+// convert numeric fields to host byte order
+void reading_ntoh(DbProtocol_Reading_t *pReading);
+
+#endif /* _READING_H */
@@ -0,0 +1,43 @@
+#ifndef _REPL_H
+#define _REPL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "common.h"
+#include "parse.h"
+
+// delay before a replica reconnects to its primary
+#define     REPL_RETRY_MS           5000
+// longest a replica waits for the primary to accept and answer the handshake
+#define     REPL_CONNECT_TIMEOUT_MS 1000
+// log frames a primary sends to one replica per event loop iteration
+#define     REPL_FRAMES_PER_STEP    64
+
+/*
+ * Replica end of a replication stream. The replica holds a copy of the
+ * primary's database as of some log position, e.g. a snapshot, asks for
+ * every record after it and applies them in order through its own log, so
+ * its database and log keep the primary's sequence numbers and a restart
+ * resumes where it stopped.
+ */
+typedef struct {
+    char host[64];                  // primary IPv4 address
+    unsigned short port;
+    int fd;                         // stream from the primary, -1 while disconnected
+    char buffer[BUFF_SIZE];         // bytes of the frame being received
+    size_t bufLen;
+    uint64_t primarySeq;            // primary log head at the last frame
+    bool refused;                   // a record was refused, only a reseed gets past it
+} Repl_Replica_t;
+
+// take the primary from "host:port", STATUS_ERROR if it is malformed
+int repl_parseAddress(const char *pSpec, Repl_Replica_t *pReplica);
+// connect, handshake and ask for the records after afterSeq, STATUS_ERROR leaves it disconnected
+int repl_connect(Repl_Replica_t *pReplica, uint64_t afterSeq);
+// drop the stream, repl_connect() resumes it
+void repl_disconnect(Repl_Replica_t *pReplica);
+// read what the primary sent and apply the complete frames, returns records applied or -1 when the stream ended,
+// refused is set when it ended at a record the replica cannot apply
+int repl_receive(Repl_Replica_t *pReplica, Parse_DbHeader_t *pDbhdr, Table_t *pTable, Wal_t *pWal);
+
+#endif /* _REPL_H */
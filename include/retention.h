@@ -0,0 +1,55 @@
+#ifndef _RETENTION_H
+#define _RETENTION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "common.h"
+#include "table.h"
+#include "segment.h"
+
+#define     DEFAULT_RETENTION_RAW_S     (30 * 86400)
+#define     DEFAULT_RETENTION_ROLLUP_S  (365 * 86400)
+// time between two expiry sweeps
+#define     RETENTION_INTERVAL_MS       60000
+// rows trimmed per event loop iteration while a sweep runs
+#define     RETENTION_ROWS_PER_STEP     256
+
+typedef enum {
+    RETENTION_RAW,
+    RETENTION_MINUTE,
+    RETENTION_HOUR,
+    RETENTION_DAY,
+    RETENTION_SKETCH,
+    RETENTION_TIERS
+} Retention_Tier_e;
+
+// maximum age of each data tier in seconds, 0 keeps a tier forever
+typedef struct {
+    uint32_t maxAgeSec[RETENTION_TIERS];
+} Retention_Policy_t;
+
+/*
+ * One pass over the table that drops everything older than the policy
+ * allows. It advances a bounded number of rows per step, so a large table
+ * is trimmed over several event loop iterations, and unlinks the expired
+ * segment files once every row is done.
+ */
+typedef struct {
+    uint32_t cutoff[RETENTION_TIERS];   // timestamps below this are expired, 0 expires nothing
+    uint32_t row;                       // next row to trim
+    bool active;
+    uint64_t samples;                   // raw samples dropped so far
+    uint64_t buckets;                   // rollup and sketch buckets dropped so far
+    uint32_t segments;                  // segment files unlinked
+} Retention_Sweep_t;
+
+// the default policy, 30 days of raw readings and a year of everything else
+void retention_defaults(Retention_Policy_t *pPolicy);
+// apply "tier=age[,tier=age...]" to a policy, age is a number with an s, m, h or d suffix or 0
+int retention_parse(const char *pSpec, Retention_Policy_t *pPolicy);
+// begin a sweep with the cutoffs of the policy at time now
+void retention_start(Retention_Sweep_t *pSweep, const Retention_Policy_t *pPolicy, uint32_t now);
+// trim up to rows rows, returns true when rollups or sketches changed
+bool retention_step(Retention_Sweep_t *pSweep, Table_t *pTable, Segment_Store_t *pStore, uint32_t rows);
+
+#endif /* _RETENTION_H */
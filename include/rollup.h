@@ -0,0 +1,49 @@
+#ifndef _ROLLUP_H
+#define _ROLLUP_H
+
+#include <stdint.h>
+#include "common.h"
+
+typedef enum {
+    ROLLUP_MINUTE,
+    ROLLUP_HOUR,
+    ROLLUP_DAY,
+    ROLLUP_TIERS
+} Rollup_Tier_e;
+
+// statistics of the readings whose timestamp falls in [start, start + width)
+typedef struct {
+    uint32_t start;
+    uint32_t count;
+    float min;
+    float max;
+    double sum;
+} Rollup_Bucket_t;
+
+// buckets of one resolution, sorted by start
+typedef struct {
+    Rollup_Bucket_t *pBuckets;
+    uint32_t count;
+    uint32_t capacity;
+} Rollup_Series_t;
+
+// every resolution of one sensor
+typedef struct {
+    Rollup_Series_t tiers[ROLLUP_TIERS];
+} Rollup_Sensor_t;
+
+// bucket width of a tier in seconds
+uint32_t rollup_width(Rollup_Tier_e tier);
+// release the buckets of a sensor
+void rollup_free(Rollup_Sensor_t *pRollup);
+// fold a reading into every tier, STATUS_ERROR on allocation failure
+int rollup_add(Rollup_Sensor_t *pRollup, uint32_t timestamp, float value);
+// append a bucket that starts after the last one, used when loading
+int rollup_append(Rollup_Series_t *pSeries, const Rollup_Bucket_t *pBucket);
+// drop the buckets of a tier that end before cutoff, returns how many
+uint32_t rollup_expire(Rollup_Sensor_t *pRollup, Rollup_Tier_e tier, uint32_t cutoff);
+// downsample [fromTs, toTs] to at most points buckets, returns the number written
+uint32_t rollup_query(const Rollup_Sensor_t *pRollup, uint32_t fromTs, uint32_t toTs, uint32_t points,
+                      Rollup_Bucket_t *pOut, uint32_t *pWidth, uint32_t *pRead);
+
+#endif /* _ROLLUP_H */
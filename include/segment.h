@@ -0,0 +1,106 @@
+#ifndef _SEGMENT_H
+#define _SEGMENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "common.h"
+
+// one segment file per UTC day of readings
+#define     SEGMENT_WIDTH       86400
+// room for the file name of a segment, "<start>.seg" or "<start>.tmp"
+#define     SEGMENT_NAME_LEN    32
+// unit of the segment buffer cache
+#define     SEGMENT_PAGE_SIZE   16384
+
+// zone map, what a segment holds without opening it
+typedef struct {
+    uint32_t minTs;
+    uint32_t maxTs;
+    float minValue;
+    float maxValue;
+    uint32_t samples;
+    uint32_t blocks;
+    char minSensorId[64];
+    char maxSensorId[64];
+} Segment_Zone_t;
+
+typedef struct {
+    uint32_t start;                 // holds timestamps [start, start + SEGMENT_WIDTH)
+    uint32_t end;                   // file offset of the footer, where the next block goes
+    Segment_Zone_t zone;
+    int fd;                         // open while a flush writes to the segment, -1 otherwise
+    uint16_t version;               // file format, version 1 files are rewritten on start
+    bool rewrite;                   // compact the file on this flush
+    bool dirty;                     // blocks appended, footer not written yet
+} Segment_t;
+
+typedef struct {
+    uint32_t start;                 // segment the page belongs to
+    uint32_t page;                  // page number within the file
+    uint32_t length;                // bytes read, short for the last page of a file
+    int32_t next;                   // next frame of the same hash chain, -1 ends it
+    bool valid;
+    bool referenced;                // hit since the clock hand last passed
+} Segment_Frame_t;
+
+/*
+ * Buffer cache of segment file pages for reads of evicted readings. Pages
+ * are found through hashed chains and replaced with the CLOCK algorithm: the
+ * hand clears the referenced bit of the frames it passes and takes the
+ * first frame that was not hit since its last pass.
+ */
+typedef struct {
+    uint8_t *pData;                 // frames * SEGMENT_PAGE_SIZE bytes
+    Segment_Frame_t *pFrames;
+    int32_t *pChains;               // chain heads, one per frame, -1 when empty
+    uint32_t frames;
+    uint32_t hand;
+    uint64_t hits;
+    uint64_t misses;
+} Segment_Cache_t;
+
+/*
+ * Catalog of the segment files in a directory, sorted by start. Only the
+ * zone maps are kept in memory, so a segment can be ruled out for a time
+ * range, a value range or a sensor ID without touching its file.
+ */
+typedef struct {
+    int dirFd;
+    Segment_t *pSegments;
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t committedSeq;          // checkpoint of the database on disk, later blocks are not committed
+    Segment_Cache_t cache;
+} Segment_Store_t;
+
+// prepare an empty catalog over an open directory
+void segment_init(Segment_Store_t *pStore, int dirFd);
+// close every open segment and release the catalog
+void segment_free(Segment_Store_t *pStore);
+// start of the segment holding a timestamp
+uint32_t segment_startOf(uint32_t timestamp);
+// last timestamp a segment holds
+uint32_t segment_last(uint32_t start);
+// file name of a segment
+void segment_name(uint32_t start, bool temporary, char *pName);
+// index of the segment starting at start, -1 if there is none
+int segment_find(const Segment_Store_t *pStore, uint32_t start);
+// index of the segment starting at start, added empty if needed, -1 on allocation failure
+int segment_insert(Segment_Store_t *pStore, uint32_t start);
+// drop a segment from the catalog, its file is left alone
+void segment_remove(Segment_Store_t *pStore, uint32_t index);
+// give the catalog a buffer cache of about bytes, STATUS_ERROR on allocation failure
+int segment_cacheInit(Segment_Store_t *pStore, uint64_t bytes);
+// copy len bytes at offset of a segment file through the buffer cache
+int segment_read(Segment_Store_t *pStore, uint32_t index, uint32_t offset, void *pBuf, uint32_t len);
+// forget the cached pages of a segment whose file changed
+void segment_invalidate(Segment_Store_t *pStore, uint32_t index);
+// reset a zone map to hold nothing
+void segment_zoneClear(Segment_Zone_t *pZone);
+// widen a zone map by one block of samples
+void segment_zoneAdd(Segment_Zone_t *pZone, const char *pSensorId, uint32_t minTs, uint32_t maxTs,
+                     float minValue, float maxValue, uint32_t samples);
+// true when the sensor ID falls within the zone's ID range
+bool segment_zoneHasId(const Segment_Zone_t *pZone, const char *pSensorId);
+
+#endif /* _SEGMENT_H */
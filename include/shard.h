@@ -0,0 +1,21 @@
+#ifndef _SHARD_H
+#define _SHARD_H
+
+#include <stdint.h>
+#include "common.h"
+
+// servers one shard map can name
+#define     SHARD_MAX           16
+
+/*
+ * Sensors are spread over shards by a 32-bit FNV-1a hash of their ID. The
+ * hash space is cut into count equal ranges and shard i owns the i-th, so
+ * servers and clients agree on the owner without talking to each other.
+ */
+
+// shard owning a sensor ID among count shards
+uint32_t shard_of(const char *pSensorId, uint32_t count);
+// take "<index>/<count>" from a command line argument, STATUS_ERROR if it is malformed
+int shard_parse(const char *pSpec, uint32_t *pIndex, uint32_t *pCount);
+
+#endif /* _SHARD_H */
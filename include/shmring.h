@@ -0,0 +1,63 @@
+#ifndef _SHMRING_H
+#define _SHMRING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "common.h"
+
+#define     SHMRING_MAGIC           0x53484D52
+#define     SHMRING_DEFAULT_SLOTS   65536
+#define     SHMRING_CACHELINE       64
+
+/*
+ * Bounded MPSC queue living in a memfd shared between the server and any
+ * number of local producers. Each slot carries a sequence number: producers
+ * claim a position with a CAS on tail and publish the slot by bumping its
+ * sequence, the single consumer (the server) releases it again. The eventfd
+ * doorbell is only rung when the consumer announced it is about to sleep.
+ */
+typedef struct {
+    _Atomic uint64_t seq;
+    DbProtocol_Reading_t reading;
+} __attribute__((aligned(SHMRING_CACHELINE))) ShmRing_Slot_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t slots;                                             // power of two
+    _Alignas(SHMRING_CACHELINE) _Atomic uint64_t tail;          // next position to claim
+    _Alignas(SHMRING_CACHELINE) _Atomic uint64_t head;          // next position to drain, informational only
+    _Alignas(SHMRING_CACHELINE) _Atomic uint32_t consumerWaiting;
+    _Atomic uint64_t dropped;                                   // pushes rejected on a full ring
+    _Alignas(SHMRING_CACHELINE) ShmRing_Slot_t ring[];
+} ShmRing_t;
+
+/*
+ * The server's own view of a ring. Producers can write anything into the
+ * shared mapping, so the consumer indexes the slots only with the size and
+ * head it keeps here, set when the ring is created.
+ */
+typedef struct {
+    ShmRing_t *pShared;
+    uint64_t mask;                                              // slots - 1
+    uint64_t head;                                              // next position to drain
+    uint32_t slots;
+    uint64_t corrupt;                                           // slots skipped for a bad sequence
+} ShmRing_Consumer_t;
+
+// create a new ring backed by a memfd (server side)
+int shmring_create(uint32_t slots, ShmRing_Consumer_t *pConsumer, int *pMemFdOut);
+// unmap the ring of the server
+void shmring_close(ShmRing_Consumer_t *pConsumer);
+// map a ring received from the server (producer side)
+ShmRing_t *shmring_map(int memFd);
+// unmap a ring
+void shmring_unmap(ShmRing_t *pRing);
+// enqueue one reading, rings the doorbell only if the consumer is parked
+int shmring_push(ShmRing_t *pRing, const DbProtocol_Reading_t *pReading, int eventFd);
+// dequeue one reading, returns false when the ring is empty
+bool shmring_pop(ShmRing_Consumer_t *pConsumer, DbProtocol_Reading_t *pOut);
+// announce the consumer is going to sleep, returns false if data raced in
+bool shmring_park(ShmRing_Consumer_t *pConsumer);
+
+#endif /* _SHMRING_H */
@@ -0,0 +1,74 @@
+#ifndef _SKETCH_H
+#define _SKETCH_H
+
+#include <stdint.h>
+#include "common.h"
+
+// relative accuracy of the returned quantiles
+#define     SKETCH_ALPHA            0.01
+// bins per store, the lowest magnitudes collapse together past this
+#define     SKETCH_MAX_BINS         2048
+// magnitudes below this are counted as zero
+#define     SKETCH_MIN_VALUE        1e-9
+// width of the per sensor sketch buckets in seconds
+#define     SKETCH_BUCKET_WIDTH     3600
+
+// counts of consecutive logarithmic bins, pCounts[0] is bin offset
+typedef struct {
+    uint32_t *pCounts;
+    int32_t offset;
+    uint32_t bins;
+    uint32_t capacity;
+} Sketch_Store_t;
+
+/*
+ * DDSketch. A value v > 0 lands in bin ceil(log(v) / log(gamma)) with
+ * gamma = (1 + alpha) / (1 - alpha), so any quantile is answered within
+ * alpha relative error. Negative values are binned by magnitude in their
+ * own store. Two sketches merge by adding bin counts, which is exact.
+ */
+typedef struct {
+    Sketch_Store_t positive;
+    Sketch_Store_t negative;
+    uint32_t zeroCount;
+    uint32_t count;
+    float min;
+    float max;
+} Sketch_t;
+
+// sketch of the readings whose timestamp falls in [start, start + SKETCH_BUCKET_WIDTH)
+typedef struct {
+    uint32_t start;
+    Sketch_t sketch;
+} Sketch_Bucket_t;
+
+// buckets of one sensor, sorted by start
+typedef struct {
+    Sketch_Bucket_t *pBuckets;
+    uint32_t count;
+    uint32_t capacity;
+} Sketch_Series_t;
+
+// release the bins of a sketch
+void sketch_free(Sketch_t *pSketch);
+// fold a value into a sketch, STATUS_ERROR on allocation failure
+int sketch_add(Sketch_t *pSketch, float value);
+// fold src into dst, STATUS_ERROR on allocation failure
+int sketch_merge(Sketch_t *pDst, const Sketch_t *pSrc);
+// value at quantile q in [0, 1], NAN for an empty sketch
+float sketch_quantile(const Sketch_t *pSketch, double q);
+// set the bins of one store, used when loading
+int sketch_setStore(Sketch_Store_t *pStore, int32_t offset, const uint32_t *pCounts, uint32_t bins);
+
+// release the buckets of a sensor
+void sketch_seriesFree(Sketch_Series_t *pSeries);
+// fold a reading into its bucket, STATUS_ERROR on allocation failure
+int sketch_seriesAdd(Sketch_Series_t *pSeries, uint32_t timestamp, float value);
+// append a bucket that starts after the last one, the series takes over its bins
+int sketch_seriesAppend(Sketch_Series_t *pSeries, Sketch_Bucket_t *pBucket);
+// drop the buckets that end before cutoff, returns how many
+uint32_t sketch_seriesExpire(Sketch_Series_t *pSeries, uint32_t cutoff);
+// merge the buckets overlapping [fromTs, toTs] into pOut
+int sketch_seriesQuery(const Sketch_Series_t *pSeries, uint32_t fromTs, uint32_t toTs, Sketch_t *pOut, uint32_t *pRead);
+
+#endif /* _SKETCH_H */
@@ -0,0 +1,37 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "common.h"
+#include "parse.h"
+
+// suffix of the snapshot kept next to the database, itself a database path
+#define     SNAPSHOT_SUFFIX     ".snapshot"
+// suffix of a snapshot file still being written
+#define     SNAPSHOT_TMP_SUFFIX ".tmp"
+
+/*
+ * Consistent copy of the database taken while the server keeps running. A
+ * forked child writes the table, rollups and sketches as they were at the
+ * fork, the kernel copies only the pages the server changes meanwhile. Each
+ * file is written under a temporary name, synced and renamed into place,
+ * so a snapshot file is always complete. Every file names the mutation
+ * log position it holds in its header, so files of two snapshots left by a
+ * crash between the renames are told apart.
+ */
+typedef struct {
+    pid_t pid;                      // child writing the snapshot, 0 when none runs
+    uint64_t seq;                   // last mutation log record the snapshot holds
+    uint64_t startMs;
+} Snapshot_t;
+
+// fork a child writing <pDbPath>.snapshot, STATUS_ERROR if one is running or fork fails
+int snapshot_start(Snapshot_t *pSnapshot, const char *pDbPath, Parse_DbHeader_t *pDbhdr, Table_t *pTable, uint64_t seq);
+// collect a finished child, wait blocks until it is done, true once none runs
+bool snapshot_reap(Snapshot_t *pSnapshot, bool wait);
+// open a file of the last complete snapshot, -1 if there is none
+int snapshot_open(const char *pDbPath, const char *pSuffix, uint64_t *pSeq);
+
+#endif /* _SNAPSHOT_H */
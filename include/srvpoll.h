@@ -4,14 +4,46 @@
 #include <poll.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
+#include <sys/un.h>
 #include <signal.h>
 #include <stdbool.h>
 #include "parse.h"
+#include "timer.h"
+#include "retention.h"
+#include "snapshot.h"
+#include "repl.h"
 
 #define     MAX_CLIENTS     256
 #define     BUFF_SIZE       4096
 #define     PORT            8080
 
+// fixed poll() slots ahead of the client descriptors
+#define     POLL_IDX_TCP        0
+#define     POLL_IDX_UNIX       1
+#define     POLL_IDX_SHM        2
+#define     POLL_IDX_UDP        3
+#define     POLL_IDX_REPLICA    4
+#define     POLL_IDX_CLIENTS    5
+
+// readings applied from the shared memory ring per loop iteration
+#define     SHM_DRAIN_BUDGET    4096
+
+// bytes an export sends to one client per loop iteration
+#define     EXPORT_STEP_BYTES   (4 * 1024 * 1024)
+
+// a reply that cannot be sent within this long drops the client
+#define     REPLY_SEND_TIMEOUT_S    5
+
+// datagrams fetched per recvmmsg() call and calls per loop iteration
+#define     UDP_BATCH           32
+#define     UDP_ROUNDS          8
+
+#define     DEFAULT_IDLE_TIMEOUT_S      300
+#define     DEFAULT_HELLO_TIMEOUT_S     10
+#define     DEFAULT_REQUEST_TIMEOUT_MS  5000
+#define     DEFAULT_FLUSH_INTERVAL_MS   1000
+#define     DEFAULT_REORDER_WINDOW_S    300
+
 typedef enum {
     STATE_NEW,
     STATE_CONNECTED,
@@ -24,9 +56,47 @@ typedef struct {
     int fd;
     State_e state;
     char buffer[BUFF_SIZE];
+    size_t bufLen;                  // bytes of unprocessed request data in buffer
+    uint64_t lastActiveMs;          // time of the last read from the client
+    bool isLocal;                   // connected over the unix domain socket
+    Timer_Node_t connTimer;         // handshake deadline, then idle timeout
+    Timer_Node_t reqTimer;          // deadline for completing a partial request
+    bool isReplica;                 // streaming the mutation log, sends no more requests
+    uint64_t replSeq;               // last log record put in a frame for the replica
+    char *pReplFrame;               // frame being sent to the replica
+    size_t replLen;
+    size_t replSent;
+    int exportFd;                   // file being streamed by MSG_EXPORT_REQ, -1 when none
+    off_t exportOffset;             // next byte of the file to send
+    off_t exportSize;               // file size when the export started
 } ClientState_t;
 
+typedef struct {
+    const char *pDbPath;            // database file, snapshots are written next to it
+    unsigned short port;
+    char *pUnixPath;                // optional AF_UNIX listener, NULL disables
+    unsigned int idleTimeoutSec;    // 0 disables idle reaping
+    unsigned int helloTimeoutSec;   // 0 disables the handshake deadline
+    unsigned int requestTimeoutMs;  // 0 disables the partial request deadline
+    unsigned int shmSlots;          // shared memory ingest ring size, 0 disables
+    unsigned short udpPort;         // fire-and-forget UDP ingest, 0 disables
+    unsigned int flushIntervalMs;   // max delay before changes reach the file, 0 flushes every loop
+    Retention_Policy_t retention;   // how long each data tier is kept
+    unsigned int reorderWindowSec;  // lateness window readings are sorted in before sealing, 0 seals on flush
+    uint64_t memoryBudget;          // bytes for reading history and segment cache, 0 is unlimited
+    const char *pPrimary;           // "host:port" to replicate from, NULL serves as a primary
+    bool verbose;                   // log every query with its timing
+} SrvPoll_Config_t;
+
+typedef struct {
+    uint64_t datagrams;             // datagrams received
+    uint64_t readings;              // readings applied
+    uint64_t malformed;             // datagrams dropped for bad header, size or truncation
+    uint64_t rejected;              // readings the database refused
+    uint32_t kernelDrops;           // datagrams dropped by the socket queue (SO_RXQ_OVFL)
+} SrvPoll_UdpStats_t;
+
 // Polling routine for the server
-void poll_loop(unsigned short port, Parse_DbHeader_t *dbhdr, Parse_Sensor_t **ppSensors, int dbfd);
+void poll_loop(SrvPoll_Config_t *pConfig, Parse_DbHeader_t *dbhdr, Table_t *pTable, int dbfd, Parse_SideFiles_t *pSide);
 
-#endif /* _SRVPOLL_H */
\ No newline at end of file
+#endif /* _SRVPOLL_H */
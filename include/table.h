@@ -0,0 +1,141 @@
+#ifndef _TABLE_H
+#define _TABLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "common.h"
+#include "dict.h"
+#include "bitmap.h"
+#include "rollup.h"
+#include "history.h"
+#include "sketch.h"
+
+#define     TABLE_INITIAL_CAPACITY  64
+#define     TABLE_NO_ALERT          0xFFFFFFFFU
+// code of a row whose type or location was not set yet
+#define     TABLE_NO_CODE           0xFFFF
+// bits of the flags column, one bitmap index each
+#define     TABLE_FLAG_BITS         8
+
+// sizes of the string fields the dictionaries are fed from
+#define     TABLE_TYPE_LEN          32
+#define     TABLE_LOCATION_LEN      128
+
+/*
+ * Rarely touched per sensor data. Kept out of the numeric columns so that
+ * scans over readings and flags do not drag the ID through the cache for
+ * every row.
+ */
+typedef struct {
+    char sensorId[64];
+    unsigned char i2cAddr;
+} Table_Cold_t;
+
+/*
+ * Rows per dictionary code, grown as the dictionary grows.
+ */
+typedef struct {
+    Bitmap_t *pRows;
+    uint32_t count;
+} Table_CodeIndex_t;
+
+/*
+ * In-memory sensor table in structure-of-arrays form. Row i of every column
+ * describes the same sensor, rows are dense in [0, count). The on-disk and
+ * wire formats stay record oriented (Parse_Sensor_t, list responses).
+ */
+typedef struct {
+    uint32_t count;
+    uint32_t capacity;
+
+    // hot columns
+    uint32_t *pTimestamp;
+    float *pReading;
+    float *pMinThreshold;
+    float *pMaxThreshold;
+    uint8_t *pFlags;
+    uint16_t *pTypeCode;            // code in the types dictionary
+    uint16_t *pLocationCode;        // code in the locations dictionary
+
+    // cold columns
+    Table_Cold_t *pCold;
+    uint64_t *pIdHash;              // hash of sensorId, avoids rehashing strings on growth
+    Rollup_Sensor_t *pRollup;       // minute/hour/day statistics of the readings
+    History_Series_t *pHistory;     // raw readings
+    Sketch_Series_t *pSketch;       // hourly quantile sketches of the readings
+
+    // open addressing sensorId index, slot holds row + 1, 0 is empty
+    uint32_t *pIndex;
+    uint32_t indexMask;
+
+    // rows currently outside their thresholds, unordered
+    uint32_t *pAlertRows;
+    uint32_t *pAlertPos;            // per row position in pAlertRows or TABLE_NO_ALERT
+    uint32_t alertCount;
+
+    // interned sensorType and location strings
+    Dict_t types;
+    Dict_t locations;
+
+    // IDs removed since the last flush, their stored history is purged then
+    Dict_t removed;
+
+    // secondary indexes, kept in step by the setters below and by remove
+    Table_CodeIndex_t typeIndex;
+    Table_CodeIndex_t locationIndex;
+    Bitmap_t flagIndex[TABLE_FLAG_BITS];
+} Table_t;
+
+/*
+ * Secondary indexes of a run of rows whose columns a loader thread filled
+ * in place. Each thread indexes its own run, the runs are then merged into
+ * the table in row order.
+ */
+typedef struct {
+    uint32_t first;                 // first row of the run
+    uint32_t count;
+    Table_CodeIndex_t typeIndex;
+    Table_CodeIndex_t locationIndex;
+    Bitmap_t flagIndex[TABLE_FLAG_BITS];
+} Table_Shard_t;
+
+// allocate an empty table
+int table_init(Table_t *pTable, uint32_t capacity);
+// release all columns
+void table_free(Table_t *pTable);
+// hash used by the sensorId index
+uint64_t table_hashId(const char *pSensorId);
+// find a sensor by ID, returns row or -1
+int table_find(const Table_t *pTable, const char *pSensorId);
+// find a sensor by ID or append a zeroed row for it, returns row or -1
+int table_insert(Table_t *pTable, const char *pSensorId, bool *pCreated);
+// remove a row, the last row moves into its place
+int table_remove(Table_t *pTable, uint32_t row);
+// set the type code of a row, STATUS_ERROR on allocation failure
+int table_setType(Table_t *pTable, uint32_t row, uint16_t code);
+// set the location code of a row, STATUS_ERROR on allocation failure
+int table_setLocation(Table_t *pTable, uint32_t row, uint16_t code);
+// set the flags of a row, STATUS_ERROR on allocation failure
+int table_setFlags(Table_t *pTable, uint32_t row, uint8_t flags);
+// sensorType string of a row
+const char *table_typeName(const Table_t *pTable, uint32_t row);
+// location string of a row
+const char *table_locationName(const Table_t *pTable, uint32_t row);
+// add a row to or drop it from the alert set
+void table_setAlert(Table_t *pTable, uint32_t row, bool alert);
+// start an empty shard whose run begins at row first
+void table_shardInit(Table_Shard_t *pShard, uint32_t first);
+// index the next row of a shard, its columns already set, STATUS_ERROR on allocation failure
+int table_shardAdd(Table_Shard_t *pShard, const Table_t *pTable);
+// release the indexes of a shard
+void table_shardFree(Table_Shard_t *pShard);
+// append the run of a shard to the table, STATUS_ERROR on a duplicate ID or allocation failure
+int table_merge(Table_t *pTable, Table_Shard_t *pShard);
+// bytes table_saveIndex() writes
+size_t table_indexBytes(const Table_t *pTable);
+// serialize the ID hashes, the ID index and the secondary indexes
+void table_saveIndex(const Table_t *pTable, uint8_t *pOut);
+// adopt saved indexes for rows whose columns are already set, STATUS_ERROR if they do not fit
+int table_loadIndex(Table_t *pTable, uint32_t count, const uint8_t *pIn, size_t len);
+
+#endif /* _TABLE_H */
@@ -0,0 +1,126 @@
+#ifndef _TELEMETRY_H
+#define _TELEMETRY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "common.h"
+#include "shmring.h"
+#include "shard.h"
+
+#define     TELEMETRY_DEFAULT_WINDOW    64
+
+/*
+ * Completion callback. status is STATUS_SUCCESS or STATUS_ERROR (server
+ * replied MSG_ERROR or the connection was lost). For list, query and aggregate
+ * responses pPayload points to count records in host byte order, valid only
+ * during the call. The aggregate sum field holds the bits of a double.
+ */
+typedef void (*Telemetry_Callback_t)(int status, DbProtocol_e type, const void *pPayload, uint32_t count, void *pUser);
+
+typedef struct {
+    Telemetry_Callback_t pCallback;
+    void *pUser;
+} Telemetry_Pending_t;
+
+typedef struct {
+    int fd;
+    bool isLocal;                   // connected over a unix domain socket
+    unsigned int window;            // max requests in flight before enqueue blocks
+
+    char *pTxBuf;                   // encoded requests not yet written
+    size_t txLen;
+    size_t txCap;
+
+    char *pRxBuf;                   // response bytes not yet dispatched
+    size_t rxLen;
+    size_t rxCap;
+
+    Telemetry_Pending_t *pPending;  // FIFO of requests awaiting a response
+    size_t pendHead;
+    size_t pendCount;
+    size_t pendCap;
+} Telemetry_Conn_t;
+
+/*
+ * Connections to every server of a hash-sharded deployment, in shard order.
+ * Requests about one sensor go to the shard owning it, see shard_of(), and
+ * requests about every sensor go to all shards at once.
+ */
+typedef struct {
+    Telemetry_Conn_t conns[SHARD_MAX];
+    uint32_t count;
+} Telemetry_Cluster_t;
+
+typedef struct {
+    ShmRing_t *pRing;
+    int memFd;
+    int eventFd;
+} Telemetry_ShmProducer_t;
+
+// connect over TCP and complete the handshake
+int telemetry_connect(Telemetry_Conn_t *pConn, const char *pHost, uint16_t port);
+// connect over a unix domain socket and complete the handshake
+int telemetry_connectUnix(Telemetry_Conn_t *pConn, const char *pPath);
+// fail outstanding requests and release the connection
+void telemetry_close(Telemetry_Conn_t *pConn);
+// limit the number of pipelined requests
+void telemetry_setWindow(Telemetry_Conn_t *pConn, unsigned int window);
+
+// queue an add request from a 'sensor_id,sensor_type,i2c_addr,timestamp,reading_value' string
+int telemetry_addSensor(Telemetry_Conn_t *pConn, const char *pAddStr, Telemetry_Callback_t pCallback, void *pUser);
+// queue a batch of up to BATCH_MAX_READINGS readings, count in the callback is the number accepted
+int telemetry_addReadings(Telemetry_Conn_t *pConn, const DbProtocol_Reading_t *pReadings, uint32_t count, Telemetry_Callback_t pCallback, void *pUser);
+// queue a list request
+int telemetry_listSensors(Telemetry_Conn_t *pConn, Telemetry_Callback_t pCallback, void *pUser);
+// queue a request for up to LIST_PAGE_MAX records starting at offset
+int telemetry_listPage(Telemetry_Conn_t *pConn, uint32_t offset, uint32_t limit, Telemetry_Callback_t pCallback, void *pUser);
+// queue a filter query for one page of matching records, pQuery in host byte order
+int telemetry_query(Telemetry_Conn_t *pConn, const DbProtocol_QueryReq_t *pQuery, Telemetry_Callback_t pCallback, void *pUser);
+// queue a group-by aggregation, pReq in host byte order
+int telemetry_aggregate(Telemetry_Conn_t *pConn, const DbProtocol_AggregateReq_t *pReq, Telemetry_Callback_t pCallback, void *pUser);
+// queue a downsampled series request for one sensor, pReq in host byte order
+int telemetry_series(Telemetry_Conn_t *pConn, const DbProtocol_SeriesReq_t *pReq, Telemetry_Callback_t pCallback, void *pUser);
+// queue a request for raw readings thinned on the server, pReq in host byte order
+int telemetry_samples(Telemetry_Conn_t *pConn, const DbProtocol_SamplesReq_t *pReq, Telemetry_Callback_t pCallback, void *pUser);
+// queue a percentile request, pReq in host byte order
+int telemetry_quantile(Telemetry_Conn_t *pConn, const DbProtocol_QuantileReq_t *pReq, Telemetry_Callback_t pCallback, void *pUser);
+// queue a snapshot request, the callback receives one DbProtocol_SnapshotResp_t once it started
+int telemetry_snapshot(Telemetry_Conn_t *pConn, Telemetry_Callback_t pCallback, void *pUser);
+// queue a replication status request, the callback receives one DbProtocol_ReplStatusResp_t
+int telemetry_replStatus(Telemetry_Conn_t *pConn, Telemetry_Callback_t pCallback, void *pUser);
+// copy a snapshot or segment file of the server to outFd over an idle connection, blocks until done
+int telemetry_export(Telemetry_Conn_t *pConn, const DbProtocol_ExportReq_t *pReq, int outFd, DbProtocol_ExportResp_t *pResp);
+// queue a delete request
+int telemetry_deleteSensor(Telemetry_Conn_t *pConn, const char *pSensorId, Telemetry_Callback_t pCallback, void *pUser);
+
+// move queued requests and responses, dispatching completions, -1 on connection loss
+int telemetry_poll(Telemetry_Conn_t *pConn, int timeoutMs);
+// wait until every queued request completed
+int telemetry_flush(Telemetry_Conn_t *pConn);
+// number of requests awaiting a response
+size_t telemetry_inFlight(const Telemetry_Conn_t *pConn);
+
+// connect to every server of a "host:port,host:port,..." shard map, shard i is the i-th entry
+int telemetry_clusterConnect(Telemetry_Cluster_t *pCluster, const char *pMap);
+// close every shard connection
+void telemetry_clusterClose(Telemetry_Cluster_t *pCluster);
+// connection to the shard owning a sensor
+Telemetry_Conn_t *telemetry_clusterRoute(Telemetry_Cluster_t *pCluster, const char *pSensorId);
+// wait until every shard completed its queued requests, the shards make progress together
+int telemetry_clusterFlush(Telemetry_Cluster_t *pCluster);
+// aggregate on every shard at once and merge the groups, the callback runs once, blocks until done
+int telemetry_clusterAggregate(Telemetry_Cluster_t *pCluster, const DbProtocol_AggregateReq_t *pReq,
+                               Telemetry_Callback_t pCallback, void *pUser);
+
+// obtain the server's shared memory ring over an idle unix connection
+int telemetry_shmAttach(Telemetry_Conn_t *pConn, Telemetry_ShmProducer_t *pProducer);
+// push one reading without any syscall in the common case
+int telemetry_shmPush(Telemetry_ShmProducer_t *pProducer, const DbProtocol_Reading_t *pReading);
+// release the ring mapping
+void telemetry_shmDetach(Telemetry_ShmProducer_t *pProducer);
+
+// send readings as fire-and-forget UDP datagrams
+int telemetry_sendUdp(const char *pHost, uint16_t port, const DbProtocol_Reading_t *pReadings, uint32_t count);
+
+#endif /* _TELEMETRY_H */
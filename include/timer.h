@@ -0,0 +1,51 @@
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "common.h"
+
+#define     TIMER_TICK_MS       10
+#define     TIMER_LEVELS        4
+#define     TIMER_SLOT_BITS     6
+#define     TIMER_SLOTS         (1 << TIMER_SLOT_BITS)
+#define     TIMER_SLOT_MASK     (TIMER_SLOTS - 1)
+
+struct Timer_Node;
+
+typedef void (*Timer_Callback_t)(struct Timer_Node *pNode, void *pArg);
+
+typedef struct Timer_Node {
+    struct Timer_Node *pNext;
+    struct Timer_Node *pPrev;
+    uint64_t expires;               // absolute expiry, in ticks
+    Timer_Callback_t pCallback;
+    void *pArg;
+} Timer_Node_t;
+
+typedef struct {
+    uint64_t now;                   // last tick that was processed
+    unsigned int pending;           // number of armed timers
+    Timer_Node_t slots[TIMER_LEVELS][TIMER_SLOTS];
+} Timer_Wheel_t;
+
+// monotonic clock in milliseconds
+uint64_t timer_nowMs(void);
+// monotonic clock in microseconds, for measuring short operations
+uint64_t timer_nowUs(void);
+// initialize an empty wheel starting at the given time
+void timer_init(Timer_Wheel_t *pWheel, uint64_t nowMs);
+// prepare a node so it can be armed later
+void timer_initNode(Timer_Node_t *pNode, Timer_Callback_t pCallback, void *pArg);
+// arm (or re-arm) a node to fire after timeoutMs
+void timer_arm(Timer_Wheel_t *pWheel, Timer_Node_t *pNode, uint64_t nowMs, uint64_t timeoutMs);
+// disarm a node, no-op if it is not armed
+void timer_cancel(Timer_Wheel_t *pWheel, Timer_Node_t *pNode);
+// check whether a node is currently armed
+bool timer_isArmed(const Timer_Node_t *pNode);
+// run all timers that expired up to nowMs, returns number of fired timers
+int timer_advance(Timer_Wheel_t *pWheel, uint64_t nowMs);
+// milliseconds until the wheel needs to be advanced, -1 if nothing is armed
+int timer_nextTimeoutMs(Timer_Wheel_t *pWheel, uint64_t nowMs);
+
+#endif /* _TIMER_H */
@@ -0,0 +1,71 @@
+#ifndef _WAL_H
+#define _WAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "common.h"
+
+// suffix of the mutation log kept next to the database
+#define     WAL_SUFFIX          ".wal"
+// records buffered before a commit grows the buffer
+#define     WAL_INITIAL_RECORDS 256
+// committed records kept in memory for replicas to catch up from
+#define     DEFAULT_WAL_BACKLOG 65536
+
+typedef enum {
+    WAL_ADD = 1,                    // reading applied through parse_addReading()
+    WAL_REMOVE = 2                  // sensor removed, only the ID is set
+} Wal_Type_e;
+
+/*
+ * One logged mutation, type is a Wal_Type_e. Sequence numbers grow by one
+ * per record and carry on across checkpoints, so a position in the log is
+ * a single number. Stored in network byte order, the layout replicas
+ * receive it in.
+ */
+typedef DbProtocol_LogRecord_t Wal_Record_t;
+
+/*
+ * Write-ahead log of the mutations since the last checkpoint. Records are
+ * buffered while an event loop iteration applies them and written and
+ * synced with one call at its end, or before a reply acknowledges them. A
+ * checkpoint stores the last sequence number in the database header and
+ * empties the log once the files are on disk, so on startup only the
+ * records past that number are replayed.
+ */
+typedef struct {
+    int fd;
+    uint64_t seq;                   // last sequence number handed out
+    Wal_Record_t *pPending;         // appended, not yet written
+    uint32_t pendingCount;
+    uint32_t pendingCapacity;
+    uint64_t readOffset;            // next record wal_read() returns
+    Wal_Record_t *pBacklog;         // committed records, record seq in slot seq % backlogCapacity
+    uint32_t backlogCapacity;
+    uint32_t backlogCount;          // the newest committed records held
+} Wal_t;
+
+// prepare a log over an open file, the first record written gets seq + 1
+void wal_init(Wal_t *pWal, int fd, uint64_t seq);
+// release the buffer, the file is left open
+void wal_free(Wal_t *pWal);
+// next intact record of the file in host byte order, false at the end or at a torn tail
+bool wal_read(Wal_t *pWal, Wal_Record_t *pRecord);
+// cut the file after the records wal_read() returned and continue numbering from the last one
+void wal_truncateRead(Wal_t *pWal);
+// log one mutation, reading in host byte order, STATUS_ERROR on allocation failure
+int wal_append(Wal_t *pWal, Wal_Type_e type, const DbProtocol_Reading_t *pReading);
+// write the buffered records to the file and sync it, on failure they stay buffered and the file is cut back
+int wal_commit(Wal_t *pWal);
+// drop every record, the database now holds them
+void wal_checkpoint(Wal_t *pWal);
+// keep the last records committed in memory for replicas, STATUS_ERROR on allocation failure
+int wal_backlogInit(Wal_t *pWal, uint32_t records);
+// true when every committed record after afterSeq is still in the backlog
+bool wal_backlogHas(const Wal_t *pWal, uint64_t afterSeq);
+// copy up to max committed records after afterSeq in network byte order, returns how many
+uint32_t wal_backlogRead(const Wal_t *pWal, uint64_t afterSeq, Wal_Record_t *pOut, uint32_t max);
+// check a record in network byte order and convert it to host byte order, false if it is damaged
+bool wal_decode(Wal_Record_t *pRecord);
+
+#endif /* _WAL_H */
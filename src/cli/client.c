@@ -1,24 +1,72 @@
 #include <stdio.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
+#include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
 #include "common.h"
+#include "reading.h"
+#include "telemetry.h"
 
-#define BUFF_SIZE   4096
+// how often bulk transfers report progress on stderr
+#define PROGRESS_INTERVAL_MS    1000
+#define SERIES_DEFAULT_POINTS   300
+#define QUANTILE_DEFAULT_LIST   "0.5,0.95,0.99"
+
+typedef struct {
+    Telemetry_Conn_t *pConn;
+    FILE *pFile;
+    uint64_t records;           // readings sent or records written
+    uint64_t applied;           // readings the server accepted
+    uint64_t bytes;             // CSV bytes read or written
+    uint64_t startMs;
+    uint64_t reportMs;
+    uint32_t nextOffset;        // export: offset of the next page to request
+    bool done;                  // export: a short page marked the end of the table
+    int status;
+} Bulk_Transfer_t;
+
+typedef struct {
+    Telemetry_Conn_t *pConn;
+    DbProtocol_QueryReq_t query;    // next page to fetch
+    uint32_t matches;
+} Query_State_t;
 
 /* Private function prototypes -----------------------------------------------*/
 static void printUsage(char *argv[]);
-static void handle_client(int fd);
-static int send_req(int fd);
-static int send_sensor(int fd, const char *addstr);
-static int list_sensors(int fd);
-static int delete_sensor(int fd, char *sensorId);
+static int send_sensor(Telemetry_Conn_t *conn, const char *addstr);
+static Telemetry_Conn_t *route_sensor(Telemetry_Cluster_t *cluster, const char *addstr);
+static int list_sensors(Telemetry_Conn_t *conn);
+static int delete_sensor(Telemetry_Conn_t *conn, char *sensorId);
+static int shm_send_sensor(Telemetry_Conn_t *conn, const char *addstr);
+static int udp_send_sensor(const char *host, uint16_t port, const char *addstr);
+static int import_csv(Telemetry_Cluster_t *cluster, const char *path, uint32_t batchSize);
+static int export_csv(Telemetry_Cluster_t *cluster, const char *path);
+static int request_page(Bulk_Transfer_t *transfer);
+static int export_file(Telemetry_Conn_t *conn, const char *spec);
+static uint64_t now_ms(void);
+static void report_progress(Bulk_Transfer_t *transfer, const char *verb, bool final);
+static void on_batch_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user);
+static void on_page_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user);
+static int query_sensors(Telemetry_Cluster_t *cluster, DbProtocol_QueryMode_e mode, float lo, float hi, const DbProtocol_QueryReq_t *match);
+static void on_query_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user);
+static int aggregate_sensors(Telemetry_Cluster_t *cluster, DbProtocol_AggGroup_e groupBy, uint32_t fromTs, uint32_t toTs, const DbProtocol_QueryReq_t *match);
+static void on_aggregate_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user);
+static int series_sensor(Telemetry_Conn_t *conn, const char *sensorId, uint32_t fromTs, uint32_t toTs, uint32_t points);
+static void on_series_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user);
+static int samples_sensor(Telemetry_Conn_t *conn, const char *sensorId, uint32_t fromTs, uint32_t toTs, uint32_t points, uint32_t method);
+static void on_samples_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user);
+static int parse_quantiles(const char *pList, DbProtocol_QuantileReq_t *pReq);
+static int quantile_sensors(Telemetry_Conn_t *conn, DbProtocol_QuantileReq_t *req, uint32_t fromTs, uint32_t toTs, const DbProtocol_QueryReq_t *match);
+static void on_quantile_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user);
+static void on_add_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user);
+static void on_list_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user);
+static void on_delete_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user);
+static void on_snapshot_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user);
+static void on_repl_status_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user);
 
 
 /**
@@ -32,17 +80,46 @@ int main(int argc, char *argv[]) {
         printUsage(argv);
         return 0;
     }
-    
+
     int c;
     char *addarg = NULL;
     char *portarg = NULL;
     char *hostarg = NULL;
     char *deletearg = NULL;
+    char *unixarg = NULL;
+    char *importarg = NULL;
+    char *exportarg = NULL;
+    char *maparg = NULL;
+    char *filearg = NULL;
+    uint32_t batchSize = BATCH_MAX_READINGS;
+    unsigned int window = TELEMETRY_DEFAULT_WINDOW;
+    bool violations = false;
+    char *rangearg = NULL;
+    float rangeLo = 0.0f;
+    float rangeHi = 0.0f;
+    char *grouparg = NULL;
+    unsigned int fromTs = 0;
+    unsigned int toTs = 0;
+    DbProtocol_QueryReq_t match = {0};
+    bool matchOnly = false;
+    char *seriesarg = NULL;
+    unsigned int points = SERIES_DEFAULT_POINTS;
+    char *methodarg = NULL;
+    char *quantilearg = NULL;
+    DbProtocol_QuantileReq_t quantile = {0};
+    unsigned int flagsMask = 0;
+    unsigned int flagsValue = 0;
     uint16_t port = 0;
+    uint16_t udpport = 0;
     bool list = false;
+    bool useShm = false;
+    bool snapshot = false;
+    bool replStatus = false;
+    Telemetry_Cluster_t cluster = {0};
+    uint32_t shard = 0;
 
 
-    while (-1 != (c = getopt(argc, argv, "a:p:h:ld:"))) {
+    while (-1 != (c = getopt(argc, argv, "a:p:h:u:SU:ld:i:e:b:w:Vr:g:t:T:L:f:qs:n:m:Q:P:BYM:X:"))) {
         switch(c) {
             case 'a': {
                 addarg = optarg;
@@ -57,6 +134,18 @@ int main(int argc, char *argv[]) {
                 hostarg = optarg;
                 break;
             }
+            case 'u': {
+                unixarg = optarg;
+                break;
+            }
+            case 'U': {
+                udpport = atoi(optarg);
+                break;
+            }
+            case 'S': {
+                useShm = true;
+                break;
+            }
             case 'l':{
                 list = true;
                 break;
@@ -65,6 +154,117 @@ int main(int argc, char *argv[]) {
                 deletearg = optarg;
                 break;
             }
+            case 'i':{
+                importarg = optarg;
+                break;
+            }
+            case 'e':{
+                exportarg = optarg;
+                break;
+            }
+            case 'b':{
+                batchSize = atoi(optarg);
+                if (0 == batchSize || batchSize > BATCH_MAX_READINGS) {
+                    batchSize = BATCH_MAX_READINGS;
+                }
+                break;
+            }
+            case 'w':{
+                window = atoi(optarg);
+                break;
+            }
+            case 'V':{
+                violations = true;
+                break;
+            }
+            case 'r':{
+                rangearg = optarg;
+                if (2 != sscanf(rangearg, "%f:%f", &rangeLo, &rangeHi)) {
+                    printf("Bad range: %s, expected <lo>:<hi>\r\n", rangearg);
+                    return -1;
+                }
+                break;
+            }
+            case 'g':{
+                grouparg = optarg;
+                if (0 != strcmp(grouparg, "type") && 0 != strcmp(grouparg, "location")) {
+                    printf("Bad group: %s, expected type or location\r\n", grouparg);
+                    return -1;
+                }
+                break;
+            }
+            case 't':{
+                if (2 != sscanf(optarg, "%u:%u", &fromTs, &toTs)) {
+                    printf("Bad time window: %s, expected <from>:<to>\r\n", optarg);
+                    return -1;
+                }
+                break;
+            }
+            case 'T':{
+                strncpy(match.sensorType, optarg, sizeof(match.sensorType) - 1);
+                break;
+            }
+            case 'L':{
+                strncpy(match.location, optarg, sizeof(match.location) - 1);
+                break;
+            }
+            case 'f':{
+                if (2 != sscanf(optarg, "%i:%i", &flagsMask, &flagsValue)) {
+                    printf("Bad flags: %s, expected <mask>:<value>\r\n", optarg);
+                    return -1;
+                }
+                match.flagsMask = flagsMask;
+                match.flagsValue = flagsValue;
+                break;
+            }
+            case 'q':{
+                matchOnly = true;
+                break;
+            }
+            case 's':{
+                seriesarg = optarg;
+                break;
+            }
+            case 'n':{
+                points = atoi(optarg);
+                break;
+            }
+            case 'm':{
+                if (0 != strcmp(optarg, "lttb") && 0 != strcmp(optarg, "minmax")) {
+                    printf("Sampling method must be lttb or minmax\r\n");
+                    return -1;
+                }
+                methodarg = optarg;
+                break;
+            }
+            case 'Q':{
+                quantilearg = optarg;
+                break;
+            }
+            case 'P':{
+                if (STATUS_SUCCESS != parse_quantiles(optarg, &quantile)) {
+                    printf("Bad quantile list: %s, expected up to %d values in [0, 1] separated by commas\r\n",
+                           optarg, QUANTILE_MAX);
+                    return -1;
+                }
+                break;
+            }
+            case 'B':{
+                snapshot = true;
+                break;
+            }
+            case 'Y':{
+                replStatus = true;
+                break;
+            }
+            case 'M':{
+                maparg = optarg;
+                break;
+            }
+            case 'X':{
+                filearg = optarg;
+                break;
+            }
             case '?': {
                 printf("Unknown option: %c\r\n", c);
                 break;
@@ -75,287 +275,988 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (0 == port) {
-        printf("Bad port: %s\r\n", portarg);
-        return -1;
+    // Fire-and-forget: no connection, no handshake, no reply
+    if (0 != udpport) {
+        if (NULL == hostarg || NULL == addarg) {
+            printf("UDP ingest needs -h and -a\r\n");
+            return -1;
+        }
+        return udp_send_sensor(hostarg, udpport, addarg);
     }
 
-    if (NULL == hostarg) {
-        printf("You need to specify host!\r\n");
-        return -1;
-    }
+    if (NULL != maparg) {
+        // Sharded deployment: one connection per shard, requests go where the sensor lives
+        if (true == useShm) {
+            printf("Shared memory ingest needs one co-located server, not a shard map\r\n");
+            return -1;
+        }
+        if (STATUS_SUCCESS != telemetry_clusterConnect(&cluster, maparg)) {
+            return -1;
+        }
+    } else if (NULL != unixarg) {
+        // Co-located server: skip the TCP stack entirely
+        if (STATUS_SUCCESS != telemetry_connectUnix(&cluster.conns[0], unixarg)) {
+            return -1;
+        }
+        cluster.count = 1;
+    } else {
+        if (0 == port) {
+            printf("Bad port: %s\r\n", portarg);
+            return -1;
+        }
 
-    struct sockaddr_in serverInfo = {0};
-    serverInfo.sin_family = AF_INET;
-    serverInfo.sin_port = htons(port);
-    serverInfo.sin_addr.s_addr = inet_addr(hostarg);
+        if (NULL == hostarg) {
+            printf("You need to specify host!\r\n");
+            return -1;
+        }
 
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (-1 == fd) {
-        perror("socket");
-        return 0;
+        if (STATUS_SUCCESS != telemetry_connect(&cluster.conns[0], hostarg, port)) {
+            return -1;
+        }
+        cluster.count = 1;
     }
 
-    if (-1 == connect(fd, (struct sockaddr *)&serverInfo, sizeof(serverInfo))) {
-        perror("connect");
-        close(fd);
-        return 0;
+    if (1 == cluster.count) {
+        printf("Server connected!\r\n");
+    } else {
+        printf("%u shards connected!\r\n", cluster.count);
     }
-
-    if (STATUS_SUCCESS != send_req(fd)) {
-        close(fd);
-        return -1;
+    for (shard = 0; shard < cluster.count; shard++) {
+        telemetry_setWindow(&cluster.conns[shard], window);
     }
 
     if (NULL != addarg) {
-        send_sensor(fd, addarg);
+        if (true == useShm) {
+            shm_send_sensor(&cluster.conns[0], addarg);
+        } else {
+            send_sensor(route_sensor(&cluster, addarg), addarg);
+        }
     }
 
     if (true == list) {
-        list_sensors(fd);
+        for (shard = 0; shard < cluster.count; shard++) {
+            list_sensors(&cluster.conns[shard]);
+        }
     }
 
     if (NULL != deletearg) {
-        delete_sensor(fd, deletearg);
+        delete_sensor(telemetry_clusterRoute(&cluster, deletearg), deletearg);
+    }
+
+    if (true == violations) {
+        query_sensors(&cluster, QUERY_VIOLATIONS, 0.0f, 0.0f, &match);
+    }
+
+    if (NULL != rangearg) {
+        query_sensors(&cluster, QUERY_RANGE, rangeLo, rangeHi, &match);
+    }
+
+    if (true == matchOnly) {
+        query_sensors(&cluster, QUERY_MATCH, 0.0f, 0.0f, &match);
     }
 
-    close(fd);
+    if (NULL != grouparg) {
+        aggregate_sensors(&cluster, (0 == strcmp(grouparg, "type")) ? AGG_BY_TYPE : AGG_BY_LOCATION, fromTs, toTs, &match);
+    }
+
+    if (NULL != seriesarg && NULL == methodarg) {
+        series_sensor(telemetry_clusterRoute(&cluster, seriesarg), seriesarg, fromTs, toTs, points);
+    }
+
+    if (NULL != seriesarg && NULL != methodarg) {
+        samples_sensor(telemetry_clusterRoute(&cluster, seriesarg), seriesarg, fromTs, toTs, points,
+                       (0 == strcmp(methodarg, "lttb")) ? SAMPLES_LTTB : SAMPLES_MINMAX);
+    }
+
+    if (NULL != quantilearg) {
+        if (0 != strcmp(quantilearg, "*")) {
+            strncpy(quantile.sensorId, quantilearg, sizeof(quantile.sensorId) - 1);
+        }
+        if (0 == quantile.count) {
+            parse_quantiles(QUANTILE_DEFAULT_LIST, &quantile);
+        }
+        if ('\0' != quantile.sensorId[0]) {
+            quantile_sensors(telemetry_clusterRoute(&cluster, quantile.sensorId), &quantile, fromTs, toTs, &match);
+        } else if (1 == cluster.count) {
+            quantile_sensors(&cluster.conns[0], &quantile, fromTs, toTs, &match);
+        } else {
+            // each shard only has a sketch of its own sensors, percentiles of sketches do not add up
+            printf("Group percentiles need a single server, ask each shard with -h/-p instead\r\n");
+        }
+    }
+
+    if (NULL != importarg) {
+        import_csv(&cluster, importarg, batchSize);
+    }
+
+    if (NULL != exportarg) {
+        export_csv(&cluster, exportarg);
+    }
+
+    for (shard = 0; shard < cluster.count; shard++) {
+        if (true == snapshot) {
+            telemetry_snapshot(&cluster.conns[shard], on_snapshot_done, NULL);
+        }
+
+        if (true == replStatus) {
+            telemetry_replStatus(&cluster.conns[shard], on_repl_status_done, NULL);
+        }
+    }
+
+    telemetry_clusterFlush(&cluster);
+
+    if (NULL != filearg) {
+        if (1 == cluster.count) {
+            export_file(&cluster.conns[0], filearg);
+        } else {
+            printf("File export needs a single server, ask each shard with -h/-p instead\r\n");
+        }
+    }
+
+    telemetry_clusterClose(&cluster);
 
     return 0;
 }
 
 /**
-  * @brief  Handle a client connection.
-  * @param fd: Client file descriptor.
+  * @brief  Add a sensor to the database
+  * @param conn: Connection to the server.
+  * @param addstr: Sensor to be added.
+  * @retval STATUS_SUCCESS or STATUS_ERROR
   */
-void handle_client(int fd) {
-    char buff[4096] = {0};
+static int send_sensor(Telemetry_Conn_t *conn, const char *addstr) {
+    return telemetry_addSensor(conn, addstr, on_add_done, NULL);
+}
 
-    read(fd, buff, sizeof(DbProtocolHdr_t) + sizeof(int));
+/**
+  * @brief  Find the shard owning the sensor of an add string
+  * @param cluster: Connections to the shards.
+  * @param addstr: Sensor string, its ID runs up to the first comma.
+  * @retval Connection to the owning shard.
+  */
+static Telemetry_Conn_t *route_sensor(Telemetry_Cluster_t *cluster, const char *addstr) {
+    char sensorId[sizeof(((DbProtocol_SensorListResp_t *)0)->sensorId)] = {0};
+    size_t len = strcspn(addstr, ",");
 
-    DbProtocolHdr_t *msgHdr = buff;
-    msgHdr->type = ntohl(msgHdr->type);
-    msgHdr->len = ntohs(msgHdr->len);
+    // a longer ID is refused by whichever shard gets it
+    if (len >= sizeof(sensorId)) {
+        len = sizeof(sensorId) - 1;
+    }
+    memcpy(sensorId, addstr, len);
 
-    int *data = &msgHdr[1];
-    *data = ntohl(*data);
+    return telemetry_clusterRoute(cluster, sensorId);
+}
 
-    if(MSG_HANDSHAKE_REQ != msgHdr->type) {
-        printf("Protocol mismatch.\r\n");
+/**
+  * @brief  List sensors
+  * @param conn: Connection to the server.
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  */
+static int list_sensors(Telemetry_Conn_t *conn) {
+    if (STATUS_SUCCESS != telemetry_listSensors(conn, on_list_done, NULL)) {
+        return STATUS_ERROR;
     }
+    printf("Sent sensor list request to server\n");
+
+    return STATUS_SUCCESS;
+}
 
-    if (1 != *data) {
-        printf("Protocol version mismatch.\r\n");
+/**
+  * @brief  Delete a sensor from the database.
+  * @param conn: Connection to the server.
+  * @param sensorId: ID of the sensor to be deleted
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  */
+static int delete_sensor(Telemetry_Conn_t *conn, char *sensorId) {
+    if (STATUS_SUCCESS != telemetry_deleteSensor(conn, sensorId, on_delete_done, sensorId)) {
+        return STATUS_ERROR;
     }
+    printf("Sent delete request to server. Sensor ID: %s\r\n", sensorId);
 
-    printf("Server connected successfully.\r\n");
+    return STATUS_SUCCESS;
 }
 
 /**
-  * @brief  Request sensor data from the server database.
-  * @param fd: File descriptor of the client.
-  * @retval Status of the request.
+  * @brief  Add a sensor through the server's shared memory ring
+  * @param conn: Unix domain socket connection to the server.
+  * @param addstr: Sensor to be added.
+  * @retval STATUS_SUCCESS or STATUS_ERROR
   */
-int send_req(int fd) {
-    char buff[BUFF_SIZE] = {0};
+static int shm_send_sensor(Telemetry_Conn_t *conn, const char *addstr) {
+    char addcopy[sizeof(((DbProtocol_SensorAddReq_t *)0)->data)] = {0};
+    DbProtocol_Reading_t reading;
+    Telemetry_ShmProducer_t producer;
+    int status = STATUS_ERROR;
 
-    DbProtocolHdr_t *hdr = buff;
-    hdr->type = MSG_HANDSHAKE_REQ;
-    hdr->len = 1;
+    strncpy(addcopy, addstr, sizeof(addcopy) - 1);
+    if (STATUS_SUCCESS != reading_fromString(addcopy, &reading)) {
+        return STATUS_ERROR;
+    }
 
-    DbProtocolVer_Req_t *req = (DbProtocolVer_Req_t *)&hdr[1];
-    req->version = PROTOCOL_VER;
+    if (STATUS_SUCCESS != telemetry_shmAttach(conn, &producer)) {
+        return STATUS_ERROR;
+    }
 
-    hdr->type = htonl(hdr->type);
-    hdr->len = htons(hdr->len);
-    req->version = htons(req->version);
+    status = telemetry_shmPush(&producer, &reading);
+    if (STATUS_SUCCESS == status) {
+        printf("Sensor queued to shared memory ring.\r\n");
+    } else {
+        printf("Shared memory ring is full\r\n");
+    }
 
-    // Write data
-    write(fd, buff, sizeof(DbProtocolHdr_t) + sizeof(DbProtocolVer_Req_t));
+    telemetry_shmDetach(&producer);
 
-    // Read response
-    read(fd, buff, sizeof(buff));
+    return status;
+}
 
-    hdr->type = ntohl(hdr->type);
-    hdr->len = ntohs(hdr->len);
-    
-    // if any errors
-    if ( MSG_ERROR == hdr->type) {
-        printf("Protocol mismatch.\r\n");
-        close(fd);
+/**
+  * @brief  Send a sensor reading as a single UDP datagram
+  * @param host: Server address.
+  * @param port: Server UDP ingest port.
+  * @param addstr: Sensor to be added.
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  */
+static int udp_send_sensor(const char *host, uint16_t port, const char *addstr) {
+    char addcopy[sizeof(((DbProtocol_SensorAddReq_t *)0)->data)] = {0};
+    DbProtocol_Reading_t reading;
+
+    strncpy(addcopy, addstr, sizeof(addcopy) - 1);
+    if (STATUS_SUCCESS != reading_fromString(addcopy, &reading)) {
+        return STATUS_ERROR;
+    }
+
+    if (STATUS_SUCCESS != telemetry_sendUdp(host, port, &reading, 1)) {
         return STATUS_ERROR;
     }
 
-    printf("Server connected!\r\n");
+    printf("Sensor sent over UDP.\r\n");
+
     return STATUS_SUCCESS;
+}
 
-    return 0;
+/**
+  * @brief  Print the sensors matching a server side filter
+  * @param cluster: Connections to the shards, every shard is asked at once.
+  * @param mode: QUERY_VIOLATIONS, QUERY_RANGE or QUERY_MATCH.
+  * @param lo: Lower bound for QUERY_RANGE.
+  * @param hi: Upper bound for QUERY_RANGE.
+  * @param match: Type, location and flags predicates, empty fields match any.
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  */
+static int query_sensors(Telemetry_Cluster_t *cluster, DbProtocol_QueryMode_e mode, float lo, float hi, const DbProtocol_QueryReq_t *match) {
+    Query_State_t states[SHARD_MAX] = {0};
+    uint32_t matches = 0;
+    uint32_t i = 0;
+    int status = STATUS_SUCCESS;
+
+    // each shard pages through its own sensors, the pages interleave in the output
+    for (; i < cluster->count; i++) {
+        states[i].pConn = &cluster->conns[i];
+        states[i].query = *match;
+        states[i].query.mode = mode;
+        states[i].query.lo = lo;
+        states[i].query.hi = hi;
+        states[i].query.limit = LIST_PAGE_MAX;
+
+        if (STATUS_SUCCESS != telemetry_query(states[i].pConn, &states[i].query, on_query_done, &states[i])) {
+            status = STATUS_ERROR;
+        }
+    }
+
+    // the states live on this stack frame, wait for the last page of every shard
+    if (STATUS_SUCCESS != telemetry_clusterFlush(cluster)) {
+        status = STATUS_ERROR;
+    }
+    for (i = 0; i < cluster->count; i++) {
+        matches += states[i].matches;
+    }
+    printf("Matching sensors: %u\r\n", matches);
+
+    return status;
 }
 
+/**
+  * @brief  Print per group reading statistics computed by the servers
+  * @param cluster: Connections to the shards, their groups are merged.
+  * @param groupBy: AGG_BY_TYPE or AGG_BY_LOCATION.
+  * @param fromTs: Start of the timestamp window, 0 with toTs 0 for no window.
+  * @param toTs: End of the timestamp window, 0 for open ended.
+  * @param match: Type, location and flags predicates, empty fields match any.
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  */
+static int aggregate_sensors(Telemetry_Cluster_t *cluster, DbProtocol_AggGroup_e groupBy, uint32_t fromTs, uint32_t toTs, const DbProtocol_QueryReq_t *match) {
+    DbProtocol_AggregateReq_t req = {0};
+
+    req.groupBy = groupBy;
+    req.fromTs = fromTs;
+    req.toTs = toTs;
+    req.flagsMask = match->flagsMask;
+    req.flagsValue = match->flagsValue;
+    memcpy(req.sensorType, match->sensorType, sizeof(req.sensorType));
+    memcpy(req.location, match->location, sizeof(req.location));
+
+    return telemetry_clusterAggregate(cluster, &req, on_aggregate_done, NULL);
+}
 
 /**
-  * @brief  Add a sensor to the database
-  * @param fd: File descriptor of the client.
-  * @param addstr: Sensor to be added.
+  * @brief  Print the readings of one sensor downsampled by the server
+  * @param conn: Connection to the server.
+  * @param sensorId: Sensor to chart.
+  * @param fromTs: Start of the range.
+  * @param toTs: End of the range, 0 for open ended.
+  * @param points: Wanted number of points.
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  */
+static int series_sensor(Telemetry_Conn_t *conn, const char *sensorId, uint32_t fromTs, uint32_t toTs, uint32_t points) {
+    DbProtocol_SeriesReq_t req = {0};
+
+    strncpy(req.sensorId, sensorId, sizeof(req.sensorId) - 1);
+    req.fromTs = fromTs;
+    req.toTs = toTs;
+    req.points = points;
+
+    return telemetry_series(conn, &req, on_series_done, NULL);
+}
+
+/**
+  * @brief  Fetch a sensor's raw readings thinned to a number of samples
+  * @param conn: Connection to the server.
+  * @param sensorId: Sensor to chart.
+  * @param fromTs: Start of the range.
+  * @param toTs: End of the range, 0 for open ended.
+  * @param points: Wanted number of samples.
+  * @param method: SAMPLES_LTTB or SAMPLES_MINMAX.
   * @retval STATUS_SUCCESS or STATUS_ERROR
   */
-int send_sensor(int fd, const char *addstr) {
-    char buff[BUFF_SIZE] = {0};
+static int samples_sensor(Telemetry_Conn_t *conn, const char *sensorId, uint32_t fromTs, uint32_t toTs, uint32_t points, uint32_t method) {
+    DbProtocol_SamplesReq_t req = {0};
 
-    DbProtocolHdr_t *hdr = buff;
-    hdr->type = MSG_SENSOR_ADD_REQ;
-    hdr->len = 1;
+    strncpy(req.sensorId, sensorId, sizeof(req.sensorId) - 1);
+    req.fromTs = fromTs;
+    req.toTs = toTs;
+    req.points = points;
+    req.method = method;
 
-    DbProtocol_SensorAddReq_t *sensor = (DbProtocol_SensorAddReq_t *)&hdr[1];
-    strncpy(sensor->data, addstr, sizeof(sensor->data));
+    return telemetry_samples(conn, &req, on_samples_done, NULL);
+}
 
-    hdr->type = htonl(hdr->type);
-    hdr->len = htons(hdr->len);
+/**
+  * @brief  Parse a comma separated list of quantiles
+  * @param pList: List such as "0.5,0.95,0.99".
+  * @param pReq: Request receiving the quantiles and their count.
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  */
+static int parse_quantiles(const char *pList, DbProtocol_QuantileReq_t *pReq) {
+    const char *pCursor = pList;
+    char *pEnd = NULL;
+    float q = 0.0f;
 
-    // Write message
-    write(fd, buff, sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_SensorAddReq_t));
+    pReq->count = 0;
+    while ('\0' != *pCursor) {
+        q = strtof(pCursor, &pEnd);
+        if (pEnd == pCursor || q < 0.0f || q > 1.0f || QUANTILE_MAX == pReq->count) {
+            return STATUS_ERROR;
+        }
+        pReq->quantiles[pReq->count++] = q;
 
-    // Read response 
-    read(fd, buff, sizeof(buff));
+        pCursor = pEnd;
+        if (',' == *pCursor) {
+            pCursor++;
+        } else if ('\0' != *pCursor) {
+            return STATUS_ERROR;
+        }
+    }
 
-    hdr->type = ntohl(hdr->type);
-    hdr->len = ntohs(hdr->len);
+    return (0 == pReq->count) ? STATUS_ERROR : STATUS_SUCCESS;
+}
 
-    if (MSG_ERROR == hdr->type) {
-        printf("Improper format for add sensor\r\n");
-        close(fd);
+/**
+  * @brief  Ask for percentiles of one sensor, or of every sensor matching -T/-L
+  * @param conn: Connection to the server.
+  * @param req: Sensor ID (empty for a group) and quantiles, kept until the reply arrives.
+  * @param fromTs: Start of the range.
+  * @param toTs: End of the range, 0 for open ended.
+  * @param match: Type and location predicates, empty fields match any.
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  */
+static int quantile_sensors(Telemetry_Conn_t *conn, DbProtocol_QuantileReq_t *req, uint32_t fromTs, uint32_t toTs, const DbProtocol_QueryReq_t *match) {
+    req->fromTs = fromTs;
+    req->toTs = toTs;
+    memcpy(req->sensorType, match->sensorType, sizeof(req->sensorType));
+    memcpy(req->location, match->location, sizeof(req->location));
+
+    return telemetry_quantile(conn, req, on_quantile_done, req);
+}
+
+/**
+  * @brief  Stream a CSV file to the servers as pipelined batch add requests
+  * @param cluster: Connections to the shards.
+  * @param path: File with one 'sensor_id,sensor_type,i2c_addr,timestamp,reading_value' per line.
+  * @param batchSize: Readings per request.
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  * @note  Blank lines and lines starting with '#' are skipped. Every shard
+  *        fills a batch of its own, so requests stay full however many
+  *        shards share the file.
+  */
+static int import_csv(Telemetry_Cluster_t *cluster, const char *path, uint32_t batchSize) {
+    char line[sizeof(((DbProtocol_SensorAddReq_t *)0)->data)];
+    DbProtocol_Reading_t *batch = NULL;
+    DbProtocol_Reading_t reading;
+    Bulk_Transfer_t transfer = {0};
+    uint32_t counts[SHARD_MAX] = {0};
+    uint32_t shard = 0;
+    uint32_t i = 0;
+    uint64_t badLines = 0;
+    size_t len = 0;
+
+    transfer.status = STATUS_SUCCESS;
+    transfer.pFile = fopen(path, "r");
+    if (NULL == transfer.pFile) {
+        perror("fopen");
         return STATUS_ERROR;
     }
 
-    if (MSG_SENSOR_ADD_RESP  == hdr->type) {
-        printf("Sensor added succesfully.\r\n");
+    batch = calloc((size_t)batchSize * cluster->count, sizeof(DbProtocol_Reading_t));
+    if (NULL == batch) {
+        printf("Malloc failed\r\n");
+        fclose(transfer.pFile);
+        return STATUS_ERROR;
     }
 
-    return STATUS_SUCCESS;
+    transfer.startMs = now_ms();
+    transfer.reportMs = transfer.startMs;
+
+    while (NULL != fgets(line, sizeof(line), transfer.pFile)) {
+        len = strlen(line);
+        transfer.bytes += len;
+        while (len > 0 && ('\n' == line[len - 1] || '\r' == line[len - 1])) {
+            line[--len] = '\0';
+        }
+
+        if (0 == len || '#' == line[0]) {
+            continue;
+        }
+
+        if (STATUS_SUCCESS != reading_fromString(line, &reading)) {
+            badLines++;
+            continue;
+        }
+
+        shard = shard_of(reading.sensorId, cluster->count);
+        batch[shard * batchSize + counts[shard]] = reading;
+        if (++counts[shard] < batchSize) {
+            continue;
+        }
+
+        // blocks while the shard's in-flight window is full
+        if (STATUS_SUCCESS != telemetry_addReadings(&cluster->conns[shard], &batch[shard * batchSize], counts[shard],
+                                                    on_batch_done, &transfer)) {
+            transfer.status = STATUS_ERROR;
+            break;
+        }
+        transfer.records += counts[shard];
+        counts[shard] = 0;
+
+        for (i = 0; i < cluster->count; i++) {
+            telemetry_poll(&cluster->conns[i], 0);
+        }
+        report_progress(&transfer, "imported", false);
+    }
+
+    for (shard = 0; STATUS_SUCCESS == transfer.status && shard < cluster->count; shard++) {
+        if (0 == counts[shard]) {
+            continue;
+        }
+        if (STATUS_SUCCESS == telemetry_addReadings(&cluster->conns[shard], &batch[shard * batchSize], counts[shard],
+                                                    on_batch_done, &transfer)) {
+            transfer.records += counts[shard];
+        } else {
+            transfer.status = STATUS_ERROR;
+        }
+    }
+
+    if (STATUS_SUCCESS != telemetry_clusterFlush(cluster)) {
+        transfer.status = STATUS_ERROR;
+    }
+
+    report_progress(&transfer, "imported", true);
+    fprintf(stderr, "Applied %llu, rejected %llu, unparsable lines %llu\r\n",
+            (unsigned long long)transfer.applied,
+            (unsigned long long)(transfer.records - transfer.applied),
+            (unsigned long long)badLines);
+
+    free(batch);
+    fclose(transfer.pFile);
+
+    return transfer.status;
 }
 
 /**
-  * @brief  List sensors
-  * @param fd: File descriptor of the client.
+  * @brief  Stream the sensor table into a CSV file with pipelined paged list requests
+  * @param cluster: Connections to the shards, their tables follow each other in the file.
+  * @param path: Output file, in the format accepted by import_csv().
   * @retval STATUS_SUCCESS or STATUS_ERROR
   */
-static int list_sensors(int fd) {
-    char buf[4096] = {0};
-    DbProtocolHdr_t *hdr = (DbProtocolHdr_t *)buf;
-    hdr->type = MSG_SENSOR_LIST_REQ;
-    hdr->len = 0;
-
-    hdr->type = htonl(hdr->type);
-    hdr->len = htons(hdr->len);
-    write(fd, buf, sizeof(DbProtocolHdr_t));
-    printf("Sent sensor list request to server\n");
+static int export_csv(Telemetry_Cluster_t *cluster, const char *path) {
+    Bulk_Transfer_t transfer = {0};
+    uint32_t shard = 0;
+    unsigned int i = 0;
 
-    read(fd, hdr, sizeof(DbProtocolHdr_t));
-    hdr->type = ntohl(hdr->type);
-    hdr->len = ntohs(hdr->len);
-    
-    if (hdr->type == MSG_ERROR) {
-        printf("Unable to list sensors.\n");
-        close(fd);
+    transfer.status = STATUS_SUCCESS;
+    transfer.pFile = fopen(path, "w");
+    if (NULL == transfer.pFile) {
+        perror("fopen");
         return STATUS_ERROR;
-    } 
-
-    if (hdr->type == MSG_SENSOR_LIST_RESP) {
-        int count = hdr->len;
-        printf("Received sensor list response from server. Count: %d\n", count);
-
-        DbProtocol_SensorListResp_t *sensor = (DbProtocol_SensorListResp_t *)&hdr[1];
-        unsigned int temp;
-        int i = 0;
-        
-        for (; i < count; i++) {
-            read(fd, sensor, sizeof(DbProtocol_SensorListResp_t));
-            
-            sensor->timestamp = ntohl(sensor->timestamp);
-            
-            temp = ntohl(*(unsigned int*)&sensor->readingValue);
-            sensor->readingValue = *(float*)&temp;
-            
-            temp = ntohl(*(unsigned int*)&sensor->minThreshold);
-            sensor->minThreshold = *(float*)&temp;
-            
-            temp = ntohl(*(unsigned int*)&sensor->maxThreshold);
-            sensor->maxThreshold = *(float*)&temp;
-            
-            printf("\nSensor %d:\r\n", i);
-            printf("  ID: %s\r\n", sensor->sensorId);
-            printf("  Type: %s\r\n", sensor->sensorType);
-            printf("  I2C Address: 0x%02X\n", sensor->i2cAddr);
-            printf("  Timestamp: %s", ctime((time_t*)&sensor->timestamp));
-            printf("  Reading: %.2f\r\n", sensor->readingValue);
-            printf("  Flags: 0x%02X", sensor->flags);
-            
-            if (sensor->flags & 0x01) printf(" ACTIVE");
-            if (sensor->flags & 0x02) printf(" ERROR");
-            if (sensor->flags & 0x04) printf(" CALIBRATED");
-            
-            printf("\r\n");
-            printf("  Location: %s\r\n", sensor->location);
-            printf("  Thresholds: Min=%.2f, Max=%.2f\r\n", 
-                   sensor->minThreshold, sensor->maxThreshold);
+    }
+
+    transfer.bytes += fprintf(transfer.pFile, "# sensor_id,sensor_type,i2c_addr,timestamp,reading_value\n");
+    transfer.startMs = now_ms();
+    transfer.reportMs = transfer.startMs;
+
+    for (; shard < cluster->count && STATUS_SUCCESS == transfer.status; shard++) {
+        transfer.pConn = &cluster->conns[shard];
+        transfer.nextOffset = 0;
+        transfer.done = false;
+
+        // keep a few pages in flight, each completion asks for the next one
+        for (i = 0; i < transfer.pConn->window && i < 4; i++) {
+            if (STATUS_SUCCESS != request_page(&transfer)) {
+                break;
+            }
+        }
+
+        if (STATUS_SUCCESS != telemetry_flush(transfer.pConn)) {
+            transfer.status = STATUS_ERROR;
         }
     }
 
-    return STATUS_SUCCESS;
+    report_progress(&transfer, "exported", true);
+
+    if (0 != fclose(transfer.pFile)) {
+        perror("fclose");
+        transfer.status = STATUS_ERROR;
+    }
+
+    return transfer.status;
 }
 
 /**
-  * @brief  Delete a sensor from the database.
-  * @param fd: File descriptor of the client.
-  * @param sensorId: ID of the sensor to be deleted
+  * @brief  Copy a snapshot or segment file of the server byte for byte
+  * @param conn: Idle connection to the server.
+  * @param spec: '<what>=<path>', what is snapshot, rollup, sketch or the start of a segment.
   * @retval STATUS_SUCCESS or STATUS_ERROR
   */
-int delete_sensor(int fd, char *sensorId) {
-    char buf[4096] = {0};
-
-    DbProtocolHdr_t *hdr = (DbProtocolHdr_t *)buf;
-    hdr->type = MSG_SENSOR_DEL_REQ;
-    hdr->len = 1;
+static int export_file(Telemetry_Conn_t *conn, const char *spec) {
+    DbProtocol_ExportReq_t req = {0};
+    DbProtocol_ExportResp_t resp = {0};
+    const char *pPath = strchr(spec, '=');
+    char *pEnd = NULL;
+    uint64_t startMs = 0;
+    double seconds = 0.0;
+    int fd = -1;
+    int status = STATUS_ERROR;
 
-    DbProtocol_SensorDeleteReq_t *sensor = (DbProtocol_SensorDeleteReq_t *)&hdr[1];
-    strncpy((char *)sensor->sensorId, sensorId, sizeof(sensor->sensorId) - 1);
-    sensor->sensorId[sizeof(sensor->sensorId) - 1] = '\0';
+    if (NULL == pPath || '\0' == pPath[1]) {
+        printf("Bad export: %s, expected <snapshot|rollup|sketch|segment start>=<path>\r\n", spec);
+        return STATUS_ERROR;
+    }
 
-    hdr->type = htonl(hdr->type);
-    hdr->len = htons(hdr->len);
+    if (0 == strncmp(spec, "snapshot=", pPath - spec + 1)) {
+        req.file = EXPORT_SNAPSHOT;
+    } else if (0 == strncmp(spec, "rollup=", pPath - spec + 1)) {
+        req.file = EXPORT_SNAPSHOT_ROLLUP;
+    } else if (0 == strncmp(spec, "sketch=", pPath - spec + 1)) {
+        req.file = EXPORT_SNAPSHOT_SKETCH;
+    } else {
+        req.file = EXPORT_SEGMENT;
+        req.start = strtoul(spec, &pEnd, 10);
+        if (pEnd != pPath) {
+            printf("Bad export: %s, expected <snapshot|rollup|sketch|segment start>=<path>\r\n", spec);
+            return STATUS_ERROR;
+        }
+    }
+    pPath++;
 
-    write(fd, buf, sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_SensorDeleteReq_t));
-    printf("Sent delete request to server. Sensor ID: %s\r\n", sensorId);
-    read(fd, buf, sizeof(buf));
+    fd = open(pPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (-1 == fd) {
+        perror("open");
+        return STATUS_ERROR;
+    }
 
-    hdr->type = ntohl(hdr->type);
-    hdr->len = ntohs(hdr->len);
+    startMs = now_ms();
+    status = telemetry_export(conn, &req, fd, &resp);
+    if (0 != close(fd)) {
+        perror("close");
+        status = STATUS_ERROR;
+    }
 
-    if (hdr->type == MSG_ERROR) {
-        printf("Unable to delete sensor '%s' - sensor not found\r\n", sensorId);
+    if (STATUS_SUCCESS != status) {
+        unlink(pPath);
         return STATUS_ERROR;
     }
 
-    if (hdr->type != MSG_SENSOR_DEL_RESP) {
-        fprintf(stderr, "Unexpected response type: %d\r\n", hdr->type);
+    seconds = (now_ms() - startMs) / 1000.0;
+    if (seconds <= 0.0) {
+        seconds = 0.001;
+    }
+    fprintf(stderr, "Exported %llu bytes to %s in %.1f s: %.2f MB/s\r\n", (unsigned long long)resp.size, pPath,
+            seconds, resp.size / seconds / (1024.0 * 1024.0));
+    if (EXPORT_SNAPSHOT == req.file) {
+        printf("Snapshot holds the log up to sequence %llu\r\n", (unsigned long long)resp.seq);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static int request_page(Bulk_Transfer_t *transfer) {
+    int status = telemetry_listPage(transfer->pConn, transfer->nextOffset, LIST_PAGE_MAX, on_page_done, transfer);
+
+    if (STATUS_SUCCESS != status) {
+        transfer->status = STATUS_ERROR;
         return STATUS_ERROR;
     }
-    printf("Successfully deleted sensor '%s' from database\r\n", sensorId);
+    transfer->nextOffset += LIST_PAGE_MAX;
+
     return STATUS_SUCCESS;
 }
 
+static uint64_t now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void report_progress(Bulk_Transfer_t *transfer, const char *verb, bool final) {
+    uint64_t now = now_ms();
+    double seconds = 0.0;
+
+    if (true != final && now - transfer->reportMs < PROGRESS_INTERVAL_MS) {
+        return;
+    }
+    transfer->reportMs = now;
+
+    seconds = (now - transfer->startMs) / 1000.0;
+    if (seconds <= 0.0) {
+        seconds = 0.001;
+    }
+
+    fprintf(stderr, "%s%llu records %s in %.1f s: %.0f records/s, %.2f MB/s\r\n",
+            final ? "Done: " : "",
+            (unsigned long long)transfer->records, verb, seconds,
+            transfer->records / seconds,
+            transfer->bytes / seconds / (1024.0 * 1024.0));
+
+    return;
+}
+
+static void on_batch_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user) {
+    Bulk_Transfer_t *transfer = (Bulk_Transfer_t *)user;
+
+    if (STATUS_SUCCESS != status) {
+        transfer->status = STATUS_ERROR;
+        return;
+    }
+
+    transfer->applied += count;
+
+    return;
+}
+
+static void on_page_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user) {
+    const DbProtocol_SensorListResp_t *sensor = (const DbProtocol_SensorListResp_t *)payload;
+    Bulk_Transfer_t *transfer = (Bulk_Transfer_t *)user;
+    char i2c[8];
+    uint32_t i = 0;
+    int written = 0;
+
+    if (STATUS_SUCCESS != status) {
+        transfer->status = STATUS_ERROR;
+        transfer->done = true;
+        return;
+    }
+
+    // pages requested past the end come back empty
+    if (true == transfer->done) {
+        return;
+    }
+
+    for (; i < count; i++, sensor++) {
+        if (0 != sensor->i2cAddr) {
+            snprintf(i2c, sizeof(i2c), "0x%02X", sensor->i2cAddr);
+        } else {
+            strcpy(i2c, "-");
+        }
+
+        written = fprintf(transfer->pFile, "%s,%s,%s,%u,%g\n",
+                          sensor->sensorId, sensor->sensorType, i2c,
+                          sensor->timestamp, sensor->readingValue);
+        if (written < 0) {
+            transfer->status = STATUS_ERROR;
+            transfer->done = true;
+            return;
+        }
+        transfer->bytes += written;
+    }
+    transfer->records += count;
+
+    if (count < LIST_PAGE_MAX) {
+        transfer->done = true;
+        return;
+    }
+
+    report_progress(transfer, "exported", false);
+    request_page(transfer);
+
+    return;
+}
+
+static void on_query_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user) {
+    const DbProtocol_SensorListResp_t *sensor = (const DbProtocol_SensorListResp_t *)payload;
+    Query_State_t *state = (Query_State_t *)user;
+    uint32_t i = 0;
+
+    if (STATUS_SUCCESS != status) {
+        printf("Unable to query sensors.\n");
+        return;
+    }
+
+    for (; i < count; i++, sensor++) {
+        printf("  %-24s %-12s %10.2f  [%.2f, %.2f]  0x%02X  %s\r\n",
+               sensor->sensorId, sensor->sensorType, sensor->readingValue,
+               sensor->minThreshold, sensor->maxThreshold, sensor->flags, sensor->location);
+    }
+    state->matches += count;
+
+    // a full page may be followed by more matches
+    if (LIST_PAGE_MAX == count) {
+        state->query.offset += count;
+        telemetry_query(state->pConn, &state->query, on_query_done, state);
+    }
+
+    return;
+}
+
+static void on_series_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user) {
+    const DbProtocol_SeriesPoint_t *point = (const DbProtocol_SeriesPoint_t *)payload;
+    double sum = 0.0;
+    uint32_t i = 0;
+
+    if (STATUS_SUCCESS != status) {
+        printf("Unable to read the series, unknown sensor?\n");
+        return;
+    }
+
+    printf("%12s %8s %10s %10s %10s %10s\r\n", "Start", "Width", "Count", "Min", "Max", "Avg");
+    for (; i < count; i++, point++) {
+        memcpy(&sum, &point->sum, sizeof(sum));
+        printf("%12u %8u %10u %10.2f %10.2f %10.2f\r\n",
+               point->start, point->width, point->count, point->min, point->max, sum / point->count);
+    }
+    printf("Points: %u\r\n", count);
+
+    return;
+}
+
+static void on_samples_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user) {
+    const DbProtocol_Sample_t *sample = (const DbProtocol_Sample_t *)payload;
+    uint32_t i = 0;
+
+    if (STATUS_SUCCESS != status) {
+        printf("Unable to read the samples, unknown sensor?\n");
+        return;
+    }
+
+    printf("%12s %10s\r\n", "Timestamp", "Value");
+    for (; i < count; i++, sample++) {
+        printf("%12u %10.2f\r\n", sample->timestamp, sample->value);
+    }
+    printf("Samples: %u\r\n", count);
+
+    return;
+}
+
+static void on_quantile_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user) {
+    const DbProtocol_QuantileResp_t *result = (const DbProtocol_QuantileResp_t *)payload;
+    const DbProtocol_QuantileReq_t *req = (const DbProtocol_QuantileReq_t *)user;
+    uint32_t i = 0;
+
+    if (STATUS_SUCCESS != status || 1 != count) {
+        printf("Unable to compute the quantiles, unknown sensor?\n");
+        return;
+    }
+
+    printf("Readings: %u from %u sensors\r\n", result->readings, result->sensors);
+    if (0 == result->readings) {
+        return;
+    }
+
+    for (; i < req->count; i++) {
+        printf("  p%-6g %10.2f\r\n", req->quantiles[i] * 100.0f, result->values[i]);
+    }
+
+    return;
+}
+
+static void on_aggregate_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user) {
+    const DbProtocol_AggregateResp_t *group = (const DbProtocol_AggregateResp_t *)payload;
+    double sum = 0.0;
+    uint32_t i = 0;
+
+    if (STATUS_SUCCESS != status) {
+        printf("Unable to aggregate sensors.\n");
+        return;
+    }
+
+    printf("%-32s %10s %10s %10s %10s %14s\r\n", "Group", "Count", "Min", "Max", "Avg", "Sum");
+    for (; i < count; i++, group++) {
+        memcpy(&sum, &group->sum, sizeof(sum));
+        printf("%-32s %10u %10.2f %10.2f %10.2f %14.2f\r\n",
+               group->key, group->count, group->min, group->max, group->avg, sum);
+    }
+
+    return;
+}
+
+static void on_add_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user) {
+    if (STATUS_SUCCESS != status) {
+        printf("Improper format for add sensor\r\n");
+        return;
+    }
+
+    printf("Sensor added succesfully.\r\n");
+
+    return;
+}
+
+static void on_list_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user) {
+    const DbProtocol_SensorListResp_t *sensor = (const DbProtocol_SensorListResp_t *)payload;
+    time_t timestamp;
+    uint32_t i = 0;
+
+    if (STATUS_SUCCESS != status) {
+        printf("Unable to list sensors.\n");
+        return;
+    }
+
+    printf("Received sensor list response from server. Count: %u\n", count);
+
+    for (; i < count; i++, sensor++) {
+        timestamp = sensor->timestamp;
+
+        printf("\nSensor %u:\r\n", i);
+        printf("  ID: %s\r\n", sensor->sensorId);
+        printf("  Type: %s\r\n", sensor->sensorType);
+        printf("  I2C Address: 0x%02X\n", sensor->i2cAddr);
+        printf("  Timestamp: %s", ctime(&timestamp));
+        printf("  Reading: %.2f\r\n", sensor->readingValue);
+        printf("  Flags: 0x%02X", sensor->flags);
+
+        if (sensor->flags & 0x01) printf(" ACTIVE");
+        if (sensor->flags & 0x02) printf(" ERROR");
+        if (sensor->flags & 0x04) printf(" CALIBRATED");
+
+        printf("\r\n");
+        printf("  Location: %s\r\n", sensor->location);
+        printf("  Thresholds: Min=%.2f, Max=%.2f\r\n",
+               sensor->minThreshold, sensor->maxThreshold);
+    }
+
+    return;
+}
+
+static void on_delete_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user) {
+    const char *sensorId = (const char *)user;
+
+    if (STATUS_SUCCESS != status) {
+        printf("Unable to delete sensor '%s' - sensor not found\r\n", sensorId);
+        return;
+    }
+
+    if (MSG_SENSOR_DEL_RESP != type) {
+        fprintf(stderr, "Unexpected response type: %d\r\n", type);
+        return;
+    }
+
+    printf("Successfully deleted sensor '%s' from database\r\n", sensorId);
+
+    return;
+}
+
+static void on_snapshot_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user) {
+    const DbProtocol_SnapshotResp_t *resp = (const DbProtocol_SnapshotResp_t *)payload;
+
+    if (STATUS_SUCCESS != status || 1 != count) {
+        printf("Unable to start a snapshot - one is still being written\r\n");
+        return;
+    }
+
+    printf("Snapshot of sequence %llu is being written by server process %u\r\n",
+           (unsigned long long)resp->seq, resp->pid);
+
+    return;
+}
+
+static void on_repl_status_done(int status, DbProtocol_e type, const void *payload, uint32_t count, void *user) {
+    const DbProtocol_ReplStatusResp_t *resp = (const DbProtocol_ReplStatusResp_t *)payload;
+
+    if (STATUS_SUCCESS != status || 1 != count) {
+        printf("Unable to get the replication status\r\n");
+        return;
+    }
+
+    if (REPL_ROLE_PRIMARY == resp->role) {
+        printf("Primary at sequence %llu with %u replicas attached\r\n", (unsigned long long)resp->seq, resp->peers);
+        return;
+    }
+
+    printf("Replica at sequence %llu, primary at %llu, %llu behind, %s\r\n",
+           (unsigned long long)resp->seq, (unsigned long long)resp->primarySeq,
+           (unsigned long long)((resp->primarySeq > resp->seq) ? resp->primarySeq - resp->seq : 0),
+           (0 != resp->peers) ? "streaming" : "disconnected");
+
+    return;
+}
+
 /**
   * @brief  Print usage information for the application
   * @param argv: [in] Array of pointers to the command-line argument strings
   */
 static void printUsage(char *argv[]) {
-    
+
     printf("\r\nUsage: %s -f -n <database file>\r\n", argv[0]);
     printf("\t -h \t\t- (required) host to connect to\r\n");
     printf("\t -p \t\t- (required) port to connect to\r\n");
+    printf("\t -u <path> \t- connect over a unix domain socket instead of -h/-p\r\n");
+    printf("\t -S \t\t- with -u, send -a through the shared memory ingest ring\r\n");
+    printf("\t -U <port> \t- with -h, send -a as a fire-and-forget UDP datagram to <port>\r\n");
     printf("\t -a \t\t- add new sensor data with the given string format 'sensor_id,sensor_type,i2c_addr(if any),timestamp,reading_value'\r\n");
     printf("\t -l \t\t- list all sensor etries in the database\r\n");
     printf("\t -d <name> \t- delete sensor entry from the database with the given ID\r\n");
+    printf("\t -V \t\t- list sensors whose reading is outside their thresholds\r\n");
+    printf("\t -r <lo>:<hi> \t- list sensors whose reading is within [lo, hi]\r\n");
+    printf("\t -g <type|location> - reading count/min/max/avg/sum per sensor type or location\r\n");
+    printf("\t -t <from>:<to> \t- with -g, only sensors whose timestamp is within the window; with -s, the time range\r\n");
+    printf("\t -s <id> \t- min/max/avg of a sensor's readings over time, from the server rollups\r\n");
+    printf("\t -n <points> \t- with -s, wanted number of points (default %d, max %d)\r\n", SERIES_DEFAULT_POINTS, SERIES_MAX_POINTS);
+    printf("\t -m <lttb|minmax> - with -s, raw readings thinned on the server instead of rollup buckets\r\n");
+    printf("\t -Q <id|*> \t- reading percentiles of a sensor, or of every sensor matching -T/-L, over the -t range\r\n");
+    printf("\t -P <q,...> \t- with -Q, quantiles in [0, 1] (default %s, max %d)\r\n", QUANTILE_DEFAULT_LIST, QUANTILE_MAX);
+    printf("\t -T <type> \t- with -V/-r/-q/-g, only sensors of this type\r\n");
+    printf("\t -L <location> \t- with -V/-r/-q/-g, only sensors at this location\r\n");
+    printf("\t -f <mask>:<value> - with -V/-r/-q/-g, only sensors with (flags & mask) == value\r\n");
+    printf("\t -q \t\t- list sensors matching -T/-L/-f\r\n");
+    printf("\t -i <file> \t- import a CSV file of sensor strings over one connection\r\n");
+    printf("\t -e <file> \t- export the sensor table to a CSV file\r\n");
+    printf("\t -b <n> \t- readings per batch for -i (default and max %lu)\r\n", (unsigned long)BATCH_MAX_READINGS);
+    printf("\t -w <n> \t- requests in flight for -i (default %d)\r\n", TELEMETRY_DEFAULT_WINDOW);
+    printf("\t -B \t\t- have the server write a snapshot of the database next to its file\r\n");
+    printf("\t -Y \t\t- show whether the server is a primary or a replica and how far a replica lags\r\n");
+    printf("\t -M <host:port,...> - talk to a sharded deployment instead of -h/-p, shard i is the i-th entry:\r\n");
+    printf("\t    -a/-d/-s/-Q <id> go to the owning shard, -l/-V/-r/-q/-g/-i/-e/-B/-Y to every shard\r\n");
+    printf("\t -X <what>=<file> - copy a server file as it is on disk, what is snapshot, rollup or sketch for the\r\n");
+    printf("\t    last snapshot (-B starts a new one, it is ready once the server logs it) or a segment start\r\n");
 
     return;
-}
\ No newline at end of file
+}
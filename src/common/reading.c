@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "reading.h"
+
+/**
+ * @brief  Parse a sensor string into a compact reading
+ * @param pStr: [in] String in the format sensor_id,sensor_type,i2c_addr,timestamp,reading_value
+ *              (tokenized in place)
+ * @param pOut: [out] Parsed reading in host byte order
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int reading_fromString(char *pStr, DbProtocol_Reading_t *pOut)
+{
+    char *pSensorId = NULL;
+    char *pSensorType = NULL;
+    char *pI2cAddrStr = NULL;
+    char *pTimestampStr = NULL;
+    char *pReadingStr = NULL;
+    char *pSave = NULL;
+
+    // Example: "BNO055_01,BNO055,0x28,1701432000,25.5"
+    pSensorId = strtok_r(pStr, ",", &pSave);
+    pSensorType = strtok_r(NULL, ",", &pSave);
+    pI2cAddrStr = strtok_r(NULL, ",", &pSave);
+    pTimestampStr = strtok_r(NULL, ",", &pSave);
+    pReadingStr = strtok_r(NULL, ",", &pSave);
+
+    if (pSensorId == NULL || pSensorType == NULL || pI2cAddrStr == NULL ||
+        pTimestampStr == NULL || pReadingStr == NULL) {
+        printf("Invalid format for sensor data\r\n");
+        return STATUS_ERROR;
+    }
+
+    memset(pOut, 0, sizeof(DbProtocol_Reading_t));
+    strncpy(pOut->sensorId, pSensorId, sizeof(pOut->sensorId) - 1);
+    strncpy(pOut->sensorType, pSensorType, sizeof(pOut->sensorType) - 1);
+
+    // '-' (or anything non numeric) means no I2C address
+    pOut->i2cAddr = (uint8_t)strtol(pI2cAddrStr, NULL, 0);
+    pOut->timestamp = (uint32_t)atol(pTimestampStr);
+    pOut->readingValue = atof(pReadingStr);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Convert a reading to network byte order
+ * @param pReading: [in,out] Reading to convert
+ */
+void reading_hton(DbProtocol_Reading_t *pReading)
+{
+    uint32_t temp = 0;
+
+    pReading->timestamp = htonl(pReading->timestamp);
+
+    memcpy(&temp, &pReading->readingValue, sizeof(temp));
+    temp = htonl(temp);
+    memcpy(&pReading->readingValue, &temp, sizeof(temp));
+
+    return;
+}
+
+/**
+ * @brief  Convert a reading to host byte order
+ * @param pReading: [in,out] Reading to convert
+ */
+void reading_ntoh(DbProtocol_Reading_t *pReading)
+{
+    uint32_t temp = 0;
+
+    pReading->timestamp = ntohl(pReading->timestamp);
+
+    memcpy(&temp, &pReading->readingValue, sizeof(temp));
+    temp = ntohl(temp);
+    memcpy(&pReading->readingValue, &temp, sizeof(temp));
+
+    pReading->sensorId[sizeof(pReading->sensorId) - 1] = '\0';
+    pReading->sensorType[sizeof(pReading->sensorType) - 1] = '\0';
+
+    return;
+}
@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "shard.h"
+
+#define FNV_OFFSET_BASIS    2166136261u
+#define FNV_PRIME           16777619u
+
+/**
+ * @brief  Find the shard owning a sensor
+ * @param pSensorId: [in] Sensor ID, NUL terminated
+ * @param count: [in] Number of shards
+ * @return shard index in [0, count)
+ * @note  The hash is scaled onto the shards instead of taken modulo count,
+ *        so each shard owns one contiguous range of hash values.
+ */
+uint32_t shard_of(const char *pSensorId, uint32_t count)
+{
+    uint32_t hash = FNV_OFFSET_BASIS;
+
+    for (; '\0' != *pSensorId; pSensorId++) {
+        hash ^= (uint8_t)*pSensorId;
+        hash *= FNV_PRIME;
+    }
+
+    return (uint32_t)(((uint64_t)hash * count) >> 32);
+}
+
+/**
+ * @brief  Parse the shard a server owns
+ * @param pSpec: [in] "<index>/<count>", e.g. "0/4"
+ * @param pIndex: [out] Shard index
+ * @param pCount: [out] Number of shards
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int shard_parse(const char *pSpec, uint32_t *pIndex, uint32_t *pCount)
+{
+    const char *pArg = pSpec;
+    char *pEnd = NULL;
+    unsigned long index = 0;
+    unsigned long count = 0;
+
+    index = strtoul(pSpec, &pEnd, 10);
+    if (pEnd == pSpec || '/' != *pEnd) {
+        printf("Shard must be given as index/count: %s\r\n", pArg);
+        return STATUS_ERROR;
+    }
+    pSpec = pEnd + 1;
+    count = strtoul(pSpec, &pEnd, 10);
+    if (pEnd == pSpec || '\0' != *pEnd || 0 == count || count > SHARD_MAX || index >= count) {
+        printf("Bad shard %s, the index must be below the count and the count at most %d\r\n", pArg, SHARD_MAX);
+        return STATUS_ERROR;
+    }
+
+    *pIndex = (uint32_t)index;
+    *pCount = (uint32_t)count;
+
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shmring.h"
+
+/* Private function prototypes -----------------------------------------------*/
+// bytes needed for a ring with the given number of slots
+static size_t shmring_size(uint32_t slots);
+
+/**
+ * @brief  Create a ring in a fresh memfd
+ * @param slots: [in] Number of slots, must be a power of two
+ * @param pConsumer: [out] server view of the mapped ring
+ * @param pMemFdOut: [out] memfd backing the ring, to be passed to producers
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  The memfd is sealed at its size, a producer shrinking it would
+ *        otherwise fault the server on its next access to the ring.
+ */
+int shmring_create(uint32_t slots, ShmRing_Consumer_t *pConsumer, int *pMemFdOut)
+{
+    ShmRing_t *pRing = NULL;
+    size_t size = 0;
+    uint32_t i = 0;
+    int fd = -1;
+
+    if (0 == slots || 0 != (slots & (slots - 1))) {
+        printf("Ring size must be a power of two\r\n");
+        return STATUS_ERROR;
+    }
+
+    size = shmring_size(slots);
+
+    fd = memfd_create("telemetry_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (-1 == fd) {
+        perror("memfd_create");
+        return STATUS_ERROR;
+    }
+
+    if (-1 == ftruncate(fd, size)) {
+        perror("ftruncate");
+        close(fd);
+        return STATUS_ERROR;
+    }
+
+    if (-1 == fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)) {
+        perror("fcntl");
+        close(fd);
+        return STATUS_ERROR;
+    }
+
+    pRing = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == pRing) {
+        perror("mmap");
+        close(fd);
+        return STATUS_ERROR;
+    }
+
+    pRing->magic = SHMRING_MAGIC;
+    pRing->slots = slots;
+    atomic_init(&pRing->tail, 0);
+    atomic_init(&pRing->head, 0);
+    atomic_init(&pRing->dropped, 0);
+    // the ring starts out empty, so the consumer starts out parked
+    atomic_init(&pRing->consumerWaiting, 1);
+
+    for (i = 0; i < slots; i++) {
+        atomic_init(&pRing->ring[i].seq, i);
+    }
+
+    pConsumer->pShared = pRing;
+    pConsumer->slots = slots;
+    pConsumer->mask = slots - 1;
+    pConsumer->head = 0;
+    pConsumer->corrupt = 0;
+    *pMemFdOut = fd;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Map an existing ring
+ * @param memFd: [in] memfd received from the server
+ * @return mapped ring or NULL on failure
+ */
+ShmRing_t *shmring_map(int memFd)
+{
+    ShmRing_t *pRing = NULL;
+    struct stat st = {0};
+
+    if (-1 == fstat(memFd, &st) || st.st_size < (off_t)sizeof(ShmRing_t)) {
+        printf("Bad shared memory ring\r\n");
+        return NULL;
+    }
+
+    pRing = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, memFd, 0);
+    if (MAP_FAILED == pRing) {
+        perror("mmap");
+        return NULL;
+    }
+
+    if (SHMRING_MAGIC != pRing->magic || 0 == pRing->slots || 0 != (pRing->slots & (pRing->slots - 1)) ||
+        (size_t)st.st_size < shmring_size(pRing->slots)) {
+        printf("Bad shared memory ring\r\n");
+        munmap(pRing, st.st_size);
+        return NULL;
+    }
+
+    return pRing;
+}
+
+/**
+ * @brief  Unmap a ring
+ * @param pRing: [in] ring to unmap
+ */
+void shmring_unmap(ShmRing_t *pRing)
+{
+    if (NULL != pRing) {
+        munmap(pRing, shmring_size(pRing->slots));
+    }
+
+    return;
+}
+
+/**
+ * @brief  Unmap the ring of the server
+ * @param pConsumer: [in] server view of the ring
+ */
+void shmring_close(ShmRing_Consumer_t *pConsumer)
+{
+    if (NULL != pConsumer->pShared) {
+        munmap(pConsumer->pShared, shmring_size(pConsumer->slots));
+        pConsumer->pShared = NULL;
+    }
+
+    return;
+}
+
+/**
+ * @brief  Enqueue a reading
+ * @param pRing: [in] ring to push into
+ * @param pReading: [in] reading in host byte order
+ * @param eventFd: [in] doorbell, written only if the consumer is parked
+ * @return STATUS_SUCCESS or STATUS_ERROR when the ring is full
+ * @note  Lock-free and safe for any number of concurrent producers.
+ */
+int shmring_push(ShmRing_t *pRing, const DbProtocol_Reading_t *pReading, int eventFd)
+{
+    uint64_t mask = pRing->slots - 1;
+    uint64_t pos = atomic_load_explicit(&pRing->tail, memory_order_relaxed);
+    uint64_t one = 1;
+    ShmRing_Slot_t *pSlot = NULL;
+    int64_t diff = 0;
+
+    for (;;) {
+        pSlot = &pRing->ring[pos & mask];
+        diff = (int64_t)atomic_load_explicit(&pSlot->seq, memory_order_acquire) - (int64_t)pos;
+
+        if (0 == diff) {
+            if (atomic_compare_exchange_weak_explicit(&pRing->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // consumer is a full lap behind
+            atomic_fetch_add_explicit(&pRing->dropped, 1, memory_order_relaxed);
+            return STATUS_ERROR;
+        } else {
+            pos = atomic_load_explicit(&pRing->tail, memory_order_relaxed);
+        }
+    }
+
+    memcpy(&pSlot->reading, pReading, sizeof(DbProtocol_Reading_t));
+    atomic_store_explicit(&pSlot->seq, pos + 1, memory_order_release);
+
+    // pairs with the fence in shmring_park()
+    atomic_thread_fence(memory_order_seq_cst);
+    if (0 != atomic_load_explicit(&pRing->consumerWaiting, memory_order_relaxed) &&
+        1 == atomic_exchange(&pRing->consumerWaiting, 0)) {
+        if (sizeof(one) != write(eventFd, &one, sizeof(one))) {
+            perror("write");
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Dequeue a reading (single consumer)
+ * @param pConsumer: [in] server view of the ring to pop from
+ * @param pOut: [out] reading in host byte order
+ * @return true if a reading was dequeued
+ * @note  A slot is only ever free (sequence at the position) or published
+ *        (one past it), any other sequence was scribbled over by a producer.
+ *        Such slots are handed back and skipped, at most one lap of them.
+ */
+bool shmring_pop(ShmRing_Consumer_t *pConsumer, DbProtocol_Reading_t *pOut)
+{
+    ShmRing_t *pRing = pConsumer->pShared;
+    ShmRing_Slot_t *pSlot = NULL;
+    uint64_t pos = 0;
+    uint64_t seq = 0;
+    uint32_t i = 0;
+
+    for (i = 0; i < pConsumer->slots; i++) {
+        pos = pConsumer->head;
+        pSlot = &pRing->ring[pos & pConsumer->mask];
+        seq = atomic_load_explicit(&pSlot->seq, memory_order_acquire);
+
+        if (pos == seq) {
+            return false;
+        }
+
+        if (pos + 1 == seq) {
+            memcpy(pOut, &pSlot->reading, sizeof(DbProtocol_Reading_t));
+            pOut->sensorId[sizeof(pOut->sensorId) - 1] = '\0';
+            pOut->sensorType[sizeof(pOut->sensorType) - 1] = '\0';
+        } else {
+            pConsumer->corrupt++;
+        }
+
+        // hand the slot back to producers for the next lap
+        atomic_store_explicit(&pSlot->seq, pos + pConsumer->slots, memory_order_release);
+        pConsumer->head = pos + 1;
+        atomic_store_explicit(&pRing->head, pConsumer->head, memory_order_relaxed);
+
+        if (pos + 1 == seq) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief  Ask producers to ring the doorbell on their next push
+ * @param pConsumer: [in] server view of the ring to park on
+ * @return true if the ring is empty and the consumer may sleep
+ */
+bool shmring_park(ShmRing_Consumer_t *pConsumer)
+{
+    ShmRing_t *pRing = pConsumer->pShared;
+    uint64_t pos = pConsumer->head;
+    ShmRing_Slot_t *pSlot = &pRing->ring[pos & pConsumer->mask];
+
+    atomic_store(&pRing->consumerWaiting, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // a producer may have published before it could see the flag, anything
+    // but a free slot is left for shmring_pop() to sort out
+    if (atomic_load_explicit(&pSlot->seq, memory_order_acquire) != pos) {
+        atomic_store(&pRing->consumerWaiting, 0);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Helper functions
+ */
+
+static size_t shmring_size(uint32_t slots)
+{
+    return sizeof(ShmRing_t) + (size_t)slots * sizeof(ShmRing_Slot_t);
+}
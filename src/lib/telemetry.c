@@ -0,0 +1,1514 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <endian.h>
+#include "telemetry.h"
+#include "reading.h"
+
+#define TELEMETRY_INITIAL_BUF   8192
+// bytes an export moves through its pipe per splice() call, the default pipe capacity
+#define TELEMETRY_SPLICE_BYTES  65536
+
+/* Private typedef -----------------------------------------------------------*/
+// groups of a fanned out aggregation merged so far
+typedef struct {
+    DbProtocol_AggregateResp_t *pGroups;
+    uint32_t count;
+    uint32_t capacity;
+    int status;
+} Cluster_Merge_t;
+
+/* Private function prototypes -----------------------------------------------*/
+// set up buffers and run the handshake on a connected socket
+static int conn_init(Telemetry_Conn_t *pConn, int fd, bool isLocal);
+// blocking version handshake
+static int conn_handshake(Telemetry_Conn_t *pConn);
+// append a request frame and remember its completion
+static int conn_enqueue(Telemetry_Conn_t *pConn, const void *pFrame, size_t len, Telemetry_Callback_t pCallback, void *pUser);
+// make room for at least extra bytes
+static int buf_reserve(char **ppBuf, size_t *pCap, size_t used, size_t extra);
+// write as much of the send queue as the socket takes
+static int conn_write(Telemetry_Conn_t *pConn);
+// read whatever the socket has
+static int conn_read(Telemetry_Conn_t *pConn);
+// dispatch every complete response in the receive buffer
+static int conn_dispatch(Telemetry_Conn_t *pConn);
+// size of the response frame at the start of the buffer
+static long resp_frame_size(const char *pData, size_t len);
+// complete every outstanding request with an error
+static void conn_fail_pending(Telemetry_Conn_t *pConn);
+// read exactly len bytes of a response, waiting for the socket as needed
+static int conn_readFull(Telemetry_Conn_t *pConn, void *pBuf, size_t len);
+// move len bytes out of a pipe into outFd, falling back to copying when outFd refuses splice()
+static int export_drain(int pipeFd, int outFd, size_t len, bool *pCopy);
+// convert a list record to host byte order
+static void list_resp_ntoh(DbProtocol_SensorListResp_t *pResp);
+// convert an aggregate record to host byte order
+static void aggregate_resp_ntoh(DbProtocol_AggregateResp_t *pResp);
+// convert a series point to host byte order
+static void series_point_ntoh(DbProtocol_SeriesPoint_t *pPoint);
+static void quantile_resp_ntoh(DbProtocol_QuantileResp_t *pResp);
+// fold the groups of one shard into the merged result
+static void cluster_on_aggregate(int status, DbProtocol_e type, const void *pPayload, uint32_t count, void *pUser);
+
+/**
+  * @brief  Connect to the server over TCP
+  * @param pConn: [out] connection to initialize
+  * @param pHost: [in] server IPv4 address
+  * @param port: [in] server port
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  */
+int telemetry_connect(Telemetry_Conn_t *pConn, const char *pHost, uint16_t port) {
+    struct sockaddr_in serverInfo = {0};
+    int fd = -1;
+
+    serverInfo.sin_family = AF_INET;
+    serverInfo.sin_port = htons(port);
+    serverInfo.sin_addr.s_addr = inet_addr(pHost);
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (-1 == fd) {
+        perror("socket");
+        return STATUS_ERROR;
+    }
+
+    if (-1 == connect(fd, (struct sockaddr *)&serverInfo, sizeof(serverInfo))) {
+        perror("connect");
+        close(fd);
+        return STATUS_ERROR;
+    }
+
+    return conn_init(pConn, fd, false);
+}
+
+/**
+  * @brief  Connect to a co-located server over a unix domain socket
+  * @param pConn: [out] connection to initialize
+  * @param pPath: [in] socket path the server listens on
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  */
+int telemetry_connectUnix(Telemetry_Conn_t *pConn, const char *pPath) {
+    struct sockaddr_un localInfo = {0};
+    int fd = -1;
+
+    localInfo.sun_family = AF_UNIX;
+    strncpy(localInfo.sun_path, pPath, sizeof(localInfo.sun_path) - 1);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (-1 == fd) {
+        perror("socket");
+        return STATUS_ERROR;
+    }
+
+    if (-1 == connect(fd, (struct sockaddr *)&localInfo, sizeof(localInfo))) {
+        perror("connect");
+        close(fd);
+        return STATUS_ERROR;
+    }
+
+    return conn_init(pConn, fd, true);
+}
+
+/**
+  * @brief  Close a connection
+  * @param pConn: [in] connection to close
+  * @note  Requests still in flight complete with STATUS_ERROR.
+  */
+void telemetry_close(Telemetry_Conn_t *pConn) {
+    conn_fail_pending(pConn);
+
+    if (-1 != pConn->fd) {
+        close(pConn->fd);
+        pConn->fd = -1;
+    }
+
+    free(pConn->pTxBuf);
+    free(pConn->pRxBuf);
+    free(pConn->pPending);
+    pConn->pTxBuf = NULL;
+    pConn->pRxBuf = NULL;
+    pConn->pPending = NULL;
+
+    return;
+}
+
+/**
+  * @brief  Set how many requests may be in flight at once
+  * @param pConn: [in] connection
+  * @param window: [in] maximum number of outstanding requests, at least 1
+  */
+void telemetry_setWindow(Telemetry_Conn_t *pConn, unsigned int window) {
+    pConn->window = (0 == window) ? 1 : window;
+
+    return;
+}
+
+/**
+  * @brief  Queue an add request
+  * @param pConn: [in] connection
+  * @param pAddStr: [in] sensor string 'sensor_id,sensor_type,i2c_addr,timestamp,reading_value'
+  * @param pCallback: [in] completion callback, may be NULL
+  * @param pUser: [in] user argument for the callback
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  */
+int telemetry_addSensor(Telemetry_Conn_t *pConn, const char *pAddStr, Telemetry_Callback_t pCallback, void *pUser) {
+    char buff[sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_SensorAddReq_t)] = {0};
+    DbProtocolHdr_t *hdr = (DbProtocolHdr_t *)buff;
+    DbProtocol_SensorAddReq_t *sensor = (DbProtocol_SensorAddReq_t *)&hdr[1];
+
+    hdr->type = htonl(MSG_SENSOR_ADD_REQ);
+    hdr->len = htons(1);
+    strncpy((char *)sensor->data, pAddStr, sizeof(sensor->data) - 1);
+
+    return conn_enqueue(pConn, buff, sizeof(buff), pCallback, pUser);
+}
+
+/**
+  * @brief  Queue a batch add request
+  * @param pConn: [in] connection
+  * @param pReadings: [in] readings in host byte order
+  * @param count: [in] number of readings, at most BATCH_MAX_READINGS
+  * @param pCallback: [in] completion callback, count is the number of accepted readings
+  * @param pUser: [in] user argument for the callback
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  */
+int telemetry_addReadings(Telemetry_Conn_t *pConn, const DbProtocol_Reading_t *pReadings, uint32_t count, Telemetry_Callback_t pCallback, void *pUser) {
+    char buff[BUFF_SIZE];
+    DbProtocolHdr_t *hdr = (DbProtocolHdr_t *)buff;
+    DbProtocol_Reading_t *pOut = (DbProtocol_Reading_t *)&hdr[1];
+    uint32_t i = 0;
+
+    if (count > BATCH_MAX_READINGS) {
+        printf("Batch too large: %u > %lu\r\n", count, (unsigned long)BATCH_MAX_READINGS);
+        return STATUS_ERROR;
+    }
+
+    memset(hdr, 0, sizeof(DbProtocolHdr_t));
+    hdr->type = htonl(MSG_SENSOR_BATCH_ADD_REQ);
+    hdr->len = htons(count);
+    for (; i < count; i++) {
+        pOut[i] = pReadings[i];
+        reading_hton(&pOut[i]);
+    }
+
+    return conn_enqueue(pConn, buff, sizeof(DbProtocolHdr_t) + count * sizeof(DbProtocol_Reading_t), pCallback, pUser);
+}
+
+/**
+  * @brief  Queue a list request
+  * @param pConn: [in] connection
+  * @param pCallback: [in] completion callback, receives the sensor records
+  * @param pUser: [in] user argument for the callback
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  */
+int telemetry_listSensors(Telemetry_Conn_t *pConn, Telemetry_Callback_t pCallback, void *pUser) {
+    DbProtocolHdr_t hdr = {0};
+
+    hdr.type = htonl(MSG_SENSOR_LIST_REQ);
+    hdr.len = htons(0);
+
+    return conn_enqueue(pConn, &hdr, sizeof(hdr), pCallback, pUser);
+}
+
+/**
+  * @brief  Queue a paged list request
+  * @param pConn: [in] connection
+  * @param offset: [in] index of the first record
+  * @param limit: [in] maximum number of records, capped at LIST_PAGE_MAX
+  * @param pCallback: [in] completion callback, receives the records of the page
+  * @param pUser: [in] user argument for the callback
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  * @note  A page shorter than limit marks the end of the table.
+  */
+int telemetry_listPage(Telemetry_Conn_t *pConn, uint32_t offset, uint32_t limit, Telemetry_Callback_t pCallback, void *pUser) {
+    char buff[sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_ListPageReq_t)] = {0};
+    DbProtocolHdr_t *hdr = (DbProtocolHdr_t *)buff;
+    DbProtocol_ListPageReq_t *req = (DbProtocol_ListPageReq_t *)&hdr[1];
+
+    hdr->type = htonl(MSG_SENSOR_LIST_PAGE_REQ);
+    hdr->len = htons(1);
+    req->offset = htonl(offset);
+    req->limit = htonl(limit);
+
+    return conn_enqueue(pConn, buff, sizeof(buff), pCallback, pUser);
+}
+
+/**
+  * @brief  Queue a filter query
+  * @param pConn: [in] connection
+  * @param pQuery: [in] query in host byte order, limit is capped at LIST_PAGE_MAX
+  * @param pCallback: [in] completion callback, receives the matching records of the page
+  * @param pUser: [in] user argument for the callback
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  * @note  A page shorter than limit means there are no further matches.
+  */
+int telemetry_query(Telemetry_Conn_t *pConn, const DbProtocol_QueryReq_t *pQuery, Telemetry_Callback_t pCallback, void *pUser) {
+    char buff[sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_QueryReq_t)] = {0};
+    DbProtocolHdr_t *hdr = (DbProtocolHdr_t *)buff;
+    DbProtocol_QueryReq_t *req = (DbProtocol_QueryReq_t *)&hdr[1];
+    uint32_t temp = 0;
+
+    hdr->type = htonl(MSG_QUERY_VIOLATIONS_REQ);
+    hdr->len = htons(1);
+
+    *req = *pQuery;
+    req->mode = htonl(pQuery->mode);
+    memcpy(&temp, &pQuery->lo, sizeof(temp));
+    temp = htonl(temp);
+    memcpy(&req->lo, &temp, sizeof(temp));
+    memcpy(&temp, &pQuery->hi, sizeof(temp));
+    temp = htonl(temp);
+    memcpy(&req->hi, &temp, sizeof(temp));
+    req->offset = htonl(pQuery->offset);
+    req->limit = htonl(pQuery->limit);
+
+    return conn_enqueue(pConn, buff, sizeof(buff), pCallback, pUser);
+}
+
+/**
+  * @brief  Queue an aggregation request
+  * @param pConn: [in] connection
+  * @param pReq: [in] request in host byte order
+  * @param pCallback: [in] completion callback, receives one DbProtocol_AggregateResp_t per group
+  * @param pUser: [in] user argument for the callback
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  */
+int telemetry_aggregate(Telemetry_Conn_t *pConn, const DbProtocol_AggregateReq_t *pReq, Telemetry_Callback_t pCallback, void *pUser) {
+    char buff[sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_AggregateReq_t)] = {0};
+    DbProtocolHdr_t *hdr = (DbProtocolHdr_t *)buff;
+    DbProtocol_AggregateReq_t *req = (DbProtocol_AggregateReq_t *)&hdr[1];
+
+    hdr->type = htonl(MSG_AGGREGATE_REQ);
+    hdr->len = htons(1);
+    *req = *pReq;
+    req->groupBy = htonl(pReq->groupBy);
+    req->fromTs = htonl(pReq->fromTs);
+    req->toTs = htonl(pReq->toTs);
+
+    return conn_enqueue(pConn, buff, sizeof(buff), pCallback, pUser);
+}
+
+/**
+  * @brief  Queue a downsampled series request
+  * @param pConn: [in] connection
+  * @param pReq: [in] request in host byte order
+  * @param pCallback: [in] completion callback, receives DbProtocol_SeriesPoint_t records
+  * @param pUser: [in] user argument for the callback
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  */
+int telemetry_series(Telemetry_Conn_t *pConn, const DbProtocol_SeriesReq_t *pReq, Telemetry_Callback_t pCallback, void *pUser) {
+    char buff[sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_SeriesReq_t)] = {0};
+    DbProtocolHdr_t *hdr = (DbProtocolHdr_t *)buff;
+    DbProtocol_SeriesReq_t *req = (DbProtocol_SeriesReq_t *)&hdr[1];
+
+    hdr->type = htonl(MSG_SERIES_REQ);
+    hdr->len = htons(1);
+    strncpy(req->sensorId, pReq->sensorId, sizeof(req->sensorId) - 1);
+    req->fromTs = htonl(pReq->fromTs);
+    req->toTs = htonl(pReq->toTs);
+    req->points = htonl(pReq->points);
+
+    return conn_enqueue(pConn, buff, sizeof(buff), pCallback, pUser);
+}
+
+/**
+  * @brief  Queue a downsampled raw readings request
+  * @param pConn: [in] connection
+  * @param pReq: [in] request in host byte order
+  * @param pCallback: [in] completion callback, receives DbProtocol_Sample_t records
+  * @param pUser: [in] user argument for the callback
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  */
+int telemetry_samples(Telemetry_Conn_t *pConn, const DbProtocol_SamplesReq_t *pReq, Telemetry_Callback_t pCallback, void *pUser) {
+    char buff[sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_SamplesReq_t)] = {0};
+    DbProtocolHdr_t *hdr = (DbProtocolHdr_t *)buff;
+    DbProtocol_SamplesReq_t *req = (DbProtocol_SamplesReq_t *)&hdr[1];
+
+    hdr->type = htonl(MSG_SAMPLES_REQ);
+    hdr->len = htons(1);
+    strncpy(req->sensorId, pReq->sensorId, sizeof(req->sensorId) - 1);
+    req->fromTs = htonl(pReq->fromTs);
+    req->toTs = htonl(pReq->toTs);
+    req->points = htonl(pReq->points);
+    req->method = htonl(pReq->method);
+
+    return conn_enqueue(pConn, buff, sizeof(buff), pCallback, pUser);
+}
+
+/**
+  * @brief  Queue a percentile request
+  * @param pConn: [in] connection
+  * @param pReq: [in] request in host byte order
+  * @param pCallback: [in] completion callback, receives one DbProtocol_QuantileResp_t
+  * @param pUser: [in] user argument for the callback
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  */
+int telemetry_quantile(Telemetry_Conn_t *pConn, const DbProtocol_QuantileReq_t *pReq, Telemetry_Callback_t pCallback, void *pUser) {
+    char buff[sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_QuantileReq_t)] = {0};
+    DbProtocolHdr_t *hdr = (DbProtocolHdr_t *)buff;
+    DbProtocol_QuantileReq_t *req = (DbProtocol_QuantileReq_t *)&hdr[1];
+    uint32_t temp = 0;
+    uint32_t i = 0;
+
+    if (0 == pReq->count || pReq->count > QUANTILE_MAX) {
+        return STATUS_ERROR;
+    }
+
+    hdr->type = htonl(MSG_QUANTILE_REQ);
+    hdr->len = htons(1);
+    strncpy(req->sensorId, pReq->sensorId, sizeof(req->sensorId) - 1);
+    strncpy(req->sensorType, pReq->sensorType, sizeof(req->sensorType) - 1);
+    strncpy(req->location, pReq->location, sizeof(req->location) - 1);
+    req->fromTs = htonl(pReq->fromTs);
+    req->toTs = htonl(pReq->toTs);
+    req->count = htonl(pReq->count);
+    for (; i < pReq->count; i++) {
+        memcpy(&temp, &pReq->quantiles[i], sizeof(temp));
+        temp = htonl(temp);
+        memcpy(&req->quantiles[i], &temp, sizeof(temp));
+    }
+
+    return conn_enqueue(pConn, buff, sizeof(buff), pCallback, pUser);
+}
+
+/**
+  * @brief  Queue a snapshot request
+  * @param pConn: [in] connection
+  * @param pCallback: [in] completion callback, receives one DbProtocol_SnapshotResp_t
+  * @param pUser: [in] user argument for the callback
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  * @note  The reply comes as soon as the server forked the writer, the
+  *        snapshot file appears when it is complete.
+  */
+int telemetry_snapshot(Telemetry_Conn_t *pConn, Telemetry_Callback_t pCallback, void *pUser) {
+    DbProtocolHdr_t hdr = {0};
+
+    hdr.type = htonl(MSG_SNAPSHOT_REQ);
+    hdr.len = htons(0);
+
+    return conn_enqueue(pConn, &hdr, sizeof(hdr), pCallback, pUser);
+}
+
+/**
+  * @brief  Queue a replication status request
+  * @param pConn: [in] connection
+  * @param pCallback: [in] completion callback, receives one DbProtocol_ReplStatusResp_t
+  * @param pUser: [in] user argument for the callback
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  * @note  On a replica, primarySeq - seq is how many mutations it lags behind.
+  */
+int telemetry_replStatus(Telemetry_Conn_t *pConn, Telemetry_Callback_t pCallback, void *pUser) {
+    DbProtocolHdr_t hdr = {0};
+
+    hdr.type = htonl(MSG_REPL_STATUS_REQ);
+    hdr.len = htons(0);
+
+    return conn_enqueue(pConn, &hdr, sizeof(hdr), pCallback, pUser);
+}
+
+/**
+  * @brief  Copy a file of the server into a local file
+  * @param pConn: [in] connection with nothing in flight
+  * @param pReq: [in] file to export, in host byte order
+  * @param outFd: [in] descriptor the file is written to at its current offset
+  * @param pResp: [out] size of the file and the sequence a snapshot holds, in host byte order
+  * @retval STATUS_SUCCESS or STATUS_ERROR, the connection is dropped if the stream broke off
+  * @note  The bytes go from the socket through a pipe into outFd with
+  *        splice(), so they never pass through user space. Descriptors
+  *        splice() refuses, such as a terminal, get the pipe's bytes copied.
+  */
+int telemetry_export(Telemetry_Conn_t *pConn, const DbProtocol_ExportReq_t *pReq, int outFd, DbProtocol_ExportResp_t *pResp) {
+    char buff[sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_ExportReq_t)] = {0};
+    DbProtocolHdr_t *hdr = (DbProtocolHdr_t *)buff;
+    DbProtocol_ExportReq_t *req = (DbProtocol_ExportReq_t *)&hdr[1];
+    struct pollfd pfd = {0};
+    uint64_t remaining = 0;
+    bool copy = false;
+    int pipeFds[2] = { -1, -1 };
+    ssize_t n = 0;
+
+    // the file follows the response unframed, so nothing may be pipelined around it
+    if (-1 == pConn->fd || 0 != pConn->pendCount || 0 != pConn->txLen || 0 != pConn->rxLen) {
+        printf("Export needs an idle connection\r\n");
+        return STATUS_ERROR;
+    }
+
+    hdr->type = htonl(MSG_EXPORT_REQ);
+    hdr->len = htons(1);
+    req->file = htonl(pReq->file);
+    req->start = htonl(pReq->start);
+    if (sizeof(buff) != write(pConn->fd, buff, sizeof(buff))) {
+        perror("write");
+        return STATUS_ERROR;
+    }
+
+    if (STATUS_SUCCESS != conn_readFull(pConn, hdr, sizeof(DbProtocolHdr_t))) {
+        goto lost;
+    }
+    if (MSG_ERROR == ntohl(hdr->type)) {
+        printf("Server has no such file to export\r\n");
+        return STATUS_ERROR;
+    }
+    if (MSG_EXPORT_RESP != ntohl(hdr->type) || STATUS_SUCCESS != conn_readFull(pConn, pResp, sizeof(DbProtocol_ExportResp_t))) {
+        printf("Malformed response from server\r\n");
+        goto lost;
+    }
+    pResp->size = be64toh(pResp->size);
+    pResp->seq = be64toh(pResp->seq);
+
+    if (0 != pipe2(pipeFds, O_CLOEXEC)) {
+        perror("pipe2");
+        goto lost;
+    }
+
+    pfd.fd = pConn->fd;
+    pfd.events = POLLIN;
+    for (remaining = pResp->size; 0 != remaining; remaining -= n) {
+        n = splice(pConn->fd, NULL, pipeFds[1], NULL,
+                   (remaining < TELEMETRY_SPLICE_BYTES) ? remaining : TELEMETRY_SPLICE_BYTES,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0 && (EAGAIN == errno || EINTR == errno)) {
+            poll(&pfd, 1, -1);
+            n = 0;
+            continue;
+        }
+        if (n <= 0) {
+            printf("Export broke off with %llu bytes to go\r\n", (unsigned long long)remaining);
+            goto lost;
+        }
+        if (STATUS_SUCCESS != export_drain(pipeFds[0], outFd, n, &copy)) {
+            goto lost;
+        }
+    }
+
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+
+    return STATUS_SUCCESS;
+
+lost:
+    if (-1 != pipeFds[0]) {
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+    }
+    close(pConn->fd);
+    pConn->fd = -1;
+    conn_fail_pending(pConn);
+    return STATUS_ERROR;
+}
+
+/**
+  * @brief  Queue a delete request
+  * @param pConn: [in] connection
+  * @param pSensorId: [in] ID of the sensor to delete
+  * @param pCallback: [in] completion callback, may be NULL
+  * @param pUser: [in] user argument for the callback
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  */
+int telemetry_deleteSensor(Telemetry_Conn_t *pConn, const char *pSensorId, Telemetry_Callback_t pCallback, void *pUser) {
+    char buff[sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_SensorDeleteReq_t)] = {0};
+    DbProtocolHdr_t *hdr = (DbProtocolHdr_t *)buff;
+    DbProtocol_SensorDeleteReq_t *sensor = (DbProtocol_SensorDeleteReq_t *)&hdr[1];
+
+    hdr->type = htonl(MSG_SENSOR_DEL_REQ);
+    hdr->len = htons(1);
+    strncpy(sensor->sensorId, pSensorId, sizeof(sensor->sensorId) - 1);
+
+    return conn_enqueue(pConn, buff, sizeof(buff), pCallback, pUser);
+}
+
+/**
+  * @brief  Drive the connection once
+  * @param pConn: [in] connection
+  * @param timeoutMs: [in] how long to wait for progress, -1 waits forever
+  * @retval number of completed requests, -1 if the connection was lost
+  */
+int telemetry_poll(Telemetry_Conn_t *pConn, int timeoutMs) {
+    struct pollfd pfd = {0};
+    int completed = 0;
+
+    if (-1 == pConn->fd) {
+        return -1;
+    }
+
+    // optimistic write, most of the time the socket has room
+    if (0 != pConn->txLen && STATUS_SUCCESS != conn_write(pConn)) {
+        goto lost;
+    }
+
+    if (0 == pConn->pendCount && 0 == pConn->txLen) {
+        return 0;
+    }
+
+    pfd.fd = pConn->fd;
+    pfd.events = POLLIN | ((0 != pConn->txLen) ? POLLOUT : 0);
+
+    if (poll(&pfd, 1, timeoutMs) < 0) {
+        if (EINTR == errno) {
+            return 0;
+        }
+        perror("poll");
+        goto lost;
+    }
+
+    if (pfd.revents & POLLOUT) {
+        if (STATUS_SUCCESS != conn_write(pConn)) {
+            goto lost;
+        }
+    }
+
+    if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+        if (STATUS_SUCCESS != conn_read(pConn)) {
+            // still hand out whatever arrived before the hangup
+            conn_dispatch(pConn);
+            goto lost;
+        }
+        completed = conn_dispatch(pConn);
+        if (completed < 0) {
+            goto lost;
+        }
+    }
+
+    return completed;
+
+lost:
+    close(pConn->fd);
+    pConn->fd = -1;
+    conn_fail_pending(pConn);
+    return -1;
+}
+
+/**
+  * @brief  Wait for every queued request to complete
+  * @param pConn: [in] connection
+  * @retval STATUS_SUCCESS or STATUS_ERROR if the connection was lost
+  */
+int telemetry_flush(Telemetry_Conn_t *pConn) {
+    while (0 != pConn->pendCount || 0 != pConn->txLen) {
+        if (telemetry_poll(pConn, -1) < 0) {
+            return STATUS_ERROR;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+  * @brief  Number of outstanding requests
+  * @param pConn: [in] connection
+  * @retval requests awaiting a response
+  */
+size_t telemetry_inFlight(const Telemetry_Conn_t *pConn) {
+    return pConn->pendCount;
+}
+
+/**
+  * @brief  Get the server's shared memory ingest ring
+  * @param pConn: [in] unix domain socket connection with nothing in flight
+  * @param pProducer: [out] mapped ring and doorbell
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  */
+int telemetry_shmAttach(Telemetry_Conn_t *pConn, Telemetry_ShmProducer_t *pProducer) {
+    DbProtocolHdr_t hdr = {0};
+    struct pollfd pfd = {0};
+    struct msghdr msg = {0};
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+    int fds[2] = { -1, -1 };
+
+    // the descriptors arrive with the response, so it must not be pipelined
+    if (true != pConn->isLocal || 0 != pConn->pendCount || 0 != pConn->txLen) {
+        printf("Shared memory attach needs an idle unix socket connection\r\n");
+        return STATUS_ERROR;
+    }
+
+    hdr.type = htonl(MSG_SHM_ATTACH_REQ);
+    hdr.len = htons(0);
+    if (sizeof(hdr) != write(pConn->fd, &hdr, sizeof(hdr))) {
+        perror("write");
+        return STATUS_ERROR;
+    }
+
+    pfd.fd = pConn->fd;
+    pfd.events = POLLIN;
+    poll(&pfd, 1, -1);
+
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof(hdr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+
+    if (recvmsg(pConn->fd, &msg, 0) < (ssize_t)sizeof(hdr) || MSG_SHM_ATTACH_RESP != ntohl(hdr.type)) {
+        printf("Server does not offer shared memory ingest\r\n");
+        return STATUS_ERROR;
+    }
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (NULL == cmsg || SCM_RIGHTS != cmsg->cmsg_type || CMSG_LEN(sizeof(fds)) != cmsg->cmsg_len) {
+        printf("No ring descriptors received\r\n");
+        return STATUS_ERROR;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    pProducer->pRing = shmring_map(fds[0]);
+    if (NULL == pProducer->pRing) {
+        close(fds[0]);
+        close(fds[1]);
+        return STATUS_ERROR;
+    }
+
+    pProducer->memFd = fds[0];
+    pProducer->eventFd = fds[1];
+
+    return STATUS_SUCCESS;
+}
+
+/**
+  * @brief  Push a reading into the shared memory ring
+  * @param pProducer: [in] attached producer
+  * @param pReading: [in] reading in host byte order
+  * @retval STATUS_SUCCESS or STATUS_ERROR when the ring is full
+  */
+int telemetry_shmPush(Telemetry_ShmProducer_t *pProducer, const DbProtocol_Reading_t *pReading) {
+    return shmring_push(pProducer->pRing, pReading, pProducer->eventFd);
+}
+
+/**
+  * @brief  Release a shared memory producer
+  * @param pProducer: [in] attached producer
+  */
+void telemetry_shmDetach(Telemetry_ShmProducer_t *pProducer) {
+    shmring_unmap(pProducer->pRing);
+    close(pProducer->memFd);
+    close(pProducer->eventFd);
+    pProducer->pRing = NULL;
+    pProducer->memFd = -1;
+    pProducer->eventFd = -1;
+
+    return;
+}
+
+/**
+  * @brief  Send readings to the UDP ingest endpoint
+  * @param pHost: [in] server IPv4 address
+  * @param port: [in] server UDP ingest port
+  * @param pReadings: [in] readings in host byte order
+  * @param count: [in] number of readings
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  * @note  Readings are packed into as few datagrams as possible, nothing is acknowledged.
+  */
+int telemetry_sendUdp(const char *pHost, uint16_t port, const DbProtocol_Reading_t *pReadings, uint32_t count) {
+    char buf[UDP_DGRAM_MAX];
+    DbProtocol_UdpHdr_t *hdr = (DbProtocol_UdpHdr_t *)buf;
+    DbProtocol_Reading_t *pOut = (DbProtocol_Reading_t *)&hdr[1];
+    uint32_t perDgram = (UDP_DGRAM_MAX - sizeof(DbProtocol_UdpHdr_t)) / sizeof(DbProtocol_Reading_t);
+    struct sockaddr_in serverInfo = {0};
+    uint32_t sent = 0;
+    uint32_t n = 0;
+    uint32_t i = 0;
+    int fd = -1;
+
+    serverInfo.sin_family = AF_INET;
+    serverInfo.sin_port = htons(port);
+    serverInfo.sin_addr.s_addr = inet_addr(pHost);
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (-1 == fd) {
+        perror("socket");
+        return STATUS_ERROR;
+    }
+
+    while (sent < count) {
+        n = (count - sent < perDgram) ? count - sent : perDgram;
+
+        hdr->magic = htonl(UDP_MAGIC);
+        hdr->version = htons(PROTOCOL_VER);
+        hdr->count = htons(n);
+        for (i = 0; i < n; i++) {
+            pOut[i] = pReadings[sent + i];
+            reading_hton(&pOut[i]);
+        }
+
+        if (sendto(fd, buf, sizeof(DbProtocol_UdpHdr_t) + n * sizeof(DbProtocol_Reading_t), 0,
+                   (struct sockaddr *)&serverInfo, sizeof(serverInfo)) < 0) {
+            perror("sendto");
+            close(fd);
+            return STATUS_ERROR;
+        }
+        sent += n;
+    }
+
+    close(fd);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+  * @brief  Connect to every shard of a deployment
+  * @param pCluster: [out] shard connections
+  * @param pMap: [in] comma separated "host:port" of each shard in shard order, host is an IPv4 address
+  * @retval STATUS_SUCCESS or STATUS_ERROR, nothing is left connected on failure
+  * @note  Every client and server must use the same map order, the order
+  *        decides which shard owns which sensors.
+  */
+int telemetry_clusterConnect(Telemetry_Cluster_t *pCluster, const char *pMap) {
+    char map[SHARD_MAX * 32] = {0};
+    char *pEntry = NULL;
+    char *pColon = NULL;
+    char *pSave = NULL;
+
+    memset(pCluster, 0, sizeof(Telemetry_Cluster_t));
+    if (strlen(pMap) >= sizeof(map)) {
+        printf("Shard map too long\r\n");
+        return STATUS_ERROR;
+    }
+    strcpy(map, pMap);
+
+    for (pEntry = strtok_r(map, ",", &pSave); NULL != pEntry; pEntry = strtok_r(NULL, ",", &pSave)) {
+        pColon = strrchr(pEntry, ':');
+        if (NULL == pColon || SHARD_MAX == pCluster->count) {
+            printf("Bad shard map entry %s, expected up to %d host:port entries\r\n", pEntry, SHARD_MAX);
+            telemetry_clusterClose(pCluster);
+            return STATUS_ERROR;
+        }
+        *pColon = '\0';
+
+        if (STATUS_SUCCESS != telemetry_connect(&pCluster->conns[pCluster->count], pEntry, (uint16_t)atoi(pColon + 1))) {
+            printf("Shard %u at %s:%s is unreachable\r\n", pCluster->count, pEntry, pColon + 1);
+            telemetry_clusterClose(pCluster);
+            return STATUS_ERROR;
+        }
+        pCluster->count++;
+    }
+
+    if (0 == pCluster->count) {
+        printf("Empty shard map\r\n");
+        return STATUS_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+  * @brief  Close every shard connection
+  * @param pCluster: [in] shard connections
+  */
+void telemetry_clusterClose(Telemetry_Cluster_t *pCluster) {
+    uint32_t i = 0;
+
+    for (; i < pCluster->count; i++) {
+        telemetry_close(&pCluster->conns[i]);
+    }
+    pCluster->count = 0;
+
+    return;
+}
+
+/**
+  * @brief  Find the connection to the shard owning a sensor
+  * @param pCluster: [in] shard connections
+  * @param pSensorId: [in] sensor ID
+  * @retval connection, requests about the sensor are queued on it as usual
+  */
+Telemetry_Conn_t *telemetry_clusterRoute(Telemetry_Cluster_t *pCluster, const char *pSensorId) {
+    return &pCluster->conns[shard_of(pSensorId, pCluster->count)];
+}
+
+/**
+  * @brief  Wait for the queued requests of every shard
+  * @param pCluster: [in] shard connections
+  * @retval STATUS_SUCCESS or STATUS_ERROR if a shard connection was lost
+  * @note  One poll() covers every shard, so a slow shard does not hold back
+  *        the others and the total wait is that of the slowest one.
+  */
+int telemetry_clusterFlush(Telemetry_Cluster_t *pCluster) {
+    struct pollfd pfds[SHARD_MAX];
+    Telemetry_Conn_t *pConn = NULL;
+    uint32_t busy = 0;
+    uint32_t i = 0;
+    int status = STATUS_SUCCESS;
+
+    while (true) {
+        busy = 0;
+        for (i = 0; i < pCluster->count; i++) {
+            pConn = &pCluster->conns[i];
+            if (0 == pConn->pendCount && 0 == pConn->txLen) {
+                continue;
+            }
+
+            // sends what is queued and dispatches what already arrived, never waits
+            if (telemetry_poll(pConn, 0) < 0) {
+                status = STATUS_ERROR;
+                continue;
+            }
+
+            if (0 != pConn->pendCount || 0 != pConn->txLen) {
+                pfds[busy].fd = pConn->fd;
+                pfds[busy].events = POLLIN | ((0 != pConn->txLen) ? POLLOUT : 0);
+                pfds[busy].revents = 0;
+                busy++;
+            }
+        }
+
+        if (0 == busy) {
+            break;
+        }
+
+        if (poll(pfds, busy, -1) < 0 && EINTR != errno) {
+            perror("poll");
+            return STATUS_ERROR;
+        }
+    }
+
+    return status;
+}
+
+/**
+  * @brief  Aggregate over every shard and merge the groups
+  * @param pCluster: [in] shard connections, other queued requests complete as well
+  * @param pReq: [in] request in host byte order
+  * @param pCallback: [in] receives the merged DbProtocol_AggregateResp_t groups once
+  * @param pUser: [in] user argument for the callback
+  * @retval STATUS_SUCCESS or STATUS_ERROR
+  * @note  Counts and sums add up and min/max combine exactly, avg is taken
+  *        from the merged sum and count. A shard that fails fails the whole
+  *        request, a partial answer would look complete.
+  */
+int telemetry_clusterAggregate(Telemetry_Cluster_t *pCluster, const DbProtocol_AggregateReq_t *pReq,
+                               Telemetry_Callback_t pCallback, void *pUser) {
+    Cluster_Merge_t merge = {0};
+    double sum = 0.0;
+    uint32_t i = 0;
+
+    merge.status = STATUS_SUCCESS;
+    for (; i < pCluster->count; i++) {
+        if (STATUS_SUCCESS != telemetry_aggregate(&pCluster->conns[i], pReq, cluster_on_aggregate, &merge)) {
+            merge.status = STATUS_ERROR;
+        }
+    }
+
+    if (STATUS_SUCCESS != telemetry_clusterFlush(pCluster)) {
+        merge.status = STATUS_ERROR;
+    }
+
+    for (i = 0; i < merge.count; i++) {
+        memcpy(&sum, &merge.pGroups[i].sum, sizeof(sum));
+        merge.pGroups[i].avg = (0 != merge.pGroups[i].count) ? (float)(sum / merge.pGroups[i].count) : 0.0f;
+    }
+
+    if (NULL != pCallback) {
+        pCallback(merge.status, (STATUS_SUCCESS == merge.status) ? MSG_AGGREGATE_RESP : MSG_ERROR,
+                  merge.pGroups, (STATUS_SUCCESS == merge.status) ? merge.count : 0, pUser);
+    }
+    free(merge.pGroups);
+
+    return merge.status;
+}
+
+/**
+ * Helper functions
+ */
+
+static void cluster_on_aggregate(int status, DbProtocol_e type, const void *pPayload, uint32_t count, void *pUser) {
+    const DbProtocol_AggregateResp_t *pGroup = (const DbProtocol_AggregateResp_t *)pPayload;
+    Cluster_Merge_t *pMerge = (Cluster_Merge_t *)pUser;
+    DbProtocol_AggregateResp_t *pGrown = NULL;
+    DbProtocol_AggregateResp_t *pInto = NULL;
+    double sum = 0.0;
+    double add = 0.0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    if (STATUS_SUCCESS != status) {
+        pMerge->status = STATUS_ERROR;
+        return;
+    }
+
+    // a few groups per shard, a linear search beats hashing them
+    for (; i < count; i++, pGroup++) {
+        for (j = 0; j < pMerge->count; j++) {
+            if (0 == strncmp(pMerge->pGroups[j].key, pGroup->key, sizeof(pGroup->key))) {
+                break;
+            }
+        }
+
+        if (j == pMerge->count) {
+            if (pMerge->count == pMerge->capacity) {
+                pGrown = realloc(pMerge->pGroups, (pMerge->capacity * 2 + 16) * sizeof(DbProtocol_AggregateResp_t));
+                if (NULL == pGrown) {
+                    pMerge->status = STATUS_ERROR;
+                    return;
+                }
+                pMerge->pGroups = pGrown;
+                pMerge->capacity = pMerge->capacity * 2 + 16;
+            }
+            pMerge->pGroups[pMerge->count++] = *pGroup;
+            continue;
+        }
+
+        pInto = &pMerge->pGroups[j];
+        if (0 == pInto->count || pGroup->min < pInto->min) {
+            pInto->min = pGroup->min;
+        }
+        if (0 == pInto->count || pGroup->max > pInto->max) {
+            pInto->max = pGroup->max;
+        }
+        pInto->count += pGroup->count;
+        memcpy(&sum, &pInto->sum, sizeof(sum));
+        memcpy(&add, &pGroup->sum, sizeof(add));
+        sum += add;
+        memcpy(&pInto->sum, &sum, sizeof(sum));
+    }
+
+    return;
+}
+
+static int conn_init(Telemetry_Conn_t *pConn, int fd, bool isLocal) {
+    memset(pConn, 0, sizeof(Telemetry_Conn_t));
+    pConn->fd = fd;
+    pConn->isLocal = isLocal;
+    pConn->window = TELEMETRY_DEFAULT_WINDOW;
+
+    if (STATUS_SUCCESS != conn_handshake(pConn)) {
+        close(fd);
+        pConn->fd = -1;
+        return STATUS_ERROR;
+    }
+
+    // everything after the handshake is driven by telemetry_poll()
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    return STATUS_SUCCESS;
+}
+
+static int conn_handshake(Telemetry_Conn_t *pConn) {
+    char buff[sizeof(DbProtocolHdr_t) + sizeof(DbProtocolVer_Req_t)] = {0};
+    DbProtocolHdr_t *hdr = (DbProtocolHdr_t *)buff;
+    DbProtocolVer_Req_t *req = (DbProtocolVer_Req_t *)&hdr[1];
+    size_t got = 0;
+    ssize_t n = 0;
+
+    hdr->type = htonl(MSG_HANDSHAKE_REQ);
+    hdr->len = htons(1);
+    req->version = htons(PROTOCOL_VER);
+
+    if (sizeof(buff) != write(pConn->fd, buff, sizeof(buff))) {
+        perror("write");
+        return STATUS_ERROR;
+    }
+
+    // header first: an error reply carries no payload
+    while (got < sizeof(DbProtocolHdr_t)) {
+        n = read(pConn->fd, buff + got, sizeof(DbProtocolHdr_t) - got);
+        if (n <= 0) {
+            printf("Server closed the connection during handshake\r\n");
+            return STATUS_ERROR;
+        }
+        got += n;
+    }
+
+    if (MSG_HANDSHAKE_RESP != ntohl(hdr->type)) {
+        printf("Protocol mismatch.\r\n");
+        return STATUS_ERROR;
+    }
+
+    while (got < sizeof(buff)) {
+        n = read(pConn->fd, buff + got, sizeof(buff) - got);
+        if (n <= 0) {
+            return STATUS_ERROR;
+        }
+        got += n;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static int conn_enqueue(Telemetry_Conn_t *pConn, const void *pFrame, size_t len, Telemetry_Callback_t pCallback, void *pUser) {
+    Telemetry_Pending_t *pNew = NULL;
+    size_t i = 0;
+
+    if (-1 == pConn->fd) {
+        return STATUS_ERROR;
+    }
+
+    // back-pressure: keep at most window requests outstanding
+    while (pConn->pendCount >= pConn->window) {
+        if (telemetry_poll(pConn, -1) < 0) {
+            return STATUS_ERROR;
+        }
+    }
+
+    if (STATUS_SUCCESS != buf_reserve(&pConn->pTxBuf, &pConn->txCap, pConn->txLen, len)) {
+        return STATUS_ERROR;
+    }
+
+    if (pConn->pendCount == pConn->pendCap) {
+        size_t newCap = (0 == pConn->pendCap) ? TELEMETRY_DEFAULT_WINDOW : pConn->pendCap * 2;
+        pNew = calloc(newCap, sizeof(Telemetry_Pending_t));
+        if (NULL == pNew) {
+            printf("Malloc failed\r\n");
+            return STATUS_ERROR;
+        }
+        // unwrap the FIFO into the new array
+        for (i = 0; i < pConn->pendCount; i++) {
+            pNew[i] = pConn->pPending[(pConn->pendHead + i) % pConn->pendCap];
+        }
+        free(pConn->pPending);
+        pConn->pPending = pNew;
+        pConn->pendCap = newCap;
+        pConn->pendHead = 0;
+    }
+
+    memcpy(pConn->pTxBuf + pConn->txLen, pFrame, len);
+    pConn->txLen += len;
+
+    pConn->pPending[(pConn->pendHead + pConn->pendCount) % pConn->pendCap].pCallback = pCallback;
+    pConn->pPending[(pConn->pendHead + pConn->pendCount) % pConn->pendCap].pUser = pUser;
+    pConn->pendCount++;
+
+    return STATUS_SUCCESS;
+}
+
+static int buf_reserve(char **ppBuf, size_t *pCap, size_t used, size_t extra) {
+    size_t newCap = (0 == *pCap) ? TELEMETRY_INITIAL_BUF : *pCap;
+    char *pNew = NULL;
+
+    if (used + extra <= *pCap) {
+        return STATUS_SUCCESS;
+    }
+
+    while (newCap < used + extra) {
+        newCap *= 2;
+    }
+
+    pNew = realloc(*ppBuf, newCap);
+    if (NULL == pNew) {
+        printf("Realloc failed\r\n");
+        return STATUS_ERROR;
+    }
+
+    *ppBuf = pNew;
+    *pCap = newCap;
+
+    return STATUS_SUCCESS;
+}
+
+static int conn_write(Telemetry_Conn_t *pConn) {
+    ssize_t n = 0;
+
+    while (0 != pConn->txLen) {
+        n = write(pConn->fd, pConn->pTxBuf, pConn->txLen);
+        if (n < 0) {
+            if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                break;
+            }
+            if (EINTR == errno) {
+                continue;
+            }
+            perror("write");
+            return STATUS_ERROR;
+        }
+
+        pConn->txLen -= n;
+        memmove(pConn->pTxBuf, pConn->pTxBuf + n, pConn->txLen);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static int conn_read(Telemetry_Conn_t *pConn) {
+    ssize_t n = 0;
+
+    for (;;) {
+        if (STATUS_SUCCESS != buf_reserve(&pConn->pRxBuf, &pConn->rxCap, pConn->rxLen, BUFF_SIZE)) {
+            return STATUS_ERROR;
+        }
+
+        n = read(pConn->fd, pConn->pRxBuf + pConn->rxLen, pConn->rxCap - pConn->rxLen);
+        if (n > 0) {
+            pConn->rxLen += n;
+            continue;
+        }
+
+        if (0 == n) {
+            printf("Server closed the connection\r\n");
+            return STATUS_ERROR;
+        }
+
+        if (EAGAIN == errno || EWOULDBLOCK == errno) {
+            return STATUS_SUCCESS;
+        }
+
+        if (EINTR != errno) {
+            perror("read");
+            return STATUS_ERROR;
+        }
+    }
+}
+
+static int conn_dispatch(Telemetry_Conn_t *pConn) {
+    uint64_t frame[BUFF_SIZE / sizeof(uint64_t)];
+    char *pFrame = NULL;
+    DbProtocolHdr_t *hdr = NULL;
+    Telemetry_Pending_t pending;
+    DbProtocol_SensorListResp_t *pRecords = NULL;
+    DbProtocol_AggregateResp_t *pGroups = NULL;
+    DbProtocol_SeriesPoint_t *pPoints = NULL;
+    DbProtocol_Sample_t *pSamples = NULL;
+    DbProtocol_QuantileResp_t *pQuantiles = NULL;
+    DbProtocol_SnapshotResp_t *pSnapshot = NULL;
+    DbProtocol_ReplStatusResp_t *pStatus = NULL;
+    uint32_t temp = 0;
+    long frameSize = 0;
+    int completed = 0;
+    uint32_t i = 0;
+
+    for (;;) {
+        frameSize = resp_frame_size(pConn->pRxBuf, pConn->rxLen);
+        if (frameSize < 0) {
+            printf("Malformed response from server\r\n");
+            return -1;
+        }
+
+        if (0 == frameSize || pConn->rxLen < (size_t)frameSize) {
+            break;
+        }
+
+        if (0 == pConn->pendCount) {
+            printf("Unsolicited response from server\r\n");
+            return -1;
+        }
+
+        // callbacks may queue more requests and so poll the connection again,
+        // the frame leaves the receive buffer before any of them runs
+        pFrame = (char *)frame;
+        if ((size_t)frameSize > sizeof(frame)) {
+            pFrame = malloc(frameSize);
+            if (NULL == pFrame) {
+                printf("Malloc failed\r\n");
+                return -1;
+            }
+        }
+        memcpy(pFrame, pConn->pRxBuf, frameSize);
+        pConn->rxLen -= frameSize;
+        memmove(pConn->pRxBuf, pConn->pRxBuf + frameSize, pConn->rxLen);
+
+        hdr = (DbProtocolHdr_t *)pFrame;
+        hdr->type = ntohl(hdr->type);
+        hdr->len = ntohs(hdr->len);
+
+        // the server answers strictly in request order
+        pending = pConn->pPending[pConn->pendHead];
+        pConn->pendHead = (pConn->pendHead + 1) % pConn->pendCap;
+        pConn->pendCount--;
+
+        if (MSG_SENSOR_LIST_RESP == hdr->type || MSG_SENSOR_LIST_PAGE_RESP == hdr->type ||
+            MSG_QUERY_VIOLATIONS_RESP == hdr->type) {
+            pRecords = (DbProtocol_SensorListResp_t *)&hdr[1];
+            for (i = 0; i < hdr->len; i++) {
+                list_resp_ntoh(&pRecords[i]);
+            }
+        }
+
+        if (MSG_AGGREGATE_RESP == hdr->type) {
+            pGroups = (DbProtocol_AggregateResp_t *)&hdr[1];
+            for (i = 0; i < hdr->len; i++) {
+                aggregate_resp_ntoh(&pGroups[i]);
+            }
+        }
+
+        if (MSG_SERIES_RESP == hdr->type) {
+            pPoints = (DbProtocol_SeriesPoint_t *)&hdr[1];
+            for (i = 0; i < hdr->len; i++) {
+                series_point_ntoh(&pPoints[i]);
+            }
+        }
+
+        if (MSG_SAMPLES_RESP == hdr->type) {
+            pSamples = (DbProtocol_Sample_t *)&hdr[1];
+            for (i = 0; i < hdr->len; i++) {
+                pSamples[i].timestamp = ntohl(pSamples[i].timestamp);
+                memcpy(&temp, &pSamples[i].value, sizeof(temp));
+                temp = ntohl(temp);
+                memcpy(&pSamples[i].value, &temp, sizeof(temp));
+            }
+        }
+
+        if (MSG_QUANTILE_RESP == hdr->type) {
+            pQuantiles = (DbProtocol_QuantileResp_t *)&hdr[1];
+            for (i = 0; i < hdr->len; i++) {
+                quantile_resp_ntoh(&pQuantiles[i]);
+            }
+        }
+
+        if (MSG_SNAPSHOT_RESP == hdr->type) {
+            pSnapshot = (DbProtocol_SnapshotResp_t *)&hdr[1];
+            for (i = 0; i < hdr->len; i++) {
+                pSnapshot[i].seq = be64toh(pSnapshot[i].seq);
+                pSnapshot[i].pid = ntohl(pSnapshot[i].pid);
+            }
+        }
+
+        if (MSG_REPL_STATUS_RESP == hdr->type) {
+            pStatus = (DbProtocol_ReplStatusResp_t *)&hdr[1];
+            for (i = 0; i < hdr->len; i++) {
+                pStatus[i].seq = be64toh(pStatus[i].seq);
+                pStatus[i].primarySeq = be64toh(pStatus[i].primarySeq);
+                pStatus[i].role = ntohl(pStatus[i].role);
+                pStatus[i].peers = ntohl(pStatus[i].peers);
+            }
+        }
+
+        if (NULL != pending.pCallback) {
+            pending.pCallback((MSG_ERROR == hdr->type) ? STATUS_ERROR : STATUS_SUCCESS,
+                              hdr->type, &hdr[1], hdr->len, pending.pUser);
+        }
+        completed++;
+
+        if ((char *)frame != pFrame) {
+            free(pFrame);
+        }
+
+        // a nested poll lost the connection and failed what was left
+        if (-1 == pConn->fd) {
+            break;
+        }
+    }
+
+    return completed;
+}
+
+static long resp_frame_size(const char *pData, size_t len) {
+    DbProtocolHdr_t hdr;
+    size_t payload = 0;
+
+    if (len < sizeof(DbProtocolHdr_t)) {
+        return 0;
+    }
+
+    memcpy(&hdr, pData, sizeof(DbProtocolHdr_t));
+    hdr.type = ntohl(hdr.type);
+    hdr.len = ntohs(hdr.len);
+
+    switch (hdr.type) {
+        case MSG_HANDSHAKE_RESP:{
+            payload = hdr.len * sizeof(DbProtocolVer_Resp_t);
+            break;
+        }
+        case MSG_SENSOR_LIST_RESP:
+        case MSG_SENSOR_LIST_PAGE_RESP:
+        case MSG_QUERY_VIOLATIONS_RESP:{
+            payload = hdr.len * sizeof(DbProtocol_SensorListResp_t);
+            break;
+        }
+        case MSG_AGGREGATE_RESP:{
+            payload = hdr.len * sizeof(DbProtocol_AggregateResp_t);
+            break;
+        }
+        case MSG_SERIES_RESP:{
+            payload = hdr.len * sizeof(DbProtocol_SeriesPoint_t);
+            break;
+        }
+        case MSG_SAMPLES_RESP:{
+            payload = hdr.len * sizeof(DbProtocol_Sample_t);
+            break;
+        }
+        case MSG_QUANTILE_RESP:{
+            payload = hdr.len * sizeof(DbProtocol_QuantileResp_t);
+            break;
+        }
+        case MSG_SNAPSHOT_RESP:{
+            payload = hdr.len * sizeof(DbProtocol_SnapshotResp_t);
+            break;
+        }
+        case MSG_REPL_STATUS_RESP:{
+            payload = hdr.len * sizeof(DbProtocol_ReplStatusResp_t);
+            break;
+        }
+        case MSG_SENSOR_ADD_RESP:
+        case MSG_SENSOR_DEL_RESP:
+        case MSG_SENSOR_BATCH_ADD_RESP:
+        case MSG_ERROR:{
+            payload = 0;
+            break;
+        }
+        default:{
+            return -1;
+        }
+    }
+
+    return sizeof(DbProtocolHdr_t) + payload;
+}
+
+static int conn_readFull(Telemetry_Conn_t *pConn, void *pBuf, size_t len) {
+    struct pollfd pfd = { .fd = pConn->fd, .events = POLLIN };
+    size_t got = 0;
+    ssize_t n = 0;
+
+    while (got < len) {
+        n = read(pConn->fd, (char *)pBuf + got, len - got);
+        if (n > 0) {
+            got += n;
+            continue;
+        }
+        if (0 == n) {
+            printf("Server closed the connection\r\n");
+            return STATUS_ERROR;
+        }
+        if (EAGAIN == errno || EWOULDBLOCK == errno) {
+            poll(&pfd, 1, -1);
+        } else if (EINTR != errno) {
+            perror("read");
+            return STATUS_ERROR;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static int export_drain(int pipeFd, int outFd, size_t len, bool *pCopy) {
+    char buff[BUFF_SIZE];
+    ssize_t n = 0;
+
+    while (0 != len) {
+        if (true != *pCopy) {
+            n = splice(pipeFd, NULL, outFd, NULL, len, SPLICE_F_MOVE);
+            if (n < 0 && EINVAL == errno) {
+                *pCopy = true;
+                continue;
+            }
+        } else {
+            n = read(pipeFd, buff, (len < sizeof(buff)) ? len : sizeof(buff));
+            if (n > 0 && n != write(outFd, buff, n)) {
+                n = -1;
+            }
+        }
+
+        if (n < 0 && EINTR == errno) {
+            continue;
+        }
+        if (n <= 0) {
+            perror("export write");
+            return STATUS_ERROR;
+        }
+        len -= n;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static void conn_fail_pending(Telemetry_Conn_t *pConn) {
+    Telemetry_Pending_t pending;
+
+    while (0 != pConn->pendCount) {
+        pending = pConn->pPending[pConn->pendHead];
+        pConn->pendHead = (pConn->pendHead + 1) % pConn->pendCap;
+        pConn->pendCount--;
+
+        if (NULL != pending.pCallback) {
+            pending.pCallback(STATUS_ERROR, MSG_ERROR, NULL, 0, pending.pUser);
+        }
+    }
+
+    pConn->txLen = 0;
+
+    return;
+}
+
+static void list_resp_ntoh(DbProtocol_SensorListResp_t *pResp) {
+    uint32_t temp = 0;
+
+    pResp->timestamp = ntohl(pResp->timestamp);
+
+    memcpy(&temp, &pResp->readingValue, sizeof(temp));
+    temp = ntohl(temp);
+    memcpy(&pResp->readingValue, &temp, sizeof(temp));
+
+    memcpy(&temp, &pResp->minThreshold, sizeof(temp));
+    temp = ntohl(temp);
+    memcpy(&pResp->minThreshold, &temp, sizeof(temp));
+
+    memcpy(&temp, &pResp->maxThreshold, sizeof(temp));
+    temp = ntohl(temp);
+    memcpy(&pResp->maxThreshold, &temp, sizeof(temp));
+
+    pResp->sensorId[sizeof(pResp->sensorId) - 1] = '\0';
+    pResp->sensorType[sizeof(pResp->sensorType) - 1] = '\0';
+    pResp->location[sizeof(pResp->location) - 1] = '\0';
+
+    return;
+}
+
+static void aggregate_resp_ntoh(DbProtocol_AggregateResp_t *pResp) {
+    uint32_t temp = 0;
+
+    pResp->count = ntohl(pResp->count);
+
+    memcpy(&temp, &pResp->min, sizeof(temp));
+    temp = ntohl(temp);
+    memcpy(&pResp->min, &temp, sizeof(temp));
+
+    memcpy(&temp, &pResp->max, sizeof(temp));
+    temp = ntohl(temp);
+    memcpy(&pResp->max, &temp, sizeof(temp));
+
+    memcpy(&temp, &pResp->avg, sizeof(temp));
+    temp = ntohl(temp);
+    memcpy(&pResp->avg, &temp, sizeof(temp));
+
+    pResp->sum = be64toh(pResp->sum);
+    pResp->key[sizeof(pResp->key) - 1] = '\0';
+
+    return;
+}
+
+static void series_point_ntoh(DbProtocol_SeriesPoint_t *pPoint) {
+    uint32_t temp = 0;
+
+    pPoint->start = ntohl(pPoint->start);
+    pPoint->width = ntohl(pPoint->width);
+    pPoint->count = ntohl(pPoint->count);
+
+    memcpy(&temp, &pPoint->min, sizeof(temp));
+    temp = ntohl(temp);
+    memcpy(&pPoint->min, &temp, sizeof(temp));
+
+    memcpy(&temp, &pPoint->max, sizeof(temp));
+    temp = ntohl(temp);
+    memcpy(&pPoint->max, &temp, sizeof(temp));
+
+    pPoint->sum = be64toh(pPoint->sum);
+
+    return;
+}
+
+static void quantile_resp_ntoh(DbProtocol_QuantileResp_t *pResp) {
+    uint32_t temp = 0;
+    int i = 0;
+
+    pResp->readings = ntohl(pResp->readings);
+    pResp->sensors = ntohl(pResp->sensors);
+
+    for (; i < QUANTILE_MAX; i++) {
+        memcpy(&temp, &pResp->values[i], sizeof(temp));
+        temp = ntohl(temp);
+        memcpy(&pResp->values[i], &temp, sizeof(temp));
+    }
+
+    return;
+}
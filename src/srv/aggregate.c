@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "aggregate.h"
+#include "filter.h"
+
+#define AGG_INITIAL_GROUPS  64
+
+/* Private function prototypes -----------------------------------------------*/
+// make room for one group per dictionary code
+static int aggregate_reserve(Aggregate_t *pAgg, uint32_t codes);
+
+/**
+ * @brief  Prepare an empty aggregation state
+ * @param pAgg: [out] State to initialize
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int aggregate_init(Aggregate_t *pAgg)
+{
+    memset(pAgg, 0, sizeof(Aggregate_t));
+
+    pAgg->pGroups = calloc(AGG_INITIAL_GROUPS, sizeof(Aggregate_Group_t));
+    pAgg->pSlots = calloc(AGG_INITIAL_GROUPS, sizeof(uint32_t));
+    if (NULL == pAgg->pGroups || NULL == pAgg->pSlots) {
+        printf("Malloc failed to create aggregation state\r\n");
+        aggregate_free(pAgg);
+        return STATUS_ERROR;
+    }
+
+    pAgg->capacity = AGG_INITIAL_GROUPS;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Release the aggregation state
+ * @param pAgg: [in] State to release
+ */
+void aggregate_free(Aggregate_t *pAgg)
+{
+    free(pAgg->pGroups);
+    free(pAgg->pSlots);
+    free(pAgg->pSelect);
+    memset(pAgg, 0, sizeof(Aggregate_t));
+
+    return;
+}
+
+/**
+ * @brief  Compute count/min/max/sum of readingValue per group
+ * @param pAgg: [in] Aggregation state, receives the groups
+ * @param pTable: [in] Sensor table
+ * @param pReq: [in] Request in host byte order
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  Rows are processed AGG_BATCH at a time: the timestamp column is
+ *        filtered first, then group indexes are resolved from the code
+ *        column, then the readings are folded into the accumulators. Each
+ *        pass runs over one column at a time. Groups appear in order of
+ *        first sight. Type, location and flag predicates are answered from
+ *        the bitmap indexes first, batches without a candidate are skipped.
+ */
+int aggregate_run(Aggregate_t *pAgg, const Table_t *pTable, const DbProtocol_AggregateReq_t *pReq)
+{
+    uint32_t rows[AGG_BATCH];
+    uint32_t groups[AGG_BATCH];
+    uint32_t fromTs = pReq->fromTs;
+    uint32_t toTs = (0 == pReq->toTs) ? UINT32_MAX : pReq->toTs;
+    uint32_t base = 0;
+    uint32_t end = 0;
+    uint32_t selected = 0;
+    uint32_t i = 0;
+    uint32_t ts = 0;
+    uint32_t code = 0;
+    float value = 0.0f;
+    const uint64_t *pSelect = NULL;
+    uint64_t *pGrown = NULL;
+    size_t words = filter_bitmapWords(pTable->count);
+    uint64_t any = 0;
+    const uint16_t *pCodes = NULL;
+    const Dict_t *pDict = NULL;
+    Aggregate_Group_t *pGroup = NULL;
+
+    if (AGG_BY_TYPE == pReq->groupBy) {
+        pCodes = pTable->pTypeCode;
+        pDict = &pTable->types;
+    } else if (AGG_BY_LOCATION == pReq->groupBy) {
+        pCodes = pTable->pLocationCode;
+        pDict = &pTable->locations;
+    } else {
+        return STATUS_ERROR;
+    }
+
+    if (STATUS_SUCCESS != aggregate_reserve(pAgg, pDict->count)) {
+        printf("Realloc failed to expand aggregation groups\r\n");
+        return STATUS_ERROR;
+    }
+
+    pAgg->count = 0;
+    memset(pAgg->pSlots, 0, pDict->count * sizeof(uint32_t));
+
+    if (0 != pReq->flagsMask || '\0' != pReq->sensorType[0] || '\0' != pReq->location[0]) {
+        if (words > pAgg->selectWords) {
+            pGrown = realloc(pAgg->pSelect, words * sizeof(uint64_t));
+            if (NULL == pGrown) {
+                printf("Realloc failed to expand aggregation selection\r\n");
+                return STATUS_ERROR;
+            }
+            pAgg->pSelect = pGrown;
+            pAgg->selectWords = words;
+        }
+
+        if (0 == filter_match(pTable, pReq->sensorType, pReq->location,
+                              pReq->flagsMask, pReq->flagsValue, pAgg->pSelect)) {
+            return STATUS_SUCCESS;
+        }
+        pSelect = pAgg->pSelect;
+    }
+
+    for (; base < pTable->count; base += AGG_BATCH) {
+        end = base + AGG_BATCH;
+        if (end > pTable->count) {
+            end = pTable->count;
+        }
+
+        // timestamp window, branch free selection
+        selected = 0;
+        if (NULL == pSelect) {
+            for (i = base; i < end; i++) {
+                ts = pTable->pTimestamp[i];
+                rows[selected] = i;
+                selected += (ts >= fromTs) & (ts <= toTs);
+            }
+        } else {
+            any = 0;
+            for (i = base / FILTER_WORD_BITS; i < filter_bitmapWords(end); i++) {
+                any |= pSelect[i];
+            }
+            if (0 == any) {
+                continue;
+            }
+
+            for (i = base; i < end; i++) {
+                ts = pTable->pTimestamp[i];
+                rows[selected] = i;
+                selected += (ts >= fromTs) & (ts <= toTs) &
+                            (uint32_t)(pSelect[i / FILTER_WORD_BITS] >> (i % FILTER_WORD_BITS));
+            }
+        }
+
+        for (i = 0; i < selected; i++) {
+            code = pCodes[rows[i]];
+            if (0 == pAgg->pSlots[code]) {
+                pGroup = &pAgg->pGroups[pAgg->count];
+                pGroup->pKey = dict_string(pDict, code);
+                pGroup->count = 0;
+                pGroup->min = INFINITY;
+                pGroup->max = -INFINITY;
+                pGroup->sum = 0.0;
+                pAgg->pSlots[code] = ++pAgg->count;
+            }
+            groups[i] = pAgg->pSlots[code] - 1;
+        }
+
+        for (i = 0; i < selected; i++) {
+            value = pTable->pReading[rows[i]];
+            pGroup = &pAgg->pGroups[groups[i]];
+            pGroup->count++;
+            pGroup->sum += value;
+            pGroup->min = (value < pGroup->min) ? value : pGroup->min;
+            pGroup->max = (value > pGroup->max) ? value : pGroup->max;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Helper functions
+ */
+
+static int aggregate_reserve(Aggregate_t *pAgg, uint32_t codes)
+{
+    Aggregate_Group_t *pGroups = NULL;
+    uint32_t *pSlots = NULL;
+    uint32_t capacity = pAgg->capacity;
+
+    if (codes <= capacity) {
+        return STATUS_SUCCESS;
+    }
+
+    while (capacity < codes) {
+        capacity *= 2;
+    }
+
+    pGroups = realloc(pAgg->pGroups, capacity * sizeof(Aggregate_Group_t));
+    if (NULL == pGroups) {
+        return STATUS_ERROR;
+    }
+    pAgg->pGroups = pGroups;
+
+    pSlots = realloc(pAgg->pSlots, capacity * sizeof(uint32_t));
+    if (NULL == pSlots) {
+        return STATUS_ERROR;
+    }
+    pAgg->pSlots = pSlots;
+    pAgg->capacity = capacity;
+
+    return STATUS_SUCCESS;
+}
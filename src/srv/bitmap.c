@@ -0,0 +1,629 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "bitmap.h"
+
+#define BITMAP_INITIAL_CONTAINERS   4
+#define BITMAP_INITIAL_ARRAY        4
+// saved items are padded to this, so bitset words stay aligned in a mapped file
+#define BITMAP_SAVE_ALIGN           8
+
+/* Private typedef -----------------------------------------------------------*/
+// saved form of a container, followed by its array values or bitset words
+typedef struct {
+    uint32_t key;
+    uint32_t cardinality;
+    uint32_t words;                 // BITMAP_CONTAINER_WORDS for a bitset, 0 for an array
+    uint32_t reserved;
+} Bitmap_Saved_t;
+
+/* Private function prototypes -----------------------------------------------*/
+// position of the container for key, or where it would be inserted
+static uint32_t bitmap_search(const Bitmap_t *pBitmap, uint32_t key, bool *pFound);
+// position of low in an array container, or where it would be inserted
+static uint32_t container_search(const Bitmap_Container_t *pContainer, uint16_t low, bool *pFound);
+// convert an array container to a bitset
+static int container_toBits(Bitmap_Container_t *pContainer);
+// convert a bitset container back to an array
+static int container_toArray(Bitmap_Container_t *pContainer);
+// words of the flat bitmap covered by a container
+static size_t container_words(uint32_t key, size_t words, size_t *pBase);
+// bytes of the values of a saved container, padded
+static size_t container_savedBytes(const Bitmap_Container_t *pContainer);
+
+/**
+ * @brief  Prepare an empty bitmap
+ * @param pBitmap: [out] Bitmap to initialize
+ * @note  Allocates nothing until the first value is added.
+ */
+void bitmap_init(Bitmap_t *pBitmap)
+{
+    memset(pBitmap, 0, sizeof(Bitmap_t));
+
+    return;
+}
+
+/**
+ * @brief  Release a bitmap
+ * @param pBitmap: [in] Bitmap to release
+ */
+void bitmap_free(Bitmap_t *pBitmap)
+{
+    uint32_t i = 0;
+
+    for (; i < pBitmap->count; i++) {
+        free(pBitmap->pContainers[i].pArray);
+        free(pBitmap->pContainers[i].pBits);
+    }
+    free(pBitmap->pContainers);
+    memset(pBitmap, 0, sizeof(Bitmap_t));
+
+    return;
+}
+
+/**
+ * @brief  Add a value to the bitmap
+ * @param pBitmap: [in] Bitmap to update
+ * @param value: [in] Value to add, adding a present value is a no-op
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int bitmap_add(Bitmap_t *pBitmap, uint32_t value)
+{
+    Bitmap_Container_t *pContainer = NULL;
+    Bitmap_Container_t *pGrown = NULL;
+    uint16_t *pArray = NULL;
+    uint16_t low = value & 0xFFFF;
+    uint32_t pos = 0;
+    uint32_t capacity = 0;
+    bool found = false;
+
+    pos = bitmap_search(pBitmap, value >> 16, &found);
+    if (true != found) {
+        if (pBitmap->count == pBitmap->capacity) {
+            capacity = (0 == pBitmap->capacity) ? BITMAP_INITIAL_CONTAINERS : pBitmap->capacity * 2;
+            pGrown = realloc(pBitmap->pContainers, capacity * sizeof(Bitmap_Container_t));
+            if (NULL == pGrown) {
+                return STATUS_ERROR;
+            }
+            pBitmap->pContainers = pGrown;
+            pBitmap->capacity = capacity;
+        }
+
+        memmove(&pBitmap->pContainers[pos + 1], &pBitmap->pContainers[pos],
+                (pBitmap->count - pos) * sizeof(Bitmap_Container_t));
+        pBitmap->count++;
+        memset(&pBitmap->pContainers[pos], 0, sizeof(Bitmap_Container_t));
+        pBitmap->pContainers[pos].key = value >> 16;
+    }
+    pContainer = &pBitmap->pContainers[pos];
+
+    if (NULL == pContainer->pBits && BITMAP_ARRAY_MAX == pContainer->cardinality) {
+        if (STATUS_SUCCESS != container_toBits(pContainer)) {
+            return STATUS_ERROR;
+        }
+    }
+
+    if (NULL != pContainer->pBits) {
+        if (0 != (pContainer->pBits[low / 64] & (1ULL << (low % 64)))) {
+            return STATUS_SUCCESS;
+        }
+        pContainer->pBits[low / 64] |= 1ULL << (low % 64);
+    } else {
+        pos = container_search(pContainer, low, &found);
+        if (true == found) {
+            return STATUS_SUCCESS;
+        }
+
+        if (pContainer->cardinality == pContainer->capacity) {
+            capacity = (0 == pContainer->capacity) ? BITMAP_INITIAL_ARRAY : pContainer->capacity * 2;
+            pArray = realloc(pContainer->pArray, capacity * sizeof(uint16_t));
+            if (NULL == pArray) {
+                return STATUS_ERROR;
+            }
+            pContainer->pArray = pArray;
+            pContainer->capacity = capacity;
+        }
+
+        memmove(&pContainer->pArray[pos + 1], &pContainer->pArray[pos],
+                (pContainer->cardinality - pos) * sizeof(uint16_t));
+        pContainer->pArray[pos] = low;
+    }
+
+    pContainer->cardinality++;
+    pBitmap->cardinality++;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Remove a value from the bitmap
+ * @param pBitmap: [in] Bitmap to update
+ * @param value: [in] Value to remove, removing an absent value is a no-op
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int bitmap_remove(Bitmap_t *pBitmap, uint32_t value)
+{
+    Bitmap_Container_t *pContainer = NULL;
+    uint16_t low = value & 0xFFFF;
+    uint32_t pos = 0;
+    uint32_t at = 0;
+    bool found = false;
+
+    pos = bitmap_search(pBitmap, value >> 16, &found);
+    if (true != found) {
+        return STATUS_SUCCESS;
+    }
+    pContainer = &pBitmap->pContainers[pos];
+
+    if (NULL != pContainer->pBits) {
+        if (0 == (pContainer->pBits[low / 64] & (1ULL << (low % 64)))) {
+            return STATUS_SUCCESS;
+        }
+        pContainer->pBits[low / 64] &= ~(1ULL << (low % 64));
+    } else {
+        at = container_search(pContainer, low, &found);
+        if (true != found) {
+            return STATUS_SUCCESS;
+        }
+        memmove(&pContainer->pArray[at], &pContainer->pArray[at + 1],
+                (pContainer->cardinality - at - 1) * sizeof(uint16_t));
+    }
+
+    pContainer->cardinality--;
+    pBitmap->cardinality--;
+
+    if (0 == pContainer->cardinality) {
+        free(pContainer->pArray);
+        free(pContainer->pBits);
+        memmove(&pBitmap->pContainers[pos], &pBitmap->pContainers[pos + 1],
+                (pBitmap->count - pos - 1) * sizeof(Bitmap_Container_t));
+        pBitmap->count--;
+    } else if (NULL != pContainer->pBits && pContainer->cardinality <= BITMAP_ARRAY_MAX / 2) {
+        // half the switch point, so a row flapping at the boundary does not convert every time
+        return container_toArray(pContainer);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Move the values of one bitmap into another
+ * @param pDst: [in] Bitmap to update
+ * @param pSrc: [in] Bitmap to empty, released on return
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  Containers whose key pDst lacks are handed over without copying,
+ *        so merging bitmaps of disjoint row ranges costs O(containers).
+ */
+int bitmap_merge(Bitmap_t *pDst, Bitmap_t *pSrc)
+{
+    Bitmap_Container_t *pContainer = NULL;
+    Bitmap_Container_t *pGrown = NULL;
+    uint64_t bits = 0;
+    uint32_t capacity = 0;
+    uint32_t pos = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    bool found = false;
+
+    for (; i < pSrc->count; i++) {
+        pContainer = &pSrc->pContainers[i];
+        pos = bitmap_search(pDst, pContainer->key, &found);
+
+        if (true == found) {
+            // shared chunk, only at the edges of the ranges: add value by value
+            for (j = 0; NULL == pContainer->pBits && j < pContainer->cardinality; j++) {
+                if (STATUS_SUCCESS != bitmap_add(pDst, (pContainer->key << 16) | pContainer->pArray[j])) {
+                    return STATUS_ERROR;
+                }
+            }
+            for (j = 0; NULL != pContainer->pBits && j < BITMAP_CONTAINER_WORDS; j++) {
+                for (bits = pContainer->pBits[j]; 0 != bits; bits &= bits - 1) {
+                    if (STATUS_SUCCESS != bitmap_add(pDst, (pContainer->key << 16) | (j * 64 + __builtin_ctzll(bits)))) {
+                        return STATUS_ERROR;
+                    }
+                }
+            }
+            continue;
+        }
+
+        if (pDst->count == pDst->capacity) {
+            capacity = (0 == pDst->capacity) ? BITMAP_INITIAL_CONTAINERS : pDst->capacity * 2;
+            pGrown = realloc(pDst->pContainers, capacity * sizeof(Bitmap_Container_t));
+            if (NULL == pGrown) {
+                return STATUS_ERROR;
+            }
+            pDst->pContainers = pGrown;
+            pDst->capacity = capacity;
+        }
+        memmove(&pDst->pContainers[pos + 1], &pDst->pContainers[pos], (pDst->count - pos) * sizeof(Bitmap_Container_t));
+        pDst->pContainers[pos] = *pContainer;
+        pDst->count++;
+        pDst->cardinality += pContainer->cardinality;
+        memset(pContainer, 0, sizeof(Bitmap_Container_t));
+    }
+
+    bitmap_free(pSrc);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Get the size of a serialized bitmap
+ * @param pBitmap: [in] Bitmap
+ * @return bytes bitmap_save() writes
+ */
+size_t bitmap_savedBytes(const Bitmap_t *pBitmap)
+{
+    size_t bytes = BITMAP_SAVE_ALIGN;
+    uint32_t i = 0;
+
+    for (; i < pBitmap->count; i++) {
+        bytes += sizeof(Bitmap_Saved_t) + container_savedBytes(&pBitmap->pContainers[i]);
+    }
+
+    return bytes;
+}
+
+/**
+ * @brief  Serialize a bitmap
+ * @param pBitmap: [in] Bitmap
+ * @param pOut: [out] bitmap_savedBytes() bytes, host byte order
+ * @return bytes written
+ */
+size_t bitmap_save(const Bitmap_t *pBitmap, uint8_t *pOut)
+{
+    const Bitmap_Container_t *pContainer = NULL;
+    Bitmap_Saved_t saved;
+    size_t at = BITMAP_SAVE_ALIGN;
+    size_t bytes = 0;
+    uint32_t i = 0;
+
+    memset(pOut, 0, BITMAP_SAVE_ALIGN);
+    memcpy(pOut, &pBitmap->count, sizeof(pBitmap->count));
+
+    for (; i < pBitmap->count; i++) {
+        pContainer = &pBitmap->pContainers[i];
+        memset(&saved, 0, sizeof(saved));
+        saved.key = pContainer->key;
+        saved.cardinality = pContainer->cardinality;
+        saved.words = (NULL != pContainer->pBits) ? BITMAP_CONTAINER_WORDS : 0;
+        memcpy(&pOut[at], &saved, sizeof(saved));
+        at += sizeof(saved);
+
+        bytes = container_savedBytes(pContainer);
+        memset(&pOut[at], 0, bytes);
+        if (NULL != pContainer->pBits) {
+            memcpy(&pOut[at], pContainer->pBits, BITMAP_CONTAINER_WORDS * sizeof(uint64_t));
+        } else {
+            memcpy(&pOut[at], pContainer->pArray, pContainer->cardinality * sizeof(uint16_t));
+        }
+        at += bytes;
+    }
+
+    return at;
+}
+
+/**
+ * @brief  Rebuild a bitmap from its serialized form
+ * @param pBitmap: [out] Bitmap, empty on failure
+ * @param pIn: [in] Output of bitmap_save()
+ * @param len: [in] Bytes available at pIn
+ * @return bytes used, 0 if the input is malformed or allocation failed
+ * @note  Every container is copied in one go, nothing is re-added value by value.
+ */
+size_t bitmap_load(Bitmap_t *pBitmap, const uint8_t *pIn, size_t len)
+{
+    Bitmap_Container_t *pContainer = NULL;
+    Bitmap_Saved_t saved;
+    size_t at = BITMAP_SAVE_ALIGN;
+    size_t bytes = 0;
+    uint32_t count = 0;
+    uint32_t i = 0;
+
+    bitmap_init(pBitmap);
+    if (len < BITMAP_SAVE_ALIGN) {
+        return 0;
+    }
+    memcpy(&count, pIn, sizeof(count));
+    if (0 == count) {
+        return at;
+    }
+
+    pBitmap->pContainers = calloc(count, sizeof(Bitmap_Container_t));
+    if (NULL == pBitmap->pContainers) {
+        return 0;
+    }
+    pBitmap->capacity = count;
+
+    for (; i < count; i++) {
+        if (len - at < sizeof(saved)) {
+            bitmap_free(pBitmap);
+            return 0;
+        }
+        memcpy(&saved, &pIn[at], sizeof(saved));
+        at += sizeof(saved);
+
+        pContainer = &pBitmap->pContainers[i];
+        pContainer->key = saved.key;
+        pContainer->cardinality = saved.cardinality;
+        // the container has no storage yet, so this is the padded array size
+        bytes = (0 != saved.words) ? BITMAP_CONTAINER_WORDS * sizeof(uint64_t) : container_savedBytes(pContainer);
+        pBitmap->count++;
+        if (len - at < bytes || (0 != saved.words && BITMAP_CONTAINER_WORDS != saved.words) ||
+            (0 == saved.words && saved.cardinality > BITMAP_ARRAY_MAX)) {
+            bitmap_free(pBitmap);
+            return 0;
+        }
+
+        if (0 != saved.words) {
+            pContainer->pBits = malloc(bytes);
+            if (NULL != pContainer->pBits) {
+                memcpy(pContainer->pBits, &pIn[at], bytes);
+            }
+        } else {
+            pContainer->capacity = (0 == saved.cardinality) ? BITMAP_INITIAL_ARRAY : saved.cardinality;
+            pContainer->pArray = malloc(pContainer->capacity * sizeof(uint16_t));
+            if (NULL != pContainer->pArray) {
+                memcpy(pContainer->pArray, &pIn[at], saved.cardinality * sizeof(uint16_t));
+            }
+        }
+        if (NULL == pContainer->pBits && NULL == pContainer->pArray) {
+            bitmap_free(pBitmap);
+            return 0;
+        }
+        pBitmap->cardinality += saved.cardinality;
+        at += bytes;
+    }
+
+    return at;
+}
+
+/**
+ * @brief  Write the bitmap into a flat selection bitmap
+ * @param pBitmap: [in] Bitmap
+ * @param pWords: [out] Flat bitmap, bit i of word i / 64 stands for value i
+ * @param words: [in] Size of pWords, values past it are dropped
+ */
+void bitmap_copyTo(const Bitmap_t *pBitmap, uint64_t *pWords, size_t words)
+{
+    const Bitmap_Container_t *pContainer = NULL;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    size_t base = 0;
+    size_t len = 0;
+    uint16_t low = 0;
+
+    memset(pWords, 0, words * sizeof(uint64_t));
+
+    for (; i < pBitmap->count; i++) {
+        pContainer = &pBitmap->pContainers[i];
+        len = container_words(pContainer->key, words, &base);
+        if (0 == len) {
+            break;
+        }
+
+        if (NULL != pContainer->pBits) {
+            memcpy(&pWords[base], pContainer->pBits, len * sizeof(uint64_t));
+            continue;
+        }
+
+        for (j = 0; j < pContainer->cardinality; j++) {
+            low = pContainer->pArray[j];
+            if (low / 64 < len) {
+                pWords[base + low / 64] |= 1ULL << (low % 64);
+            }
+        }
+    }
+
+    return;
+}
+
+/**
+ * @brief  Intersect a flat selection bitmap with the bitmap
+ * @param pBitmap: [in] Bitmap
+ * @param pWords: [in] Flat bitmap, updated in place
+ * @param words: [in] Size of pWords
+ */
+void bitmap_andInto(const Bitmap_t *pBitmap, uint64_t *pWords, size_t words)
+{
+    uint64_t keep[BITMAP_CONTAINER_WORDS];
+    const Bitmap_Container_t *pContainer = NULL;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    size_t base = 0;
+    size_t len = 0;
+    size_t w = 0;
+    uint32_t key = 0;
+    uint16_t low = 0;
+
+    for (; (size_t)key * BITMAP_CONTAINER_WORDS < words; key++) {
+        len = container_words(key, words, &base);
+        while (i < pBitmap->count && pBitmap->pContainers[i].key < key) {
+            i++;
+        }
+
+        if (i == pBitmap->count || pBitmap->pContainers[i].key != key) {
+            memset(&pWords[base], 0, len * sizeof(uint64_t));
+            continue;
+        }
+
+        pContainer = &pBitmap->pContainers[i];
+        if (NULL != pContainer->pBits) {
+            for (w = 0; w < len; w++) {
+                pWords[base + w] &= pContainer->pBits[w];
+            }
+            continue;
+        }
+
+        // sparse chunk: rebuild the words from the array values that survive
+        memset(keep, 0, len * sizeof(uint64_t));
+        for (j = 0; j < pContainer->cardinality; j++) {
+            low = pContainer->pArray[j];
+            if (low / 64 < len) {
+                keep[low / 64] |= pWords[base + low / 64] & (1ULL << (low % 64));
+            }
+        }
+        memcpy(&pWords[base], keep, len * sizeof(uint64_t));
+    }
+
+    return;
+}
+
+/**
+ * @brief  Remove the bitmap's values from a flat selection bitmap
+ * @param pBitmap: [in] Bitmap
+ * @param pWords: [in] Flat bitmap, updated in place
+ * @param words: [in] Size of pWords
+ */
+void bitmap_andNotInto(const Bitmap_t *pBitmap, uint64_t *pWords, size_t words)
+{
+    const Bitmap_Container_t *pContainer = NULL;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    size_t base = 0;
+    size_t len = 0;
+    size_t w = 0;
+    uint16_t low = 0;
+
+    for (; i < pBitmap->count; i++) {
+        pContainer = &pBitmap->pContainers[i];
+        len = container_words(pContainer->key, words, &base);
+        if (0 == len) {
+            break;
+        }
+
+        if (NULL != pContainer->pBits) {
+            for (w = 0; w < len; w++) {
+                pWords[base + w] &= ~pContainer->pBits[w];
+            }
+            continue;
+        }
+
+        for (j = 0; j < pContainer->cardinality; j++) {
+            low = pContainer->pArray[j];
+            if (low / 64 < len) {
+                pWords[base + low / 64] &= ~(1ULL << (low % 64));
+            }
+        }
+    }
+
+    return;
+}
+
+/**
+ * Helper functions
+ */
+
+static uint32_t bitmap_search(const Bitmap_t *pBitmap, uint32_t key, bool *pFound)
+{
+    uint32_t lo = 0;
+    uint32_t hi = pBitmap->count;
+    uint32_t mid = 0;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (pBitmap->pContainers[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    *pFound = (lo < pBitmap->count && pBitmap->pContainers[lo].key == key);
+
+    return lo;
+}
+
+static uint32_t container_search(const Bitmap_Container_t *pContainer, uint16_t low, bool *pFound)
+{
+    uint32_t lo = 0;
+    uint32_t hi = pContainer->cardinality;
+    uint32_t mid = 0;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (pContainer->pArray[mid] < low) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    *pFound = (lo < pContainer->cardinality && pContainer->pArray[lo] == low);
+
+    return lo;
+}
+
+static int container_toBits(Bitmap_Container_t *pContainer)
+{
+    uint64_t *pBits = calloc(BITMAP_CONTAINER_WORDS, sizeof(uint64_t));
+    uint32_t i = 0;
+    uint16_t low = 0;
+
+    if (NULL == pBits) {
+        return STATUS_ERROR;
+    }
+
+    for (; i < pContainer->cardinality; i++) {
+        low = pContainer->pArray[i];
+        pBits[low / 64] |= 1ULL << (low % 64);
+    }
+
+    free(pContainer->pArray);
+    pContainer->pArray = NULL;
+    pContainer->capacity = 0;
+    pContainer->pBits = pBits;
+
+    return STATUS_SUCCESS;
+}
+
+static int container_toArray(Bitmap_Container_t *pContainer)
+{
+    uint16_t *pArray = malloc(BITMAP_ARRAY_MAX * sizeof(uint16_t));
+    uint64_t bits = 0;
+    uint32_t n = 0;
+    uint32_t w = 0;
+
+    if (NULL == pArray) {
+        return STATUS_ERROR;
+    }
+
+    for (; w < BITMAP_CONTAINER_WORDS; w++) {
+        bits = pContainer->pBits[w];
+        while (0 != bits) {
+            pArray[n++] = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+        }
+    }
+
+    free(pContainer->pBits);
+    pContainer->pBits = NULL;
+    pContainer->pArray = pArray;
+    pContainer->capacity = BITMAP_ARRAY_MAX;
+
+    return STATUS_SUCCESS;
+}
+
+static size_t container_words(uint32_t key, size_t words, size_t *pBase)
+{
+    size_t base = (size_t)key * BITMAP_CONTAINER_WORDS;
+
+    *pBase = base;
+    if (base >= words) {
+        return 0;
+    }
+
+    return (words - base < BITMAP_CONTAINER_WORDS) ? words - base : BITMAP_CONTAINER_WORDS;
+}
+
+static size_t container_savedBytes(const Bitmap_Container_t *pContainer)
+{
+    size_t bytes = pContainer->cardinality * sizeof(uint16_t);
+
+    if (NULL != pContainer->pBits) {
+        return BITMAP_CONTAINER_WORDS * sizeof(uint64_t);
+    }
+
+    return (bytes + BITMAP_SAVE_ALIGN - 1) & ~(size_t)(BITMAP_SAVE_ALIGN - 1);
+}
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <string.h>
+#include "budget.h"
+
+/**
+ * @brief  Prepare a memory budget
+ * @param pBudget: [out] Budget
+ * @param limit: [in] Bytes for the reading history and the segment cache, 0 is unlimited
+ */
+void budget_init(Budget_t *pBudget, uint64_t limit)
+{
+    memset(pBudget, 0, sizeof(Budget_t));
+    pBudget->limit = limit;
+
+    return;
+}
+
+/**
+ * @brief  Get the part of the budget given to the segment buffer cache
+ * @param pBudget: [in] Budget
+ * @return cache size in bytes, 0 when unlimited
+ */
+uint64_t budget_cacheBytes(const Budget_t *pBudget)
+{
+    return pBudget->limit / BUDGET_CACHE_SHARE;
+}
+
+/**
+ * @brief  Evict reading history until it fits the budget
+ * @param pBudget: [in] Budget
+ * @param pTable: [in] Sensor table
+ * @return bytes released
+ * @note  O(sensors) to add up the history, plus at most two turns of the
+ *        clock hand when over budget.
+ */
+uint64_t budget_enforce(Budget_t *pBudget, Table_t *pTable)
+{
+    History_Series_t *pSeries = NULL;
+    uint64_t limit = pBudget->limit - budget_cacheBytes(pBudget);
+    uint64_t used = 0;
+    uint64_t freed = 0;
+    uint64_t released = 0;
+    uint32_t visited = 0;
+    uint32_t row = 0;
+
+    if (0 == pBudget->limit || 0 == pTable->count) {
+        return 0;
+    }
+
+    for (; row < pTable->count; row++) {
+        used += history_bytes(&pTable->pHistory[row]);
+    }
+
+    // first turn spares the sensors read since the last one and their rings
+    for (; used > limit && visited < 2 * pTable->count; visited++) {
+        pBudget->hand = (pBudget->hand < pTable->count) ? pBudget->hand : 0;
+        pSeries = &pTable->pHistory[pBudget->hand];
+        pBudget->hand++;
+
+        if (visited >= pTable->count) {
+            freed = history_evict(pSeries, 0);
+        } else if (true == pSeries->referenced) {
+            pSeries->referenced = false;
+            freed = 0;
+        } else {
+            freed = history_evict(pSeries, BUDGET_RING_SAMPLES);
+        }
+        used -= (freed < used) ? freed : used;
+        released += freed;
+    }
+
+    return released;
+}
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <string.h>
+#include <endian.h>
+#include "checksum.h"
+
+#if defined(__x86_64__)
+#define CHECKSUM_X86
+#include <immintrin.h>
+#endif
+
+// reflected Castagnoli polynomial
+#define CHECKSUM_POLY       0x82F63B78U
+
+/* Private function prototypes -----------------------------------------------*/
+// slicing-by-8 table lookup, any CPU
+static uint32_t scalar_crc32c(uint32_t crc, const uint8_t *pData, size_t len);
+#ifdef CHECKSUM_X86
+// crc32 instruction, 8 bytes per step
+static uint32_t sse42_crc32c(uint32_t crc, const uint8_t *pData, size_t len);
+#endif
+
+/* Private variables ---------------------------------------------------------*/
+static uint32_t tables[8][256];
+static uint32_t (*pKernel)(uint32_t crc, const uint8_t *pData, size_t len) = scalar_crc32c;
+
+/**
+ * @brief  Prepare the checksum kernels
+ * @note  Call once at startup, before any thread computes a checksum.
+ */
+void checksum_init(void)
+{
+    uint32_t crc = 0;
+    uint32_t i = 0;
+    int bit = 0;
+    int t = 0;
+
+    for (; i < 256; i++) {
+        crc = i;
+        for (bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CHECKSUM_POLY : 0);
+        }
+        tables[0][i] = crc;
+    }
+    for (i = 0; i < 256; i++) {
+        for (t = 1; t < 8; t++) {
+            tables[t][i] = (tables[t - 1][i] >> 8) ^ tables[0][tables[t - 1][i] & 0xFF];
+        }
+    }
+
+    pKernel = scalar_crc32c;
+#ifdef CHECKSUM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        pKernel = sse42_crc32c;
+    }
+#endif
+
+    return;
+}
+
+/**
+ * @brief  Extend a CRC-32C over a buffer
+ * @param crc: [in] Checksum so far, CHECKSUM_SEED to start
+ * @param pData: [in] Bytes to add
+ * @param len: [in] Number of bytes
+ * @return checksum including pData
+ */
+uint32_t checksum_crc32c(uint32_t crc, const void *pData, size_t len)
+{
+    return pKernel(crc, pData, len);
+}
+
+/**
+ * Helper functions
+ */
+
+static uint32_t scalar_crc32c(uint32_t crc, const uint8_t *pData, size_t len)
+{
+    uint64_t word = 0;
+
+    crc = ~crc;
+
+    for (; len >= 8; len -= 8, pData += 8) {
+        memcpy(&word, pData, sizeof(word));
+        word = le64toh(word) ^ crc;
+        crc = tables[7][word & 0xFF] ^ tables[6][(word >> 8) & 0xFF] ^
+              tables[5][(word >> 16) & 0xFF] ^ tables[4][(word >> 24) & 0xFF] ^
+              tables[3][(word >> 32) & 0xFF] ^ tables[2][(word >> 40) & 0xFF] ^
+              tables[1][(word >> 48) & 0xFF] ^ tables[0][word >> 56];
+    }
+    for (; len > 0; len--, pData++) {
+        crc = (crc >> 8) ^ tables[0][(crc ^ *pData) & 0xFF];
+    }
+
+    return ~crc;
+}
+
+#ifdef CHECKSUM_X86
+__attribute__((target("sse4.2")))
+static uint32_t sse42_crc32c(uint32_t crc, const uint8_t *pData, size_t len)
+{
+    uint64_t word = 0;
+    uint64_t acc = ~crc;
+
+    for (; len >= 8; len -= 8, pData += 8) {
+        memcpy(&word, pData, sizeof(word));
+        acc = _mm_crc32_u64(acc, word);
+    }
+    crc = (uint32_t)acc;
+    for (; len > 0; len--, pData++) {
+        crc = _mm_crc32_u8(crc, *pData);
+    }
+
+    return ~crc;
+}
+#endif
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dict.h"
+#include "table.h"
+
+#define DICT_INITIAL_CODES  64
+#define DICT_INITIAL_POOL   1024
+
+/* Private function prototypes -----------------------------------------------*/
+// slot holding str, or the empty slot where it would go
+static uint32_t dict_slot(const Dict_t *pDict, const char *pStr, uint64_t hash);
+// double the code arrays and rebuild the slots
+static int dict_grow(Dict_t *pDict);
+
+/**
+ * @brief  Prepare an empty dictionary
+ * @param pDict: [out] Dictionary to initialize
+ * @param maxLen: [in] Size of the field the strings come from, including the NUL
+ * @param maxCodes: [in] Strings it holds at most, DICT_MAX_CODES for codes
+ *                  stored in 16 bits, DICT_NO_LIMIT for a set
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int dict_init(Dict_t *pDict, uint32_t maxLen, uint32_t maxCodes)
+{
+    memset(pDict, 0, sizeof(Dict_t));
+
+    pDict->pPool = malloc(DICT_INITIAL_POOL);
+    pDict->pOffsets = malloc(DICT_INITIAL_CODES * sizeof(uint32_t));
+    pDict->pHashes = malloc(DICT_INITIAL_CODES * sizeof(uint64_t));
+    pDict->pSlots = calloc(DICT_INITIAL_CODES * 2, sizeof(uint32_t));
+    if (NULL == pDict->pPool || NULL == pDict->pOffsets || NULL == pDict->pHashes || NULL == pDict->pSlots) {
+        printf("Malloc failed to create dictionary\r\n");
+        dict_free(pDict);
+        return STATUS_ERROR;
+    }
+
+    pDict->poolCap = DICT_INITIAL_POOL;
+    pDict->capacity = DICT_INITIAL_CODES;
+    pDict->slotMask = DICT_INITIAL_CODES * 2 - 1;
+    pDict->maxLen = maxLen;
+    pDict->maxCodes = maxCodes;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Release a dictionary
+ * @param pDict: [in] Dictionary to release
+ */
+void dict_free(Dict_t *pDict)
+{
+    free(pDict->pPool);
+    free(pDict->pOffsets);
+    free(pDict->pHashes);
+    free(pDict->pSlots);
+    memset(pDict, 0, sizeof(Dict_t));
+
+    return;
+}
+
+/**
+ * @brief  Forget every string of a dictionary
+ * @param pDict: [in] Dictionary to empty, it keeps its capacity
+ */
+void dict_clear(Dict_t *pDict)
+{
+    memset(pDict->pSlots, 0, (pDict->slotMask + 1) * sizeof(uint32_t));
+    pDict->count = 0;
+    pDict->poolLen = 0;
+
+    return;
+}
+
+/**
+ * @brief  Get the code of a string, adding it on first use
+ * @param pDict: [in] Dictionary
+ * @param pStr: [in] String, truncated to maxLen - 1 characters
+ * @return code or -1 when the dictionary is full or out of memory
+ */
+int dict_intern(Dict_t *pDict, const char *pStr)
+{
+    char key[256] = {0};
+    uint64_t hash = 0;
+    uint32_t slot = 0;
+    uint32_t len = 0;
+    uint32_t code = 0;
+    char *pPool = NULL;
+
+    strncpy(key, pStr, pDict->maxLen - 1);
+    hash = table_hashId(key);
+    slot = dict_slot(pDict, key, hash);
+    if (0 != pDict->pSlots[slot]) {
+        return pDict->pSlots[slot] - 1;
+    }
+
+    if (pDict->count >= pDict->maxCodes) {
+        printf("Dictionary is full\r\n");
+        return -1;
+    }
+
+    if (pDict->count == pDict->capacity) {
+        if (STATUS_SUCCESS != dict_grow(pDict)) {
+            printf("Realloc failed to expand dictionary\r\n");
+            return -1;
+        }
+        slot = dict_slot(pDict, key, hash);
+    }
+
+    len = strlen(key) + 1;
+    if (pDict->poolLen + len > pDict->poolCap) {
+        pPool = realloc(pDict->pPool, pDict->poolCap * 2 + len);
+        if (NULL == pPool) {
+            printf("Realloc failed to expand dictionary\r\n");
+            return -1;
+        }
+        pDict->pPool = pPool;
+        pDict->poolCap = pDict->poolCap * 2 + len;
+    }
+
+    code = pDict->count++;
+    memcpy(&pDict->pPool[pDict->poolLen], key, len);
+    pDict->pOffsets[code] = pDict->poolLen;
+    pDict->pHashes[code] = hash;
+    pDict->poolLen += len;
+    pDict->pSlots[slot] = code + 1;
+
+    return code;
+}
+
+/**
+ * @brief  Look up the code of a string
+ * @param pDict: [in] Dictionary
+ * @param pStr: [in] String to look up
+ * @return code or -1 if the string was never interned
+ */
+int dict_find(const Dict_t *pDict, const char *pStr)
+{
+    uint32_t slot = dict_slot(pDict, pStr, table_hashId(pStr));
+
+    return (int)pDict->pSlots[slot] - 1;
+}
+
+/**
+ * @brief  Get the string of a code
+ * @param pDict: [in] Dictionary
+ * @param code: [in] Code returned by dict_intern()
+ * @return NUL terminated string owned by the dictionary
+ */
+const char *dict_string(const Dict_t *pDict, uint32_t code)
+{
+    return &pDict->pPool[pDict->pOffsets[code]];
+}
+
+/**
+ * Helper functions
+ */
+
+static uint32_t dict_slot(const Dict_t *pDict, const char *pStr, uint64_t hash)
+{
+    uint32_t slot = hash & pDict->slotMask;
+    uint32_t code = 0;
+
+    while (0 != pDict->pSlots[slot]) {
+        code = pDict->pSlots[slot] - 1;
+        if (pDict->pHashes[code] == hash && 0 == strcmp(dict_string(pDict, code), pStr)) {
+            break;
+        }
+        slot = (slot + 1) & pDict->slotMask;
+    }
+
+    return slot;
+}
+
+static int dict_grow(Dict_t *pDict)
+{
+    uint32_t capacity = pDict->capacity * 2;
+    uint32_t mask = capacity * 2 - 1;
+    uint32_t *pOffsets = NULL;
+    uint64_t *pHashes = NULL;
+    uint32_t *pSlots = NULL;
+    uint32_t slot = 0;
+    uint32_t code = 0;
+
+    pOffsets = realloc(pDict->pOffsets, capacity * sizeof(uint32_t));
+    if (NULL == pOffsets) {
+        return STATUS_ERROR;
+    }
+    pDict->pOffsets = pOffsets;
+
+    pHashes = realloc(pDict->pHashes, capacity * sizeof(uint64_t));
+    if (NULL == pHashes) {
+        return STATUS_ERROR;
+    }
+    pDict->pHashes = pHashes;
+
+    pSlots = calloc(mask + 1, sizeof(uint32_t));
+    if (NULL == pSlots) {
+        return STATUS_ERROR;
+    }
+
+    for (; code < pDict->count; code++) {
+        slot = pHashes[code] & mask;
+        while (0 != pSlots[slot]) {
+            slot = (slot + 1) & mask;
+        }
+        pSlots[slot] = code + 1;
+    }
+
+    free(pDict->pSlots);
+    pDict->pSlots = pSlots;
+    pDict->slotMask = mask;
+    pDict->capacity = capacity;
+
+    return STATUS_SUCCESS;
+}
@@ -49,4 +49,235 @@ int file_openDb(char *pFilename)
     }
 
     return fd;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief  Opens the side file kept next to a database file.
+ * @param  pFilename: [in] Filename of the database file
+ * @param  pSuffix: [in] Appended to pFilename to name the side file
+ * @param  truncate: [in] Discard the previous contents, used with a new database
+ * @return file descriptor on success, -1 otherwise.
+ * @note  The side file is created if it does not exist yet.
+ */
+int file_openSide(const char *pFilename, const char *pSuffix, bool truncate)
+{
+    char path[PATH_MAX] = {0};
+    int fd = -1;
+
+    if ((int)sizeof(path) <= snprintf(path, sizeof(path), "%s%s", pFilename, pSuffix))
+    {
+        printf("Path too long: %s%s\r\n", pFilename, pSuffix);
+        return STATUS_ERROR;
+    }
+
+    fd = open(path, O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+    if (-1 == fd)
+    {
+        perror("open");
+        return STATUS_ERROR;
+    }
+
+    return fd;
+}
+
+/**
+ * @brief  Deletes the side file kept next to a database file.
+ * @param  pFilename: [in] Filename of the database file
+ * @param  pSuffix: [in] Appended to pFilename to name the side file
+ */
+void file_removeSide(const char *pFilename, const char *pSuffix)
+{
+    char path[PATH_MAX] = {0};
+
+    if ((int)sizeof(path) <= snprintf(path, sizeof(path), "%s%s", pFilename, pSuffix))
+    {
+        return;
+    }
+
+    if (-1 == unlink(path) && ENOENT != errno)
+    {
+        perror("unlink");
+    }
+
+    return;
+}
+
+/**
+ * @brief  Opens the side directory kept next to a database file.
+ * @param  pFilename: [in] Filename of the database file
+ * @param  pSuffix: [in] Appended to pFilename to name the directory
+ * @param  clear: [in] Delete the files it holds, used with a new database
+ * @return directory file descriptor on success, -1 otherwise.
+ * @note  The directory is created if it does not exist yet.
+ */
+int file_openSideDir(const char *pFilename, const char *pSuffix, bool clear)
+{
+    char path[PATH_MAX] = {0};
+    struct dirent *pEntry = NULL;
+    DIR *pDir = NULL;
+    int fd = -1;
+
+    if ((int)sizeof(path) <= snprintf(path, sizeof(path), "%s%s", pFilename, pSuffix))
+    {
+        printf("Path too long: %s%s\r\n", pFilename, pSuffix);
+        return STATUS_ERROR;
+    }
+
+    if (-1 == mkdir(path, 0755) && EEXIST != errno)
+    {
+        perror("mkdir");
+        return STATUS_ERROR;
+    }
+
+    fd = open(path, O_RDONLY | O_DIRECTORY);
+    if (-1 == fd)
+    {
+        perror("open");
+        return STATUS_ERROR;
+    }
+
+    if (true == clear)
+    {
+        pDir = fdopendir(dup(fd));
+        if (NULL == pDir)
+        {
+            perror("fdopendir");
+            close(fd);
+            return STATUS_ERROR;
+        }
+
+        while (NULL != (pEntry = readdir(pDir)))
+        {
+            if ('.' != pEntry->d_name[0])
+            {
+                unlinkat(fd, pEntry->d_name, 0);
+            }
+        }
+        closedir(pDir);
+    }
+
+    return fd;
+}
+
+/**
+ * @brief  Opens the temporary file of the next version of a database or side file.
+ * @param  pFilename: [in] Filename of the database file
+ * @param  pSuffix: [in] Appended to pFilename to name the file, "" for the database
+ * @param  create: [in] Create the file empty for writing, otherwise open an existing one read only
+ * @return file descriptor on success, -1 otherwise.
+ * @note  A missing file is not an error when it is only opened.
+ */
+int file_openTemp(const char *pFilename, const char *pSuffix, bool create)
+{
+    char path[PATH_MAX] = {0};
+    int fd = -1;
+
+    if ((int)sizeof(path) <= snprintf(path, sizeof(path), "%s%s%s", pFilename, pSuffix, FILE_TMP_SUFFIX))
+    {
+        printf("Path too long: %s%s%s\r\n", pFilename, pSuffix, FILE_TMP_SUFFIX);
+        return STATUS_ERROR;
+    }
+
+    fd = open(path, create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDONLY, 0644);
+    if (-1 == fd && (true == create || ENOENT != errno))
+    {
+        perror("open");
+    }
+
+    return fd;
+}
+
+/**
+ * @brief  Replaces a database or side file by its temporary file.
+ * @param  pFilename: [in] Filename of the database file
+ * @param  pSuffix: [in] Appended to pFilename to name the file, "" for the database
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  The temporary file must already be synced, and the rename only
+ *        survives a crash once file_syncDir() returns.
+ */
+int file_commitTemp(const char *pFilename, const char *pSuffix)
+{
+    char path[PATH_MAX] = {0};
+    char tmpPath[PATH_MAX] = {0};
+
+    if ((int)sizeof(path) <= snprintf(path, sizeof(path), "%s%s", pFilename, pSuffix) ||
+        (int)sizeof(tmpPath) <= snprintf(tmpPath, sizeof(tmpPath), "%s%s", path, FILE_TMP_SUFFIX))
+    {
+        printf("Path too long: %s%s%s\r\n", pFilename, pSuffix, FILE_TMP_SUFFIX);
+        return STATUS_ERROR;
+    }
+
+    if (-1 == rename(tmpPath, path))
+    {
+        perror("rename");
+        return STATUS_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Deletes the temporary file of a database or side file.
+ * @param  pFilename: [in] Filename of the database file
+ * @param  pSuffix: [in] Appended to pFilename to name the file, "" for the database
+ */
+void file_removeTemp(const char *pFilename, const char *pSuffix)
+{
+    char path[PATH_MAX] = {0};
+
+    if ((int)sizeof(path) <= snprintf(path, sizeof(path), "%s%s%s", pFilename, pSuffix, FILE_TMP_SUFFIX))
+    {
+        return;
+    }
+
+    if (-1 == unlink(path) && ENOENT != errno)
+    {
+        perror("unlink");
+    }
+
+    return;
+}
+
+/**
+ * @brief  Syncs the directory holding a database file.
+ * @param  pFilename: [in] Filename of the database file
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int file_syncDir(const char *pFilename)
+{
+    char path[PATH_MAX] = {0};
+    char *pSlash = NULL;
+    int fd = -1;
+    int status = STATUS_SUCCESS;
+
+    if ((int)sizeof(path) <= snprintf(path, sizeof(path), "%s", pFilename))
+    {
+        return STATUS_ERROR;
+    }
+
+    pSlash = strrchr(path, '/');
+    if (NULL == pSlash)
+    {
+        strcpy(path, ".");
+    }
+    else
+    {
+        pSlash[(pSlash == path) ? 1 : 0] = '\0';
+    }
+
+    fd = open(path, O_RDONLY | O_DIRECTORY);
+    if (-1 == fd)
+    {
+        perror("open");
+        return STATUS_ERROR;
+    }
+
+    if (0 != fsync(fd))
+    {
+        perror("fsync");
+        status = STATUS_ERROR;
+    }
+    close(fd);
+
+    return status;
+}
@@ -0,0 +1,436 @@
+#include <stdio.h>
+#include <string.h>
+#include "filter.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FILTER_X86
+#include <immintrin.h>
+#endif
+
+/* Private function prototypes -----------------------------------------------*/
+// drop candidates that fail the reading predicate of the query
+static uint32_t filter_refine(const Table_t *pTable, const DbProtocol_QueryReq_t *pQuery, uint64_t *pBitmap, size_t words);
+// portable kernels, also used for the tail of the vector kernels
+static void scalar_outside(const float *pValue, const float *pMin, const float *pMax, uint32_t count, uint64_t *pBitmap);
+static void scalar_inside(const float *pValue, float lo, float hi, uint32_t count, uint64_t *pBitmap);
+static void scalar_flags(const uint8_t *pFlags, uint8_t mask, uint8_t value, uint32_t count, uint64_t *pBitmap);
+static void scalar_outsideFrom(const float *pValue, const float *pMin, const float *pMax, uint32_t start, uint32_t count, uint64_t *pBitmap);
+static void scalar_insideFrom(const float *pValue, float lo, float hi, uint32_t start, uint32_t count, uint64_t *pBitmap);
+static void scalar_flagsFrom(const uint8_t *pFlags, uint8_t mask, uint8_t value, uint32_t start, uint32_t count, uint64_t *pBitmap);
+#ifdef FILTER_X86
+static void sse2_outside(const float *pValue, const float *pMin, const float *pMax, uint32_t count, uint64_t *pBitmap);
+static void sse2_inside(const float *pValue, float lo, float hi, uint32_t count, uint64_t *pBitmap);
+static void sse2_flags(const uint8_t *pFlags, uint8_t mask, uint8_t value, uint32_t count, uint64_t *pBitmap);
+static void avx2_outside(const float *pValue, const float *pMin, const float *pMax, uint32_t count, uint64_t *pBitmap);
+static void avx2_inside(const float *pValue, float lo, float hi, uint32_t count, uint64_t *pBitmap);
+static void avx2_flags(const uint8_t *pFlags, uint8_t mask, uint8_t value, uint32_t count, uint64_t *pBitmap);
+#endif
+
+/* Private variables ---------------------------------------------------------*/
+static const Filter_Kernels_t scalarKernels = {
+    "scalar", scalar_outside, scalar_inside, scalar_flags
+};
+#ifdef FILTER_X86
+static const Filter_Kernels_t sse2Kernels = {
+    "sse2", sse2_outside, sse2_inside, sse2_flags
+};
+static const Filter_Kernels_t avx2Kernels = {
+    "avx2", avx2_outside, avx2_inside, avx2_flags
+};
+#endif
+static const Filter_Kernels_t *pKernels = &scalarKernels;
+
+/**
+ * @brief  Select the filter kernels for this CPU
+ * @note  Call once at startup, before the first query.
+ */
+void filter_init(void)
+{
+    pKernels = &scalarKernels;
+
+#ifdef FILTER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        pKernels = &avx2Kernels;
+    } else if (__builtin_cpu_supports("sse2")) {
+        pKernels = &sse2Kernels;
+    }
+#endif
+
+    printf("Filter kernels: %s\r\n", pKernels->pName);
+
+    return;
+}
+
+/**
+ * @brief  Get the kernels selected by filter_init()
+ * @return kernel table
+ */
+const Filter_Kernels_t *filter_kernels(void)
+{
+    return pKernels;
+}
+
+/**
+ * @brief  Size of a selection bitmap
+ * @param count: [in] Number of rows
+ * @return number of 64-bit words
+ */
+size_t filter_bitmapWords(uint32_t count)
+{
+    return ((size_t)count + FILTER_WORD_BITS - 1) / FILTER_WORD_BITS;
+}
+
+/**
+ * @brief  Select rows by type, location and flag bits using the bitmap indexes
+ * @param pTable: [in] Sensor table
+ * @param pType: [in] sensorType to match, NULL or empty for any
+ * @param pLocation: [in] location to match, NULL or empty for any
+ * @param flagsMask: [in] Flag bits to test
+ * @param flagsValue: [in] Required value of the tested bits
+ * @param pBitmap: [out] Selection bitmap of filter_bitmapWords(count) words
+ * @return number of matching rows
+ * @note  No column is read: the smallest index bitmap is copied out and the
+ *        others are intersected into it, so the cost follows the size of the
+ *        indexes rather than the table.
+ */
+uint32_t filter_match(const Table_t *pTable, const char *pType, const char *pLocation,
+                      uint8_t flagsMask, uint8_t flagsValue, uint64_t *pBitmap)
+{
+    const Bitmap_t *pSets[2 + TABLE_FLAG_BITS];
+    const Bitmap_t *pSwap = NULL;
+    size_t words = filter_bitmapWords(pTable->count);
+    uint32_t matches = 0;
+    uint32_t n = 0;
+    uint32_t i = 0;
+    uint8_t bits = 0;
+    int code = -1;
+
+    memset(pBitmap, 0, words * sizeof(uint64_t));
+
+    // bits asked to be set outside the mask can never match
+    if (0 != (flagsValue & ~flagsMask)) {
+        return 0;
+    }
+
+    if (NULL != pType && '\0' != pType[0]) {
+        code = dict_find(&pTable->types, pType);
+        if (-1 == code || (uint32_t)code >= pTable->typeIndex.count) {
+            return 0;
+        }
+        pSets[n++] = &pTable->typeIndex.pRows[code];
+    }
+
+    if (NULL != pLocation && '\0' != pLocation[0]) {
+        code = dict_find(&pTable->locations, pLocation);
+        if (-1 == code || (uint32_t)code >= pTable->locationIndex.count) {
+            return 0;
+        }
+        pSets[n++] = &pTable->locationIndex.pRows[code];
+    }
+
+    for (bits = flagsMask & flagsValue; 0 != bits; bits &= bits - 1) {
+        pSets[n++] = &pTable->flagIndex[__builtin_ctz(bits)];
+    }
+
+    if (0 == n) {
+        // nothing to intersect with, start from every row
+        memset(pBitmap, 0xFF, words * sizeof(uint64_t));
+        if (0 != pTable->count % FILTER_WORD_BITS) {
+            pBitmap[words - 1] = (1ULL << (pTable->count % FILTER_WORD_BITS)) - 1;
+        }
+    } else {
+        // smallest set first, every AND after it can only shrink the result
+        for (i = 1; i < n; i++) {
+            if (pSets[i]->cardinality < pSets[0]->cardinality) {
+                pSwap = pSets[0];
+                pSets[0] = pSets[i];
+                pSets[i] = pSwap;
+            }
+        }
+
+        bitmap_copyTo(pSets[0], pBitmap, words);
+        for (i = 1; i < n; i++) {
+            bitmap_andInto(pSets[i], pBitmap, words);
+        }
+    }
+
+    for (bits = flagsMask & ~flagsValue; 0 != bits; bits &= bits - 1) {
+        bitmap_andNotInto(&pTable->flagIndex[__builtin_ctz(bits)], pBitmap, words);
+    }
+
+    for (i = 0; i < words; i++) {
+        matches += __builtin_popcountll(pBitmap[i]);
+    }
+
+    return matches;
+}
+
+/**
+ * @brief  Evaluate a query over the table
+ * @param pTable: [in] Sensor table
+ * @param pQuery: [in] Query in host byte order, strings NUL terminated
+ * @param pBitmap: [out] Selection bitmap of filter_bitmapWords(count) words
+ * @return number of matching rows
+ * @note  With a type or location predicate (or QUERY_MATCH) the candidates
+ *        come from the bitmap indexes and only those rows are read. Otherwise
+ *        the column kernels scan the whole table.
+ */
+uint32_t filter_select(const Table_t *pTable, const DbProtocol_QueryReq_t *pQuery, uint64_t *pBitmap)
+{
+    size_t words = filter_bitmapWords(pTable->count);
+    uint32_t matches = 0;
+    size_t i = 0;
+
+    if (QUERY_MATCH == pQuery->mode || '\0' != pQuery->sensorType[0] || '\0' != pQuery->location[0]) {
+        matches = filter_match(pTable, pQuery->sensorType, pQuery->location,
+                               pQuery->flagsMask, pQuery->flagsValue, pBitmap);
+        if (QUERY_MATCH == pQuery->mode) {
+            return matches;
+        }
+        return filter_refine(pTable, pQuery, pBitmap, words);
+    }
+
+    if (QUERY_RANGE == pQuery->mode) {
+        pKernels->pInside(pTable->pReading, pQuery->lo, pQuery->hi, pTable->count, pBitmap);
+    } else {
+        pKernels->pOutside(pTable->pReading, pTable->pMinThreshold, pTable->pMaxThreshold, pTable->count, pBitmap);
+    }
+
+    if (0 != pQuery->flagsMask) {
+        pKernels->pFlags(pTable->pFlags, pQuery->flagsMask, pQuery->flagsValue, pTable->count, pBitmap);
+    }
+
+    for (; i < words; i++) {
+        matches += __builtin_popcountll(pBitmap[i]);
+    }
+
+    return matches;
+}
+
+/**
+ * Helper functions
+ */
+
+static uint32_t filter_refine(const Table_t *pTable, const DbProtocol_QueryReq_t *pQuery, uint64_t *pBitmap, size_t words)
+{
+    uint32_t matches = 0;
+    uint64_t bits = 0;
+    uint64_t keep = 0;
+    uint32_t row = 0;
+    float value = 0.0f;
+    size_t w = 0;
+
+    for (; w < words; w++) {
+        bits = pBitmap[w];
+        keep = 0;
+        while (0 != bits) {
+            row = w * FILTER_WORD_BITS + __builtin_ctzll(bits);
+            value = pTable->pReading[row];
+            if (QUERY_RANGE == pQuery->mode) {
+                keep |= (uint64_t)((value >= pQuery->lo) & (value <= pQuery->hi)) << (row % FILTER_WORD_BITS);
+            } else {
+                keep |= (uint64_t)((value < pTable->pMinThreshold[row]) | (value > pTable->pMaxThreshold[row]))
+                        << (row % FILTER_WORD_BITS);
+            }
+            bits &= bits - 1;
+        }
+        pBitmap[w] = keep;
+        matches += __builtin_popcountll(keep);
+    }
+
+    return matches;
+}
+
+static void scalar_outside(const float *pValue, const float *pMin, const float *pMax, uint32_t count, uint64_t *pBitmap)
+{
+    memset(pBitmap, 0, filter_bitmapWords(count) * sizeof(uint64_t));
+    scalar_outsideFrom(pValue, pMin, pMax, 0, count, pBitmap);
+
+    return;
+}
+
+static void scalar_inside(const float *pValue, float lo, float hi, uint32_t count, uint64_t *pBitmap)
+{
+    memset(pBitmap, 0, filter_bitmapWords(count) * sizeof(uint64_t));
+    scalar_insideFrom(pValue, lo, hi, 0, count, pBitmap);
+
+    return;
+}
+
+static void scalar_flags(const uint8_t *pFlags, uint8_t mask, uint8_t value, uint32_t count, uint64_t *pBitmap)
+{
+    scalar_flagsFrom(pFlags, mask, value, 0, count, pBitmap);
+
+    return;
+}
+
+static void scalar_outsideFrom(const float *pValue, const float *pMin, const float *pMax, uint32_t start, uint32_t count, uint64_t *pBitmap)
+{
+    uint32_t i = start;
+    uint64_t hit = 0;
+
+    for (; i < count; i++) {
+        hit = (pValue[i] < pMin[i]) | (pValue[i] > pMax[i]);
+        pBitmap[i / FILTER_WORD_BITS] |= hit << (i % FILTER_WORD_BITS);
+    }
+
+    return;
+}
+
+static void scalar_insideFrom(const float *pValue, float lo, float hi, uint32_t start, uint32_t count, uint64_t *pBitmap)
+{
+    uint32_t i = start;
+    uint64_t hit = 0;
+
+    for (; i < count; i++) {
+        hit = (pValue[i] >= lo) & (pValue[i] <= hi);
+        pBitmap[i / FILTER_WORD_BITS] |= hit << (i % FILTER_WORD_BITS);
+    }
+
+    return;
+}
+
+static void scalar_flagsFrom(const uint8_t *pFlags, uint8_t mask, uint8_t value, uint32_t start, uint32_t count, uint64_t *pBitmap)
+{
+    uint32_t i = start;
+    uint64_t miss = 0;
+
+    for (; i < count; i++) {
+        miss = ((pFlags[i] & mask) != value);
+        pBitmap[i / FILTER_WORD_BITS] &= ~(miss << (i % FILTER_WORD_BITS));
+    }
+
+    return;
+}
+
+#ifdef FILTER_X86
+
+static void sse2_outside(const float *pValue, const float *pMin, const float *pMax, uint32_t count, uint64_t *pBitmap)
+{
+    uint32_t bulk = count & ~3U;
+    uint32_t i = 0;
+    __m128 v, lt, gt;
+
+    memset(pBitmap, 0, filter_bitmapWords(count) * sizeof(uint64_t));
+
+    for (; i < bulk; i += 4) {
+        v = _mm_loadu_ps(&pValue[i]);
+        lt = _mm_cmplt_ps(v, _mm_loadu_ps(&pMin[i]));
+        gt = _mm_cmpgt_ps(v, _mm_loadu_ps(&pMax[i]));
+        pBitmap[i / FILTER_WORD_BITS] |= (uint64_t)_mm_movemask_ps(_mm_or_ps(lt, gt)) << (i % FILTER_WORD_BITS);
+    }
+
+    scalar_outsideFrom(pValue, pMin, pMax, bulk, count, pBitmap);
+
+    return;
+}
+
+static void sse2_inside(const float *pValue, float lo, float hi, uint32_t count, uint64_t *pBitmap)
+{
+    uint32_t bulk = count & ~3U;
+    uint32_t i = 0;
+    __m128 vlo = _mm_set1_ps(lo);
+    __m128 vhi = _mm_set1_ps(hi);
+    __m128 v, ge, le;
+
+    memset(pBitmap, 0, filter_bitmapWords(count) * sizeof(uint64_t));
+
+    for (; i < bulk; i += 4) {
+        v = _mm_loadu_ps(&pValue[i]);
+        ge = _mm_cmpge_ps(v, vlo);
+        le = _mm_cmple_ps(v, vhi);
+        pBitmap[i / FILTER_WORD_BITS] |= (uint64_t)_mm_movemask_ps(_mm_and_ps(ge, le)) << (i % FILTER_WORD_BITS);
+    }
+
+    scalar_insideFrom(pValue, lo, hi, bulk, count, pBitmap);
+
+    return;
+}
+
+static void sse2_flags(const uint8_t *pFlags, uint8_t mask, uint8_t value, uint32_t count, uint64_t *pBitmap)
+{
+    uint32_t bulk = count & ~15U;
+    uint32_t i = 0;
+    uint64_t miss = 0;
+    __m128i vmask = _mm_set1_epi8((char)mask);
+    __m128i vvalue = _mm_set1_epi8((char)value);
+    __m128i eq;
+
+    for (; i < bulk; i += 16) {
+        eq = _mm_cmpeq_epi8(_mm_and_si128(_mm_loadu_si128((const __m128i *)&pFlags[i]), vmask), vvalue);
+        miss = ~(uint64_t)_mm_movemask_epi8(eq) & 0xFFFFULL;
+        pBitmap[i / FILTER_WORD_BITS] &= ~(miss << (i % FILTER_WORD_BITS));
+    }
+
+    scalar_flagsFrom(pFlags, mask, value, bulk, count, pBitmap);
+
+    return;
+}
+
+__attribute__((target("avx2")))
+static void avx2_outside(const float *pValue, const float *pMin, const float *pMax, uint32_t count, uint64_t *pBitmap)
+{
+    uint32_t bulk = count & ~7U;
+    uint32_t i = 0;
+    __m256 v, lt, gt;
+
+    memset(pBitmap, 0, filter_bitmapWords(count) * sizeof(uint64_t));
+
+    for (; i < bulk; i += 8) {
+        v = _mm256_loadu_ps(&pValue[i]);
+        lt = _mm256_cmp_ps(v, _mm256_loadu_ps(&pMin[i]), _CMP_LT_OQ);
+        gt = _mm256_cmp_ps(v, _mm256_loadu_ps(&pMax[i]), _CMP_GT_OQ);
+        pBitmap[i / FILTER_WORD_BITS] |= (uint64_t)_mm256_movemask_ps(_mm256_or_ps(lt, gt)) << (i % FILTER_WORD_BITS);
+    }
+
+    scalar_outsideFrom(pValue, pMin, pMax, bulk, count, pBitmap);
+
+    return;
+}
+
+__attribute__((target("avx2")))
+static void avx2_inside(const float *pValue, float lo, float hi, uint32_t count, uint64_t *pBitmap)
+{
+    uint32_t bulk = count & ~7U;
+    uint32_t i = 0;
+    __m256 vlo = _mm256_set1_ps(lo);
+    __m256 vhi = _mm256_set1_ps(hi);
+    __m256 v, ge, le;
+
+    memset(pBitmap, 0, filter_bitmapWords(count) * sizeof(uint64_t));
+
+    for (; i < bulk; i += 8) {
+        v = _mm256_loadu_ps(&pValue[i]);
+        ge = _mm256_cmp_ps(v, vlo, _CMP_GE_OQ);
+        le = _mm256_cmp_ps(v, vhi, _CMP_LE_OQ);
+        pBitmap[i / FILTER_WORD_BITS] |= (uint64_t)_mm256_movemask_ps(_mm256_and_ps(ge, le)) << (i % FILTER_WORD_BITS);
+    }
+
+    scalar_insideFrom(pValue, lo, hi, bulk, count, pBitmap);
+
+    return;
+}
+
+__attribute__((target("avx2")))
+static void avx2_flags(const uint8_t *pFlags, uint8_t mask, uint8_t value, uint32_t count, uint64_t *pBitmap)
+{
+    uint32_t bulk = count & ~31U;
+    uint32_t i = 0;
+    uint64_t miss = 0;
+    __m256i vmask = _mm256_set1_epi8((char)mask);
+    __m256i vvalue = _mm256_set1_epi8((char)value);
+    __m256i eq;
+
+    for (; i < bulk; i += 32) {
+        eq = _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_loadu_si256((const __m256i *)&pFlags[i]), vmask), vvalue);
+        miss = ~(uint64_t)(uint32_t)_mm256_movemask_epi8(eq) & 0xFFFFFFFFULL;
+        pBitmap[i / FILTER_WORD_BITS] &= ~(miss << (i % FILTER_WORD_BITS));
+    }
+
+    scalar_flagsFrom(pFlags, mask, value, bulk, count, pBitmap);
+
+    return;
+}
+
+#endif /* FILTER_X86 */
@@ -0,0 +1,401 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "history.h"
+
+#define HISTORY_INITIAL_SAMPLES 16
+
+/* Private function prototypes -----------------------------------------------*/
+// first sample whose timestamp is not below timestamp
+static uint32_t history_lowerBound(const History_Series_t *pSeries, uint32_t timestamp);
+// queue a reading for its segment, STATUS_ERROR on allocation failure
+static int history_queueLate(History_Series_t *pSeries, uint32_t timestamp, float value);
+// qsort order of samples by timestamp
+static int history_compareSamples(const void *pA, const void *pB);
+
+/**
+ * @brief  Release the samples of a series
+ * @param pSeries: [in] Series to release, left empty
+ */
+void history_free(History_Series_t *pSeries)
+{
+    free(pSeries->pSamples);
+    free(pSeries->pLate);
+    memset(pSeries, 0, sizeof(History_Series_t));
+
+    return;
+}
+
+/**
+ * @brief  Mark samples of a series as stored
+ * @param pSeries: [in] Series written out or just loaded
+ * @param saved: [in] Number of leading samples now in the segment files
+ */
+void history_markSaved(History_Series_t *pSeries, uint32_t saved)
+{
+    pSeries->saved = saved;
+    pSeries->lateCount = 0;
+
+    return;
+}
+
+/**
+ * @brief  Sort samples by timestamp
+ * @param pSamples: [in] Samples to sort in place
+ * @param count: [in] Number of samples
+ */
+void history_sort(History_Sample_t *pSamples, uint32_t count)
+{
+    if (count > 1) {
+        qsort(pSamples, count, sizeof(History_Sample_t), history_compareSamples);
+    }
+
+    return;
+}
+
+/**
+ * @brief  Insert a reading into a series
+ * @param pSeries: [in] Series to update
+ * @param timestamp: [in] Reading timestamp
+ * @param value: [in] Reading value
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  In-order readings are appended. An older timestamp is inserted in
+ *        place, and if it lands among samples already saved it is also
+ *        queued as a late reading instead of joining the unsaved tail.
+ *        Readings older than the evicted samples are only queued.
+ */
+int history_add(History_Series_t *pSeries, uint32_t timestamp, float value)
+{
+    History_Sample_t *pSamples = NULL;
+    uint32_t capacity = 0;
+    uint32_t pos = pSeries->count;
+
+    if (timestamp < pSeries->warmFrom) {
+        return history_queueLate(pSeries, timestamp, value);
+    }
+
+    if (pSeries->count == pSeries->capacity) {
+        capacity = (0 == pSeries->capacity) ? HISTORY_INITIAL_SAMPLES : pSeries->capacity * 2;
+        pSamples = realloc(pSeries->pSamples, capacity * sizeof(History_Sample_t));
+        if (NULL == pSamples) {
+            printf("Realloc failed to expand reading history\r\n");
+            return STATUS_ERROR;
+        }
+        pSeries->pSamples = pSamples;
+        pSeries->capacity = capacity;
+    }
+
+    if (0 != pSeries->count && pSeries->pSamples[pSeries->count - 1].timestamp > timestamp) {
+        // equal timestamps keep arrival order
+        pos = history_lowerBound(pSeries, timestamp + 1);
+        if (pos < pSeries->saved) {
+            if (STATUS_SUCCESS != history_queueLate(pSeries, timestamp, value)) {
+                return STATUS_ERROR;
+            }
+            pSeries->saved++;
+        }
+        memmove(&pSeries->pSamples[pos + 1], &pSeries->pSamples[pos], (pSeries->count - pos) * sizeof(History_Sample_t));
+    }
+
+    pSeries->pSamples[pos].timestamp = timestamp;
+    pSeries->pSamples[pos].value = value;
+    pSeries->count++;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Locate the samples of a time range
+ * @param pSeries: [in] Series
+ * @param fromTs: [in] First timestamp, inclusive
+ * @param toTs: [in] Last timestamp, inclusive
+ * @param pFirst: [out] Index of the first sample in range
+ * @return number of samples in range
+ */
+uint32_t history_range(const History_Series_t *pSeries, uint32_t fromTs, uint32_t toTs, uint32_t *pFirst)
+{
+    uint32_t last = 0;
+
+    *pFirst = history_lowerBound(pSeries, fromTs);
+    if (toTs < fromTs) {
+        return 0;
+    }
+
+    last = (UINT32_MAX == toTs) ? pSeries->count : history_lowerBound(pSeries, toTs + 1);
+
+    return last - *pFirst;
+}
+
+/**
+ * @brief  Evict the oldest saved samples of a series
+ * @param pSeries: [in] Series
+ * @param keep: [in] Number of newest samples to keep in memory
+ * @return heap bytes released
+ * @note  Samples sharing a timestamp are evicted together, so warmFrom
+ *        splits the series cleanly between segments and memory. Unsaved
+ *        samples are never evicted. The array shrinks to what is left.
+ */
+uint64_t history_evict(History_Series_t *pSeries, uint32_t keep)
+{
+    History_Sample_t *pSamples = NULL;
+    uint64_t before = history_bytes(pSeries);
+    uint32_t capacity = 0;
+    uint32_t n = (pSeries->count > keep) ? pSeries->count - keep : 0;
+
+    n = (n < pSeries->saved) ? n : pSeries->saved;
+    while (n > 0 && n < pSeries->count && pSeries->pSamples[n - 1].timestamp == pSeries->pSamples[n].timestamp) {
+        n--;
+    }
+    if (0 == n) {
+        return 0;
+    }
+
+    pSeries->warmFrom = pSeries->pSamples[n - 1].timestamp + 1;
+    memmove(pSeries->pSamples, &pSeries->pSamples[n], (pSeries->count - n) * sizeof(History_Sample_t));
+    pSeries->count -= n;
+    pSeries->saved -= n;
+
+    capacity = (pSeries->count > HISTORY_INITIAL_SAMPLES) ? pSeries->count : HISTORY_INITIAL_SAMPLES;
+    if (capacity < pSeries->capacity) {
+        pSamples = realloc(pSeries->pSamples, capacity * sizeof(History_Sample_t));
+        if (NULL != pSamples) {
+            pSeries->pSamples = pSamples;
+            pSeries->capacity = capacity;
+        }
+    }
+
+    return before - history_bytes(pSeries);
+}
+
+/**
+ * @brief  Get the heap bytes held by a series
+ * @param pSeries: [in] Series
+ * @return bytes of sample storage
+ */
+uint64_t history_bytes(const History_Series_t *pSeries)
+{
+    return ((uint64_t)pSeries->capacity + pSeries->lateCapacity) * sizeof(History_Sample_t);
+}
+
+/**
+ * @brief  Drop the samples older than a cutoff
+ * @param pSeries: [in] Series to trim
+ * @param cutoff: [in] Samples with a smaller timestamp are dropped
+ * @return number of samples dropped
+ * @note  The saved position moves down with the samples, late readings
+ *        past the cutoff are forgotten instead of being written.
+ */
+uint32_t history_expire(History_Series_t *pSeries, uint32_t cutoff)
+{
+    uint32_t n = history_lowerBound(pSeries, cutoff);
+    uint32_t kept = 0;
+    uint32_t i = 0;
+
+    if (0 == n) {
+        return 0;
+    }
+
+    for (; i < pSeries->lateCount; i++) {
+        if (pSeries->pLate[i].timestamp >= cutoff) {
+            pSeries->pLate[kept++] = pSeries->pLate[i];
+        }
+    }
+    pSeries->lateCount = kept;
+
+    memmove(pSeries->pSamples, &pSeries->pSamples[n], (pSeries->count - n) * sizeof(History_Sample_t));
+    pSeries->count -= n;
+    pSeries->saved = (pSeries->saved > n) ? pSeries->saved - n : 0;
+
+    return n;
+}
+
+/**
+ * @brief  Downsample with Largest-Triangle-Three-Buckets
+ * @param pIn: [in] Samples sorted by timestamp
+ * @param count: [in] Number of samples
+ * @param points: [in] Maximum number of samples to keep
+ * @param pOut: [out] Room for points samples
+ * @return number of samples written to pOut
+ * @note  The first and last samples are always kept. The rest is cut into
+ *        points - 2 buckets and each bucket keeps the sample forming the
+ *        largest triangle with the previous pick and the average of the
+ *        next bucket. A single forward walk over the range: each sample is
+ *        read once for its bucket's average and once as a candidate.
+ */
+uint32_t history_lttb(const History_Sample_t *pIn, uint32_t count, uint32_t points, History_Sample_t *pOut)
+{
+    double every = 0.0;
+    double avgTs = 0.0;
+    double avgValue = 0.0;
+    double area = 0.0;
+    double best = 0.0;
+    double prevTs = 0.0;
+    double prevValue = 0.0;
+    uint32_t start = 0;
+    uint32_t end = 0;
+    uint32_t nextEnd = 0;
+    uint32_t pick = 0;
+    uint32_t bucket = 0;
+    uint32_t i = 0;
+    uint32_t n = 0;
+
+    if (count <= points || points < 3) {
+        n = (count < points) ? count : points;
+        memcpy(pOut, pIn, n * sizeof(History_Sample_t));
+        return n;
+    }
+
+    every = (double)(count - 2) / (points - 2);
+    pOut[n++] = pIn[0];
+    prevTs = pIn[0].timestamp;
+    prevValue = pIn[0].value;
+
+    for (; bucket < points - 2; bucket++) {
+        start = (uint32_t)(bucket * every) + 1;
+        end = (uint32_t)((bucket + 1) * every) + 1;
+        nextEnd = (uint32_t)((bucket + 2) * every) + 1;
+        if (nextEnd > count - 1) {
+            nextEnd = count - 1;
+        }
+
+        // average of the next bucket, the last sample for the final bucket
+        avgTs = 0.0;
+        avgValue = 0.0;
+        if (end >= nextEnd) {
+            avgTs = pIn[count - 1].timestamp;
+            avgValue = pIn[count - 1].value;
+        } else {
+            for (i = end; i < nextEnd; i++) {
+                avgTs += pIn[i].timestamp;
+                avgValue += pIn[i].value;
+            }
+            avgTs /= nextEnd - end;
+            avgValue /= nextEnd - end;
+        }
+
+        best = -1.0;
+        pick = start;
+        for (i = start; i < end; i++) {
+            area = (prevTs - avgTs) * (pIn[i].value - prevValue) - (prevTs - pIn[i].timestamp) * (avgValue - prevValue);
+            area = (area < 0.0) ? -area : area;
+            if (area > best) {
+                best = area;
+                pick = i;
+            }
+        }
+
+        pOut[n++] = pIn[pick];
+        prevTs = pIn[pick].timestamp;
+        prevValue = pIn[pick].value;
+    }
+
+    pOut[n++] = pIn[count - 1];
+
+    return n;
+}
+
+/**
+ * @brief  Downsample by keeping the extremes of each time bucket
+ * @param pIn: [in] Samples sorted by timestamp
+ * @param count: [in] Number of samples
+ * @param points: [in] Maximum number of samples to keep
+ * @param pOut: [out] Room for points samples
+ * @return number of samples written to pOut
+ * @note  The time span is cut into points / 2 equal buckets. Each bucket
+ *        emits its minimum and maximum in timestamp order, so spikes are
+ *        never dropped. One pass over the samples.
+ */
+uint32_t history_minMax(const History_Sample_t *pIn, uint32_t count, uint32_t points, History_Sample_t *pOut)
+{
+    uint64_t span = 0;
+    uint64_t width = 0;
+    uint64_t bucket = 0;
+    uint64_t current = 0;
+    uint32_t lo = 0;
+    uint32_t hi = 0;
+    uint32_t i = 0;
+    uint32_t n = 0;
+
+    if (count <= points || points < 2) {
+        n = (count < points) ? count : points;
+        memcpy(pOut, pIn, n * sizeof(History_Sample_t));
+        return n;
+    }
+
+    span = (uint64_t)pIn[count - 1].timestamp - pIn[0].timestamp + 1;
+    width = (span + points / 2 - 1) / (points / 2);
+
+    for (i = 0; i <= count; i++) {
+        bucket = (i < count) ? (pIn[i].timestamp - pIn[0].timestamp) / width : UINT64_MAX;
+        if (0 != i && bucket == current) {
+            lo = (pIn[i].value < pIn[lo].value) ? i : lo;
+            hi = (pIn[i].value > pIn[hi].value) ? i : hi;
+            continue;
+        }
+
+        if (0 != i) {
+            pOut[n++] = pIn[(lo < hi) ? lo : hi];
+            if (lo != hi) {
+                pOut[n++] = pIn[(lo < hi) ? hi : lo];
+            }
+        }
+        current = bucket;
+        lo = i;
+        hi = i;
+    }
+
+    return n;
+}
+
+/**
+ * Helper functions
+ */
+
+static uint32_t history_lowerBound(const History_Series_t *pSeries, uint32_t timestamp)
+{
+    uint32_t lo = 0;
+    uint32_t hi = pSeries->count;
+    uint32_t mid = 0;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (pSeries->pSamples[mid].timestamp < timestamp) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+static int history_queueLate(History_Series_t *pSeries, uint32_t timestamp, float value)
+{
+    History_Sample_t *pLate = NULL;
+    uint32_t capacity = 0;
+
+    if (pSeries->lateCount == pSeries->lateCapacity) {
+        capacity = (0 == pSeries->lateCapacity) ? HISTORY_INITIAL_SAMPLES : pSeries->lateCapacity * 2;
+        pLate = realloc(pSeries->pLate, capacity * sizeof(History_Sample_t));
+        if (NULL == pLate) {
+            printf("Realloc failed to queue a late reading\r\n");
+            return STATUS_ERROR;
+        }
+        pSeries->pLate = pLate;
+        pSeries->lateCapacity = capacity;
+    }
+
+    pSeries->pLate[pSeries->lateCount].timestamp = timestamp;
+    pSeries->pLate[pSeries->lateCount].value = value;
+    pSeries->lateCount++;
+
+    return STATUS_SUCCESS;
+}
+
+static int history_compareSamples(const void *pA, const void *pB)
+{
+    const History_Sample_t *pLeft = pA;
+    const History_Sample_t *pRight = pB;
+
+    return (pLeft->timestamp > pRight->timestamp) - (pLeft->timestamp < pRight->timestamp);
+}
@@ -10,6 +10,8 @@
 #include <signal.h>
 #include <poll.h>
 #include "srvpoll.h"
+#include "checksum.h"
+#include "shard.h"
 
 
 /* Private define ------------------------------------------------------------*/
@@ -20,7 +22,7 @@ ClientState_t clientStates[MAX_CLIENTS];
 
 /* Private function prototypes -----------------------------------------------*/
 void printUsage(char *argv[]);
-void poll_loop(unsigned short port, Parse_DbHeader_t *dbhdr, Parse_Sensor_t **ppSensors, int dbfd);
+void poll_loop(SrvPoll_Config_t *pConfig, Parse_DbHeader_t *dbhdr, Table_t *pTable, int dbfd, Parse_SideFiles_t *pSide);
 
 /**
   * @brief  The application entry point.
@@ -31,16 +33,36 @@ void poll_loop(unsigned short port, Parse_DbHeader_t *dbhdr, Parse_Sensor_t **pp
 int main(int argc, char *argv[]) {
     char *pFilepath = NULL;
     char *pPortArg = NULL;
-    unsigned short port = 0;
+    SrvPoll_Config_t config = {
+        .pDbPath = NULL,
+        .port = 0,
+        .pUnixPath = NULL,
+        .idleTimeoutSec = DEFAULT_IDLE_TIMEOUT_S,
+        .helloTimeoutSec = DEFAULT_HELLO_TIMEOUT_S,
+        .requestTimeoutMs = DEFAULT_REQUEST_TIMEOUT_MS,
+        .shmSlots = 0,
+        .udpPort = 0,
+        .flushIntervalMs = DEFAULT_FLUSH_INTERVAL_MS,
+        .reorderWindowSec = DEFAULT_REORDER_WINDOW_S
+    };
+    uint32_t backlogRecords = DEFAULT_WAL_BACKLOG;
+    uint32_t shardIndex = 0;
+    uint32_t shardCount = 0;
     bool newFile = false;
     bool list = false;
     int c;
 
+    retention_defaults(&config.retention);
+
     int dbfd = -1;
-    struct Parse_DbHeader_t *pDbHdr = NULL;
-    struct Parse_Sensor_t *pSensors = NULL;
+    Parse_SideFiles_t side = { .rollupFd = -1, .sketchFd = -1, .indexFd = -1, .reorderFd = -1, .segments = { .dirFd = -1 } };
+    int walFd = -1;
+    Budget_t budget;
+    int historyFd = -1;
+    Parse_DbHeader_t *pDbHdr = NULL;
+    Table_t table;
 
-    while (-1 != (c = getopt(argc, argv, "nf:p:"))) {
+    while (-1 != (c = getopt(argc, argv, "nf:p:u:S:U:i:H:R:F:K:W:m:r:b:s:v"))) {
         switch (c)
         {
             case 'n':{
@@ -53,12 +75,74 @@ int main(int argc, char *argv[]) {
             }
             case 'p':{
                 pPortArg = optarg;
-                port = atoi(pPortArg);
-                if (0 == pPortArg) {
+                config.port = atoi(pPortArg);
+                if (0 == config.port) {
                     printf("Incorrect port value!\r\n");
                 }
                 break;
             }
+            case 'u':{
+                config.pUnixPath = optarg;
+                break;
+            }
+            case 'S':{
+                config.shmSlots = atoi(optarg);
+                break;
+            }
+            case 'U':{
+                config.udpPort = atoi(optarg);
+                break;
+            }
+            case 'i':{
+                config.idleTimeoutSec = atoi(optarg);
+                break;
+            }
+            case 'H':{
+                config.helloTimeoutSec = atoi(optarg);
+                break;
+            }
+            case 'R':{
+                config.requestTimeoutMs = atoi(optarg);
+                break;
+            }
+            case 'F':{
+                config.flushIntervalMs = atoi(optarg);
+                break;
+            }
+            case 'K':{
+                if (STATUS_SUCCESS != retention_parse(optarg, &config.retention)) {
+                    printUsage(argv);
+                    return -1;
+                }
+                break;
+            }
+            case 'W':{
+                config.reorderWindowSec = atoi(optarg);
+                break;
+            }
+            case 'm':{
+                config.memoryBudget = strtoull(optarg, NULL, 10);
+                break;
+            }
+            case 'r':{
+                config.pPrimary = optarg;
+                break;
+            }
+            case 'b':{
+                backlogRecords = strtoul(optarg, NULL, 10);
+                break;
+            }
+            case 's':{
+                if (STATUS_SUCCESS != shard_parse(optarg, &shardIndex, &shardCount)) {
+                    printUsage(argv);
+                    return -1;
+                }
+                break;
+            }
+            case 'v':{
+                config.verbose = true;
+                break;
+            }
             case 'l':{
                 list = true;
                 break;
@@ -80,6 +164,13 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
+    config.pDbPath = pFilepath;
+    checksum_init();
+    parse_setShard(shardIndex, shardCount);
+    if (0 != shardCount) {
+        printf("Serving shard %u of %u\r\n", shardIndex, shardCount);
+    }
+
     if (true == newFile) {
         dbfd = file_createDb(pFilepath);
         if (STATUS_ERROR == dbfd)
@@ -106,17 +197,96 @@ int main(int argc, char *argv[]) {
             printf("Failed to validate database header\r\n");
             return -1;
         }
+        parse_recoverCheckpoint(pFilepath, pDbHdr->checkpointSeq);
     }
 
-    if (STATUS_SUCCESS != parse_readSensors(dbfd, pDbHdr, &pSensors))
+    side.indexFd = file_openSide(pFilepath, INDEX_SUFFIX, newFile);
+    if (STATUS_SUCCESS != parse_readSensors(dbfd, pDbHdr, &table, side.indexFd))
     {
         printf("Failed to read sensors");
         return 0;
     }
 
-    poll_loop(port, pDbHdr, pSensors, dbfd);
+    // the log of a new database needs a file to be replayed onto
+    if (true == newFile && STATUS_SUCCESS != parse_outputFile(dbfd, pDbHdr, &table))
+    {
+        printf("Failed to write the new database\r\n");
+        return -1;
+    }
+
+    side.rollupFd = file_openSide(pFilepath, ROLLUP_SUFFIX, newFile);
+    if (STATUS_ERROR == side.rollupFd || STATUS_SUCCESS != parse_readRollups(side.rollupFd, &table, pDbHdr->checkpointSeq))
+    {
+        printf("Failed to read rollups\r\n");
+        return -1;
+    }
+
+    budget_init(&budget, config.memoryBudget);
+    segment_init(&side.segments, file_openSideDir(pFilepath, SEGMENT_DIR_SUFFIX, newFile));
+    if (side.segments.dirFd < 0 || STATUS_SUCCESS != segment_cacheInit(&side.segments, budget_cacheBytes(&budget)) ||
+        STATUS_SUCCESS != parse_readSegments(&side.segments, &table, &budget, pDbHdr->checkpointSeq))
+    {
+        printf("Failed to read reading history\r\n");
+        return -1;
+    }
+
+    // readings kept in the single history file of older versions move into segments
+    historyFd = file_openSide(pFilepath, HISTORY_SUFFIX, newFile);
+    if (STATUS_ERROR == historyFd || STATUS_SUCCESS != parse_readHistory(historyFd, &table) ||
+        STATUS_SUCCESS != parse_outputSegments(&side.segments, &table, 0, pDbHdr->checkpointSeq))
+    {
+        printf("Failed to move the reading history into segments\r\n");
+        return -1;
+    }
+    close(historyFd);
+    file_removeSide(pFilepath, HISTORY_SUFFIX);
 
-    parse_outputFile(dbfd, pDbHdr, &pSensors);
+    // readings the lateness window held back at the last checkpoint, the log no longer has them
+    side.reorderFd = file_openSide(pFilepath, REORDER_SUFFIX, newFile);
+    if (STATUS_ERROR == side.reorderFd || STATUS_SUCCESS != parse_readReorder(side.reorderFd, &table, pDbHdr->checkpointSeq))
+    {
+        printf("Failed to read the reorder buffers\r\n");
+        return -1;
+    }
+
+    side.sketchFd = file_openSide(pFilepath, SKETCH_SUFFIX, newFile);
+    if (STATUS_ERROR == side.sketchFd || STATUS_SUCCESS != parse_readSketches(side.sketchFd, &table, pDbHdr->checkpointSeq))
+    {
+        printf("Failed to read quantile sketches\r\n");
+        return -1;
+    }
+
+    // changes made after the last checkpoint are only in the log
+    walFd = file_openSide(pFilepath, WAL_SUFFIX, newFile);
+    if (STATUS_ERROR == walFd)
+    {
+        printf("Failed to open the mutation log\r\n");
+        return -1;
+    }
+    wal_init(&side.wal, walFd, pDbHdr->checkpointSeq);
+    printf("Replayed %d logged changes\r\n", parse_replayLog(&side.wal, pDbHdr, &table));
+    parse_attachLog(&side.wal);
+    // only a primary hands out its log, a replica keeps it for its own restarts
+    if (NULL == config.pPrimary && STATUS_SUCCESS != wal_backlogInit(&side.wal, backlogRecords))
+    {
+        return -1;
+    }
+
+    poll_loop(&config, pDbHdr, &table, dbfd, &side);
+
+    // changes the log could not take are still saved by the checkpoint
+    wal_commit(&side.wal);
+    pDbHdr->checkpointSeq = side.wal.seq;
+    // nothing is left in the reorder buffers on exit
+    if (STATUS_SUCCESS == parse_checkpoint(pFilepath, dbfd, pDbHdr, &table, &side, 0))
+    {
+        wal_checkpoint(&side.wal);
+    }
+    parse_attachLog(NULL);
+    wal_free(&side.wal);
+    close(walFd);
+    segment_free(&side.segments);
+    table_free(&table);
 
     return 0;
 }
@@ -131,6 +301,23 @@ void printUsage(char *argv[]) {
     printf("\t -n - create new database file\r\n");
     printf("\t -f - (required) path to database file\r\n");
     printf("\t -p - (required) port to listen on\r\n");
+    printf("\t -u <path> - also listen on a unix domain socket\r\n");
+    printf("\t -S <slots> - shared memory ingest ring for local producers, power of two (needs -u)\r\n");
+    printf("\t -U <port> - fire-and-forget UDP reading ingest\r\n");
+    printf("\t -i <sec> - idle connection timeout, 0 disables (default %d)\r\n", DEFAULT_IDLE_TIMEOUT_S);
+    printf("\t -H <sec> - handshake deadline, 0 disables (default %d)\r\n", DEFAULT_HELLO_TIMEOUT_S);
+    printf("\t -F <ms> - max delay before changes are written to the file, 0 writes every loop (default %d)\r\n", DEFAULT_FLUSH_INTERVAL_MS);
+    printf("\t -K <tier>=<age>[,...] - keep raw, minute, hour, day and sketch data for age (s, m, h or d suffix), 0 keeps forever\r\n");
+    printf("\t    (default raw=%dd, everything else %dd)\r\n", DEFAULT_RETENTION_RAW_S / 86400, DEFAULT_RETENTION_ROLLUP_S / 86400);
+    printf("\t -W <sec> - lateness window out-of-order readings are sorted in before they are sealed into segments, 0 seals on every flush (default %d)\r\n", DEFAULT_REORDER_WINDOW_S);
+    printf("\t -m <bytes> - memory budget of the raw reading history and its segment cache, 0 keeps everything in memory (default 0)\r\n");
+    printf("\t -R <ms> - deadline for completing a request, 0 disables (default %d)\r\n", DEFAULT_REQUEST_TIMEOUT_MS);
+    printf("\t -r <host:port> - run as a read-only replica of the primary at host:port, the database must be a copy\r\n");
+    printf("\t    of the primary's, e.g. its snapshot, or both new\r\n");
+    printf("\t -b <records> - log records a primary keeps in memory for replicas to catch up from (default %d)\r\n", DEFAULT_WAL_BACKLOG);
+    printf("\t -s <index>/<count> - serve shard index of count, sensors hashing to another shard are refused (max %d shards)\r\n", SHARD_MAX);
+    printf("\t -v - log every query and how long it took\r\n");
+    printf("\t SIGUSR1 writes a snapshot to <database file>%s without stopping the server\r\n", SNAPSHOT_SUFFIX);
 
     return;
 }
\ No newline at end of file
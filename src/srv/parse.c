@@ -1,4 +1,105 @@
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include "parse.h"
+#include "reading.h"
+#include "checksum.h"
+#include "timer.h"
+#include "shard.h"
+#include "file.h"
+
+// records converted per write() when saving
+#define PARSE_WRITE_BATCH   256
+// side files written to a temporary file and renamed at a checkpoint
+#define PARSE_CHECKPOINT_FILES 4
+
+/* Private variables ---------------------------------------------------------*/
+static Wal_t *pLog = NULL;                  // mutations are logged here once attached
+static uint32_t shardIndex = 0;             // shard of the sensors this server may create
+static uint32_t shardCount = 0;             // 0 creates any sensor
+// side files of a checkpoint, renamed in this order after the database
+static const char *pCheckpointSuffixes[PARSE_CHECKPOINT_FILES] = { INDEX_SUFFIX, ROLLUP_SUFFIX, SKETCH_SUFFIX, REORDER_SUFFIX };
+
+/* Private typedef -----------------------------------------------------------*/
+// one sample of a segment being compacted
+typedef struct {
+    uint64_t checkpoint;            // checkpoint of its block when not committed yet, 0 otherwise
+    uint32_t row;
+    uint32_t seq;                   // position in the file, keeps equal timestamps in order
+    History_Sample_t sample;
+} Parse_SegmentEntry_t;
+
+// blocks of records one loader thread decodes into the table
+typedef struct {
+    int fd;
+    off_t offset;                   // file offset of the first record
+    uint32_t count;                 // records in the file
+    const uint32_t *pChecksums;     // per block, NULL for version 2 files
+    uint32_t firstBlock;
+    uint32_t endBlock;
+    Table_t *pTable;
+    Table_Shard_t shard;            // secondary indexes of the decoded rows
+    bool indexed;                   // indexes come from the index file, no shard is built
+    pthread_t thread;
+    bool spawned;
+    int status;
+} Parse_LoadTask_t;
+
+/* Private function prototypes -----------------------------------------------*/
+// load version 1 records with inline strings
+static int parse_readRecordsV1(int fd, Parse_DbHeader_t *pDbhdr, Table_t *pTable);
+// load version 2 to 4 dictionaries and records, the records on a pool of threads
+static int parse_readRecords(int fd, Parse_DbHeader_t *pDbhdr, Table_t *pTable, const Parse_IndexHeader_t *pIndex);
+// map the index file if it was saved for this database, NULL otherwise
+static const Parse_IndexHeader_t *parse_mapIndex(int fd, const Parse_DbHeader_t *pDbhdr, size_t *pSize);
+// CRC-32C of the checksums of a database file, as stored
+static int parse_dbDigest(int fd, const Parse_DbHeader_t *pDbhdr, uint32_t *pDigest);
+// thread body, decode and index the blocks of a load task
+static void *parse_loadBlocks(void *pArg);
+// decode one record into its row of the table, STATUS_ERROR if it is corrupted
+static int parse_decodeRecord(Table_t *pTable, uint32_t row, Parse_Record_t *pRecord);
+// read a dictionary pool and intern its strings in code order, extending a checksum over it
+static int parse_readDict(int fd, Dict_t *pDict, unsigned int entries, unsigned int bytes, uint32_t *pCrc);
+// refresh counts, dictionary sizes and filesize from the table
+static void parse_updateHeader(Parse_DbHeader_t *pDbhdr, const Table_t *pTable);
+// read a rollup or sketch header of version 1 or version, bytes read, 0 for an empty file, -1 if it is not one
+static ssize_t parse_readSideHeader(int fd, uint32_t magic, uint16_t version, Parse_SideHeader_t *pHeader);
+// read the bin counts of one sketch store, pStore NULL skips them
+static int parse_readSketchStore(int fd, Sketch_Store_t *pStore, int32_t offset, uint32_t bins);
+// write the bin counts of one sketch store
+static void parse_writeSketchStore(int fd, const Sketch_Store_t *pStore, int *pStatus);
+// add a reading, refusing sensors of other shards only if checkShard is set
+static int parse_insertReading(Parse_DbHeader_t *pDbhdr, Table_t *pTable, const DbProtocol_Reading_t *pReading,
+                               bool checkShard);
+// replay one segment file, flagging it for a rewrite when it needs compacting
+static int parse_loadSegment(Segment_Store_t *pStore, uint32_t index, Table_t *pTable, uint32_t *pSeen);
+// compact a segment into one sorted block per sensor, dropping it if none are left
+static int parse_rewriteSegment(Segment_Store_t *pStore, uint32_t index, const Table_t *pTable);
+// qsort order of compacted samples, by uncommitted checkpoint, then sensor, then timestamp, then file position
+static int parse_compareEntries(const void *pA, const void *pB);
+// bytes of a block header in a segment of the given file version
+static uint32_t parse_segmentBlockSize(uint16_t version);
+// append one block of checkpoint seq to a segment, opening it and writing its header if needed
+static int parse_appendBlock(Segment_Store_t *pStore, uint32_t index, const char *pSensorId,
+                             const History_Sample_t *pSamples, uint32_t count, uint64_t seq);
+// write one block at the current offset and widen the zone map, returns its size, a segment block names
+// checkpoint *pSeq, NULL writes a history block
+static uint32_t parse_writeBlock(int fd, const char *pSensorId, const History_Sample_t *pSamples, uint32_t count,
+                                 const uint64_t *pSeq, Segment_Zone_t *pZone, int *pStatus);
+// write the zone map footer at end and cut the file after it
+static int parse_writeFooter(int fd, const Segment_Zone_t *pZone, uint32_t end);
+// take the zone map of a segment from its footer
+static void parse_readFooter(const Parse_SegmentFooter_t *pFooter, Segment_Zone_t *pZone);
+// write every byte unless an earlier write failed, a failure is kept in *pStatus
+static void parse_write(int fd, const void *pBuf, size_t bytes, int *pStatus);
+// cut a file at size unless an earlier write failed, a failure is kept in *pStatus
+static void parse_truncate(int fd, off_t size, int *pStatus);
+// write one file of a checkpoint to <database><suffix>.tmp and sync it
+static int parse_checkpointFile(const char *pDbPath, const char *pSuffix, int dbTmpFd, Parse_DbHeader_t *pDbhdr,
+                                Table_t *pTable, int *pTmpFd);
 
 /**
  * @brief  Creates a new database header in the file. 
@@ -16,7 +117,7 @@ int parse_createDbHeader(int fd, Parse_DbHeader_t **ppHeaderOut) {
         return STATUS_ERROR;
     }
 
-    pHeader->version = 0x1;
+    pHeader->version = DB_VERSION_CHECKPOINT;
     pHeader->count = 0;
     pHeader->magic = HEADER_MAGIC;
     pHeader->filesize = sizeof(Parse_DbHeader_t);
@@ -35,7 +136,9 @@ int parse_createDbHeader(int fd, Parse_DbHeader_t **ppHeaderOut) {
 int parse_validateDbHeader(int fd, Parse_DbHeader_t **ppHeaderOut)
 {
     Parse_DbHeader_t *pHeader = NULL;
+    Parse_DbHeaderV1_t headerV1;
     struct stat dbstat = {0};
+    size_t rest = offsetof(Parse_DbHeader_t, checkpointSeq) - sizeof(Parse_DbHeaderV1_t);
 
     if (fd < 0)
     {
@@ -50,17 +153,16 @@ int parse_validateDbHeader(int fd, Parse_DbHeader_t **ppHeaderOut)
         return STATUS_ERROR;
     }
 
-    if (read(fd, pHeader, sizeof(Parse_DbHeader_t)) != sizeof(Parse_DbHeader_t))
+    // both versions start with the version 1 header fields
+    if (read(fd, &headerV1, sizeof(headerV1)) != sizeof(headerV1))
     {
     perror("read");
         free(pHeader);
         return STATUS_ERROR;
     }
 
-    pHeader->version = ntohs(pHeader->version);
-    pHeader->count = ntohs(pHeader->count);
-    pHeader->magic = ntohl(pHeader->magic);
-    pHeader->filesize = ntohl(pHeader->filesize);
+    pHeader->magic = ntohl(headerV1.magic);
+    pHeader->version = ntohs(headerV1.version);
 
     if (HEADER_MAGIC != pHeader->magic)
     {
@@ -69,7 +171,37 @@ int parse_validateDbHeader(int fd, Parse_DbHeader_t **ppHeaderOut)
         return STATUS_ERROR;
     }
 
-    if (1 != pHeader->version)
+    if (DB_VERSION_RECORDS == pHeader->version)
+    {
+        pHeader->count = ntohs(headerV1.count);
+        pHeader->filesize = ntohl(headerV1.filesize);
+    }
+    else if (DB_VERSION_DICT <= pHeader->version && DB_VERSION_CHECKPOINT >= pHeader->version)
+    {
+        // only version 4 headers carry the checkpoint
+        if (DB_VERSION_CHECKPOINT == pHeader->version)
+        {
+            rest += sizeof(pHeader->checkpointSeq);
+        }
+        memcpy(pHeader, &headerV1, sizeof(headerV1));
+        if (read(fd, (char *)pHeader + sizeof(headerV1), rest) != (ssize_t)rest)
+        {
+            perror("read");
+            free(pHeader);
+            return STATUS_ERROR;
+        }
+
+        pHeader->magic = ntohl(pHeader->magic);
+        pHeader->version = ntohs(pHeader->version);
+        pHeader->count = ntohl(pHeader->count);
+        pHeader->filesize = ntohl(pHeader->filesize);
+        pHeader->typeCount = ntohl(pHeader->typeCount);
+        pHeader->typeBytes = ntohl(pHeader->typeBytes);
+        pHeader->locationCount = ntohl(pHeader->locationCount);
+        pHeader->locationBytes = ntohl(pHeader->locationBytes);
+        pHeader->checkpointSeq = be64toh(pHeader->checkpointSeq);
+    }
+    else
     {
         printf("Improper header version\r\n");
         free(pHeader);
@@ -92,92 +224,54 @@ int parse_validateDbHeader(int fd, Parse_DbHeader_t **ppHeaderOut)
 /**
  * @brief  Parse a sensor string and add it to the database
  * @param pDbhdr Pointer to the database header
- * @param ppSensors Pointer to pointer of sensors array
+ * @param pTable Pointer to the sensor table
  * @param pAddString String containing the sensor data in the following format:
  *                  sensor_id,sensor_type,i2c_addr,timestamp,reading_value
  * @return STATUS_SUCCESS or STATUS_ERROR
  */
-int parse_addSensor(Parse_DbHeader_t *pDbhdr, Parse_Sensor_t **ppSensors, char *pAddString)
+int parse_addSensor(Parse_DbHeader_t *pDbhdr, Table_t *pTable, char *pAddString)
 {
-    char *pSensorId = NULL;
-    char *pSensorType = NULL;
-    char *pI2cAddrStr = NULL;
-    char *pTimestampStr = NULL;
-    char *pReadingStr = NULL;
-    Parse_Sensor_t *pNewSensors = NULL;
+    DbProtocol_Reading_t reading;
 
     printf("%s\n", pAddString);
 
-    // Parse format: sensor_id,sensor_type,i2c_addr,timestamp,reading_value
-    // Example: "BNO055_01,BNO055,0x28,1701432000,25.5"
-
-    pSensorId = strtok(pAddString, ",");
-    pSensorType = strtok(NULL, ",");
-    pI2cAddrStr = strtok(NULL, ",");
-    pTimestampStr = strtok(NULL, ",");
-    pReadingStr = strtok(NULL, ",");
-
-    if (pSensorId == NULL || pSensorType == NULL || pI2cAddrStr == NULL ||
-        pTimestampStr == NULL || pReadingStr == NULL) {
-        printf("Invalid format for sensor data\r\n");
-        return STATUS_ERROR;
-    }
-
-    printf("%s %s %s %s %s\n", pSensorId, pSensorType, pI2cAddrStr, 
-            pTimestampStr, pReadingStr);
-
-    // Increment count first
-    pDbhdr->count++;
-
-    // Reallocate the sensors array to fit the new sensor
-    pNewSensors = realloc(*ppSensors, pDbhdr->count * sizeof(Parse_Sensor_t));
-    if (NULL == pNewSensors && pDbhdr->count > 0)
-    {
-        printf("Realloc failed to expand sensors array\r\n");
-        pDbhdr->count--;
+    if (STATUS_SUCCESS != reading_fromString(pAddString, &reading)) {
         return STATUS_ERROR;
     }
 
-    *ppSensors = pNewSensors;
-
-    // Initialize the new sensor entry
-    memset(&(*ppSensors)[pDbhdr->count - 1], 0, sizeof(Parse_Sensor_t));
-
-    strncpy((*ppSensors)[pDbhdr->count - 1].sensorId, pSensorId, 
-            sizeof((*ppSensors)[pDbhdr->count - 1].sensorId) - 1);
-    strncpy((*ppSensors)[pDbhdr->count - 1].sensorType, pSensorType, 
-            sizeof((*ppSensors)[pDbhdr->count - 1].sensorType) - 1);
-
-    // Parse I2C address if any
-    (*ppSensors)[pDbhdr->count - 1].i2cAddr = (unsigned char)strtol(pI2cAddrStr, NULL, 0);
-
-    (*ppSensors)[pDbhdr->count - 1].timestamp = (time_t)atol(pTimestampStr);
-
-    (*ppSensors)[pDbhdr->count - 1].readingValue = atof(pReadingStr);
+    printf("%s %s 0x%02X %u %.2f\n", reading.sensorId, reading.sensorType,
+            reading.i2cAddr, reading.timestamp, reading.readingValue);
 
-    (*ppSensors)[pDbhdr->count - 1].flags = SENSOR_FLAG_ACTIVE | SENSOR_FLAG_CALIBRATED;
-    strcpy((*ppSensors)[pDbhdr->count - 1].location, "Unknown Location");
-    (*ppSensors)[pDbhdr->count - 1].minThreshold = -100.0;
-    (*ppSensors)[pDbhdr->count - 1].maxThreshold = 100.0;
-
-    // Update filesize
-    pDbhdr->filesize = sizeof(Parse_DbHeader_t) + (sizeof(Parse_Sensor_t) * pDbhdr->count);
+    return parse_addReading(pDbhdr, pTable, &reading);
+}
 
-    return STATUS_SUCCESS;
+/**
+ * @brief  Add a reading to the database
+ * @param pDbhdr Pointer to the database header
+ * @param pTable Pointer to the sensor table
+ * @param pReading Reading in host byte order
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  A known sensor ID updates the existing record in place, otherwise a
+ *        new record with default location and thresholds is appended. An
+ *        applied reading is logged if a log is attached.
+ */
+int parse_addReading(Parse_DbHeader_t *pDbhdr, Table_t *pTable, const DbProtocol_Reading_t *pReading)
+{
+    return parse_insertReading(pDbhdr, pTable, pReading, true);
 }
 
 /**
  * @brief Remove a sensor from the database
  * @param pDbhdr: Pointer to the database header
- * @param ppSensors: Pointer to pointer of sensors array (for reallocation)
+ * @param pTable: Pointer to the sensor table
  * @param pRemove: Pointer to the string containing the sensor ID to be removed
  * @return STATUS_SUCCESS or STATUS_ERROR
  */
-int parse_removeSensor(Parse_DbHeader_t *pDbhdr, Parse_Sensor_t **ppSensors, char *pRemove) {
+int parse_removeSensor(Parse_DbHeader_t *pDbhdr, Table_t *pTable, char *pRemove) {
+    DbProtocol_Reading_t reading;
     int sensorIndex = -1;
-    Parse_Sensor_t *pNewSensors = NULL;
 
-    sensorIndex = parse_findSensor(pDbhdr, *ppSensors, pRemove);
+    sensorIndex = table_find(pTable, pRemove);
 
     if (-1 == sensorIndex)
     {
@@ -187,92 +281,124 @@ int parse_removeSensor(Parse_DbHeader_t *pDbhdr, Parse_Sensor_t **ppSensors, cha
 
     printf("Removing sensor at index %d\n", sensorIndex);
 
-    // Determine how many sensors need to be moved
-    int sensors_to_move = pDbhdr->count - sensorIndex - 1;
+    // The last sensor takes over the freed row
+    table_remove(pTable, sensorIndex);
 
-    // Shift all subsequent sensors up one position
-    if (sensors_to_move > 0)
-    {
-        memmove(&(*ppSensors)[sensorIndex], &(*ppSensors)[sensorIndex + 1],
-                sensors_to_move * sizeof(Parse_Sensor_t));
-    }
+    // Update count and filesize
+    parse_updateHeader(pDbhdr, pTable);
 
-    pDbhdr->count--;
-
-    // Reallocate the array to the new smaller size
-    if (pDbhdr->count > 0)
-    {
-        pNewSensors = realloc(*ppSensors, pDbhdr->count * sizeof(Parse_Sensor_t));
-        if (NULL == pNewSensors)
-        {
-            // Revert count decrement
-            pDbhdr->count++;
-            printf("Failed to resize sensors array\n");
-            return STATUS_ERROR;
-        }
-        *ppSensors = pNewSensors;
-    }
-    else
-    {
-        // If count is 0, free the array
-        free(*ppSensors);
-        *ppSensors = NULL;
+    if (NULL != pLog) {
+        memset(&reading, 0, sizeof(reading));
+        strncpy(reading.sensorId, pRemove, sizeof(reading.sensorId) - 1);
+        return wal_append(pLog, WAL_REMOVE, &reading);
     }
 
-    // Update filesize
-    pDbhdr->filesize = sizeof(Parse_DbHeader_t) + (sizeof(Parse_Sensor_t) * pDbhdr->count);
-
     return STATUS_SUCCESS;
 }
 
 
-void parse_listSensors(Parse_DbHeader_t *pDbhdr, Parse_Sensor_t *pSensors)
+void parse_listSensors(Parse_DbHeader_t *pDbhdr, Table_t *pTable)
 {
+    Parse_Sensor_t sensor;
     int i = 0;
 
     for (i = 0; i < pDbhdr->count; i++)
     {
+        parse_getSensor(pTable, i, &sensor);
+
         printf("Sensor %d\n", i);
-        printf("\tID: %s\n", pSensors[i].sensorId);
-        printf("\tType: %s\n", pSensors[i].sensorType);
-        printf("\tI2C Address: 0x%02X\n", pSensors[i].i2cAddr);
-        printf("\tTimestamp: %s", ctime(&pSensors[i].timestamp));
-        printf("\tReading: %.2f\n", pSensors[i].readingValue);
-        printf("\tFlags: 0x%02X", pSensors[i].flags);
-
-        if (pSensors[i].flags & SENSOR_FLAG_ACTIVE)
+        printf("\tID: %s\n", sensor.sensorId);
+        printf("\tType: %s\n", sensor.sensorType);
+        printf("\tI2C Address: 0x%02X\n", sensor.i2cAddr);
+        printf("\tTimestamp: %s", ctime(&sensor.timestamp));
+        printf("\tReading: %.2f\n", sensor.readingValue);
+        printf("\tFlags: 0x%02X", sensor.flags);
+
+        if (sensor.flags & SENSOR_FLAG_ACTIVE)
         {
             printf(" ACTIVE");
         }
-        if (pSensors[i].flags & SENSOR_FLAG_ERROR)
+        if (sensor.flags & SENSOR_FLAG_ERROR)
         {
             printf(" ERROR");
         }
-        if (pSensors[i].flags & SENSOR_FLAG_CALIBRATED)
+        if (sensor.flags & SENSOR_FLAG_CALIBRATED)
         {
             printf(" CALIBRATED");
         }
 
         printf("\n");
-        printf("\tLocation: %s\n", pSensors[i].location);
+        printf("\tLocation: %s\n", sensor.location);
         printf("\tThresholds: Min=%.2f, Max=%.2f\n", 
-                pSensors[i].minThreshold, pSensors[i].maxThreshold);
+                sensor.minThreshold, sensor.maxThreshold);
+    }
+}
+
+/**
+ * @brief  Evaluate a row against its thresholds
+ * @param pTable: [in] Sensor table
+ * @param row: [in] Row to check
+ * @return true if the reading is outside [minThreshold, maxThreshold]
+ * @note  Sets or clears SENSOR_FLAG_ERROR and keeps the alert set in step,
+ *        so a sensor leaves the set as soon as a reading crosses back.
+ */
+bool parse_checkThresholds(Table_t *pTable, uint32_t row)
+{
+    float value = pTable->pReading[row];
+    bool violation = (value < pTable->pMinThreshold[row] || value > pTable->pMaxThreshold[row]);
+
+    if (true == violation) {
+        table_setFlags(pTable, row, pTable->pFlags[row] | SENSOR_FLAG_ERROR);
+    } else {
+        table_setFlags(pTable, row, pTable->pFlags[row] & ~SENSOR_FLAG_ERROR);
     }
+
+    table_setAlert(pTable, row, violation);
+
+    return violation;
+}
+
+/**
+ * @brief  Gather the columns of one table row into a version 1 record
+ * @param pTable: [in] Sensor table
+ * @param row: [in] Row to gather
+ * @param pOut: [out] Record in host byte order
+ */
+void parse_getSensor(const Table_t *pTable, uint32_t row, Parse_Sensor_t *pOut)
+{
+    const Table_Cold_t *pCold = &pTable->pCold[row];
+
+    memset(pOut, 0, sizeof(Parse_Sensor_t));
+    memcpy(pOut->sensorId, pCold->sensorId, sizeof(pOut->sensorId));
+    strncpy(pOut->sensorType, table_typeName(pTable, row), sizeof(pOut->sensorType) - 1);
+    strncpy(pOut->location, table_locationName(pTable, row), sizeof(pOut->location) - 1);
+    pOut->i2cAddr = pCold->i2cAddr;
+    pOut->timestamp = (time_t)pTable->pTimestamp[row];
+    pOut->readingValue = pTable->pReading[row];
+    pOut->flags = pTable->pFlags[row];
+    pOut->minThreshold = pTable->pMinThreshold[row];
+    pOut->maxThreshold = pTable->pMaxThreshold[row];
+
+    return;
 }
 
 /**
  * @brief  Reads sensor data in the database
- * @param fd: [in] File descriptor
+ * @param fd: [in] File descriptor, positioned after the header
  * @param  pDbhdr: [in] Pointer to database header
- * @param ppSensorsOut: [out] Pointer to array of sensors
+ * @param pTable: [out] Sensor table to load the records into
+ * @param indexFd: [in] Index file saved with the database, -1 if there is none
  * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  Version 1 files are converted on load and written back as version 4
+ *        on the next flush. Later versions are split into blocks decoded and
+ *        checked by a pool of threads, one per CPU, which also rebuild the
+ *        indexes unless the index file matches the records.
  */
-int parse_readSensors(int fd, Parse_DbHeader_t *pDbhdr, Parse_Sensor_t **ppSensorsOut)
+int parse_readSensors(int fd, Parse_DbHeader_t *pDbhdr, Table_t *pTable, int indexFd)
 {
-    int count = 0;
-    int i = 0;
-    Parse_Sensor_t *pSensors = NULL;
-    unsigned int temp = 0;
+    const Parse_IndexHeader_t *pIndex = NULL;
+    size_t indexSize = 0;
+    int status = STATUS_ERROR;
 
     if (fd < 0)
     {
@@ -280,70 +406,166 @@ int parse_readSensors(int fd, Parse_DbHeader_t *pDbhdr, Parse_Sensor_t **ppSenso
         return STATUS_ERROR;
     }
 
-    count = pDbhdr->count;
+    if (DB_VERSION_RECORDS != pDbhdr->version)
+    {
+        pIndex = parse_mapIndex(indexFd, pDbhdr, &indexSize);
+    }
 
-    pSensors = calloc(count, sizeof(Parse_Sensor_t));
-    if (NULL == pSensors)
+    // the saved ID index only fits a table of the capacity it was saved at
+    if (STATUS_SUCCESS != table_init(pTable, (NULL == pIndex) ? pDbhdr->count : pIndex->capacity))
     {
         printf("Malloc failed\r\n");
+        if (NULL != pIndex)
+        {
+            munmap((void *)pIndex, indexSize);
+        }
         return STATUS_ERROR;
     }
 
-    read(fd, pSensors, count * sizeof(Parse_Sensor_t));
-
-    for (i = 0; i < count; i++)
+    if (DB_VERSION_RECORDS == pDbhdr->version)
     {
-        pSensors[i].timestamp = ntohl(pSensors[i].timestamp);
-
-        temp = ntohl(*(unsigned int*)&pSensors[i].readingValue);
-        pSensors[i].readingValue = *(float*)&temp;
+        status = parse_readRecordsV1(fd, pDbhdr, pTable);
+    }
+    else
+    {
+        status = parse_readRecords(fd, pDbhdr, pTable, pIndex);
+    }
 
-        temp = ntohl(*(unsigned int*)&pSensors[i].minThreshold);
-        pSensors[i].minThreshold = *(float*)&temp;
+    if (NULL != pIndex)
+    {
+        munmap((void *)pIndex, indexSize);
+    }
 
-        temp = ntohl(*(unsigned int*)&pSensors[i].maxThreshold);
-        pSensors[i].maxThreshold = *(float*)&temp;
+    if (STATUS_SUCCESS != status)
+    {
+        return STATUS_ERROR;
     }
 
-    *ppSensorsOut = pSensors;
+    // duplicate IDs in an old file collapse into one row
+    pDbhdr->version = DB_VERSION_CHECKPOINT;
+    parse_updateHeader(pDbhdr, pTable);
 
     return STATUS_SUCCESS;
 }
 
 /**
- * @brief Find a sensor by ID
- * @param pDbhdr: Pointer to the database header
- * @param pSensors: Pointer to the array of sensors
- * @param pSensorId: Sensor ID to search for
- * @return Index of sensor if found, -1 otherwise
+ * @brief Output database to disk
+ * @param fd: [in] File descriptor
+ * @param  pDbhdr: [in] Pointer to database header
+ * @param pTable: [in] Pointer to sensor table
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  Always writes the version 4 layout, with the checkpoint set in pDbhdr.
  */
-int parse_findSensor(Parse_DbHeader_t *pDbhdr, Parse_Sensor_t *pSensors, const char *pSensorId) {
-    int i = 0;
+int parse_outputFile(int fd, Parse_DbHeader_t *pDbhdr, Table_t *pTable)
+{
+    Parse_DbHeader_t header;
+    Parse_Record_t records[PARSE_WRITE_BATCH];
+    Parse_Record_t *pRecord = NULL;
+    uint32_t *pChecksums = NULL;
+    uint32_t blocks = (pTable->count + PARSE_BLOCK_RECORDS - 1) / PARSE_BLOCK_RECORDS;
+    uint32_t crc = CHECKSUM_SEED;
+    uint32_t row = 0;
+    uint32_t n = 0;
+    unsigned int temp = 0;
+    int status = STATUS_SUCCESS;
 
-    for (i = 0; i < pDbhdr->count; i++)
+    if (fd < 0)
+    {
+        printf("Got a bad FD from the user\r\n");
+        return STATUS_ERROR;
+    }
+
+    pChecksums = malloc((blocks + 1) * sizeof(uint32_t));
+    if (NULL == pChecksums)
+    {
+        printf("Malloc failed to checksum the database\r\n");
+        return STATUS_ERROR;
+    }
+
+    parse_updateHeader(pDbhdr, pTable);
+
+    // Convert header to network byte order
+    header = *pDbhdr;
+    header.magic = htonl(pDbhdr->magic);
+    header.version = htons(DB_VERSION_CHECKPOINT);
+    header.reserved = 0;
+    header.count = htonl(pDbhdr->count);
+    header.filesize = htonl(pDbhdr->filesize);
+    header.typeCount = htonl(pDbhdr->typeCount);
+    header.typeBytes = htonl(pDbhdr->typeBytes);
+    header.locationCount = htonl(pDbhdr->locationCount);
+    header.locationBytes = htonl(pDbhdr->locationBytes);
+    header.checkpointSeq = htobe64(pDbhdr->checkpointSeq);
+
+    // Position file pointer at beginning
+    lseek(fd, 0, SEEK_SET);
+
+    parse_write(fd, &header, sizeof(Parse_DbHeader_t), &status);
+    parse_write(fd, pTable->types.pPool, pTable->types.poolLen, &status);
+    parse_write(fd, pTable->locations.pPool, pTable->locations.poolLen, &status);
+    crc = checksum_crc32c(crc, pTable->types.pPool, pTable->types.poolLen);
+    pChecksums[0] = htonl(checksum_crc32c(crc, pTable->locations.pPool, pTable->locations.poolLen));
+    crc = CHECKSUM_SEED;
+
+    // Write the sensors, a batch of records per call, batches never straddle a block
+    for (row = 0; row < pTable->count && STATUS_SUCCESS == status; row++)
     {
-        if (0 == strcmp(pSensorId, pSensors[i].sensorId))
+        pRecord = &records[n++];
+        memset(pRecord, 0, sizeof(Parse_Record_t));
+        memcpy(pRecord->sensorId, pTable->pCold[row].sensorId, sizeof(pRecord->sensorId));
+        pRecord->timestamp = htonl(pTable->pTimestamp[row]);
+
+        temp = htonl(*(unsigned int*)&pTable->pReading[row]);
+        pRecord->readingValue = *(float*)&temp;
+
+        temp = htonl(*(unsigned int*)&pTable->pMinThreshold[row]);
+        pRecord->minThreshold = *(float*)&temp;
+
+        temp = htonl(*(unsigned int*)&pTable->pMaxThreshold[row]);
+        pRecord->maxThreshold = *(float*)&temp;
+
+        pRecord->typeCode = htons(pTable->pTypeCode[row]);
+        pRecord->locationCode = htons(pTable->pLocationCode[row]);
+        pRecord->i2cAddr = pTable->pCold[row].i2cAddr;
+        pRecord->flags = pTable->pFlags[row];
+
+        if (PARSE_WRITE_BATCH == n || row + 1 == pTable->count)
+        {
+            parse_write(fd, records, n * sizeof(Parse_Record_t), &status);
+            crc = checksum_crc32c(crc, records, n * sizeof(Parse_Record_t));
+            n = 0;
+        }
+        if (0 == (row + 1) % PARSE_BLOCK_RECORDS || row + 1 == pTable->count)
         {
-            return i;
+            pChecksums[1 + row / PARSE_BLOCK_RECORDS] = htonl(crc);
+            crc = CHECKSUM_SEED;
         }
     }
+    parse_write(fd, pChecksums, (blocks + 1) * sizeof(uint32_t), &status);
+    free(pChecksums);
 
-    return -1;
+    // Truncate file to exact size
+    parse_truncate(fd, pDbhdr->filesize, &status);
+
+    return status;
 }
 
 /**
- * @brief Output database to disk
- * @param fd: [in] File descriptor
- * @param  pDbhdr: [in] Pointer to database header
- * @param pSensors: [in] Pointer to sensor array
+ * @brief  Save the indexes of the table next to the database
+ * @param fd: [in] Index file descriptor
+ * @param dbfd: [in] Database file, just written by parse_outputFile()
+ * @param pDbhdr: [in] Header of the database file
+ * @param pTable: [in] Sensor table
  * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  The header names the records it was saved for, a file that no
+ *        longer matches the database is ignored at startup.
  */
-int parse_outputFile(int fd, Parse_DbHeader_t *pDbhdr, Parse_Sensor_t *pSensors)
+int parse_outputIndex(int fd, int dbfd, const Parse_DbHeader_t *pDbhdr, const Table_t *pTable)
 {
-    int realCount = 0;
-    int i = 0;
-    Parse_Sensor_t tempSensor;
-    unsigned int temp = 0;
+    Parse_IndexHeader_t header;
+    uint8_t *pPayload = NULL;
+    size_t bytes = table_indexBytes(pTable);
+    int status = STATUS_SUCCESS;
 
     if (fd < 0)
     {
@@ -351,45 +573,2253 @@ int parse_outputFile(int fd, Parse_DbHeader_t *pDbhdr, Parse_Sensor_t *pSensors)
         return STATUS_ERROR;
     }
 
-    realCount = pDbhdr->count;
+    memset(&header, 0, sizeof(header));
+    if (STATUS_SUCCESS != parse_dbDigest(dbfd, pDbhdr, &header.dbDigest))
+    {
+        return STATUS_ERROR;
+    }
+
+    pPayload = malloc(bytes);
+    if (NULL == pPayload)
+    {
+        printf("Malloc failed to save the indexes\r\n");
+        return STATUS_ERROR;
+    }
+    table_saveIndex(pTable, pPayload);
 
-    // Convert header to network byte order
-    pDbhdr->magic = htonl(pDbhdr->magic);
-    pDbhdr->filesize = htonl(sizeof(Parse_DbHeader_t) + (sizeof(Parse_Sensor_t) * realCount));
-    pDbhdr->count = htons(pDbhdr->count);
-    pDbhdr->version = htons(pDbhdr->version);
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    header.count = pTable->count;
+    header.capacity = pTable->capacity;
+    header.bytes = bytes;
+    header.checksum = checksum_crc32c(CHECKSUM_SEED, pPayload, bytes);
+    header.seq = pDbhdr->checkpointSeq;
 
-    // Position file pointer at beginning
     lseek(fd, 0, SEEK_SET);
+    parse_write(fd, &header, sizeof(header), &status);
+    parse_write(fd, pPayload, bytes, &status);
+    parse_truncate(fd, sizeof(header) + bytes, &status);
+    free(pPayload);
 
-    write(fd, pDbhdr, sizeof(Parse_DbHeader_t));
+    return status;
+}
+
+/**
+ * @brief  Start or stop logging mutations
+ * @param pWal: [in] Log every applied reading and removal is appended to, NULL stops
+ */
+void parse_attachLog(Wal_t *pWal)
+{
+    pLog = pWal;
+
+    return;
+}
+
+/**
+ * @brief  Refuse to create sensors owned by other shards
+ * @param index: [in] Shard this server owns
+ * @param count: [in] Number of shards, 0 creates any sensor
+ * @note  Readings of sensors already in the table are always applied, and
+ *        so are logged and replicated records, which were checked when they
+ *        were first applied.
+ */
+void parse_setShard(uint32_t index, uint32_t count)
+{
+    shardIndex = index;
+    shardCount = count;
+
+    return;
+}
+
+/**
+ * @brief  Apply the mutations logged after the last checkpoint
+ * @param pWal: [in] Log, read from its start
+ * @param pDbhdr: [in] Header of the loaded database, holds the checkpoint
+ * @param pTable: [in] Sensor table with every side file loaded
+ * @return number of records applied
+ * @note  Records up to the checkpoint are already in the files and skipped.
+ *        Reading stops at a record a crash cut short, which is dropped.
+ */
+int parse_replayLog(Wal_t *pWal, Parse_DbHeader_t *pDbhdr, Table_t *pTable)
+{
+    Wal_Record_t record;
+    Wal_t *pAttached = pLog;
+    int applied = 0;
+
+    // replayed mutations are already in the log
+    pLog = NULL;
+    if (pWal->seq < pDbhdr->checkpointSeq)
+    {
+        pWal->seq = pDbhdr->checkpointSeq;
+    }
 
-    // Write each sensor
-    for (i = 0; i < realCount; i++)
+    while (true == wal_read(pWal, &record))
     {
-        tempSensor = pSensors[i];
-        tempSensor.timestamp = htonl(tempSensor.timestamp);
-        
-        temp = htonl(*(unsigned int*)&tempSensor.readingValue);
-        tempSensor.readingValue = *(float*)&temp;
+        if (record.seq <= pDbhdr->checkpointSeq)
+        {
+            continue;
+        }
 
-        temp = htonl(*(unsigned int*)&tempSensor.minThreshold);
-        tempSensor.minThreshold = *(float*)&temp;
+        parse_applyRecord(pDbhdr, pTable, &record);
+        applied++;
+    }
+    wal_truncateRead(pWal);
+    pLog = pAttached;
 
-        temp = htonl(*(unsigned int*)&tempSensor.maxThreshold);
-        tempSensor.maxThreshold = *(float*)&temp;
+    return applied;
+}
 
-        write(fd, &tempSensor, sizeof(Parse_Sensor_t));
+/**
+ * @brief  Apply one logged mutation
+ * @param pDbhdr: [in] Database header
+ * @param pTable: [in] Sensor table
+ * @param pRecord: [in] Record in host byte order, its strings are terminated here
+ * @return STATUS_SUCCESS, or STATUS_ERROR if the table refused the reading
+ * @note  Removing a sensor that is already gone succeeds, the log may hold
+ *        a removal the database file has caught up with.
+ */
+int parse_applyRecord(Parse_DbHeader_t *pDbhdr, Table_t *pTable, Wal_Record_t *pRecord)
+{
+    pRecord->reading.sensorId[sizeof(pRecord->reading.sensorId) - 1] = '\0';
+    if (WAL_REMOVE == pRecord->type)
+    {
+        if (-1 == table_find(pTable, pRecord->reading.sensorId))
+        {
+            return STATUS_SUCCESS;
+        }
+        return parse_removeSensor(pDbhdr, pTable, pRecord->reading.sensorId);
     }
 
-    // Truncate file to exact size
-    ftruncate(fd, sizeof(Parse_DbHeader_t) + (sizeof(Parse_Sensor_t) * realCount));
+    pRecord->reading.sensorType[sizeof(pRecord->reading.sensorType) - 1] = '\0';
+    return parse_insertReading(pDbhdr, pTable, &pRecord->reading, false);
+}
+
+/**
+ * @brief  Load the rollups of the sensors in the table
+ * @param fd: [in] Rollup file descriptor
+ * @param pTable: [in] Sensor table, already loaded
+ * @param seq: [in] Checkpoint of the loaded database
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  Sensors missing from the table are skipped, so a rollup file that
+ *        is older than the database still loads. A file naming another
+ *        checkpoint is refused, its rollups and the log would not add up.
+ */
+int parse_readRollups(int fd, Table_t *pTable, uint64_t seq)
+{
+    Parse_RollupHeader_t header = {0};
+    Parse_RollupSensor_t sensor;
+    Parse_RollupBucket_t records[PARSE_WRITE_BATCH];
+    Rollup_Bucket_t bucket;
+    Rollup_Series_t *pSeries = NULL;
+    uint64_t sumBits = 0;
+    uint32_t sensors = 0;
+    uint32_t remaining = 0;
+    uint32_t n = 0;
+    uint32_t i = 0;
+    int tier = 0;
+    int row = -1;
+    unsigned int temp = 0;
+    ssize_t got = 0;
+
+    lseek(fd, 0, SEEK_SET);
+    got = parse_readSideHeader(fd, ROLLUP_MAGIC, ROLLUP_VERSION, &header);
+    if (0 == got) {
+        return STATUS_SUCCESS;
+    }
+
+    if (got < 0) {
+        printf("Improper rollup file\r\n");
+        return STATUS_ERROR;
+    }
+
+    if (sizeof(header) == got && seq != be64toh(header.seq)) {
+        printf("Rollup file is of checkpoint %llu, the database of %llu\r\n",
+               (unsigned long long)be64toh(header.seq), (unsigned long long)seq);
+        return STATUS_ERROR;
+    }
+
+    sensors = ntohl(header.sensors);
+    for (; sensors > 0; sensors--) {
+        if (sizeof(sensor) != read(fd, &sensor, sizeof(sensor))) {
+            printf("Truncated rollup file\r\n");
+            return STATUS_ERROR;
+        }
+        sensor.sensorId[sizeof(sensor.sensorId) - 1] = '\0';
+        row = table_find(pTable, sensor.sensorId);
+
+        for (tier = 0; tier < ROLLUP_TIERS; tier++) {
+            pSeries = (-1 == row) ? NULL : &pTable->pRollup[row].tiers[tier];
+            for (remaining = ntohl(sensor.counts[tier]); remaining > 0; remaining -= n) {
+                n = (remaining > PARSE_WRITE_BATCH) ? PARSE_WRITE_BATCH : remaining;
+                if ((ssize_t)(n * sizeof(Parse_RollupBucket_t)) != read(fd, records, n * sizeof(Parse_RollupBucket_t))) {
+                    printf("Truncated rollup file\r\n");
+                    return STATUS_ERROR;
+                }
+                if (NULL == pSeries) {
+                    continue;
+                }
+
+                for (i = 0; i < n; i++) {
+                    bucket.start = ntohl(records[i].start);
+                    bucket.count = ntohl(records[i].count);
+
+                    temp = ntohl(*(unsigned int*)&records[i].min);
+                    bucket.min = *(float*)&temp;
+
+                    temp = ntohl(*(unsigned int*)&records[i].max);
+                    bucket.max = *(float*)&temp;
+
+                    sumBits = be64toh(records[i].sum);
+                    memcpy(&bucket.sum, &sumBits, sizeof(bucket.sum));
+
+                    if (STATUS_SUCCESS != rollup_append(pSeries, &bucket)) {
+                        printf("Corrupted rollup file\r\n");
+                        return STATUS_ERROR;
+                    }
+                }
+            }
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Write the rollups of every sensor
+ * @param fd: [in] Rollup file descriptor
+ * @param pTable: [in] Sensor table
+ * @param seq: [in] Checkpoint of the database written with the rollups
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int parse_outputRollups(int fd, const Table_t *pTable, uint64_t seq)
+{
+    Parse_RollupHeader_t header = {0};
+    Parse_RollupSensor_t sensor;
+    Parse_RollupBucket_t records[PARSE_WRITE_BATCH];
+    const Rollup_Series_t *pSeries = NULL;
+    const Rollup_Bucket_t *pBucket = NULL;
+    uint64_t sumBits = 0;
+    off_t size = sizeof(header);
+    uint32_t row = 0;
+    uint32_t i = 0;
+    uint32_t n = 0;
+    int tier = 0;
+    unsigned int temp = 0;
+    int status = STATUS_SUCCESS;
+
+    if (fd < 0) {
+        return STATUS_ERROR;
+    }
 
-    // Convert header back to host byte order
-    pDbhdr->magic = ntohl(pDbhdr->magic);
-    pDbhdr->version = ntohs(pDbhdr->version);
-    pDbhdr->count = ntohs(pDbhdr->count);
-    pDbhdr->filesize = ntohl(pDbhdr->filesize);
+    header.magic = htonl(ROLLUP_MAGIC);
+    header.version = htons(ROLLUP_VERSION);
+    header.sensors = htonl(pTable->count);
+    header.seq = htobe64(seq);
+
+    lseek(fd, 0, SEEK_SET);
+    parse_write(fd, &header, sizeof(header), &status);
+
+    for (; row < pTable->count && STATUS_SUCCESS == status; row++) {
+        memset(&sensor, 0, sizeof(sensor));
+        memcpy(sensor.sensorId, pTable->pCold[row].sensorId, sizeof(sensor.sensorId));
+        for (tier = 0; tier < ROLLUP_TIERS; tier++) {
+            sensor.counts[tier] = htonl(pTable->pRollup[row].tiers[tier].count);
+        }
+        parse_write(fd, &sensor, sizeof(sensor), &status);
+        size += sizeof(sensor);
+
+        for (tier = 0; tier < ROLLUP_TIERS; tier++) {
+            pSeries = &pTable->pRollup[row].tiers[tier];
+            for (i = 0, n = 0; i < pSeries->count; i++) {
+                pBucket = &pSeries->pBuckets[i];
+                records[n].start = htonl(pBucket->start);
+                records[n].count = htonl(pBucket->count);
+
+                temp = htonl(*(unsigned int*)&pBucket->min);
+                records[n].min = *(float*)&temp;
+
+                temp = htonl(*(unsigned int*)&pBucket->max);
+                records[n].max = *(float*)&temp;
+
+                memcpy(&sumBits, &pBucket->sum, sizeof(sumBits));
+                records[n].sum = htobe64(sumBits);
+
+                if (PARSE_WRITE_BATCH == ++n || i + 1 == pSeries->count) {
+                    parse_write(fd, records, n * sizeof(Parse_RollupBucket_t), &status);
+                    n = 0;
+                }
+            }
+            size += (off_t)pSeries->count * sizeof(Parse_RollupBucket_t);
+        }
+    }
+
+    parse_truncate(fd, size, &status);
+
+    return status;
+}
+
+/**
+ * @brief  Replay the single history file of an older version
+ * @param fd: [in] History file descriptor
+ * @param pTable: [in] Sensor table, already loaded
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  Blocks of sensors missing from the table are skipped. A block cut
+ *        short by a crash ends the replay, everything before it is kept.
+ *        The samples are left unsaved so the next flush moves them into
+ *        segment files.
+ */
+int parse_readHistory(int fd, Table_t *pTable)
+{
+    Parse_HistoryHeader_t header = {0};
+    Parse_HistoryBlock_t block;
+    Parse_HistorySample_t records[PARSE_WRITE_BATCH];
+    History_Series_t *pSeries = NULL;
+    uint32_t remaining = 0;
+    uint32_t n = 0;
+    uint32_t i = 0;
+    unsigned int temp = 0;
+    float value = 0.0f;
+    ssize_t got = 0;
+    int found = -1;
+    bool truncated = false;
+
+    lseek(fd, 0, SEEK_SET);
+    got = read(fd, &header, sizeof(header));
+    if (0 == got) {
+        return STATUS_SUCCESS;
+    }
+
+    if (sizeof(header) != got || HISTORY_MAGIC != ntohl(header.magic) || HISTORY_VERSION != ntohs(header.version)) {
+        printf("Improper history file\r\n");
+        return STATUS_ERROR;
+    }
+
+    while (true != truncated && sizeof(block) == read(fd, &block, sizeof(block))) {
+        block.sensorId[sizeof(block.sensorId) - 1] = '\0';
+        found = table_find(pTable, block.sensorId);
+        pSeries = (-1 == found) ? NULL : &pTable->pHistory[found];
+        if (NULL != pSeries && 0 != (ntohl(block.flags) & HISTORY_BLOCK_RESET)) {
+            history_free(pSeries);
+        }
+
+        for (remaining = ntohl(block.count); remaining > 0; remaining -= n) {
+            n = (remaining > PARSE_WRITE_BATCH) ? PARSE_WRITE_BATCH : remaining;
+            if ((ssize_t)(n * sizeof(Parse_HistorySample_t)) != read(fd, records, n * sizeof(Parse_HistorySample_t))) {
+                printf("History file ends in a partial block, ignoring it\r\n");
+                truncated = true;
+                break;
+            }
+            if (NULL == pSeries) {
+                continue;
+            }
+
+            for (i = 0; i < n; i++) {
+                temp = ntohl(*(unsigned int*)&records[i].value);
+                value = *(float*)&temp;
+                if (STATUS_SUCCESS != history_add(pSeries, ntohl(records[i].timestamp), value)) {
+                    return STATUS_ERROR;
+                }
+            }
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Load the segment catalog and replay the readings it holds
+ * @param pStore: [in] Catalog over the segment directory, empty
+ * @param pTable: [in] Sensor table, already loaded
+ * @param pBudget: [in] Memory budget of the history, enforced after every segment
+ * @param seq: [in] checkpointSeq of the database
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  Segments are replayed oldest first, so samples are mostly
+ *        appended and a budget evicts the oldest of them while loading. A
+ *        segment holding several blocks of one sensor, blocks of sensors
+ *        missing from the table, or no valid footer is rewritten afterwards
+ *        with one block per sensor. Blocks of a later checkpoint than seq
+ *        were appended by a checkpoint that never committed, they are
+ *        left out and cut off by the rewrite, since the log replays their
+ *        readings. Leftover temporary files of an interrupted rewrite are
+ *        deleted.
+ */
+int parse_readSegments(Segment_Store_t *pStore, Table_t *pTable, Budget_t *pBudget, uint64_t seq)
+{
+    struct dirent *pEntry = NULL;
+    DIR *pDir = NULL;
+    char *pEnd = NULL;
+    uint32_t *pSeen = NULL;
+    unsigned long start = 0;
+    uint32_t row = 0;
+    uint32_t i = 0;
+    int status = STATUS_SUCCESS;
+
+    pStore->committedSeq = seq;
+    pDir = fdopendir(dup(pStore->dirFd));
+    if (NULL == pDir) {
+        perror("fdopendir");
+        return STATUS_ERROR;
+    }
+
+    while (NULL != (pEntry = readdir(pDir))) {
+        start = strtoul(pEntry->d_name, &pEnd, 10);
+        if (pEnd == pEntry->d_name || start > UINT32_MAX || start % SEGMENT_WIDTH != 0) {
+            continue;
+        }
+
+        if (0 == strcmp(pEnd, ".tmp")) {
+            unlinkat(pStore->dirFd, pEntry->d_name, 0);
+        } else if (0 == strcmp(pEnd, ".seg") && -1 == segment_insert(pStore, (uint32_t)start)) {
+            status = STATUS_ERROR;
+            break;
+        }
+    }
+    closedir(pDir);
+
+    // per row, index + 1 of the last segment that held one of its blocks
+    pSeen = calloc(pTable->count + 1, sizeof(uint32_t));
+    if (STATUS_SUCCESS != status || NULL == pSeen) {
+        free(pSeen);
+        return STATUS_ERROR;
+    }
+
+    for (i = 0; i < pStore->count && STATUS_SUCCESS == status; i++) {
+        status = parse_loadSegment(pStore, i, pTable, pSeen);
+        if (STATUS_SUCCESS == status && 0 != pBudget->limit) {
+            // only what the files hold can be evicted
+            for (row = 0; row < pTable->count; row++) {
+                history_markSaved(&pTable->pHistory[row], pTable->pHistory[row].count);
+            }
+            budget_enforce(pBudget, pTable);
+        }
+    }
+    free(pSeen);
+
+    if (STATUS_SUCCESS != status) {
+        return STATUS_ERROR;
+    }
+
+    for (i = 0; i < pTable->count; i++) {
+        history_markSaved(&pTable->pHistory[i], pTable->pHistory[i].count);
+    }
+
+    for (i = pStore->count; i > 0; i--) {
+        if (true == pStore->pSegments[i - 1].rewrite &&
+            STATUS_SUCCESS != parse_rewriteSegment(pStore, i - 1, pTable)) {
+            return STATUS_ERROR;
+        }
+    }
+
+    for (i = 0; i < pStore->count; i++) {
+        pStore->pSegments[i].rewrite = false;
+    }
 
     return STATUS_SUCCESS;
 }
+
+/**
+ * @brief  Write the sealed readings to their segments
+ * @param pStore: [in] Segment catalog
+ * @param pTable: [in] Sensor table, saved positions are updated
+ * @param window: [in] Lateness window in seconds, readings newer than this
+ *                relative to the sensor's newest reading or the clock stay
+ *                in the reorder buffer, 0 seals everything
+ * @param seq: [in] Checkpoint the blocks are written for, named in each block
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  Sorted runs cost one appended block per sensor per segment touched,
+ *        plus a new footer for each of those segments. Readings that missed
+ *        the window are appended as extra blocks of their own, the segment
+ *        is left overlapping and merged when read. Segments that may hold
+ *        blocks of removed sensors, picked by the ID range of their zone
+ *        map, are compacted first without those blocks. The blocks only
+ *        count once the database of checkpoint seq is committed.
+ */
+int parse_outputSegments(Segment_Store_t *pStore, Table_t *pTable, uint32_t window, uint64_t seq)
+{
+    History_Series_t *pSeries = NULL;
+    Segment_t *pSegment = NULL;
+    const char *pRemoved = NULL;
+    uint32_t now = (uint32_t)time(NULL);
+    uint32_t newest = 0;
+    uint32_t sealed = 0;
+    uint32_t start = 0;
+    uint32_t row = 0;
+    uint32_t first = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    int index = -1;
+    int status = STATUS_SUCCESS;
+
+    if (pStore->dirFd < 0) {
+        return STATUS_ERROR;
+    }
+
+    for (i = 0; i < pTable->removed.count; i++) {
+        pRemoved = dict_string(&pTable->removed, i);
+        for (j = 0; j < pStore->count; j++) {
+            if (true == segment_zoneHasId(&pStore->pSegments[j].zone, pRemoved)) {
+                pStore->pSegments[j].rewrite = true;
+            }
+        }
+    }
+
+    // a rewrite compacts what the file holds, late readings and tails are appended after it
+    for (i = pStore->count; i > 0 && STATUS_SUCCESS == status; i--) {
+        if (true == pStore->pSegments[i - 1].rewrite) {
+            status = parse_rewriteSegment(pStore, i - 1, pTable);
+        }
+    }
+
+    // the rewrites dropped the blocks of removed sensors, after a failed one the IDs and marks stay for
+    // the next flush; blocks of a sensor added again under the same ID must survive later rewrites
+    if (STATUS_SUCCESS == status) {
+        dict_clear(&pTable->removed);
+    }
+
+    for (row = 0; row < pTable->count && STATUS_SUCCESS == status; row++) {
+        pSeries = &pTable->pHistory[row];
+
+        // late readings, one block per run falling into the same segment
+        history_sort(pSeries->pLate, pSeries->lateCount);
+        for (i = 0; i < pSeries->lateCount && STATUS_SUCCESS == status; i = j) {
+            start = segment_startOf(pSeries->pLate[i].timestamp);
+            j = i + 1;
+            while (j < pSeries->lateCount && pSeries->pLate[j].timestamp <= segment_last(start)) {
+                j++;
+            }
+
+            index = segment_insert(pStore, start);
+            if (-1 == index) {
+                status = STATUS_ERROR;
+            } else {
+                status = parse_appendBlock(pStore, index, pTable->pCold[row].sensorId, &pSeries->pLate[i], j - i,
+                                           seq);
+            }
+        }
+
+        // the part of the reorder buffer older than the window
+        sealed = pSeries->count;
+        if (0 != window && 0 != pSeries->count) {
+            newest = pSeries->pSamples[pSeries->count - 1].timestamp;
+            newest = (newest > now) ? newest : now;
+            sealed = (newest < window) ? 0 : history_range(pSeries, 0, newest - window, &first);
+            sealed = (sealed < pSeries->saved) ? pSeries->saved : sealed;
+        }
+
+        // sealed tail, one block per run of samples falling into the same segment
+        for (i = pSeries->saved; i < sealed && STATUS_SUCCESS == status; i = j) {
+            start = segment_startOf(pSeries->pSamples[i].timestamp);
+            j = i + 1;
+            while (j < sealed && pSeries->pSamples[j].timestamp <= segment_last(start)) {
+                j++;
+            }
+
+            index = segment_insert(pStore, start);
+            if (-1 == index) {
+                status = STATUS_ERROR;
+            } else {
+                status = parse_appendBlock(pStore, index, pTable->pCold[row].sensorId, &pSeries->pSamples[i], j - i,
+                                           seq);
+            }
+        }
+
+        if (STATUS_SUCCESS == status) {
+            history_markSaved(pSeries, sealed);
+        }
+    }
+
+    // the log is emptied after a checkpoint, what it sealed has to be on disk by then
+    for (i = 0; i < pStore->count; i++) {
+        pSegment = &pStore->pSegments[i];
+        if (true == pSegment->dirty) {
+            if (STATUS_SUCCESS != parse_writeFooter(pSegment->fd, &pSegment->zone, pSegment->end)) {
+                status = STATUS_ERROR;
+            } else if (0 != fdatasync(pSegment->fd)) {
+                perror("fdatasync");
+                status = STATUS_ERROR;
+            }
+            pSegment->dirty = false;
+        }
+        if (-1 != pSegment->fd) {
+            close(pSegment->fd);
+            pSegment->fd = -1;
+        }
+    }
+
+    // new, compacted and dropped segment files
+    if (0 != fsync(pStore->dirFd)) {
+        perror("fsync");
+        status = STATUS_ERROR;
+    }
+
+    return status;
+}
+
+/**
+ * @brief  Read the stored readings of one sensor over a time range
+ * @param pStore: [in] Segment catalog
+ * @param pSensorId: [in] Sensor ID
+ * @param fromTs: [in] First timestamp, inclusive
+ * @param toTs: [in] Last timestamp, inclusive
+ * @param ppSamples: [in] Buffer the readings are appended to, grown as needed
+ * @param pCount: [in] Number of samples in the buffer, updated
+ * @param pCapacity: [in] Capacity of the buffer, updated
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  Zone maps rule out the segments outside the range or the sensor's
+ *        ID range. Block headers and samples are read through the buffer
+ *        cache, blocks of other sensors are skipped without reading them.
+ *        Late blocks overlap, so the appended samples are sorted at the end.
+ */
+int parse_readSamples(Segment_Store_t *pStore, const char *pSensorId, uint32_t fromTs, uint32_t toTs,
+                      History_Sample_t **ppSamples, uint32_t *pCount, uint32_t *pCapacity)
+{
+    Parse_SegmentBlock_t block;
+    Parse_HistorySample_t records[PARSE_WRITE_BATCH];
+    const Segment_t *pSegment = NULL;
+    History_Sample_t *pGrown = NULL;
+    uint32_t first = *pCount;
+    uint32_t capacity = 0;
+    uint32_t offset = 0;
+    uint32_t remaining = 0;
+    uint32_t timestamp = 0;
+    uint32_t blockSize = 0;
+    uint32_t index = 0;
+    uint32_t n = 0;
+    uint32_t i = 0;
+    unsigned int temp = 0;
+    bool sorted = true;
+
+    for (; index < pStore->count && pStore->pSegments[index].start <= toTs; index++) {
+        pSegment = &pStore->pSegments[index];
+        if (pSegment->zone.maxTs < fromTs || pSegment->zone.minTs > toTs ||
+            true != segment_zoneHasId(&pSegment->zone, pSensorId)) {
+            continue;
+        }
+
+        // blocks of a checkpoint that failed to commit hold saved readings all the same
+        blockSize = parse_segmentBlockSize(pSegment->version);
+        offset = sizeof(Parse_SegmentHeader_t);
+        while (offset + blockSize <= pSegment->end) {
+            if (STATUS_SUCCESS != segment_read(pStore, index, offset, &block, blockSize)) {
+                return STATUS_ERROR;
+            }
+            block.block.sensorId[sizeof(block.block.sensorId) - 1] = '\0';
+            remaining = ntohl(block.block.count);
+            offset += blockSize;
+            if (0 != strcmp(block.block.sensorId, pSensorId)) {
+                offset += remaining * sizeof(Parse_HistorySample_t);
+                continue;
+            }
+
+            for (; remaining > 0; remaining -= n) {
+                n = (remaining > PARSE_WRITE_BATCH) ? PARSE_WRITE_BATCH : remaining;
+                if (STATUS_SUCCESS != segment_read(pStore, index, offset, records, n * sizeof(Parse_HistorySample_t))) {
+                    return STATUS_ERROR;
+                }
+                offset += n * sizeof(Parse_HistorySample_t);
+
+                if (*pCount + n > *pCapacity) {
+                    capacity = (*pCount + n) * 2;
+                    pGrown = realloc(*ppSamples, capacity * sizeof(History_Sample_t));
+                    if (NULL == pGrown) {
+                        printf("Realloc failed to read stored readings\r\n");
+                        return STATUS_ERROR;
+                    }
+                    *ppSamples = pGrown;
+                    *pCapacity = capacity;
+                }
+
+                for (i = 0; i < n; i++) {
+                    timestamp = ntohl(records[i].timestamp);
+                    if (timestamp < fromTs || timestamp > toTs) {
+                        continue;
+                    }
+                    if (*pCount > first && (*ppSamples)[*pCount - 1].timestamp > timestamp) {
+                        sorted = false;
+                    }
+                    temp = ntohl(*(unsigned int*)&records[i].value);
+                    (*ppSamples)[*pCount].timestamp = timestamp;
+                    (*ppSamples)[*pCount].value = *(float*)&temp;
+                    (*pCount)++;
+                }
+            }
+        }
+    }
+
+    if (true != sorted) {
+        history_sort(&(*ppSamples)[first], *pCount - first);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Load the quantile sketches of the sensors in the table
+ * @param fd: [in] Sketch file descriptor
+ * @param pTable: [in] Sensor table, already loaded
+ * @param seq: [in] Checkpoint of the loaded database
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  Sensors missing from the table are skipped, so a sketch file that
+ *        is older than the database still loads. A file naming another
+ *        checkpoint is refused, its sketches and the log would not add up.
+ */
+int parse_readSketches(int fd, Table_t *pTable, uint64_t seq)
+{
+    Parse_SketchHeader_t header = {0};
+    Parse_SketchSensor_t sensor;
+    Parse_SketchBucket_t record;
+    Sketch_Bucket_t bucket;
+    Sketch_Series_t *pSeries = NULL;
+    uint32_t sensors = 0;
+    uint32_t buckets = 0;
+    int row = -1;
+    unsigned int temp = 0;
+    ssize_t got = 0;
+
+    lseek(fd, 0, SEEK_SET);
+    got = parse_readSideHeader(fd, SKETCH_MAGIC, SKETCH_VERSION, &header);
+    if (0 == got) {
+        return STATUS_SUCCESS;
+    }
+
+    if (got < 0) {
+        printf("Improper sketch file\r\n");
+        return STATUS_ERROR;
+    }
+
+    if (sizeof(header) == got && seq != be64toh(header.seq)) {
+        printf("Sketch file is of checkpoint %llu, the database of %llu\r\n",
+               (unsigned long long)be64toh(header.seq), (unsigned long long)seq);
+        return STATUS_ERROR;
+    }
+
+    sensors = ntohl(header.sensors);
+    for (; sensors > 0; sensors--) {
+        if (sizeof(sensor) != read(fd, &sensor, sizeof(sensor))) {
+            printf("Truncated sketch file\r\n");
+            return STATUS_ERROR;
+        }
+        sensor.sensorId[sizeof(sensor.sensorId) - 1] = '\0';
+        row = table_find(pTable, sensor.sensorId);
+        pSeries = (-1 == row) ? NULL : &pTable->pSketch[row];
+
+        for (buckets = ntohl(sensor.buckets); buckets > 0; buckets--) {
+            if (sizeof(record) != read(fd, &record, sizeof(record))) {
+                printf("Truncated sketch file\r\n");
+                return STATUS_ERROR;
+            }
+
+            memset(&bucket, 0, sizeof(bucket));
+            bucket.start = ntohl(record.start);
+            bucket.sketch.count = ntohl(record.count);
+            bucket.sketch.zeroCount = ntohl(record.zeroCount);
+
+            temp = ntohl(*(unsigned int*)&record.min);
+            bucket.sketch.min = *(float*)&temp;
+
+            temp = ntohl(*(unsigned int*)&record.max);
+            bucket.sketch.max = *(float*)&temp;
+
+            if (STATUS_SUCCESS != parse_readSketchStore(fd, (NULL == pSeries) ? NULL : &bucket.sketch.positive,
+                                                        (int32_t)ntohl(record.positiveOffset), ntohl(record.positiveBins)) ||
+                STATUS_SUCCESS != parse_readSketchStore(fd, (NULL == pSeries) ? NULL : &bucket.sketch.negative,
+                                                        (int32_t)ntohl(record.negativeOffset), ntohl(record.negativeBins))) {
+                sketch_free(&bucket.sketch);
+                printf("Truncated sketch file\r\n");
+                return STATUS_ERROR;
+            }
+
+            if (NULL != pSeries && STATUS_SUCCESS != sketch_seriesAppend(pSeries, &bucket)) {
+                sketch_free(&bucket.sketch);
+                printf("Corrupted sketch file\r\n");
+                return STATUS_ERROR;
+            }
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Write the quantile sketches of every sensor
+ * @param fd: [in] Sketch file descriptor
+ * @param pTable: [in] Sensor table
+ * @param seq: [in] Checkpoint of the database written with the sketches
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int parse_outputSketches(int fd, const Table_t *pTable, uint64_t seq)
+{
+    Parse_SketchHeader_t header = {0};
+    Parse_SketchSensor_t sensor;
+    Parse_SketchBucket_t record;
+    const Sketch_Series_t *pSeries = NULL;
+    const Sketch_t *pSketch = NULL;
+    uint32_t row = 0;
+    uint32_t i = 0;
+    unsigned int temp = 0;
+    int status = STATUS_SUCCESS;
+
+    if (fd < 0) {
+        return STATUS_ERROR;
+    }
+
+    header.magic = htonl(SKETCH_MAGIC);
+    header.version = htons(SKETCH_VERSION);
+    header.sensors = htonl(pTable->count);
+    header.seq = htobe64(seq);
+
+    lseek(fd, 0, SEEK_SET);
+    parse_write(fd, &header, sizeof(header), &status);
+
+    for (; row < pTable->count && STATUS_SUCCESS == status; row++) {
+        pSeries = &pTable->pSketch[row];
+        memset(&sensor, 0, sizeof(sensor));
+        memcpy(sensor.sensorId, pTable->pCold[row].sensorId, sizeof(sensor.sensorId));
+        sensor.buckets = htonl(pSeries->count);
+        parse_write(fd, &sensor, sizeof(sensor), &status);
+
+        for (i = 0; i < pSeries->count; i++) {
+            pSketch = &pSeries->pBuckets[i].sketch;
+            record.start = htonl(pSeries->pBuckets[i].start);
+            record.count = htonl(pSketch->count);
+            record.zeroCount = htonl(pSketch->zeroCount);
+
+            temp = htonl(*(unsigned int*)&pSketch->min);
+            record.min = *(float*)&temp;
+
+            temp = htonl(*(unsigned int*)&pSketch->max);
+            record.max = *(float*)&temp;
+
+            record.positiveOffset = (int32_t)htonl((uint32_t)pSketch->positive.offset);
+            record.positiveBins = htonl(pSketch->positive.bins);
+            record.negativeOffset = (int32_t)htonl((uint32_t)pSketch->negative.offset);
+            record.negativeBins = htonl(pSketch->negative.bins);
+            parse_write(fd, &record, sizeof(record), &status);
+
+            parse_writeSketchStore(fd, &pSketch->positive, &status);
+            parse_writeSketchStore(fd, &pSketch->negative, &status);
+        }
+    }
+
+    parse_truncate(fd, lseek(fd, 0, SEEK_CUR), &status);
+
+    return status;
+}
+
+/**
+ * @brief  Load the readings the reorder buffers held at the last checkpoint
+ * @param fd: [in] Reorder file descriptor
+ * @param pTable: [in] Sensor table, its segments already loaded
+ * @param seq: [in] Checkpoint of the loaded database
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  Blocks of sensors missing from the table are skipped. The samples
+ *        are left unsaved, the window seals them as if they never left
+ *        memory. A file naming another checkpoint is refused.
+ */
+int parse_readReorder(int fd, Table_t *pTable, uint64_t seq)
+{
+    Parse_SideHeader_t header;
+    Parse_HistoryBlock_t block;
+    Parse_HistorySample_t records[PARSE_WRITE_BATCH];
+    History_Series_t *pSeries = NULL;
+    uint32_t blocks = 0;
+    uint32_t remaining = 0;
+    uint32_t n = 0;
+    uint32_t i = 0;
+    unsigned int temp = 0;
+    float value = 0.0f;
+    ssize_t got = 0;
+    int row = -1;
+
+    lseek(fd, 0, SEEK_SET);
+    got = read(fd, &header, sizeof(header));
+    if (0 == got) {
+        return STATUS_SUCCESS;
+    }
+
+    if (sizeof(header) != got || REORDER_MAGIC != ntohl(header.magic) || REORDER_VERSION != ntohs(header.version)) {
+        printf("Improper reorder file\r\n");
+        return STATUS_ERROR;
+    }
+
+    if (seq != be64toh(header.seq)) {
+        printf("Reorder file is of checkpoint %llu, the database of %llu\r\n",
+               (unsigned long long)be64toh(header.seq), (unsigned long long)seq);
+        return STATUS_ERROR;
+    }
+
+    for (blocks = ntohl(header.sensors); blocks > 0; blocks--) {
+        if (sizeof(block) != read(fd, &block, sizeof(block))) {
+            printf("Truncated reorder file\r\n");
+            return STATUS_ERROR;
+        }
+        block.sensorId[sizeof(block.sensorId) - 1] = '\0';
+        row = table_find(pTable, block.sensorId);
+        pSeries = (-1 == row) ? NULL : &pTable->pHistory[row];
+
+        for (remaining = ntohl(block.count); remaining > 0; remaining -= n) {
+            n = (remaining > PARSE_WRITE_BATCH) ? PARSE_WRITE_BATCH : remaining;
+            if ((ssize_t)(n * sizeof(Parse_HistorySample_t)) != read(fd, records, n * sizeof(Parse_HistorySample_t))) {
+                printf("Truncated reorder file\r\n");
+                return STATUS_ERROR;
+            }
+            if (NULL == pSeries) {
+                continue;
+            }
+
+            for (i = 0; i < n; i++) {
+                temp = ntohl(*(unsigned int*)&records[i].value);
+                value = *(float*)&temp;
+                if (STATUS_SUCCESS != history_add(pSeries, ntohl(records[i].timestamp), value)) {
+                    return STATUS_ERROR;
+                }
+            }
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Write the readings of every reorder buffer
+ * @param fd: [in] Reorder file descriptor
+ * @param pTable: [in] Sensor table, just sealed
+ * @param seq: [in] Checkpoint of the database written with the file
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int parse_outputReorder(int fd, const Table_t *pTable, uint64_t seq)
+{
+    Parse_SideHeader_t header;
+    Segment_Zone_t zone;
+    const History_Series_t *pSeries = NULL;
+    uint32_t blocks = 0;
+    uint32_t row = 0;
+    off_t size = sizeof(header);
+    int status = STATUS_SUCCESS;
+
+    if (fd < 0) {
+        return STATUS_ERROR;
+    }
+
+    for (row = 0; row < pTable->count; row++) {
+        blocks += (pTable->pHistory[row].count > pTable->pHistory[row].saved) ? 1 : 0;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = htonl(REORDER_MAGIC);
+    header.version = htons(REORDER_VERSION);
+    header.sensors = htonl(blocks);
+    header.seq = htobe64(seq);
+
+    lseek(fd, 0, SEEK_SET);
+    parse_write(fd, &header, sizeof(header), &status);
+
+    segment_zoneClear(&zone);
+    for (row = 0; row < pTable->count && STATUS_SUCCESS == status; row++) {
+        pSeries = &pTable->pHistory[row];
+        if (pSeries->count > pSeries->saved) {
+            size += parse_writeBlock(fd, pTable->pCold[row].sensorId, &pSeries->pSamples[pSeries->saved],
+                                     pSeries->count - pSeries->saved, NULL, &zone, &status);
+        }
+    }
+
+    parse_truncate(fd, size, &status);
+
+    return status;
+}
+
+/**
+ * @brief  Write a checkpoint of the table and its side files
+ * @param pDbPath: [in] Path of the database
+ * @param dbfd: [in] Database file, refers to the new file afterwards
+ * @param pDbhdr: [in] Database header, checkpointSeq set to the last mutation the table holds
+ * @param pTable: [in] Sensor table
+ * @param pSide: [in] Side files, their descriptors refer to the new files afterwards
+ * @param window: [in] Lateness window of parse_outputSegments()
+ * @return STATUS_SUCCESS once every file is on disk and the log may be
+ *         emptied, STATUS_ERROR leaves the log to cover what is missing
+ * @note  Readings are sealed into segments, which are synced in place
+ *        in blocks naming the checkpoint, a start before it commits drops
+ *        them again. The database, index, rollups, sketches and the
+ *        readings left in the reorder buffers are written to .tmp files
+ *        and synced. Renaming the database commits the checkpoint,
+ *        the side files follow it. A crash between the renames is finished
+ *        by parse_recoverCheckpoint() at the next start.
+ */
+int parse_checkpoint(const char *pDbPath, int dbfd, Parse_DbHeader_t *pDbhdr, Table_t *pTable,
+                     Parse_SideFiles_t *pSide, uint32_t window)
+{
+    const char **pSuffixes = pCheckpointSuffixes;
+    int *pFds[PARSE_CHECKPOINT_FILES] = { &pSide->indexFd, &pSide->rollupFd, &pSide->sketchFd, &pSide->reorderFd };
+    int tmpFds[PARSE_CHECKPOINT_FILES] = { -1, -1, -1, -1 };
+    int dbTmpFd = -1;
+    int status = STATUS_SUCCESS;
+    int i = 0;
+
+    // the reorder file holds what sealing leaves in the buffers
+    status = parse_outputSegments(&pSide->segments, pTable, window, pDbhdr->checkpointSeq);
+
+    // the database goes first, while its temporary file exists nothing is committed
+    if (STATUS_SUCCESS == status) {
+        status = parse_checkpointFile(pDbPath, "", -1, pDbhdr, pTable, &dbTmpFd);
+    }
+    for (i = 0; i < PARSE_CHECKPOINT_FILES && STATUS_SUCCESS == status; i++) {
+        status = parse_checkpointFile(pDbPath, pSuffixes[i], dbTmpFd, pDbhdr, pTable, &tmpFds[i]);
+    }
+
+    if (STATUS_SUCCESS == status) {
+        status = file_commitTemp(pDbPath, "");
+    }
+
+    if (STATUS_SUCCESS != status) {
+        for (i = PARSE_CHECKPOINT_FILES; i > 0; i--) {
+            if (-1 != tmpFds[i - 1]) {
+                close(tmpFds[i - 1]);
+                file_removeTemp(pDbPath, pSuffixes[i - 1]);
+            }
+        }
+        if (-1 != dbTmpFd) {
+            close(dbTmpFd);
+            file_removeTemp(pDbPath, "");
+        }
+        printf("Checkpoint of sequence %llu failed, the log is kept\r\n", (unsigned long long)pDbhdr->checkpointSeq);
+        return STATUS_ERROR;
+    }
+
+    // committed, the side files must follow even if one of them fails
+    pSide->segments.committedSeq = pDbhdr->checkpointSeq;
+    status = file_syncDir(pDbPath);
+    dup2(dbTmpFd, dbfd);
+    close(dbTmpFd);
+    for (i = 0; i < PARSE_CHECKPOINT_FILES; i++) {
+        if (STATUS_SUCCESS != file_commitTemp(pDbPath, pSuffixes[i])) {
+            close(tmpFds[i]);
+            status = STATUS_ERROR;
+        } else if (-1 == *pFds[i]) {
+            *pFds[i] = tmpFds[i];
+        } else {
+            dup2(tmpFds[i], *pFds[i]);
+            close(tmpFds[i]);
+        }
+    }
+
+    if (STATUS_SUCCESS != file_syncDir(pDbPath) || STATUS_SUCCESS != status) {
+        printf("Checkpoint of sequence %llu is not complete, the log is kept\r\n",
+               (unsigned long long)pDbhdr->checkpointSeq);
+        return STATUS_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Clean up after a checkpoint a crash interrupted
+ * @param pDbPath: [in] Path of the database
+ * @param seq: [in] checkpointSeq of the database file
+ * @note  Once the database was renamed, the side files written with it are
+ *        renamed into place. Before that, every temporary file is dropped
+ *        and the last checkpoint stays with the log.
+ */
+void parse_recoverCheckpoint(const char *pDbPath, uint64_t seq)
+{
+    const char **pSuffixes = pCheckpointSuffixes;
+    uint64_t fileSeq = 0;
+    bool committed = true;
+    int fd = -1;
+    int i = 0;
+
+    fd = file_openTemp(pDbPath, "", false);
+    if (-1 != fd) {
+        close(fd);
+        committed = false;
+    }
+
+    for (i = 0; i < PARSE_CHECKPOINT_FILES; i++) {
+        fd = file_openTemp(pDbPath, pSuffixes[i], false);
+        if (-1 == fd) {
+            continue;
+        }
+
+        if (true == committed && true == parse_fileSeq(fd, pSuffixes[i], &fileSeq) && fileSeq == seq &&
+            STATUS_SUCCESS == file_commitTemp(pDbPath, pSuffixes[i])) {
+            printf("Finished the checkpoint of %s%s at sequence %llu\r\n", pDbPath, pSuffixes[i],
+                   (unsigned long long)seq);
+        } else {
+            file_removeTemp(pDbPath, pSuffixes[i]);
+        }
+        close(fd);
+    }
+
+    // the side files go first, a crash in between must not make them look committed
+    file_removeTemp(pDbPath, "");
+    file_syncDir(pDbPath);
+
+    return;
+}
+
+/**
+ * @brief  Read the checkpoint a file was written at
+ * @param fd: [in] Database or side file
+ * @param pSuffix: [in] "" for a database or the suffix of a side file
+ * @param pSeq: [out] checkpointSeq the file holds
+ * @return false if the file is empty, damaged or of a version without one
+ */
+bool parse_fileSeq(int fd, const char *pSuffix, uint64_t *pSeq)
+{
+    Parse_DbHeader_t dbHeader;
+    Parse_IndexHeader_t indexHeader;
+    Parse_SideHeader_t header;
+    uint32_t magic = 0;
+    uint16_t version = 0;
+
+    *pSeq = 0;
+    if (0 == strcmp(pSuffix, INDEX_SUFFIX)) {
+        if (sizeof(indexHeader) != pread(fd, &indexHeader, sizeof(indexHeader), 0) ||
+            INDEX_MAGIC != indexHeader.magic || INDEX_VERSION != indexHeader.version) {
+            return false;
+        }
+        *pSeq = indexHeader.seq;
+        return true;
+    }
+
+    if ('\0' == pSuffix[0]) {
+        if (sizeof(dbHeader) != pread(fd, &dbHeader, sizeof(dbHeader), 0) || HEADER_MAGIC != ntohl(dbHeader.magic) ||
+            DB_VERSION_CHECKPOINT != ntohs(dbHeader.version)) {
+            return false;
+        }
+        *pSeq = be64toh(dbHeader.checkpointSeq);
+        return true;
+    }
+
+    if (0 == strcmp(pSuffix, ROLLUP_SUFFIX)) {
+        magic = ROLLUP_MAGIC;
+        version = ROLLUP_VERSION;
+    } else if (0 == strcmp(pSuffix, SKETCH_SUFFIX)) {
+        magic = SKETCH_MAGIC;
+        version = SKETCH_VERSION;
+    } else if (0 == strcmp(pSuffix, REORDER_SUFFIX)) {
+        magic = REORDER_MAGIC;
+        version = REORDER_VERSION;
+    } else {
+        return false;
+    }
+
+    if (sizeof(header) != pread(fd, &header, sizeof(header), 0) || magic != ntohl(header.magic) ||
+        version != ntohs(header.version)) {
+        return false;
+    }
+    *pSeq = be64toh(header.seq);
+
+    return true;
+}
+
+/**
+ * Helper functions
+ */
+
+static int parse_insertReading(Parse_DbHeader_t *pDbhdr, Table_t *pTable, const DbProtocol_Reading_t *pReading,
+                               bool checkShard)
+{
+    bool created = false;
+    int row = -1;
+    int typeCode = -1;
+    int locationCode = -1;
+
+    // every refusal that depends on the reading comes before the table changes, a
+    // replica stops at a refused record and must not keep half of it
+    if ('\0' == pReading->sensorId[0]) {
+        printf("Empty sensor ID\r\n");
+        return STATUS_ERROR;
+    }
+
+    row = table_find(pTable, pReading->sensorId);
+    if (-1 == row) {
+        // a misrouted reading would leave the sensor on two shards
+        if (true == checkShard && 0 != shardCount && shard_of(pReading->sensorId, shardCount) != shardIndex) {
+            printf("Sensor %s belongs to shard %u of %u, not %u\r\n", pReading->sensorId,
+                   shard_of(pReading->sensorId, shardCount), shardCount, shardIndex);
+            return STATUS_ERROR;
+        }
+
+        if (pTable->count >= PARSE_MAX_SENSORS) {
+            printf("Database is full\r\n");
+            return STATUS_ERROR;
+        }
+
+        locationCode = dict_intern(&pTable->locations, "Unknown Location");
+        if (-1 == locationCode) {
+            return STATUS_ERROR;
+        }
+    }
+
+    typeCode = dict_intern(&pTable->types, pReading->sensorType);
+    if (-1 == typeCode) {
+        return STATUS_ERROR;
+    }
+
+    if (-1 == row) {
+        row = table_insert(pTable, pReading->sensorId, &created);
+        if (-1 == row) {
+            return STATUS_ERROR;
+        }
+    }
+
+    if (true == created) {
+        // Initialize the new sensor entry
+        pTable->pMinThreshold[row] = -100.0;
+        pTable->pMaxThreshold[row] = 100.0;
+        if (STATUS_SUCCESS != table_setLocation(pTable, row, locationCode)) {
+            table_remove(pTable, row);
+            return STATUS_ERROR;
+        }
+    }
+
+    if (STATUS_SUCCESS != table_setType(pTable, row, typeCode)) {
+        if (true == created) {
+            table_remove(pTable, row);
+        }
+        return STATUS_ERROR;
+    }
+    pTable->pCold[row].i2cAddr = pReading->i2cAddr;
+    pTable->pTimestamp[row] = pReading->timestamp;
+    pTable->pReading[row] = pReading->readingValue;
+    table_setFlags(pTable, row, (pTable->pFlags[row] & SENSOR_FLAG_ERROR) | SENSOR_FLAG_ACTIVE | SENSOR_FLAG_CALIBRATED);
+    parse_checkThresholds(pTable, row);
+
+    // Update count and filesize
+    parse_updateHeader(pDbhdr, pTable);
+
+    if (STATUS_SUCCESS != history_add(&pTable->pHistory[row], pReading->timestamp, pReading->readingValue)) {
+        return STATUS_ERROR;
+    }
+
+    if (STATUS_SUCCESS != sketch_seriesAdd(&pTable->pSketch[row], pReading->timestamp, pReading->readingValue)) {
+        return STATUS_ERROR;
+    }
+
+    if (STATUS_SUCCESS != rollup_add(&pTable->pRollup[row], pReading->timestamp, pReading->readingValue)) {
+        return STATUS_ERROR;
+    }
+
+    return (NULL == pLog) ? STATUS_SUCCESS : wal_append(pLog, WAL_ADD, pReading);
+}
+
+static int parse_readRecordsV1(int fd, Parse_DbHeader_t *pDbhdr, Table_t *pTable)
+{
+    int count = pDbhdr->count;
+    int i = 0;
+    int row = -1;
+    int typeCode = -1;
+    int locationCode = -1;
+    Parse_Sensor_t *pSensors = NULL;
+    Parse_Sensor_t *pSensor = NULL;
+    unsigned int temp = 0;
+
+    pSensors = calloc(count + 1, sizeof(Parse_Sensor_t));
+    if (NULL == pSensors)
+    {
+        printf("Malloc failed\r\n");
+        return STATUS_ERROR;
+    }
+
+    read(fd, pSensors, count * sizeof(Parse_Sensor_t));
+
+    for (i = 0; i < count; i++)
+    {
+        pSensor = &pSensors[i];
+        pSensor->sensorId[sizeof(pSensor->sensorId) - 1] = '\0';
+        pSensor->sensorType[sizeof(pSensor->sensorType) - 1] = '\0';
+        pSensor->location[sizeof(pSensor->location) - 1] = '\0';
+
+        typeCode = dict_intern(&pTable->types, pSensor->sensorType);
+        locationCode = dict_intern(&pTable->locations, pSensor->location);
+        row = table_insert(pTable, pSensor->sensorId, NULL);
+        if (-1 == row || -1 == typeCode || -1 == locationCode)
+        {
+            free(pSensors);
+            return STATUS_ERROR;
+        }
+
+        if (STATUS_SUCCESS != table_setType(pTable, row, typeCode) ||
+            STATUS_SUCCESS != table_setLocation(pTable, row, locationCode) ||
+            STATUS_SUCCESS != table_setFlags(pTable, row, pSensor->flags)) {
+            free(pSensors);
+            return STATUS_ERROR;
+        }
+        pTable->pCold[row].i2cAddr = pSensor->i2cAddr;
+        pTable->pTimestamp[row] = ntohl(pSensor->timestamp);
+
+        temp = ntohl(*(unsigned int*)&pSensor->readingValue);
+        pTable->pReading[row] = *(float*)&temp;
+
+        temp = ntohl(*(unsigned int*)&pSensor->minThreshold);
+        pTable->pMinThreshold[row] = *(float*)&temp;
+
+        temp = ntohl(*(unsigned int*)&pSensor->maxThreshold);
+        pTable->pMaxThreshold[row] = *(float*)&temp;
+
+        // files written before thresholds were enforced never set ERROR
+        parse_checkThresholds(pTable, row);
+    }
+
+    free(pSensors);
+
+    return STATUS_SUCCESS;
+}
+
+static int parse_readRecords(int fd, Parse_DbHeader_t *pDbhdr, Table_t *pTable, const Parse_IndexHeader_t *pIndex)
+{
+    Parse_LoadTask_t tasks[PARSE_LOAD_THREADS];
+    uint32_t *pChecksums = NULL;
+    uint32_t blocks = (pDbhdr->count + PARSE_BLOCK_RECORDS - 1) / PARSE_BLOCK_RECORDS;
+    uint32_t crc = CHECKSUM_SEED;
+    uint32_t digest = CHECKSUM_SEED;
+    uint32_t workers = 1;
+    uint32_t row = 0;
+    uint32_t i = 0;
+    uint64_t startUs = timer_nowUs();
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    off_t offset = 0;
+    size_t bytes = 0;
+    int status = STATUS_SUCCESS;
+    bool indexed = false;
+
+    if (STATUS_SUCCESS != parse_readDict(fd, &pTable->types, pDbhdr->typeCount, pDbhdr->typeBytes, &crc) ||
+        STATUS_SUCCESS != parse_readDict(fd, &pTable->locations, pDbhdr->locationCount, pDbhdr->locationBytes, &crc))
+    {
+        printf("Corrupted database dictionary\r\n");
+        return STATUS_ERROR;
+    }
+    offset = lseek(fd, 0, SEEK_CUR);
+
+    // a database just created has no checksums until its first flush
+    if (DB_VERSION_BLOCKS <= pDbhdr->version && 0 != pDbhdr->count)
+    {
+        bytes = (blocks + 1) * sizeof(uint32_t);
+        pChecksums = malloc(bytes);
+        if (NULL == pChecksums)
+        {
+            printf("Malloc failed\r\n");
+            return STATUS_ERROR;
+        }
+        if (pread(fd, pChecksums, bytes, offset + (off_t)pDbhdr->count * sizeof(Parse_Record_t)) != (ssize_t)bytes)
+        {
+            perror("pread");
+            free(pChecksums);
+            return STATUS_ERROR;
+        }
+        digest = checksum_crc32c(CHECKSUM_SEED, pChecksums, bytes);
+        for (i = 0; i <= blocks; i++)
+        {
+            pChecksums[i] = ntohl(pChecksums[i]);
+        }
+        if (crc != pChecksums[0])
+        {
+            printf("Corrupted database dictionary\r\n");
+            free(pChecksums);
+            return STATUS_ERROR;
+        }
+    }
+
+    // the saved indexes are only trusted for the very records they were built from
+    if (NULL != pIndex && NULL != pChecksums && digest == pIndex->dbDigest &&
+        pIndex->checksum == checksum_crc32c(CHECKSUM_SEED, &pIndex[1], pIndex->bytes))
+    {
+        indexed = true;
+    }
+
+    if (cpus > 1)
+    {
+        workers = (cpus > PARSE_LOAD_THREADS) ? PARSE_LOAD_THREADS : (uint32_t)cpus;
+    }
+    if (workers > blocks)
+    {
+        workers = (0 == blocks) ? 1 : blocks;
+    }
+
+    // contiguous runs of blocks, so the shards only meet at their edges
+    for (i = 0; i < workers; i++)
+    {
+        memset(&tasks[i], 0, sizeof(Parse_LoadTask_t));
+        tasks[i].fd = fd;
+        tasks[i].offset = offset;
+        tasks[i].count = pDbhdr->count;
+        tasks[i].pChecksums = (NULL == pChecksums) ? NULL : &pChecksums[1];
+        tasks[i].firstBlock = (uint32_t)((uint64_t)blocks * i / workers);
+        tasks[i].endBlock = (uint32_t)((uint64_t)blocks * (i + 1) / workers);
+        tasks[i].pTable = pTable;
+        tasks[i].indexed = indexed;
+        table_shardInit(&tasks[i].shard, tasks[i].firstBlock * PARSE_BLOCK_RECORDS);
+    }
+    for (i = 1; i < workers; i++)
+    {
+        tasks[i].spawned = (0 == pthread_create(&tasks[i].thread, NULL, parse_loadBlocks, &tasks[i]));
+    }
+    // the calling thread takes the first run, and any run no thread could be started for
+    for (i = 0; i < workers; i++)
+    {
+        if (true != tasks[i].spawned)
+        {
+            parse_loadBlocks(&tasks[i]);
+        }
+    }
+    for (i = 1; i < workers; i++)
+    {
+        if (true == tasks[i].spawned)
+        {
+            pthread_join(tasks[i].thread, NULL);
+        }
+    }
+
+    for (i = 0; i < workers; i++)
+    {
+        if (STATUS_SUCCESS == status && STATUS_SUCCESS != tasks[i].status)
+        {
+            status = STATUS_ERROR;
+        }
+        if (STATUS_SUCCESS == status && true != indexed && STATUS_SUCCESS != table_merge(pTable, &tasks[i].shard))
+        {
+            status = STATUS_ERROR;
+        }
+        table_shardFree(&tasks[i].shard);
+    }
+    free(pChecksums);
+
+    if (STATUS_SUCCESS != status)
+    {
+        printf("Corrupted database record\r\n");
+        return STATUS_ERROR;
+    }
+
+    if (true == indexed &&
+        STATUS_SUCCESS != table_loadIndex(pTable, pDbhdr->count, (const uint8_t *)&pIndex[1], pIndex->bytes))
+    {
+        printf("Corrupted database index\r\n");
+        return STATUS_ERROR;
+    }
+
+    for (row = 0; row < pTable->count; row++)
+    {
+        table_setAlert(pTable, row, 0 != (pTable->pFlags[row] & SENSOR_FLAG_ERROR));
+    }
+
+    printf("Loaded %u sensors with %u threads in %lu us, %s\r\n", pTable->count, workers,
+           (unsigned long)(timer_nowUs() - startUs), (true == indexed) ? "saved indexes" : "indexes rebuilt");
+
+    return STATUS_SUCCESS;
+}
+
+static void *parse_loadBlocks(void *pArg)
+{
+    Parse_LoadTask_t *pTask = (Parse_LoadTask_t *)pArg;
+    Parse_Record_t *pRecords = NULL;
+    uint32_t block = pTask->firstBlock;
+    uint32_t row = 0;
+    uint32_t n = 0;
+    uint32_t i = 0;
+    size_t bytes = 0;
+
+    pTask->status = STATUS_ERROR;
+
+    pRecords = malloc(PARSE_BLOCK_RECORDS * sizeof(Parse_Record_t));
+    if (NULL == pRecords)
+    {
+        printf("Malloc failed\r\n");
+        return NULL;
+    }
+
+    for (; block < pTask->endBlock; block++)
+    {
+        row = block * PARSE_BLOCK_RECORDS;
+        n = (pTask->count - row > PARSE_BLOCK_RECORDS) ? PARSE_BLOCK_RECORDS : pTask->count - row;
+        bytes = n * sizeof(Parse_Record_t);
+
+        if (pread(pTask->fd, pRecords, bytes, pTask->offset + (off_t)row * sizeof(Parse_Record_t)) != (ssize_t)bytes)
+        {
+            perror("pread");
+            free(pRecords);
+            return NULL;
+        }
+        if (NULL != pTask->pChecksums && pTask->pChecksums[block] != checksum_crc32c(CHECKSUM_SEED, pRecords, bytes))
+        {
+            printf("Checksum mismatch in database block %u\r\n", block);
+            free(pRecords);
+            return NULL;
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            if (STATUS_SUCCESS != parse_decodeRecord(pTask->pTable, row + i, &pRecords[i]) ||
+                (true != pTask->indexed && STATUS_SUCCESS != table_shardAdd(&pTask->shard, pTask->pTable)))
+            {
+                free(pRecords);
+                return NULL;
+            }
+        }
+    }
+
+    free(pRecords);
+    pTask->status = STATUS_SUCCESS;
+
+    return NULL;
+}
+
+static int parse_decodeRecord(Table_t *pTable, uint32_t row, Parse_Record_t *pRecord)
+{
+    Table_Cold_t *pCold = &pTable->pCold[row];
+    bool violation = false;
+    unsigned int temp = 0;
+
+    pRecord->sensorId[sizeof(pRecord->sensorId) - 1] = '\0';
+    pRecord->typeCode = ntohs(pRecord->typeCode);
+    pRecord->locationCode = ntohs(pRecord->locationCode);
+    if ('\0' == pRecord->sensorId[0] ||
+        pRecord->typeCode >= pTable->types.count || pRecord->locationCode >= pTable->locations.count)
+    {
+        return STATUS_ERROR;
+    }
+
+    memset(pCold, 0, sizeof(Table_Cold_t));
+    strncpy(pCold->sensorId, pRecord->sensorId, sizeof(pCold->sensorId) - 1);
+    pCold->i2cAddr = pRecord->i2cAddr;
+    pTable->pIdHash[row] = table_hashId(pCold->sensorId);
+    pTable->pTypeCode[row] = pRecord->typeCode;
+    pTable->pLocationCode[row] = pRecord->locationCode;
+    pTable->pTimestamp[row] = ntohl(pRecord->timestamp);
+
+    temp = ntohl(*(unsigned int*)&pRecord->readingValue);
+    pTable->pReading[row] = *(float*)&temp;
+
+    temp = ntohl(*(unsigned int*)&pRecord->minThreshold);
+    pTable->pMinThreshold[row] = *(float*)&temp;
+
+    temp = ntohl(*(unsigned int*)&pRecord->maxThreshold);
+    pTable->pMaxThreshold[row] = *(float*)&temp;
+
+    // same rule as parse_checkThresholds(), the alert set is filled after the merge
+    violation = (pTable->pReading[row] < pTable->pMinThreshold[row] || pTable->pReading[row] > pTable->pMaxThreshold[row]);
+    pTable->pFlags[row] = (true == violation) ? (pRecord->flags | SENSOR_FLAG_ERROR) : (pRecord->flags & ~SENSOR_FLAG_ERROR);
+
+    return STATUS_SUCCESS;
+}
+
+static int parse_readDict(int fd, Dict_t *pDict, unsigned int entries, unsigned int bytes, uint32_t *pCrc)
+{
+    char *pPool = NULL;
+    char *pStr = NULL;
+    char *pEnd = NULL;
+    unsigned int i = 0;
+
+    if (0 == bytes)
+    {
+        return (0 == entries) ? STATUS_SUCCESS : STATUS_ERROR;
+    }
+
+    pPool = malloc(bytes);
+    if (NULL == pPool)
+    {
+        printf("Malloc failed\r\n");
+        return STATUS_ERROR;
+    }
+
+    if (read(fd, pPool, bytes) != (ssize_t)bytes || '\0' != pPool[bytes - 1])
+    {
+        free(pPool);
+        return STATUS_ERROR;
+    }
+    *pCrc = checksum_crc32c(*pCrc, pPool, bytes);
+
+    // codes are positions, so interning in file order reproduces them
+    pStr = pPool;
+    pEnd = pPool + bytes;
+    for (; i < entries && pStr < pEnd; i++)
+    {
+        if ((int)i != dict_intern(pDict, pStr))
+        {
+            free(pPool);
+            return STATUS_ERROR;
+        }
+        pStr += strlen(pStr) + 1;
+    }
+
+    free(pPool);
+
+    return (i == entries && pStr == pEnd) ? STATUS_SUCCESS : STATUS_ERROR;
+}
+
+static const Parse_IndexHeader_t *parse_mapIndex(int fd, const Parse_DbHeader_t *pDbhdr, size_t *pSize)
+{
+    const Parse_IndexHeader_t *pIndex = NULL;
+    struct stat indexStat = {0};
+    void *pMap = NULL;
+
+    if (fd < 0 || 0 == pDbhdr->count || 0 != fstat(fd, &indexStat) ||
+        (size_t)indexStat.st_size < sizeof(Parse_IndexHeader_t))
+    {
+        return NULL;
+    }
+
+    pMap = mmap(NULL, indexStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED == pMap)
+    {
+        perror("mmap");
+        return NULL;
+    }
+
+    pIndex = (const Parse_IndexHeader_t *)pMap;
+    if (INDEX_MAGIC != pIndex->magic || INDEX_VERSION != pIndex->version ||
+        pIndex->count != pDbhdr->count || pIndex->seq != pDbhdr->checkpointSeq ||
+        pIndex->capacity < pIndex->count || pIndex->capacity > PARSE_MAX_SENSORS ||
+        pIndex->bytes != (uint64_t)indexStat.st_size - sizeof(Parse_IndexHeader_t))
+    {
+        printf("Index file does not match the database, rebuilding the indexes\r\n");
+        munmap(pMap, indexStat.st_size);
+        return NULL;
+    }
+    *pSize = indexStat.st_size;
+
+    return pIndex;
+}
+
+static int parse_dbDigest(int fd, const Parse_DbHeader_t *pDbhdr, uint32_t *pDigest)
+{
+    uint32_t *pChecksums = NULL;
+    size_t bytes = sizeof(uint32_t) * (1 + (pDbhdr->count + PARSE_BLOCK_RECORDS - 1) / PARSE_BLOCK_RECORDS);
+
+    pChecksums = malloc(bytes);
+    if (NULL == pChecksums)
+    {
+        printf("Malloc failed\r\n");
+        return STATUS_ERROR;
+    }
+
+    // the checksums end the file
+    if (pread(fd, pChecksums, bytes, (off_t)pDbhdr->filesize - bytes) != (ssize_t)bytes)
+    {
+        perror("pread");
+        free(pChecksums);
+        return STATUS_ERROR;
+    }
+    *pDigest = checksum_crc32c(CHECKSUM_SEED, pChecksums, bytes);
+    free(pChecksums);
+
+    return STATUS_SUCCESS;
+}
+
+static void parse_updateHeader(Parse_DbHeader_t *pDbhdr, const Table_t *pTable)
+{
+    pDbhdr->count = pTable->count;
+    pDbhdr->typeCount = pTable->types.count;
+    pDbhdr->typeBytes = pTable->types.poolLen;
+    pDbhdr->locationCount = pTable->locations.count;
+    pDbhdr->locationBytes = pTable->locations.poolLen;
+    pDbhdr->filesize = sizeof(Parse_DbHeader_t) + pDbhdr->typeBytes + pDbhdr->locationBytes +
+                       sizeof(Parse_Record_t) * pDbhdr->count +
+                       sizeof(uint32_t) * (1 + (pDbhdr->count + PARSE_BLOCK_RECORDS - 1) / PARSE_BLOCK_RECORDS);
+
+    return;
+}
+
+static void parse_write(int fd, const void *pBuf, size_t bytes, int *pStatus)
+{
+    const char *pData = pBuf;
+    ssize_t written = 0;
+
+    while (STATUS_SUCCESS == *pStatus && bytes > 0) {
+        written = write(fd, pData, bytes);
+        if (-1 == written && EINTR == errno) {
+            continue;
+        }
+        if (written <= 0) {
+            perror("write");
+            *pStatus = STATUS_ERROR;
+            break;
+        }
+        pData += written;
+        bytes -= (size_t)written;
+    }
+
+    return;
+}
+
+static void parse_truncate(int fd, off_t size, int *pStatus)
+{
+    if (STATUS_SUCCESS == *pStatus && 0 != ftruncate(fd, size)) {
+        perror("ftruncate");
+        *pStatus = STATUS_ERROR;
+    }
+
+    return;
+}
+
+static int parse_checkpointFile(const char *pDbPath, const char *pSuffix, int dbTmpFd, Parse_DbHeader_t *pDbhdr,
+                                Table_t *pTable, int *pTmpFd)
+{
+    int fd = -1;
+    int status = STATUS_ERROR;
+
+    fd = file_openTemp(pDbPath, pSuffix, true);
+    if (-1 == fd) {
+        return STATUS_ERROR;
+    }
+
+    if ('\0' == pSuffix[0]) {
+        status = parse_outputFile(fd, pDbhdr, pTable);
+    } else if (0 == strcmp(pSuffix, INDEX_SUFFIX)) {
+        status = parse_outputIndex(fd, dbTmpFd, pDbhdr, pTable);
+    } else if (0 == strcmp(pSuffix, ROLLUP_SUFFIX)) {
+        status = parse_outputRollups(fd, pTable, pDbhdr->checkpointSeq);
+    } else if (0 == strcmp(pSuffix, SKETCH_SUFFIX)) {
+        status = parse_outputSketches(fd, pTable, pDbhdr->checkpointSeq);
+    } else if (0 == strcmp(pSuffix, REORDER_SUFFIX)) {
+        status = parse_outputReorder(fd, pTable, pDbhdr->checkpointSeq);
+    }
+
+    if (STATUS_SUCCESS == status && 0 != fsync(fd)) {
+        perror("fsync");
+        status = STATUS_ERROR;
+    }
+
+    if (STATUS_SUCCESS != status) {
+        printf("Failed to write %s%s%s\r\n", pDbPath, pSuffix, FILE_TMP_SUFFIX);
+        close(fd);
+        file_removeTemp(pDbPath, pSuffix);
+        return STATUS_ERROR;
+    }
+    *pTmpFd = fd;
+
+    return STATUS_SUCCESS;
+}
+
+static ssize_t parse_readSideHeader(int fd, uint32_t magic, uint16_t version, Parse_SideHeader_t *pHeader)
+{
+    ssize_t got = 0;
+
+    memset(pHeader, 0, sizeof(Parse_SideHeader_t));
+    got = read(fd, pHeader, PARSE_SIDE_HEADER_V1);
+    if (0 == got) {
+        return 0;
+    }
+
+    if (PARSE_SIDE_HEADER_V1 != got || magic != ntohl(pHeader->magic) ||
+        (1 != ntohs(pHeader->version) && version != ntohs(pHeader->version))) {
+        return -1;
+    }
+
+    // version 2 goes on with the checkpoint
+    if (1 != ntohs(pHeader->version)) {
+        if ((ssize_t)(sizeof(Parse_SideHeader_t) - PARSE_SIDE_HEADER_V1) !=
+            read(fd, (char *)pHeader + PARSE_SIDE_HEADER_V1, sizeof(Parse_SideHeader_t) - PARSE_SIDE_HEADER_V1)) {
+            return -1;
+        }
+        got = sizeof(Parse_SideHeader_t);
+    }
+
+    return got;
+}
+
+static int parse_readSketchStore(int fd, Sketch_Store_t *pStore, int32_t offset, uint32_t bins)
+{
+    uint32_t counts[SKETCH_MAX_BINS];
+    uint32_t i = 0;
+
+    if (bins > SKETCH_MAX_BINS) {
+        return STATUS_ERROR;
+    }
+
+    if ((ssize_t)(bins * sizeof(uint32_t)) != read(fd, counts, bins * sizeof(uint32_t))) {
+        return STATUS_ERROR;
+    }
+
+    if (NULL == pStore) {
+        return STATUS_SUCCESS;
+    }
+
+    for (; i < bins; i++) {
+        counts[i] = ntohl(counts[i]);
+    }
+
+    return sketch_setStore(pStore, offset, counts, bins);
+}
+
+static void parse_writeSketchStore(int fd, const Sketch_Store_t *pStore, int *pStatus)
+{
+    uint32_t counts[SKETCH_MAX_BINS];
+    uint32_t i = 0;
+
+    for (; i < pStore->bins; i++) {
+        counts[i] = htonl(pStore->pCounts[i]);
+    }
+    parse_write(fd, counts, pStore->bins * sizeof(uint32_t), pStatus);
+
+    return;
+}
+
+static int parse_loadSegment(Segment_Store_t *pStore, uint32_t index, Table_t *pTable, uint32_t *pSeen)
+{
+    Segment_t *pSegment = &pStore->pSegments[index];
+    Parse_SegmentHeader_t header;
+    Parse_SegmentFooter_t footer;
+    Parse_SegmentBlock_t block;
+    Parse_HistorySample_t records[PARSE_WRITE_BATCH];
+    History_Series_t *pSeries = NULL;
+    char name[SEGMENT_NAME_LEN];
+    struct stat st;
+    off_t offset = sizeof(header);
+    off_t end = 0;
+    uint64_t seq = 0;
+    uint32_t blockSize = 0;
+    uint32_t remaining = 0;
+    uint32_t n = 0;
+    uint32_t i = 0;
+    uint32_t timestamp = 0;
+    uint32_t minTs = 0;
+    uint32_t maxTs = 0;
+    unsigned int temp = 0;
+    float value = 0.0f;
+    float minValue = 0.0f;
+    float maxValue = 0.0f;
+    bool hasFooter = false;
+    bool uncommitted = false;
+    int found = -1;
+    int fd = -1;
+
+    segment_name(pSegment->start, false, name);
+    fd = openat(pStore->dirFd, name, O_RDONLY);
+    if (-1 == fd || -1 == fstat(fd, &st)) {
+        perror("openat");
+        if (-1 != fd) {
+            close(fd);
+        }
+        return STATUS_ERROR;
+    }
+
+    if (sizeof(header) != read(fd, &header, sizeof(header)) || SEGMENT_MAGIC != ntohl(header.magic) ||
+        (SEGMENT_VERSION != ntohs(header.version) && SEGMENT_VERSION_V1 != ntohs(header.version)) ||
+        pSegment->start != ntohl(header.start)) {
+        printf("Improper segment file %s\r\n", name);
+        close(fd);
+        return STATUS_ERROR;
+    }
+    // blocks of a version 1 file carry no checkpoint, they were all committed
+    pSegment->version = ntohs(header.version);
+    pSegment->rewrite = (SEGMENT_VERSION != pSegment->version);
+    blockSize = parse_segmentBlockSize(pSegment->version);
+
+    // the footer says where the blocks end, without one the file is scanned to its last whole block
+    end = st.st_size;
+    if (st.st_size >= (off_t)(sizeof(header) + sizeof(footer)) &&
+        sizeof(footer) == pread(fd, &footer, sizeof(footer), st.st_size - sizeof(footer)) &&
+        SEGMENT_FOOTER_MAGIC == ntohl(footer.magic) &&
+        (off_t)ntohl(footer.blocksEnd) + (off_t)sizeof(footer) == st.st_size) {
+        end = ntohl(footer.blocksEnd);
+        // the zone map was saved with the blocks, only a recovered file needs it rebuilt
+        parse_readFooter(&footer, &pSegment->zone);
+        hasFooter = true;
+    } else {
+        printf("Segment %s has no footer, recovering its blocks\r\n", name);
+        pSegment->rewrite = true;
+    }
+
+    while (offset + (off_t)blockSize <= end) {
+        if ((ssize_t)blockSize != read(fd, &block, blockSize)) {
+            break;
+        }
+        block.block.sensorId[sizeof(block.block.sensorId) - 1] = '\0';
+        remaining = ntohl(block.block.count);
+        if (0 == remaining || offset + (off_t)blockSize + (off_t)remaining * (off_t)sizeof(Parse_HistorySample_t) > end) {
+            break;
+        }
+
+        // checkpoints append in order, every later block is just as uncommitted
+        seq = (SEGMENT_VERSION == pSegment->version) ? be64toh(block.seq) : 0;
+        if (seq > pStore->committedSeq) {
+            printf("Segment %s holds readings of checkpoint %llu the database does not, dropping them\r\n", name,
+                   (unsigned long long)seq);
+            pSegment->rewrite = true;
+            uncommitted = true;
+            break;
+        }
+        offset += blockSize + (off_t)remaining * sizeof(Parse_HistorySample_t);
+
+        found = table_find(pTable, block.block.sensorId);
+        pSeries = (-1 == found) ? NULL : &pTable->pHistory[found];
+        if (NULL == pSeries || index + 1 == pSeen[found]) {
+            pSegment->rewrite = true;
+        }
+        if (NULL != pSeries) {
+            pSeen[found] = index + 1;
+        }
+
+        minTs = UINT32_MAX;
+        maxTs = 0;
+        for (; remaining > 0; remaining -= n) {
+            n = (remaining > PARSE_WRITE_BATCH) ? PARSE_WRITE_BATCH : remaining;
+            if ((ssize_t)(n * sizeof(Parse_HistorySample_t)) != read(fd, records, n * sizeof(Parse_HistorySample_t))) {
+                printf("Segment %s ends early\r\n", name);
+                close(fd);
+                return STATUS_ERROR;
+            }
+
+            for (i = 0; i < n; i++) {
+                timestamp = ntohl(records[i].timestamp);
+                temp = ntohl(*(unsigned int*)&records[i].value);
+                value = *(float*)&temp;
+                if (UINT32_MAX == minTs) {
+                    minValue = value;
+                    maxValue = value;
+                }
+                minTs = (timestamp < minTs) ? timestamp : minTs;
+                maxTs = (timestamp > maxTs) ? timestamp : maxTs;
+                minValue = (value < minValue) ? value : minValue;
+                maxValue = (value > maxValue) ? value : maxValue;
+                if (NULL != pSeries && STATUS_SUCCESS != history_add(pSeries, timestamp, value)) {
+                    close(fd);
+                    return STATUS_ERROR;
+                }
+            }
+        }
+
+        if (true != hasFooter) {
+            segment_zoneAdd(&pSegment->zone, block.block.sensorId, minTs, maxTs, minValue, maxValue,
+                            ntohl(block.block.count));
+        }
+    }
+    close(fd);
+
+    if (true != uncommitted && offset != end) {
+        printf("Segment %s ends in a partial block, ignoring it\r\n", name);
+        pSegment->rewrite = true;
+    }
+    pSegment->end = (uint32_t)offset;
+
+    return STATUS_SUCCESS;
+}
+
+static int parse_rewriteSegment(Segment_Store_t *pStore, uint32_t index, const Table_t *pTable)
+{
+    Segment_t *pSegment = &pStore->pSegments[index];
+    Parse_SegmentHeader_t header = {0};
+    Parse_SegmentBlock_t block;
+    Parse_HistorySample_t records[PARSE_WRITE_BATCH];
+    Parse_SegmentEntry_t *pEntries = NULL;
+    Parse_SegmentEntry_t *pGrown = NULL;
+    History_Sample_t *pSamples = NULL;
+    Segment_Zone_t zone;
+    char name[SEGMENT_NAME_LEN];
+    char tempName[SEGMENT_NAME_LEN];
+    uint32_t offset = sizeof(header);
+    uint32_t end = sizeof(header);
+    uint32_t blockSize = parse_segmentBlockSize(pSegment->version);
+    uint32_t entries = 0;
+    uint32_t capacity = 0;
+    uint32_t remaining = 0;
+    uint32_t n = 0;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint64_t checkpoint = 0;
+    unsigned int temp = 0;
+    int row = -1;
+    int fd = -1;
+    int status = STATUS_SUCCESS;
+
+    if (-1 != pSegment->fd) {
+        close(pSegment->fd);
+        pSegment->fd = -1;
+    }
+
+    // gather the blocks of sensors that are still in the table
+    while (STATUS_SUCCESS == status && offset + blockSize <= pSegment->end &&
+           STATUS_SUCCESS == segment_read(pStore, index, offset, &block, blockSize)) {
+        block.block.sensorId[sizeof(block.block.sensorId) - 1] = '\0';
+        remaining = ntohl(block.block.count);
+        offset += blockSize;
+        if (offset + (uint64_t)remaining * sizeof(Parse_HistorySample_t) > pSegment->end) {
+            break;
+        }
+        row = table_find(pTable, block.block.sensorId);
+        if (-1 != row && -1 != dict_find(&pTable->removed, block.block.sensorId)) {
+            row = -1;
+        }
+        // blocks of a checkpoint still being written stay apart, a start before it commits drops them
+        checkpoint = (SEGMENT_VERSION == pSegment->version) ? be64toh(block.seq) : 0;
+        checkpoint = (checkpoint > pStore->committedSeq) ? checkpoint : 0;
+
+        if (-1 != row && entries + remaining > capacity) {
+            capacity = (entries + remaining) * 2;
+            pGrown = realloc(pEntries, capacity * sizeof(Parse_SegmentEntry_t));
+            if (NULL == pGrown) {
+                printf("Realloc failed to compact a segment\r\n");
+                status = STATUS_ERROR;
+                break;
+            }
+            pEntries = pGrown;
+        }
+
+        for (; -1 != row && remaining > 0; remaining -= n) {
+            n = (remaining > PARSE_WRITE_BATCH) ? PARSE_WRITE_BATCH : remaining;
+            if (STATUS_SUCCESS != segment_read(pStore, index, offset, records, n * sizeof(Parse_HistorySample_t))) {
+                status = STATUS_ERROR;
+                break;
+            }
+            offset += n * sizeof(Parse_HistorySample_t);
+
+            for (i = 0; i < n; i++, entries++) {
+                pEntries[entries].checkpoint = checkpoint;
+                pEntries[entries].row = (uint32_t)row;
+                pEntries[entries].seq = entries;
+                pEntries[entries].sample.timestamp = ntohl(records[i].timestamp);
+                temp = ntohl(*(unsigned int*)&records[i].value);
+                pEntries[entries].sample.value = *(float*)&temp;
+            }
+        }
+        offset += remaining * sizeof(Parse_HistorySample_t);
+    }
+
+    pSamples = malloc((entries + 1) * sizeof(History_Sample_t));
+    if (STATUS_SUCCESS != status || NULL == pSamples) {
+        free(pEntries);
+        free(pSamples);
+        return STATUS_ERROR;
+    }
+
+    // one sorted block per sensor and checkpoint, the committed ones first, the blocks of one sensor may
+    // overlap in time
+    qsort(pEntries, entries, sizeof(Parse_SegmentEntry_t), parse_compareEntries);
+    for (i = 0; i < entries; i++) {
+        pSamples[i] = pEntries[i].sample;
+    }
+
+    segment_name(pSegment->start, false, name);
+    segment_name(pSegment->start, true, tempName);
+    fd = openat(pStore->dirFd, tempName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (-1 == fd) {
+        perror("openat");
+        free(pEntries);
+        free(pSamples);
+        return STATUS_ERROR;
+    }
+
+    header.magic = htonl(SEGMENT_MAGIC);
+    header.version = htons(SEGMENT_VERSION);
+    header.start = htonl(pSegment->start);
+    header.width = htonl(SEGMENT_WIDTH);
+    parse_write(fd, &header, sizeof(header), &status);
+
+    segment_zoneClear(&zone);
+    for (i = 0; i < entries && STATUS_SUCCESS == status; i = j) {
+        j = i + 1;
+        while (j < entries && pEntries[j].row == pEntries[i].row && pEntries[j].checkpoint == pEntries[i].checkpoint) {
+            j++;
+        }
+        end += parse_writeBlock(fd, pTable->pCold[pEntries[i].row].sensorId, &pSamples[i], j - i,
+                                &pEntries[i].checkpoint, &zone, &status);
+    }
+    free(pEntries);
+    free(pSamples);
+    segment_invalidate(pStore, index);
+
+    // nothing left, dropping the segment is unlinking its file
+    if (STATUS_SUCCESS == status && 0 == zone.samples) {
+        close(fd);
+        unlinkat(pStore->dirFd, tempName, 0);
+        unlinkat(pStore->dirFd, name, 0);
+        segment_remove(pStore, index);
+        return STATUS_SUCCESS;
+    }
+
+    if (STATUS_SUCCESS == status) {
+        status = parse_writeFooter(fd, &zone, end);
+    }
+    // the compacted file replaces the only copy of these readings
+    if (STATUS_SUCCESS == status && 0 != fsync(fd)) {
+        perror("fsync");
+        status = STATUS_ERROR;
+    }
+    close(fd);
+    if (STATUS_SUCCESS != status) {
+        unlinkat(pStore->dirFd, tempName, 0);
+        return STATUS_ERROR;
+    }
+
+    if (-1 == renameat(pStore->dirFd, tempName, pStore->dirFd, name)) {
+        perror("renameat");
+        return STATUS_ERROR;
+    }
+
+    pSegment->zone = zone;
+    pSegment->end = end;
+    pSegment->version = SEGMENT_VERSION;
+    pSegment->dirty = false;
+    pSegment->rewrite = false;
+
+    return STATUS_SUCCESS;
+}
+
+static int parse_appendBlock(Segment_Store_t *pStore, uint32_t index, const char *pSensorId,
+                             const History_Sample_t *pSamples, uint32_t count, uint64_t seq)
+{
+    Segment_t *pSegment = &pStore->pSegments[index];
+    Parse_SegmentHeader_t header = {0};
+    char name[SEGMENT_NAME_LEN];
+    uint32_t end = 0;
+    int status = STATUS_SUCCESS;
+
+    if (-1 == pSegment->fd) {
+        segment_invalidate(pStore, index);
+        segment_name(pSegment->start, false, name);
+        pSegment->fd = openat(pStore->dirFd, name, O_RDWR | O_CREAT | ((0 == pSegment->end) ? O_TRUNC : 0), 0644);
+        if (-1 == pSegment->fd) {
+            perror("openat");
+            return STATUS_ERROR;
+        }
+
+        if (0 == pSegment->end) {
+            header.magic = htonl(SEGMENT_MAGIC);
+            header.version = htons(SEGMENT_VERSION);
+            header.start = htonl(pSegment->start);
+            header.width = htonl(SEGMENT_WIDTH);
+            parse_write(pSegment->fd, &header, sizeof(header), &status);
+            if (STATUS_SUCCESS != status) {
+                close(pSegment->fd);
+                pSegment->fd = -1;
+                unlinkat(pStore->dirFd, name, 0);
+                return STATUS_ERROR;
+            }
+            pSegment->end = sizeof(header);
+            pSegment->version = SEGMENT_VERSION;
+        }
+    }
+
+    // a failed block is left past end, the footer written at end cuts it off
+    pSegment->dirty = true;
+    lseek(pSegment->fd, pSegment->end, SEEK_SET);
+    end = pSegment->end + parse_writeBlock(pSegment->fd, pSensorId, pSamples, count, &seq, &pSegment->zone, &status);
+    if (STATUS_SUCCESS == status) {
+        pSegment->end = end;
+    }
+
+    return status;
+}
+
+static uint32_t parse_writeBlock(int fd, const char *pSensorId, const History_Sample_t *pSamples, uint32_t count,
+                                 const uint64_t *pSeq, Segment_Zone_t *pZone, int *pStatus)
+{
+    Parse_SegmentBlock_t block;
+    Parse_HistorySample_t records[PARSE_WRITE_BATCH];
+    float minValue = pSamples[0].value;
+    float maxValue = pSamples[0].value;
+    uint32_t blockSize = sizeof(block.block);
+    uint32_t i = 0;
+    uint32_t n = 0;
+    unsigned int temp = 0;
+
+    memset(&block, 0, sizeof(block));
+    strncpy(block.block.sensorId, pSensorId, sizeof(block.block.sensorId) - 1);
+    block.block.count = htonl(count);
+    if (NULL != pSeq) {
+        block.seq = htobe64(*pSeq);
+        blockSize = sizeof(block);
+    }
+    parse_write(fd, &block, blockSize, pStatus);
+
+    for (; i < count; i++) {
+        minValue = (pSamples[i].value < minValue) ? pSamples[i].value : minValue;
+        maxValue = (pSamples[i].value > maxValue) ? pSamples[i].value : maxValue;
+
+        records[n].timestamp = htonl(pSamples[i].timestamp);
+        temp = htonl(*(unsigned int*)&pSamples[i].value);
+        records[n].value = *(float*)&temp;
+
+        if (PARSE_WRITE_BATCH == ++n || i + 1 == count) {
+            parse_write(fd, records, n * sizeof(Parse_HistorySample_t), pStatus);
+            n = 0;
+        }
+    }
+
+    // samples are sorted, the first and last carry the time range
+    segment_zoneAdd(pZone, pSensorId, pSamples[0].timestamp, pSamples[count - 1].timestamp, minValue, maxValue, count);
+
+    return blockSize + count * sizeof(Parse_HistorySample_t);
+}
+
+static int parse_writeFooter(int fd, const Segment_Zone_t *pZone, uint32_t end)
+{
+    Parse_SegmentFooter_t footer;
+    unsigned int temp = 0;
+
+    memset(&footer, 0, sizeof(footer));
+    footer.minTs = htonl(pZone->minTs);
+    footer.maxTs = htonl(pZone->maxTs);
+
+    temp = htonl(*(unsigned int*)&pZone->minValue);
+    footer.minValue = *(float*)&temp;
+
+    temp = htonl(*(unsigned int*)&pZone->maxValue);
+    footer.maxValue = *(float*)&temp;
+
+    footer.samples = htonl(pZone->samples);
+    footer.blocks = htonl(pZone->blocks);
+    memcpy(footer.minSensorId, pZone->minSensorId, sizeof(footer.minSensorId));
+    memcpy(footer.maxSensorId, pZone->maxSensorId, sizeof(footer.maxSensorId));
+    footer.blocksEnd = htonl(end);
+    footer.magic = htonl(SEGMENT_FOOTER_MAGIC);
+
+    if (sizeof(footer) != pwrite(fd, &footer, sizeof(footer), end)) {
+        perror("pwrite");
+        return STATUS_ERROR;
+    }
+
+    if (0 != ftruncate(fd, end + sizeof(footer))) {
+        perror("ftruncate");
+        return STATUS_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static void parse_readFooter(const Parse_SegmentFooter_t *pFooter, Segment_Zone_t *pZone)
+{
+    unsigned int temp = 0;
+
+    pZone->minTs = ntohl(pFooter->minTs);
+    pZone->maxTs = ntohl(pFooter->maxTs);
+
+    temp = ntohl(*(unsigned int*)&pFooter->minValue);
+    pZone->minValue = *(float*)&temp;
+
+    temp = ntohl(*(unsigned int*)&pFooter->maxValue);
+    pZone->maxValue = *(float*)&temp;
+
+    pZone->samples = ntohl(pFooter->samples);
+    pZone->blocks = ntohl(pFooter->blocks);
+    memcpy(pZone->minSensorId, pFooter->minSensorId, sizeof(pZone->minSensorId));
+    memcpy(pZone->maxSensorId, pFooter->maxSensorId, sizeof(pZone->maxSensorId));
+    pZone->minSensorId[sizeof(pZone->minSensorId) - 1] = '\0';
+    pZone->maxSensorId[sizeof(pZone->maxSensorId) - 1] = '\0';
+
+    return;
+}
+
+static int parse_compareEntries(const void *pA, const void *pB)
+{
+    const Parse_SegmentEntry_t *pLeft = pA;
+    const Parse_SegmentEntry_t *pRight = pB;
+
+    if (pLeft->checkpoint != pRight->checkpoint) {
+        return (pLeft->checkpoint > pRight->checkpoint) ? 1 : -1;
+    }
+    if (pLeft->row != pRight->row) {
+        return (pLeft->row > pRight->row) ? 1 : -1;
+    }
+    if (pLeft->sample.timestamp != pRight->sample.timestamp) {
+        return (pLeft->sample.timestamp > pRight->sample.timestamp) ? 1 : -1;
+    }
+
+    return (pLeft->seq > pRight->seq) - (pLeft->seq < pRight->seq);
+}
+
+static uint32_t parse_segmentBlockSize(uint16_t version)
+{
+    return (SEGMENT_VERSION_V1 == version) ? sizeof(Parse_HistoryBlock_t) : sizeof(Parse_SegmentBlock_t);
+}
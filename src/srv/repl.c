@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "repl.h"
+
+/* Private function prototypes -----------------------------------------------*/
+// wait until fd is ready for events, STATUS_ERROR on timeout or error
+static int repl_wait(int fd, short events);
+// apply the records of one complete MSG_REPLICATE_RESP frame, -1 if the stream is broken
+static int repl_applyFrame(Repl_Replica_t *pReplica, const char *pFrame, uint16_t len,
+                           Parse_DbHeader_t *pDbhdr, Table_t *pTable, Wal_t *pWal);
+
+/**
+ * @brief  Take the primary's address from a command line argument
+ * @param pSpec: [in] "host:port", host is an IPv4 address
+ * @param pReplica: [out] Replica, left disconnected
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int repl_parseAddress(const char *pSpec, Repl_Replica_t *pReplica)
+{
+    const char *pColon = strrchr(pSpec, ':');
+
+    memset(pReplica, 0, sizeof(Repl_Replica_t));
+    pReplica->fd = -1;
+
+    if (NULL == pColon || pColon == pSpec || (size_t)(pColon - pSpec) >= sizeof(pReplica->host)) {
+        printf("Primary must be given as host:port: %s\r\n", pSpec);
+        return STATUS_ERROR;
+    }
+
+    memcpy(pReplica->host, pSpec, pColon - pSpec);
+    pReplica->port = (unsigned short)atoi(pColon + 1);
+    if (0 == pReplica->port || INADDR_NONE == inet_addr(pReplica->host)) {
+        printf("Bad primary address: %s\r\n", pSpec);
+        return STATUS_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Open the replication stream
+ * @param pReplica: [in] Replica
+ * @param afterSeq: [in] Last log record the replica holds
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  Connect and handshake are bounded by REPL_CONNECT_TIMEOUT_MS each,
+ *        so an unreachable primary stalls the replica's event loop briefly.
+ */
+int repl_connect(Repl_Replica_t *pReplica, uint64_t afterSeq)
+{
+    char txBuf[sizeof(DbProtocolHdr_t) + sizeof(DbProtocolVer_Req_t) +
+               sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_ReplicateReq_t)] = {0};
+    DbProtocolHdr_t *hdr = (DbProtocolHdr_t *)txBuf;
+    DbProtocolVer_Req_t *ver = (DbProtocolVer_Req_t *)&hdr[1];
+    DbProtocolHdr_t *replHdr = (DbProtocolHdr_t *)(txBuf + sizeof(DbProtocolHdr_t) + sizeof(DbProtocolVer_Req_t));
+    DbProtocol_ReplicateReq_t *req = (DbProtocol_ReplicateReq_t *)&replHdr[1];
+    size_t helloLen = sizeof(DbProtocolHdr_t) + sizeof(DbProtocolVer_Resp_t);
+    struct sockaddr_in primaryInfo = {0};
+    socklen_t errLen = sizeof(int);
+    DbProtocolHdr_t resp;
+    ssize_t n = 0;
+    int err = 0;
+    int fd = -1;
+
+    primaryInfo.sin_family = AF_INET;
+    primaryInfo.sin_port = htons(pReplica->port);
+    primaryInfo.sin_addr.s_addr = inet_addr(pReplica->host);
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (-1 == fd) {
+        perror("socket");
+        return STATUS_ERROR;
+    }
+
+    if (-1 == connect(fd, (struct sockaddr *)&primaryInfo, sizeof(primaryInfo)) && EINPROGRESS != errno) {
+        printf("Primary %s:%u: %s\r\n", pReplica->host, pReplica->port, strerror(errno));
+        close(fd);
+        return STATUS_ERROR;
+    }
+    if (STATUS_SUCCESS != repl_wait(fd, POLLOUT) ||
+        0 != getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errLen) || 0 != err) {
+        printf("Primary %s:%u: %s\r\n", pReplica->host, pReplica->port, (0 != err) ? strerror(err) : "no answer");
+        close(fd);
+        return STATUS_ERROR;
+    }
+
+    // the handshake and the request go out together, the primary handles pipelined frames
+    hdr->type = htonl(MSG_HANDSHAKE_REQ);
+    hdr->len = htons(1);
+    ver->version = htons(PROTOCOL_VER);
+    replHdr->type = htonl(MSG_REPLICATE_REQ);
+    replHdr->len = htons(1);
+    req->afterSeq = htobe64(afterSeq);
+    if (sizeof(txBuf) != send(fd, txBuf, sizeof(txBuf), MSG_NOSIGNAL)) {
+        perror("send");
+        close(fd);
+        return STATUS_ERROR;
+    }
+
+    // read no further than the reply, what follows is left for the event loop to poll
+    pReplica->bufLen = 0;
+    while (pReplica->bufLen < helloLen) {
+        if (STATUS_SUCCESS != repl_wait(fd, POLLIN)) {
+            printf("Primary %s:%u did not answer the handshake\r\n", pReplica->host, pReplica->port);
+            close(fd);
+            return STATUS_ERROR;
+        }
+        n = read(fd, pReplica->buffer + pReplica->bufLen, helloLen - pReplica->bufLen);
+        if (n <= 0) {
+            break;
+        }
+        pReplica->bufLen += n;
+    }
+
+    memcpy(&resp, pReplica->buffer, sizeof(resp));
+    if (pReplica->bufLen < helloLen || MSG_HANDSHAKE_RESP != ntohl(resp.type)) {
+        printf("Primary %s:%u refused the handshake\r\n", pReplica->host, pReplica->port);
+        close(fd);
+        pReplica->bufLen = 0;
+        return STATUS_ERROR;
+    }
+    pReplica->bufLen = 0;
+
+    // the primary is at least where the replica is until its first frame tells
+    if (pReplica->primarySeq < afterSeq) {
+        pReplica->primarySeq = afterSeq;
+    }
+    pReplica->fd = fd;
+    printf("Replicating from %s:%u after sequence %llu\r\n", pReplica->host, pReplica->port,
+           (unsigned long long)afterSeq);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Close the replication stream
+ * @param pReplica: [in] Replica
+ */
+void repl_disconnect(Repl_Replica_t *pReplica)
+{
+    if (-1 != pReplica->fd) {
+        close(pReplica->fd);
+    }
+    pReplica->fd = -1;
+    pReplica->bufLen = 0;
+
+    return;
+}
+
+/**
+ * @brief  Apply what the primary sent
+ * @param pReplica: [in] Replica, connected
+ * @param pDbhdr: [in] Database header
+ * @param pTable: [in] Sensor table
+ * @param pWal: [in] Local log, its seq is the replica's position
+ * @return records applied, or -1 when the stream ended or broke
+ * @note  One read per call, so a fast primary cannot starve the replica's
+ *        readers. Records applied before a broken frame stay applied. A
+ *        refused record sets refused, the replica cannot continue past it.
+ */
+int repl_receive(Repl_Replica_t *pReplica, Parse_DbHeader_t *pDbhdr, Table_t *pTable, Wal_t *pWal)
+{
+    DbProtocolHdr_t hdr;
+    size_t frameSize = 0;
+    ssize_t n = 0;
+    int applied = 0;
+    int frame = 0;
+
+    n = read(pReplica->fd, pReplica->buffer + pReplica->bufLen, sizeof(pReplica->buffer) - pReplica->bufLen);
+    if (0 == n) {
+        printf("Primary closed the replication stream\r\n");
+        return -1;
+    }
+    if (n < 0) {
+        if (EAGAIN == errno || EINTR == errno) {
+            return 0;
+        }
+        perror("read");
+        return -1;
+    }
+    pReplica->bufLen += n;
+
+    while (pReplica->bufLen >= sizeof(DbProtocolHdr_t)) {
+        memcpy(&hdr, pReplica->buffer, sizeof(hdr));
+        hdr.type = ntohl(hdr.type);
+        hdr.len = ntohs(hdr.len);
+
+        if (MSG_ERROR == hdr.type) {
+            printf("Primary cannot serve the log after sequence %llu, reseed the replica from a snapshot\r\n",
+                   (unsigned long long)pWal->seq);
+            return -1;
+        }
+        if (MSG_REPLICATE_RESP != hdr.type || hdr.len > REPL_FRAME_RECORDS) {
+            printf("Malformed replication frame\r\n");
+            return -1;
+        }
+
+        frameSize = sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_ReplicateResp_t) + hdr.len * sizeof(DbProtocol_LogRecord_t);
+        if (pReplica->bufLen < frameSize) {
+            break;
+        }
+
+        frame = repl_applyFrame(pReplica, pReplica->buffer + sizeof(DbProtocolHdr_t), hdr.len, pDbhdr, pTable, pWal);
+        if (frame < 0) {
+            return -1;
+        }
+        applied += frame;
+
+        pReplica->bufLen -= frameSize;
+        memmove(pReplica->buffer, pReplica->buffer + frameSize, pReplica->bufLen);
+    }
+
+    return applied;
+}
+
+/**
+ * Helper functions
+ */
+
+static int repl_wait(int fd, short events)
+{
+    struct pollfd pfd = { .fd = fd, .events = events };
+    int n = 0;
+
+    do {
+        n = poll(&pfd, 1, REPL_CONNECT_TIMEOUT_MS);
+    } while (n < 0 && EINTR == errno);
+
+    return (1 == n) ? STATUS_SUCCESS : STATUS_ERROR;
+}
+
+static int repl_applyFrame(Repl_Replica_t *pReplica, const char *pFrame, uint16_t len,
+                           Parse_DbHeader_t *pDbhdr, Table_t *pTable, Wal_t *pWal)
+{
+    DbProtocol_ReplicateResp_t resp;
+    Wal_Record_t record;
+    uint16_t i = 0;
+
+    memcpy(&resp, pFrame, sizeof(resp));
+    pFrame += sizeof(resp);
+
+    for (; i < len; i++) {
+        memcpy(&record, pFrame + i * sizeof(record), sizeof(record));
+        if (true != wal_decode(&record)) {
+            printf("Damaged record in the replication stream after sequence %llu\r\n", (unsigned long long)pWal->seq);
+            return -1;
+        }
+        if (pWal->seq + 1 != record.seq) {
+            printf("Replication stream jumped from sequence %llu to %llu\r\n",
+                   (unsigned long long)pWal->seq, (unsigned long long)record.seq);
+            return -1;
+        }
+
+        // applied through the local log, which numbers it record.seq as well; the primary
+        // accepted a record the replica refuses, so asking again would only refuse it again
+        if (STATUS_SUCCESS != parse_applyRecord(pDbhdr, pTable, &record)) {
+            printf("Replicated record %llu was refused, replication stopped, reseed the replica from a snapshot\r\n",
+                   (unsigned long long)record.seq);
+            pReplica->refused = true;
+            return -1;
+        }
+        pWal->seq = record.seq;
+    }
+
+    pReplica->primarySeq = be64toh(resp.headSeq);
+
+    return len;
+}
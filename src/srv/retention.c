@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "retention.h"
+
+/* Private variables ---------------------------------------------------------*/
+static const char *tierNames[RETENTION_TIERS] = { "raw", "minute", "hour", "day", "sketch" };
+
+/* Private function prototypes -----------------------------------------------*/
+// cutoff of a tier, timestamps below it are expired
+static uint32_t retention_cutoff(uint32_t maxAgeSec, uint32_t now);
+// parse an age such as 30d, STATUS_ERROR if it is malformed
+static int retention_parseAge(const char *pAge, size_t len, uint32_t *pSeconds);
+// unlink the segment files that hold nothing past the raw cutoff
+static void retention_dropSegments(Retention_Sweep_t *pSweep, Segment_Store_t *pStore);
+
+/**
+ * @brief  Fill in the default policy
+ * @param pPolicy: [out] Policy
+ */
+void retention_defaults(Retention_Policy_t *pPolicy)
+{
+    int tier = 0;
+
+    for (; tier < RETENTION_TIERS; tier++) {
+        pPolicy->maxAgeSec[tier] = DEFAULT_RETENTION_ROLLUP_S;
+    }
+    pPolicy->maxAgeSec[RETENTION_RAW] = DEFAULT_RETENTION_RAW_S;
+
+    return;
+}
+
+/**
+ * @brief  Apply a retention specification to a policy
+ * @param pSpec: [in] Comma separated "tier=age" pairs, e.g. "raw=30d,minute=7d"
+ * @param pPolicy: [in] Policy, tiers not named keep their age
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int retention_parse(const char *pSpec, Retention_Policy_t *pPolicy)
+{
+    const char *pEnd = NULL;
+    const char *pEq = NULL;
+    uint32_t seconds = 0;
+    int tier = 0;
+
+    while ('\0' != *pSpec) {
+        pEnd = strchr(pSpec, ',');
+        if (NULL == pEnd) {
+            pEnd = pSpec + strlen(pSpec);
+        }
+        pEq = memchr(pSpec, '=', pEnd - pSpec);
+        if (NULL == pEq) {
+            printf("Retention entry without '=': %.*s\r\n", (int)(pEnd - pSpec), pSpec);
+            return STATUS_ERROR;
+        }
+
+        for (tier = 0; tier < RETENTION_TIERS; tier++) {
+            if (strlen(tierNames[tier]) == (size_t)(pEq - pSpec) && 0 == strncmp(pSpec, tierNames[tier], pEq - pSpec)) {
+                break;
+            }
+        }
+        if (RETENTION_TIERS == tier) {
+            printf("Unknown retention tier: %.*s\r\n", (int)(pEq - pSpec), pSpec);
+            return STATUS_ERROR;
+        }
+
+        if (STATUS_SUCCESS != retention_parseAge(pEq + 1, pEnd - pEq - 1, &seconds)) {
+            printf("Bad retention age: %.*s\r\n", (int)(pEnd - pEq - 1), pEq + 1);
+            return STATUS_ERROR;
+        }
+        pPolicy->maxAgeSec[tier] = seconds;
+
+        pSpec = ('\0' == *pEnd) ? pEnd : pEnd + 1;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Begin an expiry sweep
+ * @param pSweep: [out] Sweep state
+ * @param pPolicy: [in] Retention policy
+ * @param now: [in] Current time in seconds since the epoch
+ * @note  The raw cutoff is rounded down to a segment start, so whole segment
+ *        files expire and what stays in memory matches what stays on disk.
+ */
+void retention_start(Retention_Sweep_t *pSweep, const Retention_Policy_t *pPolicy, uint32_t now)
+{
+    int tier = 0;
+
+    memset(pSweep, 0, sizeof(Retention_Sweep_t));
+    for (; tier < RETENTION_TIERS; tier++) {
+        pSweep->cutoff[tier] = retention_cutoff(pPolicy->maxAgeSec[tier], now);
+    }
+    pSweep->cutoff[RETENTION_RAW] = segment_startOf(pSweep->cutoff[RETENTION_RAW]);
+    pSweep->active = true;
+
+    return;
+}
+
+/**
+ * @brief  Advance an expiry sweep
+ * @param pSweep: [in] Sweep state, inactive once every row is done
+ * @param pTable: [in] Sensor table
+ * @param pStore: [in] Segment catalog
+ * @param rows: [in] Maximum number of rows to trim
+ * @return true when rollups or sketches lost buckets and need to be written
+ * @note  Trimming is a binary search and a memmove per series, so a step
+ *        costs about the same no matter how much has expired. Rows swapped
+ *        in by a remove during the sweep wait for the next one.
+ */
+bool retention_step(Retention_Sweep_t *pSweep, Table_t *pTable, Segment_Store_t *pStore, uint32_t rows)
+{
+    uint64_t buckets = pSweep->buckets;
+    uint32_t row = pSweep->row;
+    uint32_t end = row;
+
+    if (row < pTable->count) {
+        end = (pTable->count - row > rows) ? row + rows : pTable->count;
+    }
+
+    for (; row < end; row++) {
+        pSweep->samples += history_expire(&pTable->pHistory[row], pSweep->cutoff[RETENTION_RAW]);
+        pSweep->buckets += rollup_expire(&pTable->pRollup[row], ROLLUP_MINUTE, pSweep->cutoff[RETENTION_MINUTE]);
+        pSweep->buckets += rollup_expire(&pTable->pRollup[row], ROLLUP_HOUR, pSweep->cutoff[RETENTION_HOUR]);
+        pSweep->buckets += rollup_expire(&pTable->pRollup[row], ROLLUP_DAY, pSweep->cutoff[RETENTION_DAY]);
+        pSweep->buckets += sketch_seriesExpire(&pTable->pSketch[row], pSweep->cutoff[RETENTION_SKETCH]);
+    }
+    pSweep->row = end;
+
+    // segments go last, a flush before that may still rewrite or append to them
+    if (pSweep->row >= pTable->count) {
+        retention_dropSegments(pSweep, pStore);
+        pSweep->active = false;
+        if (0 != pSweep->samples || 0 != pSweep->buckets || 0 != pSweep->segments) {
+            printf("Retention: expired %llu readings, %llu buckets, %u segments\r\n",
+                   (unsigned long long)pSweep->samples, (unsigned long long)pSweep->buckets, pSweep->segments);
+        }
+    }
+
+    return pSweep->buckets != buckets;
+}
+
+/**
+ * Helper functions
+ */
+
+static uint32_t retention_cutoff(uint32_t maxAgeSec, uint32_t now)
+{
+    return (0 == maxAgeSec || now <= maxAgeSec) ? 0 : now - maxAgeSec;
+}
+
+static int retention_parseAge(const char *pAge, size_t len, uint32_t *pSeconds)
+{
+    char *pUnit = NULL;
+    unsigned long value = 0;
+    unsigned long scale = 0;
+
+    if (0 == len || pAge[0] < '0' || pAge[0] > '9') {
+        return STATUS_ERROR;
+    }
+
+    value = strtoul(pAge, &pUnit, 10);
+    if (pUnit == pAge + len) {
+        // a bare number is only accepted as "keep forever"
+        *pSeconds = 0;
+        return (0 == value) ? STATUS_SUCCESS : STATUS_ERROR;
+    }
+    if (pUnit != pAge + len - 1) {
+        return STATUS_ERROR;
+    }
+
+    switch (*pUnit)
+    {
+        case 's':{
+            scale = 1;
+            break;
+        }
+        case 'm':{
+            scale = 60;
+            break;
+        }
+        case 'h':{
+            scale = 3600;
+            break;
+        }
+        case 'd':{
+            scale = 86400;
+            break;
+        }
+        default:{
+            return STATUS_ERROR;
+        }
+    }
+    if (value > UINT32_MAX / scale) {
+        return STATUS_ERROR;
+    }
+    *pSeconds = (uint32_t)(value * scale);
+
+    return STATUS_SUCCESS;
+}
+
+static void retention_dropSegments(Retention_Sweep_t *pSweep, Segment_Store_t *pStore)
+{
+    char name[SEGMENT_NAME_LEN];
+
+    if (pStore->dirFd < 0) {
+        return;
+    }
+
+    // the catalog is sorted, expired segments are all at the front
+    while (0 != pStore->count && segment_last(pStore->pSegments[0].start) < pSweep->cutoff[RETENTION_RAW]) {
+        segment_name(pStore->pSegments[0].start, false, name);
+        if (0 != unlinkat(pStore->dirFd, name, 0)) {
+            perror("unlinkat");
+        }
+        segment_remove(pStore, 0);
+        pSweep->segments++;
+    }
+
+    return;
+}
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "rollup.h"
+
+#define ROLLUP_INITIAL_BUCKETS  16
+
+/* Private variables ---------------------------------------------------------*/
+static const uint32_t tierWidth[ROLLUP_TIERS] = { 60, 3600, 86400 };
+
+/* Private function prototypes -----------------------------------------------*/
+// first bucket whose start is not below start
+static uint32_t rollup_lowerBound(const Rollup_Series_t *pSeries, uint32_t start);
+// make room for one more bucket
+static int rollup_reserve(Rollup_Series_t *pSeries);
+// fold a reading into one tier
+static int rollup_addTier(Rollup_Series_t *pSeries, uint32_t start, float value);
+// fold src into dst
+static void rollup_merge(Rollup_Bucket_t *pDst, const Rollup_Bucket_t *pSrc);
+
+/**
+ * @brief  Get the bucket width of a tier
+ * @param tier: [in] Rollup tier
+ * @return width in seconds
+ */
+uint32_t rollup_width(Rollup_Tier_e tier)
+{
+    return tierWidth[tier];
+}
+
+/**
+ * @brief  Release the buckets of a sensor
+ * @param pRollup: [in] Rollups to release, left empty
+ */
+void rollup_free(Rollup_Sensor_t *pRollup)
+{
+    int tier = 0;
+
+    for (; tier < ROLLUP_TIERS; tier++) {
+        free(pRollup->tiers[tier].pBuckets);
+    }
+    memset(pRollup, 0, sizeof(Rollup_Sensor_t));
+
+    return;
+}
+
+/**
+ * @brief  Fold a reading into the minute, hour and day buckets
+ * @param pRollup: [in] Rollups of the sensor
+ * @param timestamp: [in] Reading timestamp
+ * @param value: [in] Reading value
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  O(1) for in-order readings, which only ever touch the last bucket
+ *        of each tier. Older timestamps are placed by binary search.
+ */
+int rollup_add(Rollup_Sensor_t *pRollup, uint32_t timestamp, float value)
+{
+    int tier = 0;
+
+    for (; tier < ROLLUP_TIERS; tier++) {
+        if (STATUS_SUCCESS != rollup_addTier(&pRollup->tiers[tier], timestamp - timestamp % tierWidth[tier], value)) {
+            printf("Realloc failed to expand rollups\r\n");
+            return STATUS_ERROR;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Append a bucket to a series
+ * @param pSeries: [in] Series to extend
+ * @param pBucket: [in] Bucket, must start after the last bucket of the series
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int rollup_append(Rollup_Series_t *pSeries, const Rollup_Bucket_t *pBucket)
+{
+    if (0 != pSeries->count && pSeries->pBuckets[pSeries->count - 1].start >= pBucket->start) {
+        return STATUS_ERROR;
+    }
+
+    if (STATUS_SUCCESS != rollup_reserve(pSeries)) {
+        return STATUS_ERROR;
+    }
+    pSeries->pBuckets[pSeries->count++] = *pBucket;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Drop the buckets of one tier that end before a cutoff
+ * @param pRollup: [in] Rollups of the sensor
+ * @param tier: [in] Tier to trim
+ * @param cutoff: [in] Buckets whose last second is below this are dropped
+ * @return number of buckets dropped
+ */
+uint32_t rollup_expire(Rollup_Sensor_t *pRollup, Rollup_Tier_e tier, uint32_t cutoff)
+{
+    Rollup_Series_t *pSeries = &pRollup->tiers[tier];
+    uint32_t n = 0;
+
+    if (cutoff < tierWidth[tier]) {
+        return 0;
+    }
+
+    n = rollup_lowerBound(pSeries, cutoff - tierWidth[tier] + 1);
+    if (0 != n) {
+        memmove(pSeries->pBuckets, &pSeries->pBuckets[n], (pSeries->count - n) * sizeof(Rollup_Bucket_t));
+        pSeries->count -= n;
+    }
+
+    return n;
+}
+
+/**
+ * @brief  Downsample the readings of [fromTs, toTs]
+ * @param pRollup: [in] Rollups of the sensor
+ * @param fromTs: [in] First timestamp, inclusive
+ * @param toTs: [in] Last timestamp, inclusive
+ * @param points: [in] Maximum number of buckets to return, at least 1
+ * @param pOut: [out] Room for points buckets, empty buckets are left out
+ * @param pWidth: [out] Width of the returned buckets in seconds
+ * @param pRead: [out] Number of stored buckets that were read
+ * @return number of buckets written to pOut
+ * @note  The coarsest tier that still has at least points buckets over the
+ *        range is read, and its buckets are merged into whole multiples of
+ *        its width. Count, min, max and sum merge exactly, so the result
+ *        matches what the raw readings would give at that width.
+ */
+uint32_t rollup_query(const Rollup_Sensor_t *pRollup, uint32_t fromTs, uint32_t toTs, uint32_t points,
+                      Rollup_Bucket_t *pOut, uint32_t *pWidth, uint32_t *pRead)
+{
+    const Rollup_Series_t *pSeries = NULL;
+    const Rollup_Bucket_t *pBucket = NULL;
+    uint64_t span = (uint64_t)toTs - fromTs + 1;
+    uint64_t width = 0;
+    uint32_t first = 0;
+    uint32_t i = 0;
+    uint32_t n = 0;
+    int tier = ROLLUP_DAY;
+
+    *pWidth = 0;
+    *pRead = 0;
+    if (0 == points || toTs < fromTs) {
+        return 0;
+    }
+
+    while (tier > ROLLUP_MINUTE && span / tierWidth[tier] < points) {
+        tier--;
+    }
+    pSeries = &pRollup->tiers[tier];
+
+    // widest multiple of the tier width that keeps the aligned buckets within points
+    width = tierWidth[tier] * ((span + (uint64_t)tierWidth[tier] * points - 1) / ((uint64_t)tierWidth[tier] * points));
+    while (toTs / width - fromTs / width + 1 > points) {
+        width += tierWidth[tier];
+    }
+    *pWidth = (width > UINT32_MAX) ? UINT32_MAX : (uint32_t)width;
+
+    first = rollup_lowerBound(pSeries, fromTs - fromTs % tierWidth[tier]);
+    for (i = first; i < pSeries->count && pSeries->pBuckets[i].start <= toTs; i++) {
+        pBucket = &pSeries->pBuckets[i];
+        if (0 != n && pOut[n - 1].start == pBucket->start - pBucket->start % width) {
+            rollup_merge(&pOut[n - 1], pBucket);
+            continue;
+        }
+
+        pOut[n] = *pBucket;
+        pOut[n].start = pBucket->start - pBucket->start % width;
+        n++;
+    }
+    *pRead = i - first;
+
+    return n;
+}
+
+/**
+ * Helper functions
+ */
+
+static uint32_t rollup_lowerBound(const Rollup_Series_t *pSeries, uint32_t start)
+{
+    uint32_t lo = 0;
+    uint32_t hi = pSeries->count;
+    uint32_t mid = 0;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (pSeries->pBuckets[mid].start < start) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+static int rollup_reserve(Rollup_Series_t *pSeries)
+{
+    Rollup_Bucket_t *pBuckets = NULL;
+    uint32_t capacity = 0;
+
+    if (pSeries->count < pSeries->capacity) {
+        return STATUS_SUCCESS;
+    }
+
+    capacity = (0 == pSeries->capacity) ? ROLLUP_INITIAL_BUCKETS : pSeries->capacity * 2;
+    pBuckets = realloc(pSeries->pBuckets, capacity * sizeof(Rollup_Bucket_t));
+    if (NULL == pBuckets) {
+        return STATUS_ERROR;
+    }
+    pSeries->pBuckets = pBuckets;
+    pSeries->capacity = capacity;
+
+    return STATUS_SUCCESS;
+}
+
+static int rollup_addTier(Rollup_Series_t *pSeries, uint32_t start, float value)
+{
+    Rollup_Bucket_t reading = { start, 1, value, value, value };
+    uint32_t pos = pSeries->count;
+
+    // common case: same bucket as the previous reading, or a new one after it
+    if (0 != pSeries->count && pSeries->pBuckets[pSeries->count - 1].start >= start) {
+        pos = rollup_lowerBound(pSeries, start);
+        if (pos < pSeries->count && pSeries->pBuckets[pos].start == start) {
+            rollup_merge(&pSeries->pBuckets[pos], &reading);
+            return STATUS_SUCCESS;
+        }
+    }
+
+    if (STATUS_SUCCESS != rollup_reserve(pSeries)) {
+        return STATUS_ERROR;
+    }
+
+    memmove(&pSeries->pBuckets[pos + 1], &pSeries->pBuckets[pos], (pSeries->count - pos) * sizeof(Rollup_Bucket_t));
+    pSeries->pBuckets[pos] = reading;
+    pSeries->count++;
+
+    return STATUS_SUCCESS;
+}
+
+static void rollup_merge(Rollup_Bucket_t *pDst, const Rollup_Bucket_t *pSrc)
+{
+    pDst->count += pSrc->count;
+    pDst->sum += pSrc->sum;
+    pDst->min = (pSrc->min < pDst->min) ? pSrc->min : pDst->min;
+    pDst->max = (pSrc->max > pDst->max) ? pSrc->max : pDst->max;
+
+    return;
+}
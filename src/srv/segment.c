@@ -0,0 +1,439 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "segment.h"
+
+#define SEGMENT_INITIAL_COUNT   16
+
+/* Private function prototypes -----------------------------------------------*/
+// first segment whose start is not below start
+static uint32_t segment_lowerBound(const Segment_Store_t *pStore, uint32_t start);
+// hash chain of a page
+static uint32_t segment_chainOf(const Segment_Cache_t *pCache, uint32_t start, uint32_t page);
+// frame holding a page, loaded into a CLOCK victim on a miss, -1 on read failure
+static int32_t segment_cachePage(Segment_Store_t *pStore, uint32_t start, uint32_t page, int *pFd);
+// take a frame out of its hash chain
+static void segment_cacheUnlink(Segment_Cache_t *pCache, int32_t frame);
+
+/**
+ * @brief  Prepare an empty catalog
+ * @param pStore: [out] Catalog to initialize
+ * @param dirFd: [in] Directory holding the segment files, owned by the catalog
+ */
+void segment_init(Segment_Store_t *pStore, int dirFd)
+{
+    memset(pStore, 0, sizeof(Segment_Store_t));
+    pStore->dirFd = dirFd;
+
+    return;
+}
+
+/**
+ * @brief  Close every open segment and release the catalog
+ * @param pStore: [in] Catalog to release
+ */
+void segment_free(Segment_Store_t *pStore)
+{
+    uint32_t i = 0;
+
+    for (; i < pStore->count; i++) {
+        if (-1 != pStore->pSegments[i].fd) {
+            close(pStore->pSegments[i].fd);
+        }
+    }
+    if (pStore->dirFd >= 0) {
+        close(pStore->dirFd);
+    }
+    free(pStore->cache.pData);
+    free(pStore->cache.pFrames);
+    free(pStore->cache.pChains);
+    free(pStore->pSegments);
+    memset(pStore, 0, sizeof(Segment_Store_t));
+    pStore->dirFd = -1;
+
+    return;
+}
+
+/**
+ * @brief  Get the start of the segment holding a timestamp
+ * @param timestamp: [in] Reading timestamp
+ * @return segment start
+ */
+uint32_t segment_startOf(uint32_t timestamp)
+{
+    return timestamp - timestamp % SEGMENT_WIDTH;
+}
+
+/**
+ * @brief  Get the last timestamp a segment holds
+ * @param start: [in] Segment start
+ * @return last timestamp, clamped to the timestamp range
+ */
+uint32_t segment_last(uint32_t start)
+{
+    return (start > UINT32_MAX - (SEGMENT_WIDTH - 1)) ? UINT32_MAX : start + SEGMENT_WIDTH - 1;
+}
+
+/**
+ * @brief  Build the file name of a segment
+ * @param start: [in] Segment start
+ * @param temporary: [in] Name of the file a rewrite goes to before it is renamed
+ * @param pName: [out] Room for SEGMENT_NAME_LEN characters
+ */
+void segment_name(uint32_t start, bool temporary, char *pName)
+{
+    snprintf(pName, SEGMENT_NAME_LEN, "%010u.%s", start, temporary ? "tmp" : "seg");
+
+    return;
+}
+
+/**
+ * @brief  Look up a segment
+ * @param pStore: [in] Catalog
+ * @param start: [in] Segment start
+ * @return index in the catalog or -1
+ */
+int segment_find(const Segment_Store_t *pStore, uint32_t start)
+{
+    uint32_t pos = segment_lowerBound(pStore, start);
+
+    if (pos < pStore->count && pStore->pSegments[pos].start == start) {
+        return (int)pos;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief  Look up a segment, adding an empty one if needed
+ * @param pStore: [in] Catalog
+ * @param start: [in] Segment start
+ * @return index in the catalog or -1 on allocation failure
+ * @note  Indexes past the returned one shift when a segment is added.
+ */
+int segment_insert(Segment_Store_t *pStore, uint32_t start)
+{
+    Segment_t *pSegments = NULL;
+    uint32_t capacity = 0;
+    uint32_t pos = segment_lowerBound(pStore, start);
+
+    if (pos < pStore->count && pStore->pSegments[pos].start == start) {
+        return (int)pos;
+    }
+
+    if (pStore->count == pStore->capacity) {
+        capacity = (0 == pStore->capacity) ? SEGMENT_INITIAL_COUNT : pStore->capacity * 2;
+        pSegments = realloc(pStore->pSegments, capacity * sizeof(Segment_t));
+        if (NULL == pSegments) {
+            printf("Realloc failed to expand segment catalog\r\n");
+            return -1;
+        }
+        pStore->pSegments = pSegments;
+        pStore->capacity = capacity;
+    }
+
+    memmove(&pStore->pSegments[pos + 1], &pStore->pSegments[pos], (pStore->count - pos) * sizeof(Segment_t));
+    memset(&pStore->pSegments[pos], 0, sizeof(Segment_t));
+    pStore->pSegments[pos].start = start;
+    pStore->pSegments[pos].fd = -1;
+    segment_zoneClear(&pStore->pSegments[pos].zone);
+    pStore->count++;
+
+    return (int)pos;
+}
+
+/**
+ * @brief  Drop a segment from the catalog
+ * @param pStore: [in] Catalog
+ * @param index: [in] Segment to drop, closed if open
+ */
+void segment_remove(Segment_Store_t *pStore, uint32_t index)
+{
+    if (-1 != pStore->pSegments[index].fd) {
+        close(pStore->pSegments[index].fd);
+    }
+    segment_invalidate(pStore, index);
+
+    pStore->count--;
+    memmove(&pStore->pSegments[index], &pStore->pSegments[index + 1], (pStore->count - index) * sizeof(Segment_t));
+
+    return;
+}
+
+/**
+ * @brief  Give the catalog a buffer cache
+ * @param pStore: [in] Catalog
+ * @param bytes: [in] Cache size, rounded down to whole pages, 0 reads files directly
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int segment_cacheInit(Segment_Store_t *pStore, uint64_t bytes)
+{
+    Segment_Cache_t *pCache = &pStore->cache;
+    uint32_t i = 0;
+
+    pCache->frames = (uint32_t)(bytes / SEGMENT_PAGE_SIZE);
+    if (0 == pCache->frames) {
+        return STATUS_SUCCESS;
+    }
+
+    pCache->pData = malloc((size_t)pCache->frames * SEGMENT_PAGE_SIZE);
+    pCache->pFrames = calloc(pCache->frames, sizeof(Segment_Frame_t));
+    pCache->pChains = malloc(pCache->frames * sizeof(int32_t));
+    if (NULL == pCache->pData || NULL == pCache->pFrames || NULL == pCache->pChains) {
+        printf("Malloc failed to create the segment cache\r\n");
+        free(pCache->pData);
+        free(pCache->pFrames);
+        free(pCache->pChains);
+        memset(pCache, 0, sizeof(Segment_Cache_t));
+        return STATUS_ERROR;
+    }
+
+    for (; i < pCache->frames; i++) {
+        pCache->pChains[i] = -1;
+        pCache->pFrames[i].next = -1;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Read part of a segment file through the buffer cache
+ * @param pStore: [in] Catalog
+ * @param index: [in] Segment to read
+ * @param offset: [in] File offset
+ * @param pBuf: [out] Room for len bytes
+ * @param len: [in] Number of bytes
+ * @return STATUS_SUCCESS, STATUS_ERROR if the file is shorter or unreadable
+ * @note  The file is opened only when a page misses.
+ */
+int segment_read(Segment_Store_t *pStore, uint32_t index, uint32_t offset, void *pBuf, uint32_t len)
+{
+    Segment_Cache_t *pCache = &pStore->cache;
+    Segment_Frame_t *pFrame = NULL;
+    uint8_t *pOut = pBuf;
+    char name[SEGMENT_NAME_LEN];
+    uint32_t start = pStore->pSegments[index].start;
+    uint32_t inPage = 0;
+    uint32_t n = 0;
+    int32_t frame = -1;
+    int fd = -1;
+    int status = STATUS_SUCCESS;
+
+    if (0 == pCache->frames) {
+        segment_name(start, false, name);
+        fd = openat(pStore->dirFd, name, O_RDONLY);
+        if (-1 == fd || (ssize_t)len != pread(fd, pBuf, len, offset)) {
+            status = STATUS_ERROR;
+        }
+        if (-1 != fd) {
+            close(fd);
+        }
+        return status;
+    }
+
+    while (len > 0) {
+        frame = segment_cachePage(pStore, start, offset / SEGMENT_PAGE_SIZE, &fd);
+        inPage = offset % SEGMENT_PAGE_SIZE;
+        pFrame = (-1 == frame) ? NULL : &pCache->pFrames[frame];
+        if (NULL == pFrame || pFrame->length <= inPage) {
+            status = STATUS_ERROR;
+            break;
+        }
+
+        n = pFrame->length - inPage;
+        n = (n < len) ? n : len;
+        memcpy(pOut, &pCache->pData[(size_t)frame * SEGMENT_PAGE_SIZE + inPage], n);
+        pOut += n;
+        offset += n;
+        len -= n;
+    }
+
+    if (-1 != fd) {
+        close(fd);
+    }
+
+    return status;
+}
+
+/**
+ * @brief  Forget the cached pages of a segment
+ * @param pStore: [in] Catalog
+ * @param index: [in] Segment whose file was written or removed
+ */
+void segment_invalidate(Segment_Store_t *pStore, uint32_t index)
+{
+    Segment_Cache_t *pCache = &pStore->cache;
+    uint32_t start = pStore->pSegments[index].start;
+    uint32_t i = 0;
+
+    for (; i < pCache->frames; i++) {
+        if (true == pCache->pFrames[i].valid && start == pCache->pFrames[i].start) {
+            segment_cacheUnlink(pCache, (int32_t)i);
+            pCache->pFrames[i].valid = false;
+        }
+    }
+
+    return;
+}
+
+/**
+ * @brief  Reset a zone map
+ * @param pZone: [out] Zone map holding nothing
+ */
+void segment_zoneClear(Segment_Zone_t *pZone)
+{
+    memset(pZone, 0, sizeof(Segment_Zone_t));
+    pZone->minTs = UINT32_MAX;
+
+    return;
+}
+
+/**
+ * @brief  Widen a zone map by one block of samples
+ * @param pZone: [in] Zone map
+ * @param pSensorId: [in] Sensor of the block
+ * @param minTs: [in] Smallest timestamp of the block
+ * @param maxTs: [in] Largest timestamp of the block
+ * @param minValue: [in] Smallest value of the block
+ * @param maxValue: [in] Largest value of the block
+ * @param samples: [in] Number of samples in the block, at least 1
+ */
+void segment_zoneAdd(Segment_Zone_t *pZone, const char *pSensorId, uint32_t minTs, uint32_t maxTs,
+                     float minValue, float maxValue, uint32_t samples)
+{
+    if (0 == pZone->samples) {
+        pZone->minValue = minValue;
+        pZone->maxValue = maxValue;
+        strncpy(pZone->minSensorId, pSensorId, sizeof(pZone->minSensorId) - 1);
+        strncpy(pZone->maxSensorId, pSensorId, sizeof(pZone->maxSensorId) - 1);
+    }
+
+    pZone->minTs = (minTs < pZone->minTs) ? minTs : pZone->minTs;
+    pZone->maxTs = (maxTs > pZone->maxTs) ? maxTs : pZone->maxTs;
+    pZone->minValue = (minValue < pZone->minValue) ? minValue : pZone->minValue;
+    pZone->maxValue = (maxValue > pZone->maxValue) ? maxValue : pZone->maxValue;
+    if (strcmp(pSensorId, pZone->minSensorId) < 0) {
+        strncpy(pZone->minSensorId, pSensorId, sizeof(pZone->minSensorId) - 1);
+    }
+    if (strcmp(pSensorId, pZone->maxSensorId) > 0) {
+        strncpy(pZone->maxSensorId, pSensorId, sizeof(pZone->maxSensorId) - 1);
+    }
+    pZone->samples += samples;
+    pZone->blocks++;
+
+    return;
+}
+
+/**
+ * @brief  Check a sensor ID against the ID range of a zone map
+ * @param pZone: [in] Zone map
+ * @param pSensorId: [in] Sensor ID
+ * @return false when the segment holds no block of the sensor for sure
+ */
+bool segment_zoneHasId(const Segment_Zone_t *pZone, const char *pSensorId)
+{
+    return 0 != pZone->samples &&
+           strcmp(pSensorId, pZone->minSensorId) >= 0 &&
+           strcmp(pSensorId, pZone->maxSensorId) <= 0;
+}
+
+/**
+ * Helper functions
+ */
+
+static uint32_t segment_lowerBound(const Segment_Store_t *pStore, uint32_t start)
+{
+    uint32_t lo = 0;
+    uint32_t hi = pStore->count;
+    uint32_t mid = 0;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (pStore->pSegments[mid].start < start) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+static uint32_t segment_chainOf(const Segment_Cache_t *pCache, uint32_t start, uint32_t page)
+{
+    return ((start / SEGMENT_WIDTH) * 2654435761u + page) % pCache->frames;
+}
+
+static int32_t segment_cachePage(Segment_Store_t *pStore, uint32_t start, uint32_t page, int *pFd)
+{
+    Segment_Cache_t *pCache = &pStore->cache;
+    Segment_Frame_t *pFrame = NULL;
+    char name[SEGMENT_NAME_LEN];
+    uint32_t chain = segment_chainOf(pCache, start, page);
+    int32_t frame = pCache->pChains[chain];
+    ssize_t got = 0;
+
+    for (; -1 != frame; frame = pCache->pFrames[frame].next) {
+        pFrame = &pCache->pFrames[frame];
+        if (start == pFrame->start && page == pFrame->page) {
+            pFrame->referenced = true;
+            pCache->hits++;
+            return frame;
+        }
+    }
+    pCache->misses++;
+
+    if (-1 == *pFd) {
+        segment_name(start, false, name);
+        *pFd = openat(pStore->dirFd, name, O_RDONLY);
+        if (-1 == *pFd) {
+            perror("openat");
+            return -1;
+        }
+    }
+
+    // second chance for every frame hit since the hand last passed it
+    while (true == pCache->pFrames[pCache->hand].valid && true == pCache->pFrames[pCache->hand].referenced) {
+        pCache->pFrames[pCache->hand].referenced = false;
+        pCache->hand = (pCache->hand + 1) % pCache->frames;
+    }
+    frame = (int32_t)pCache->hand;
+    pCache->hand = (pCache->hand + 1) % pCache->frames;
+
+    pFrame = &pCache->pFrames[frame];
+    if (true == pFrame->valid) {
+        segment_cacheUnlink(pCache, frame);
+        pFrame->valid = false;
+    }
+
+    got = pread(*pFd, &pCache->pData[(size_t)frame * SEGMENT_PAGE_SIZE], SEGMENT_PAGE_SIZE, (off_t)page * SEGMENT_PAGE_SIZE);
+    if (got <= 0) {
+        return -1;
+    }
+
+    pFrame->start = start;
+    pFrame->page = page;
+    pFrame->length = (uint32_t)got;
+    pFrame->valid = true;
+    pFrame->referenced = false;
+    pFrame->next = pCache->pChains[chain];
+    pCache->pChains[chain] = frame;
+
+    return frame;
+}
+
+static void segment_cacheUnlink(Segment_Cache_t *pCache, int32_t frame)
+{
+    Segment_Frame_t *pFrame = &pCache->pFrames[frame];
+    int32_t *pLink = &pCache->pChains[segment_chainOf(pCache, pFrame->start, pFrame->page)];
+
+    while (frame != *pLink) {
+        pLink = &pCache->pFrames[*pLink].next;
+    }
+    *pLink = pFrame->next;
+    pFrame->next = -1;
+
+    return;
+}
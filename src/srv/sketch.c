@@ -0,0 +1,477 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sketch.h"
+
+#define SKETCH_INITIAL_BINS     8
+#define SKETCH_INITIAL_BUCKETS  16
+
+/* Private function prototypes -----------------------------------------------*/
+// natural log of gamma, computed on first use
+static double sketch_lnGamma(void);
+// bin of a magnitude above SKETCH_MIN_VALUE
+static int32_t sketch_key(double magnitude);
+// representative magnitude of a bin, within alpha of every value it holds
+static double sketch_keyValue(int32_t key);
+// add n to a bin, growing the store or collapsing its lowest bins
+static int sketch_storeAdd(Sketch_Store_t *pStore, int32_t key, uint32_t n);
+// make the store cover exactly [lo, hi], bins below lo fold into lo
+static int sketch_storeRange(Sketch_Store_t *pStore, int32_t lo, int32_t hi);
+// first bucket whose start is not below start
+static uint32_t sketch_lowerBound(const Sketch_Series_t *pSeries, uint32_t start);
+// make room for one more bucket
+static int sketch_reserve(Sketch_Series_t *pSeries);
+
+/**
+ * @brief  Release the bins of a sketch
+ * @param pSketch: [in] Sketch to release, left empty
+ */
+void sketch_free(Sketch_t *pSketch)
+{
+    free(pSketch->positive.pCounts);
+    free(pSketch->negative.pCounts);
+    memset(pSketch, 0, sizeof(Sketch_t));
+
+    return;
+}
+
+/**
+ * @brief  Fold a value into a sketch
+ * @param pSketch: [in] Sketch
+ * @param value: [in] Value, NaN and infinities are ignored
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int sketch_add(Sketch_t *pSketch, float value)
+{
+    int status = STATUS_SUCCESS;
+
+    if (!isfinite(value)) {
+        return STATUS_SUCCESS;
+    }
+
+    if (value > SKETCH_MIN_VALUE) {
+        status = sketch_storeAdd(&pSketch->positive, sketch_key(value), 1);
+    } else if (value < -SKETCH_MIN_VALUE) {
+        status = sketch_storeAdd(&pSketch->negative, sketch_key(-(double)value), 1);
+    } else {
+        pSketch->zeroCount++;
+    }
+
+    if (STATUS_SUCCESS != status) {
+        return STATUS_ERROR;
+    }
+
+    if (0 == pSketch->count) {
+        pSketch->min = value;
+        pSketch->max = value;
+    }
+    pSketch->min = (value < pSketch->min) ? value : pSketch->min;
+    pSketch->max = (value > pSketch->max) ? value : pSketch->max;
+    pSketch->count++;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Fold one sketch into another
+ * @param pDst: [in] Sketch receiving the counts
+ * @param pSrc: [in] Sketch to add
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int sketch_merge(Sketch_t *pDst, const Sketch_t *pSrc)
+{
+    uint32_t i = 0;
+
+    if (0 == pSrc->count) {
+        return STATUS_SUCCESS;
+    }
+
+    for (i = 0; i < pSrc->positive.bins; i++) {
+        if (0 != pSrc->positive.pCounts[i] &&
+            STATUS_SUCCESS != sketch_storeAdd(&pDst->positive, pSrc->positive.offset + i, pSrc->positive.pCounts[i])) {
+            return STATUS_ERROR;
+        }
+    }
+
+    for (i = 0; i < pSrc->negative.bins; i++) {
+        if (0 != pSrc->negative.pCounts[i] &&
+            STATUS_SUCCESS != sketch_storeAdd(&pDst->negative, pSrc->negative.offset + i, pSrc->negative.pCounts[i])) {
+            return STATUS_ERROR;
+        }
+    }
+
+    if (0 == pDst->count) {
+        pDst->min = pSrc->min;
+        pDst->max = pSrc->max;
+    }
+    pDst->min = (pSrc->min < pDst->min) ? pSrc->min : pDst->min;
+    pDst->max = (pSrc->max > pDst->max) ? pSrc->max : pDst->max;
+    pDst->zeroCount += pSrc->zeroCount;
+    pDst->count += pSrc->count;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Get the value at a quantile
+ * @param pSketch: [in] Sketch
+ * @param q: [in] Quantile, 0 is the minimum and 1 the maximum
+ * @return value within SKETCH_ALPHA relative error, NAN for an empty sketch
+ * @note  Bins are walked from the most negative value up, so the cost is
+ *        bounded by the number of bins, not the number of values.
+ */
+float sketch_quantile(const Sketch_t *pSketch, double q)
+{
+    double rank = 0.0;
+    double value = 0.0;
+    uint64_t seen = 0;
+    uint32_t i = 0;
+
+    if (0 == pSketch->count) {
+        return NAN;
+    }
+    if (q <= 0.0) {
+        return pSketch->min;
+    }
+    if (q >= 1.0) {
+        return pSketch->max;
+    }
+
+    rank = q * (pSketch->count - 1);
+    value = pSketch->max;
+
+    for (i = pSketch->negative.bins; i > 0; i--) {
+        seen += pSketch->negative.pCounts[i - 1];
+        if (seen > rank) {
+            value = -sketch_keyValue(pSketch->negative.offset + i - 1);
+            break;
+        }
+    }
+
+    if (seen <= rank) {
+        seen += pSketch->zeroCount;
+        if (seen > rank) {
+            value = 0.0;
+        }
+    }
+
+    for (i = 0; seen <= rank && i < pSketch->positive.bins; i++) {
+        seen += pSketch->positive.pCounts[i];
+        if (seen > rank) {
+            value = sketch_keyValue(pSketch->positive.offset + i);
+        }
+    }
+
+    // the bin representative may fall just outside the values seen
+    if (value < pSketch->min) {
+        value = pSketch->min;
+    }
+    if (value > pSketch->max) {
+        value = pSketch->max;
+    }
+
+    return (float)value;
+}
+
+/**
+ * @brief  Set the bins of an empty store
+ * @param pStore: [in] Store to fill
+ * @param offset: [in] Bin of pCounts[0]
+ * @param pCounts: [in] Bin counts
+ * @param bins: [in] Number of bins, at most SKETCH_MAX_BINS
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int sketch_setStore(Sketch_Store_t *pStore, int32_t offset, const uint32_t *pCounts, uint32_t bins)
+{
+    if (0 == bins) {
+        return STATUS_SUCCESS;
+    }
+
+    if (bins > SKETCH_MAX_BINS || 0 != pStore->bins) {
+        return STATUS_ERROR;
+    }
+
+    pStore->pCounts = malloc(bins * sizeof(uint32_t));
+    if (NULL == pStore->pCounts) {
+        return STATUS_ERROR;
+    }
+    memcpy(pStore->pCounts, pCounts, bins * sizeof(uint32_t));
+    pStore->offset = offset;
+    pStore->bins = bins;
+    pStore->capacity = bins;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Release the buckets of a sensor
+ * @param pSeries: [in] Series to release, left empty
+ */
+void sketch_seriesFree(Sketch_Series_t *pSeries)
+{
+    uint32_t i = 0;
+
+    for (; i < pSeries->count; i++) {
+        sketch_free(&pSeries->pBuckets[i].sketch);
+    }
+    free(pSeries->pBuckets);
+    memset(pSeries, 0, sizeof(Sketch_Series_t));
+
+    return;
+}
+
+/**
+ * @brief  Fold a reading into the sketch of its bucket
+ * @param pSeries: [in] Sketches of the sensor
+ * @param timestamp: [in] Reading timestamp
+ * @param value: [in] Reading value
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  In-order readings only touch the last bucket, older timestamps
+ *        are placed by binary search.
+ */
+int sketch_seriesAdd(Sketch_Series_t *pSeries, uint32_t timestamp, float value)
+{
+    uint32_t start = timestamp - timestamp % SKETCH_BUCKET_WIDTH;
+    uint32_t pos = pSeries->count;
+
+    if (0 != pSeries->count && pSeries->pBuckets[pSeries->count - 1].start >= start) {
+        pos = sketch_lowerBound(pSeries, start);
+    }
+
+    if (pos == pSeries->count || pSeries->pBuckets[pos].start != start) {
+        if (STATUS_SUCCESS != sketch_reserve(pSeries)) {
+            printf("Realloc failed to expand quantile sketches\r\n");
+            return STATUS_ERROR;
+        }
+
+        memmove(&pSeries->pBuckets[pos + 1], &pSeries->pBuckets[pos], (pSeries->count - pos) * sizeof(Sketch_Bucket_t));
+        memset(&pSeries->pBuckets[pos], 0, sizeof(Sketch_Bucket_t));
+        pSeries->pBuckets[pos].start = start;
+        pSeries->count++;
+    }
+
+    if (STATUS_SUCCESS != sketch_add(&pSeries->pBuckets[pos].sketch, value)) {
+        printf("Realloc failed to expand quantile sketch\r\n");
+        return STATUS_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Append a bucket to a series
+ * @param pSeries: [in] Series to extend
+ * @param pBucket: [in] Bucket, must start after the last bucket of the series.
+ *                 Its bins belong to the series on success.
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int sketch_seriesAppend(Sketch_Series_t *pSeries, Sketch_Bucket_t *pBucket)
+{
+    if (0 != pSeries->count && pSeries->pBuckets[pSeries->count - 1].start >= pBucket->start) {
+        return STATUS_ERROR;
+    }
+
+    if (STATUS_SUCCESS != sketch_reserve(pSeries)) {
+        return STATUS_ERROR;
+    }
+    pSeries->pBuckets[pSeries->count++] = *pBucket;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Drop the buckets that end before a cutoff
+ * @param pSeries: [in] Sketches of the sensor
+ * @param cutoff: [in] Buckets whose last second is below this are dropped
+ * @return number of buckets dropped
+ */
+uint32_t sketch_seriesExpire(Sketch_Series_t *pSeries, uint32_t cutoff)
+{
+    uint32_t n = 0;
+    uint32_t i = 0;
+
+    if (cutoff < SKETCH_BUCKET_WIDTH) {
+        return 0;
+    }
+
+    n = sketch_lowerBound(pSeries, cutoff - SKETCH_BUCKET_WIDTH + 1);
+    for (; i < n; i++) {
+        sketch_free(&pSeries->pBuckets[i].sketch);
+    }
+    if (0 != n) {
+        memmove(pSeries->pBuckets, &pSeries->pBuckets[n], (pSeries->count - n) * sizeof(Sketch_Bucket_t));
+        pSeries->count -= n;
+    }
+
+    return n;
+}
+
+/**
+ * @brief  Merge the buckets of a time range
+ * @param pSeries: [in] Sketches of the sensor
+ * @param fromTs: [in] First timestamp, inclusive
+ * @param toTs: [in] Last timestamp, inclusive
+ * @param pOut: [in] Sketch receiving the buckets
+ * @param pRead: [out] Number of buckets merged
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  The range is widened to whole SKETCH_BUCKET_WIDTH buckets.
+ */
+int sketch_seriesQuery(const Sketch_Series_t *pSeries, uint32_t fromTs, uint32_t toTs, Sketch_t *pOut, uint32_t *pRead)
+{
+    uint32_t first = sketch_lowerBound(pSeries, fromTs - fromTs % SKETCH_BUCKET_WIDTH);
+    uint32_t i = first;
+
+    for (; i < pSeries->count && pSeries->pBuckets[i].start <= toTs; i++) {
+        if (STATUS_SUCCESS != sketch_merge(pOut, &pSeries->pBuckets[i].sketch)) {
+            return STATUS_ERROR;
+        }
+    }
+    *pRead = i - first;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Helper functions
+ */
+
+static double sketch_lnGamma(void)
+{
+    static double lnGamma = 0.0;
+
+    if (0.0 == lnGamma) {
+        lnGamma = log((1.0 + SKETCH_ALPHA) / (1.0 - SKETCH_ALPHA));
+    }
+
+    return lnGamma;
+}
+
+static int32_t sketch_key(double magnitude)
+{
+    return (int32_t)ceil(log(magnitude) / sketch_lnGamma());
+}
+
+static double sketch_keyValue(int32_t key)
+{
+    double lnGamma = sketch_lnGamma();
+
+    // midpoint of (gamma^(key-1), gamma^key] in relative terms
+    return 2.0 * exp(key * lnGamma) / (exp(lnGamma) + 1.0);
+}
+
+static int sketch_storeAdd(Sketch_Store_t *pStore, int32_t key, uint32_t n)
+{
+    int32_t lo = key;
+    int32_t hi = key;
+
+    if (0 != pStore->bins) {
+        lo = (key < pStore->offset) ? key : pStore->offset;
+        hi = (key > pStore->offset + (int32_t)pStore->bins - 1) ? key : pStore->offset + (int32_t)pStore->bins - 1;
+    }
+
+    // keep the high end exact, the lowest magnitudes share a bin
+    if ((int64_t)hi - lo + 1 > SKETCH_MAX_BINS) {
+        lo = hi - SKETCH_MAX_BINS + 1;
+        key = (key < lo) ? lo : key;
+    }
+
+    if (STATUS_SUCCESS != sketch_storeRange(pStore, lo, hi)) {
+        return STATUS_ERROR;
+    }
+    pStore->pCounts[key - pStore->offset] += n;
+
+    return STATUS_SUCCESS;
+}
+
+static int sketch_storeRange(Sketch_Store_t *pStore, int32_t lo, int32_t hi)
+{
+    uint32_t bins = (uint32_t)(hi - lo + 1);
+    uint32_t capacity = pStore->capacity;
+    uint32_t *pCounts = NULL;
+    uint64_t collapsed = 0;
+    uint32_t kept = 0;
+    uint32_t shift = 0;
+    uint32_t end = 0;
+    uint32_t i = 0;
+
+    if (0 != pStore->bins && lo == pStore->offset && bins == pStore->bins) {
+        return STATUS_SUCCESS;
+    }
+
+    if (bins > capacity) {
+        capacity = (0 == capacity) ? SKETCH_INITIAL_BINS : capacity;
+        while (capacity < bins) {
+            capacity *= 2;
+        }
+        capacity = (capacity > SKETCH_MAX_BINS) ? SKETCH_MAX_BINS : capacity;
+
+        pCounts = realloc(pStore->pCounts, capacity * sizeof(uint32_t));
+        if (NULL == pCounts) {
+            return STATUS_ERROR;
+        }
+        pStore->pCounts = pCounts;
+        pStore->capacity = capacity;
+    }
+    pCounts = pStore->pCounts;
+
+    // old bins below lo are summed into the new lowest bin
+    if (0 != pStore->bins && lo > pStore->offset) {
+        kept = ((int64_t)lo - pStore->offset < pStore->bins) ? (uint32_t)(lo - pStore->offset) : pStore->bins;
+        for (i = 0; i < kept; i++) {
+            collapsed += pCounts[i];
+        }
+    }
+
+    if (kept < pStore->bins) {
+        shift = (uint32_t)(pStore->offset + (int32_t)kept - lo);
+        memmove(&pCounts[shift], &pCounts[kept], (pStore->bins - kept) * sizeof(uint32_t));
+        memset(pCounts, 0, shift * sizeof(uint32_t));
+        end = shift + pStore->bins - kept;
+    }
+    memset(&pCounts[end], 0, (bins - end) * sizeof(uint32_t));
+    pCounts[0] += (uint32_t)collapsed;
+
+    pStore->offset = lo;
+    pStore->bins = bins;
+
+    return STATUS_SUCCESS;
+}
+
+static uint32_t sketch_lowerBound(const Sketch_Series_t *pSeries, uint32_t start)
+{
+    uint32_t lo = 0;
+    uint32_t hi = pSeries->count;
+    uint32_t mid = 0;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (pSeries->pBuckets[mid].start < start) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+static int sketch_reserve(Sketch_Series_t *pSeries)
+{
+    Sketch_Bucket_t *pBuckets = NULL;
+    uint32_t capacity = 0;
+
+    if (pSeries->count < pSeries->capacity) {
+        return STATUS_SUCCESS;
+    }
+
+    capacity = (0 == pSeries->capacity) ? SKETCH_INITIAL_BUCKETS : pSeries->capacity * 2;
+    pBuckets = realloc(pSeries->pBuckets, capacity * sizeof(Sketch_Bucket_t));
+    if (NULL == pBuckets) {
+        return STATUS_ERROR;
+    }
+    pSeries->pBuckets = pBuckets;
+    pSeries->capacity = capacity;
+
+    return STATUS_SUCCESS;
+}
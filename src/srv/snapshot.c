@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include "snapshot.h"
+#include "timer.h"
+
+/* Private typedef -----------------------------------------------------------*/
+// writes one file of the snapshot
+typedef int (*Snapshot_Writer_t)(int fd, Parse_DbHeader_t *pDbhdr, Table_t *pTable);
+
+/* Private function prototypes -----------------------------------------------*/
+// open <db>.snapshot<suffix> read only
+static int snapshot_openFile(const char *pDbPath, const char *pSuffix);
+// child body, write every file of the snapshot and exit
+static void snapshot_child(const char *pDbPath, Parse_DbHeader_t *pDbhdr, Table_t *pTable);
+// write <db>.snapshot<suffix> through a temporary file
+static int snapshot_writeFile(const char *pDbPath, const char *pSuffix, Snapshot_Writer_t pWriter,
+                              Parse_DbHeader_t *pDbhdr, Table_t *pTable);
+static int snapshot_writeDb(int fd, Parse_DbHeader_t *pDbhdr, Table_t *pTable);
+static int snapshot_writeRollups(int fd, Parse_DbHeader_t *pDbhdr, Table_t *pTable);
+static int snapshot_writeSketches(int fd, Parse_DbHeader_t *pDbhdr, Table_t *pTable);
+
+/**
+ * @brief  Start writing a snapshot in a child process
+ * @param pSnapshot: [in] Snapshot state
+ * @param pDbPath: [in] Path of the database, the snapshot is written next to it
+ * @param pDbhdr: [in] Database header
+ * @param pTable: [in] Sensor table
+ * @param seq: [in] Last mutation log record applied to the table, already written to the log
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  Returns as soon as the child is forked, the caller goes on serving
+ *        and collects the child with snapshot_reap().
+ */
+int snapshot_start(Snapshot_t *pSnapshot, const char *pDbPath, Parse_DbHeader_t *pDbhdr, Table_t *pTable, uint64_t seq)
+{
+    pid_t pid = 0;
+
+    if (0 != pSnapshot->pid) {
+        printf("Snapshot of sequence %llu still being written\r\n", (unsigned long long)pSnapshot->seq);
+        return STATUS_ERROR;
+    }
+
+    // the child must not write out what the server printed so far a second time
+    fflush(stdout);
+
+    pid = fork();
+    if (-1 == pid) {
+        perror("fork");
+        return STATUS_ERROR;
+    }
+
+    if (0 == pid) {
+        pDbhdr->checkpointSeq = seq;
+        snapshot_child(pDbPath, pDbhdr, pTable);
+    }
+
+    pSnapshot->pid = pid;
+    pSnapshot->seq = seq;
+    pSnapshot->startMs = timer_nowMs();
+    printf("Snapshot of sequence %llu started in process %d\r\n", (unsigned long long)seq, (int)pid);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Collect the child of a finished snapshot
+ * @param pSnapshot: [in] Snapshot state
+ * @param wait: [in] Block until the child is done
+ * @return true when no snapshot is being written any more
+ */
+bool snapshot_reap(Snapshot_t *pSnapshot, bool wait)
+{
+    pid_t pid = 0;
+    int status = 0;
+
+    if (0 == pSnapshot->pid) {
+        return true;
+    }
+
+    do {
+        pid = waitpid(pSnapshot->pid, &status, (true == wait) ? 0 : WNOHANG);
+    } while (-1 == pid && EINTR == errno);
+
+    if (0 == pid) {
+        return false;
+    }
+
+    if (pid == pSnapshot->pid && WIFEXITED(status) && STATUS_SUCCESS == WEXITSTATUS(status)) {
+        printf("Snapshot of sequence %llu written in %llu ms\r\n", (unsigned long long)pSnapshot->seq,
+               (unsigned long long)(timer_nowMs() - pSnapshot->startMs));
+    } else {
+        printf("Snapshot of sequence %llu failed\r\n", (unsigned long long)pSnapshot->seq);
+    }
+    pSnapshot->pid = 0;
+
+    return true;
+}
+
+/**
+ * @brief  Open a file of the last complete snapshot for reading
+ * @param pDbPath: [in] Path of the database the snapshot was taken of
+ * @param pSuffix: [in] "" for the database, ROLLUP_SUFFIX or SKETCH_SUFFIX
+ * @param pSeq: [out] Last mutation the snapshot holds, taken from the file
+ * @return file descriptor, or -1 if there is no such snapshot file
+ * @note  A newer snapshot is renamed over the file, the descriptor keeps the
+ *        one it opened, so what is read through it never changes. A rollup
+ *        or sketch file must name the same mutation as the snapshot
+ *        database, a crash between the renames of two snapshots leaves
+ *        files of both.
+ */
+int snapshot_open(const char *pDbPath, const char *pSuffix, uint64_t *pSeq)
+{
+    uint64_t dbSeq = 0;
+    int dbFd = -1;
+    int fd = -1;
+
+    *pSeq = 0;
+    fd = snapshot_openFile(pDbPath, pSuffix);
+    if (-1 == fd) {
+        return -1;
+    }
+
+    if (true != parse_fileSeq(fd, pSuffix, pSeq)) {
+        printf("Snapshot file %s%s%s names no checkpoint\r\n", pDbPath, SNAPSHOT_SUFFIX, pSuffix);
+        close(fd);
+        return -1;
+    }
+
+    if ('\0' != pSuffix[0]) {
+        dbFd = snapshot_openFile(pDbPath, "");
+        if (-1 == dbFd || true != parse_fileSeq(dbFd, "", &dbSeq) || dbSeq != *pSeq) {
+            printf("Snapshot file %s%s%s holds sequence %llu, the snapshot database %llu\r\n", pDbPath,
+                   SNAPSHOT_SUFFIX, pSuffix, (unsigned long long)*pSeq, (unsigned long long)dbSeq);
+            close(fd);
+            fd = -1;
+        }
+        if (-1 != dbFd) {
+            close(dbFd);
+        }
+    }
+
+    return fd;
+}
+
+/**
+ * Helper functions
+ */
+
+static int snapshot_openFile(const char *pDbPath, const char *pSuffix)
+{
+    char path[PATH_MAX] = {0};
+    int fd = -1;
+
+    if ((int)sizeof(path) <= snprintf(path, sizeof(path), "%s%s%s", pDbPath, SNAPSHOT_SUFFIX, pSuffix)) {
+        printf("Path too long: %s%s%s\r\n", pDbPath, SNAPSHOT_SUFFIX, pSuffix);
+        return -1;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (-1 == fd) {
+        printf("No snapshot at %s: %s\r\n", path, strerror(errno));
+    }
+
+    return fd;
+}
+
+static void snapshot_child(const char *pDbPath, Parse_DbHeader_t *pDbhdr, Table_t *pTable)
+{
+    int status = STATUS_SUCCESS;
+
+    // the database goes last, a snapshot is only complete once it is in place
+    if (STATUS_SUCCESS != snapshot_writeFile(pDbPath, ROLLUP_SUFFIX, snapshot_writeRollups, pDbhdr, pTable) ||
+        STATUS_SUCCESS != snapshot_writeFile(pDbPath, SKETCH_SUFFIX, snapshot_writeSketches, pDbhdr, pTable) ||
+        STATUS_SUCCESS != snapshot_writeFile(pDbPath, "", snapshot_writeDb, pDbhdr, pTable)) {
+        status = STATUS_ERROR;
+    }
+
+    // leave the server's sockets, files and atexit handlers alone
+    fflush(stdout);
+    _exit((STATUS_SUCCESS == status) ? 0 : 1);
+}
+
+static int snapshot_writeFile(const char *pDbPath, const char *pSuffix, Snapshot_Writer_t pWriter,
+                              Parse_DbHeader_t *pDbhdr, Table_t *pTable)
+{
+    char path[PATH_MAX] = {0};
+    char tmpPath[PATH_MAX] = {0};
+    int fd = -1;
+
+    if ((int)sizeof(path) <= snprintf(path, sizeof(path), "%s%s%s", pDbPath, SNAPSHOT_SUFFIX, pSuffix) ||
+        (int)sizeof(tmpPath) <= snprintf(tmpPath, sizeof(tmpPath), "%s%s", path, SNAPSHOT_TMP_SUFFIX)) {
+        printf("Path too long: %s%s%s\r\n", pDbPath, SNAPSHOT_SUFFIX, pSuffix);
+        return STATUS_ERROR;
+    }
+
+    fd = open(tmpPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (-1 == fd) {
+        perror("open");
+        return STATUS_ERROR;
+    }
+
+    if (STATUS_SUCCESS != pWriter(fd, pDbhdr, pTable)) {
+        printf("Failed to write %s\r\n", tmpPath);
+        close(fd);
+        unlink(tmpPath);
+        return STATUS_ERROR;
+    }
+
+    // the snapshot is a backup, it has to be on disk before it replaces the last one
+    if (0 != fsync(fd)) {
+        perror("fsync");
+        close(fd);
+        unlink(tmpPath);
+        return STATUS_ERROR;
+    }
+    close(fd);
+
+    if (0 != rename(tmpPath, path)) {
+        perror("rename");
+        unlink(tmpPath);
+        return STATUS_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static int snapshot_writeDb(int fd, Parse_DbHeader_t *pDbhdr, Table_t *pTable)
+{
+    return parse_outputFile(fd, pDbhdr, pTable);
+}
+
+static int snapshot_writeRollups(int fd, Parse_DbHeader_t *pDbhdr, Table_t *pTable)
+{
+    return parse_outputRollups(fd, pTable, pDbhdr->checkpointSeq);
+}
+
+static int snapshot_writeSketches(int fd, Parse_DbHeader_t *pDbhdr, Table_t *pTable)
+{
+    return parse_outputSketches(fd, pTable, pDbhdr->checkpointSeq);
+}
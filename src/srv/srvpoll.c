@@ -1,10 +1,51 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include "srvpoll.h"
+#include "shmring.h"
+#include "reading.h"
+#include "filter.h"
+#include "aggregate.h"
+#include <endian.h>
 
 // define in main.c to initialize clients
 extern ClientState_t clientStates[MAX_CLIENTS];
 
 /* Private variables ---------------------------------------------------------*/
 static volatile bool keep_running = true;
+static Timer_Wheel_t timerWheel;
+static SrvPoll_Config_t *pSrvConfig = NULL;
+static ShmRing_Consumer_t shmRing = { .pShared = NULL };
+static int shmMemFd = -1;
+static int shmEventFd = -1;
+static bool shmBacklog = false;             // ring still had data after the last drain
+static SrvPoll_UdpStats_t udpStats;
+static bool dbDirty = false;                // in-memory table differs from the file
+static bool flushDue = false;               // flush timer expired
+static Timer_Node_t flushTimer;
+static char udpBuffers[UDP_BATCH][UDP_DGRAM_MAX];
+static uint64_t *pQueryBitmap = NULL;       // selection scratch for filter queries
+static size_t queryBitmapWords = 0;
+static Aggregate_t aggState;                // hash aggregation scratch, reused by every request
+static Retention_Sweep_t retentionSweep;    // expiry pass in progress, if active
+static Timer_Node_t retentionTimer;
+static Budget_t budget;                     // caps the reading history kept in memory
+static Segment_Store_t *pSegmentStore = NULL;
+static History_Sample_t *pColdSamples = NULL;   // evicted readings read back for a query
+static uint32_t coldCapacity = 0;
+static bool sealDue = false;                // reorder buffers may hold readings past the window
+static Timer_Node_t sealTimer;
+static Wal_t *pWal = NULL;                  // mutation log, committed before replies and once per iteration
+static Snapshot_t snapshot;                 // child writing a snapshot, if any
+static volatile sig_atomic_t snapshotRequested = 0;    // SIGUSR1 arrived
+static Repl_Replica_t replica;              // stream from the primary, replica mode only
+static bool replConnectDue = false;         // replica is disconnected and its retry delay passed
+static Timer_Node_t replRetryTimer;
+static bool replBacklog = false;            // a replica has more log to send than one step allows
+static bool exportBacklog = false;          // an export has more to send than one step allows
 
 /* Private function prototypes -----------------------------------------------*/
 // Initialize clients
@@ -14,7 +55,7 @@ static int find_free_slot(ClientState_t* states);
 // Find the slot number of the client that has data to be read 
 static int find_slot_by_fd(ClientState_t* states, int fd);
 // State machine
-static void handle_client_fsm(Parse_DbHeader_t *dbhdr, Parse_Sensor_t **ppSensors, ClientState_t *client, int dbfd);
+static void handle_client_fsm(Parse_DbHeader_t *dbhdr, Table_t *pTable, ClientState_t *client, DbProtocolHdr_t *hdr, int dbfd);
 // reply to client's request
 static void fsm_reply_hello(ClientState_t *client, DbProtocolHdr_t *hdr);
 // reply error to client
@@ -22,13 +63,87 @@ static void fsm_reply_err(ClientState_t *client, DbProtocolHdr_t *hdr);
 // Reply successfull add 
 static void fsm_reply_add(ClientState_t *client, DbProtocolHdr_t *hdr);
 // List all sensors in database
-static void fsm_reply_list(ClientState_t *client, Parse_DbHeader_t *dbhdr, Parse_Sensor_t **sensors);
+static void fsm_reply_list(ClientState_t *client, Parse_DbHeader_t *dbhdr, Table_t *pTable);
 // Delete a selected sensor from the database
 static void fsm_reply_delete(ClientState_t *client, DbProtocolHdr_t *hdr);
 // Handle client's request
 static void handle_signal(int sig);
+// SIGUSR1 asks for a snapshot, SIGCHLD only wakes poll() to collect the child
+static void handle_snapshot_signal(int sig);
+// Fork a snapshot of the table as of the last applied mutation
+static int start_snapshot(Parse_DbHeader_t *dbhdr, Table_t *pTable);
+// Start a snapshot and tell the client which mutation it holds
+static void fsm_reply_snapshot(ClientState_t *client, Parse_DbHeader_t *dbhdr, Table_t *pTable, DbProtocolHdr_t *hdr);
+// Turn the client into a replica fed from the log backlog
+static void fsm_reply_replicate(ClientState_t *client, DbProtocolHdr_t *hdr);
+// Report the role and log position of this server
+static void fsm_reply_repl_status(ClientState_t *client, DbProtocolHdr_t *hdr);
+// Send each replica the committed log records it does not have yet
+static void feed_replicas(void);
+// Replica mode: time to connect to the primary again
+static void on_repl_retry(Timer_Node_t *pNode, void *pArg);
+// Replica mode: apply what the primary sent, reconnecting later if the stream ended
+static void receive_replication(Parse_DbHeader_t *dbhdr, Table_t *pTable);
+// open the requested file and start streaming it to the client
+static void fsm_reply_export(ClientState_t *client, DbProtocolHdr_t *hdr);
+// send the next part of every export, then serve what the client pipelined behind a finished one
+static void feed_exports(Parse_DbHeader_t *dbhdr, Table_t *pTable, int dbfd);
+// end an export, its file is closed
+static void finish_export(ClientState_t *client);
 // listen for incoming connections
 static int setup_server_socket(unsigned short port);
+// listen for local connections on a unix domain socket
+static int setup_unix_socket(const char *pPath);
+// accept a pending connection into a free client slot
+static void accept_client(int listen_fd, uint64_t now);
+// Split buffered client data into frames and dispatch them
+static void handle_client_data(Parse_DbHeader_t *dbhdr, Table_t *pTable, ClientState_t *client, int dbfd);
+// Size of the frame at the start of the buffer
+static int fsm_frame_size(const char *pData, size_t len);
+// Release a client slot and its timers
+static void close_client(ClientState_t *client);
+// Handshake deadline or idle timeout expired
+static void on_conn_timeout(Timer_Node_t *pNode, void *pArg);
+// Partial request was not completed in time
+static void on_request_timeout(Timer_Node_t *pNode, void *pArg);
+// Hand the shared memory ring and its doorbell to a local producer
+static void fsm_reply_shm_attach(ClientState_t *client, DbProtocolHdr_t *hdr);
+// Create the shared memory ingest ring
+static int setup_shm_ring(unsigned int slots);
+// Apply queued shared memory readings to the database
+static void drain_shm_ring(Parse_DbHeader_t *dbhdr, Table_t *pTable, int dbfd);
+// bind the fire-and-forget UDP ingest socket
+static int setup_udp_socket(unsigned short port);
+// Receive pending datagrams in bulk and apply their readings
+static void drain_udp_socket(int udp_fd, Parse_DbHeader_t *dbhdr, Table_t *pTable, int dbfd);
+// Note that the table changed, the file is rewritten at most once per flush interval
+static void mark_db_dirty(void);
+// Flush interval elapsed
+static void on_flush_timeout(Timer_Node_t *pNode, void *pArg);
+// Time for the next expiry sweep
+static void on_retention_timeout(Timer_Node_t *pNode, void *pArg);
+// Readings buffered at the last flush have aged past the lateness window
+static void on_seal_timeout(Timer_Node_t *pNode, void *pArg);
+// Send a whole reply, closes the client if it cannot take it
+static int reply_write(ClientState_t *client, const void *pData, size_t len);
+// Apply a batch of compact readings
+static void fsm_reply_batch_add(ClientState_t *client, Parse_DbHeader_t *dbhdr, Table_t *pTable, DbProtocolHdr_t *hdr);
+// Reply with one page of the sensor table
+static void fsm_reply_list_page(ClientState_t *client, Parse_DbHeader_t *dbhdr, Table_t *pTable, DbProtocolHdr_t *hdr);
+// Fill a list record in network byte order
+static void fill_list_resp(DbProtocol_SensorListResp_t *resp, const Table_t *pTable, uint32_t row);
+// Evaluate a filter query and reply with one page of matches
+static void fsm_reply_query(ClientState_t *client, Table_t *pTable, DbProtocolHdr_t *hdr);
+// Compute per group statistics and reply with the result set
+static void fsm_reply_aggregate(ClientState_t *client, Table_t *pTable, DbProtocolHdr_t *hdr);
+static void fsm_reply_series(ClientState_t *client, Table_t *pTable, DbProtocolHdr_t *hdr);
+static void fsm_reply_samples(ClientState_t *client, Table_t *pTable, DbProtocolHdr_t *hdr);
+// Gather the evicted readings of a sensor with the ones in memory, returns how many
+static int gather_cold_samples(History_Series_t *pSeries, const char *pSensorId, uint32_t fromTs, uint32_t toTs,
+                               uint32_t first, uint32_t count);
+static void fsm_reply_quantile(ClientState_t *client, Table_t *pTable, DbProtocolHdr_t *hdr);
+// Apply the readings carried by one datagram
+static int apply_udp_datagram(Parse_DbHeader_t *dbhdr, Table_t *pTable, const char *pData, size_t len);
 
 /**
   * @brief  Initialize the client state array
@@ -40,6 +155,14 @@ static void init_clients(ClientState_t* states) {
         states[i].fd = -1;
         states[i].state = STATE_NEW;
         memset(states[i].buffer, '\0', BUFF_SIZE);
+        states[i].bufLen = 0;
+        states[i].isLocal = false;
+        states[i].lastActiveMs = 0;
+        states[i].isReplica = false;
+        states[i].pReplFrame = NULL;
+        states[i].exportFd = -1;
+        timer_initNode(&states[i].connTimer, on_conn_timeout, &states[i]);
+        timer_initNode(&states[i].reqTimer, on_request_timeout, &states[i]);
     }
 
     return;
@@ -79,103 +202,259 @@ static int find_slot_by_fd(ClientState_t *states, int fd) {
 
 /**
   * @brief  Polling routine for the server
-  * @param port: port number to listen on
+  * @param pConfig: pointer to the server configuration
   * @param dbhdr: pointer to the database header structure
-  * @param ppSensors: pointer to the array of sensors
+  * @param pTable: pointer to the sensor table
   * @param dbfd: file descriptor for the database file
+  * @param pSide: side files flushed together with the database
   */
-void poll_loop(unsigned short port, Parse_DbHeader_t *dbhdr, Parse_Sensor_t **sensors, int dbfd) {
-    int conn_fd, freeSlot;
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
-
-    int i, listen_fd;
+void poll_loop(SrvPoll_Config_t *pConfig, Parse_DbHeader_t *dbhdr, Table_t *pTable, int dbfd, Parse_SideFiles_t *pSide) {
+    int listen_fd;
+    int unix_fd = -1;
+    int udp_fd = -1;
     int n_events;
     int nfds;
-    struct pollfd fds[MAX_CLIENTS + 1];
+    int timeout;
+    uint64_t now;
+    struct pollfd fds[MAX_CLIENTS + POLL_IDX_CLIENTS];
     
     signal(SIGINT, handle_signal);
     signal(SIGTERM, handle_signal);
+    // a client vanishing mid-reply must not take the server down
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGUSR1, handle_snapshot_signal);
+    signal(SIGCHLD, handle_snapshot_signal);
     
+    pSrvConfig = pConfig;
+    timer_init(&timerWheel, timer_nowMs());
+    timer_initNode(&flushTimer, on_flush_timeout, NULL);
+    timer_initNode(&retentionTimer, on_retention_timeout, NULL);
+    timer_initNode(&sealTimer, on_seal_timeout, NULL);
+    timer_initNode(&replRetryTimer, on_repl_retry, NULL);
+    budget_init(&budget, pConfig->memoryBudget);
+    pSegmentStore = &pSide->segments;
+    pWal = &pSide->wal;
+    memset(&snapshot, 0, sizeof(snapshot));
+    memset(&replica, 0, sizeof(replica));
+    replica.fd = -1;
+    retention_start(&retentionSweep, &pConfig->retention, (uint32_t)time(NULL));
     init_clients(clientStates);
+    filter_init();
+    aggregate_init(&aggState);
     
-    listen_fd = setup_server_socket(port);
-    printf("  Listening on: 0.0.0.0:%d\r\n", port);
+    listen_fd = setup_server_socket(pConfig->port);
+    printf("  Listening on: 0.0.0.0:%d\r\n", pConfig->port);
+
+    if (NULL != pConfig->pUnixPath) {
+        unix_fd = setup_unix_socket(pConfig->pUnixPath);
+        printf("  Listening on: unix:%s\r\n", pConfig->pUnixPath);
+    }
+
+    if (NULL != pConfig->pPrimary) {
+        // a replica only changes through the stream, it takes no ingest of its own
+        if (STATUS_SUCCESS != repl_parseAddress(pConfig->pPrimary, &replica)) {
+            return;
+        }
+        printf("  Replica of: %s:%u\r\n", replica.host, replica.port);
+        replConnectDue = true;
+        if (0 != pConfig->udpPort || 0 != pConfig->shmSlots) {
+            printf("Replica ignores UDP and shared memory ingest\r\n");
+        }
+    } else if (0 != pConfig->udpPort) {
+        udp_fd = setup_udp_socket(pConfig->udpPort);
+        printf("  Listening on: udp 0.0.0.0:%d\r\n", pConfig->udpPort);
+    }
+
+    if (0 != pConfig->shmSlots && NULL == pConfig->pPrimary) {
+        if (NULL == pConfig->pUnixPath) {
+            printf("Shared memory ingest needs a unix socket (-u) to hand out the ring\r\n");
+        } else if (STATUS_SUCCESS == setup_shm_ring(pConfig->shmSlots)) {
+            printf("  Shared memory ingest ring: %u slots\r\n", pConfig->shmSlots);
+        }
+    }
 
     
     while (true == keep_running) {
-        int i, poll_idx = 1;
-        memset(fds, 0, sizeof(struct pollfd) * (MAX_CLIENTS + 1));
+        int i, poll_idx = POLL_IDX_CLIENTS;
+
+        // signals only set flags, act on them here where the table is consistent
+        if (0 != snapshotRequested) {
+            snapshotRequested = 0;
+            start_snapshot(dbhdr, pTable);
+        }
+        snapshot_reap(&snapshot, false);
+        if (true == replConnectDue) {
+            replConnectDue = false;
+            if (STATUS_SUCCESS != repl_connect(&replica, pWal->seq)) {
+                printf("Reconnecting to the primary in %d ms\r\n", REPL_RETRY_MS);
+                timer_arm(&timerWheel, &replRetryTimer, timer_nowMs(), REPL_RETRY_MS);
+            }
+        }
+        memset(fds, 0, sizeof(struct pollfd) * (MAX_CLIENTS + POLL_IDX_CLIENTS));
         
-        fds[0].fd = listen_fd;
-        fds[0].events = POLLIN;
+        fds[POLL_IDX_TCP].fd = listen_fd;
+        fds[POLL_IDX_TCP].events = POLLIN;
+
+        // poll() skips negative descriptors, so a disabled listener costs nothing
+        fds[POLL_IDX_UNIX].fd = unix_fd;
+        fds[POLL_IDX_UNIX].events = POLLIN;
+
+        fds[POLL_IDX_SHM].fd = shmEventFd;
+        fds[POLL_IDX_SHM].events = POLLIN;
+
+        fds[POLL_IDX_UDP].fd = udp_fd;
+        fds[POLL_IDX_UDP].events = POLLIN;
+
+        fds[POLL_IDX_REPLICA].fd = replica.fd;
+        fds[POLL_IDX_REPLICA].events = POLLIN;
         
         for (i = 0; i < MAX_CLIENTS; i++) {
             if (clientStates[i].fd != -1) {
                 fds[poll_idx].fd = clientStates[i].fd;
                 fds[poll_idx].events = POLLIN;
+                // an exporting client is not read from until its file is out, nor
+                // one whose pipelined requests already fill its buffer
+                if (-1 != clientStates[i].exportFd || sizeof(clientStates[i].buffer) == clientStates[i].bufLen) {
+                    fds[poll_idx].events = POLLOUT;
+                }
+                // a replica whose socket filled up mid-frame waits for room
+                if (clientStates[i].replSent < clientStates[i].replLen) {
+                    fds[poll_idx].events |= POLLOUT;
+                }
                 poll_idx++;
             }
         }
         
         nfds = poll_idx;
+
+        // sleep until the next timer is due, but never longer than 30 s
+        timeout = timer_nextTimeoutMs(&timerWheel, timer_nowMs());
+        if (-1 == timeout || timeout > 30000) {
+            timeout = 30000;
+        }
+
+        // keep draining without sleeping while producers outpace us or old data expires
+        if (true == shmBacklog || true == retentionSweep.active || true == replBacklog || true == exportBacklog) {
+            timeout = 0;
+        }
         
-        n_events = poll(fds, nfds, 30000);
+        n_events = poll(fds, nfds, timeout);
         
         if (n_events < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
             perror("poll");
             break;
         }
         
-        if (n_events == 0) {
+        if (n_events == 0 && 0 == timerWheel.pending && true != shmBacklog && true != retentionSweep.active &&
+            true != replBacklog && true != exportBacklog) {
             printf("Poll timeout - no activity\r\n");
             continue;
         }
 
-        if (fds[0].revents & POLLIN) {
-            if ((conn_fd = accept(listen_fd, (struct sockaddr *)&client_addr, &client_len)) == -1) {
-                perror("accept");
-                continue;
-            }
-        
-            printf("New connection from %s:%d\r\n", 
-                   inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
-        
-            freeSlot = find_free_slot(clientStates);
-            if (freeSlot == -1) {
-                printf("Server full: closing new connection\r\n");
-                close(conn_fd);
-            } else {
-                clientStates[freeSlot].fd = conn_fd;
-                clientStates[freeSlot].state = STATE_HELLO;
-                printf("Client connected in slot %d with fd %d\r\n", freeSlot, conn_fd);
-                nfds++;
+        now = timer_nowMs();
+
+        if (fds[POLL_IDX_TCP].revents & POLLIN) {
+            accept_client(listen_fd, now);
+            n_events--;
+        }
+
+        if (fds[POLL_IDX_UNIX].revents & POLLIN) {
+            accept_client(unix_fd, now);
+            n_events--;
+        }
+
+        if ((fds[POLL_IDX_SHM].revents & POLLIN) || true == shmBacklog) {
+            if (fds[POLL_IDX_SHM].revents & POLLIN) {
+                uint64_t doorbell;
+                read(shmEventFd, &doorbell, sizeof(doorbell));
+                n_events--;
             }
+            drain_shm_ring(dbhdr, pTable, dbfd);
+        }
+
+        if (fds[POLL_IDX_UDP].revents & POLLIN) {
+            drain_udp_socket(udp_fd, dbhdr, pTable, dbfd);
+            n_events--;
+        }
+
+        if (fds[POLL_IDX_REPLICA].revents & (POLLIN | POLLHUP | POLLERR)) {
+            receive_replication(dbhdr, pTable);
             n_events--;
         }
         
-        for (i = 1; i <= nfds && n_events > 0; i++) {
-            if (fds[i].revents & POLLIN) {
+        for (i = POLL_IDX_CLIENTS; i < nfds && n_events > 0; i++) {
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
                 n_events--;
 
                 int fd = fds[i].fd;
                 int slot = find_slot_by_fd(clientStates, fd);
-                ssize_t bytes_read = read(fd, &clientStates[slot].buffer, sizeof(clientStates[slot].buffer));
-                if (bytes_read <= 0) {
-                    close(fd);
+                if (-1 == slot) {
+                    continue;
+                }
 
-                    if (-1 != slot) {
-                        clientStates[slot].fd = -1;
-                        clientStates[slot].state = STATE_DISCONNECTED;
-                        printf("Client disconnected\n");
-                        nfds--;
+                ClientState_t *client = &clientStates[slot];
+                // a full buffer would read 0 bytes and look like a hangup, it drains
+                // once the export ahead of the requests is out
+                if (sizeof(client->buffer) == client->bufLen) {
+                    if (fds[i].revents & (POLLHUP | POLLERR)) {
+                        close_client(client);
                     }
+                    continue;
+                }
+
+                ssize_t bytes_read = read(fd, client->buffer + client->bufLen, sizeof(client->buffer) - client->bufLen);
+                if (bytes_read <= 0) {
+                    close_client(client);
                 } else {
-                   handle_client_fsm(dbhdr, sensors, &clientStates[slot], dbfd);
+                    client->bufLen += bytes_read;
+                    client->lastActiveMs = now;
+                    handle_client_data(dbhdr, pTable, client, dbfd);
                 }
             }
         }
 
+        timer_advance(&timerWheel, timer_nowMs());
+
+        // expire a slice of old data, the rest waits for the next iteration
+        if (true == retentionSweep.active) {
+            if (true == retention_step(&retentionSweep, pTable, &pSide->segments, RETENTION_ROWS_PER_STEP)) {
+                mark_db_dirty();
+            }
+            if (true != retentionSweep.active) {
+                timer_arm(&timerWheel, &retentionTimer, timer_nowMs(), RETENTION_INTERVAL_MS);
+            }
+        }
+
+        // readings applied without a reply, UDP, the ring and the primary, reach the log here,
+        // a failed commit keeps them buffered for the next iteration and the checkpoint saves them
+        wal_commit(pWal);
+        feed_replicas();
+        feed_exports(dbhdr, pTable, dbfd);
+
+        // Batch every change of this interval into a single rewrite, sealing logged
+        // readings into segments is only safe as part of a checkpoint, which also
+        // saves what the window keeps in the reorder buffers
+        if (true == sealDue || (true == dbDirty && (true == flushDue || 0 == pConfig->flushIntervalMs))) {
+            // readings arrived since the last checkpoint, seal them once the window has passed
+            if (true == dbDirty && 0 != pConfig->reorderWindowSec) {
+                timer_arm(&timerWheel, &sealTimer, timer_nowMs(), (uint64_t)pConfig->reorderWindowSec * 1000);
+            }
+            dbhdr->checkpointSeq = pWal->seq;
+            flushDue = false;
+            sealDue = false;
+            // the log goes only once every file is on disk, a failed checkpoint is retried at the next interval
+            if (STATUS_SUCCESS == parse_checkpoint(pConfig->pDbPath, dbfd, dbhdr, pTable, pSide, pConfig->reorderWindowSec)) {
+                wal_checkpoint(pWal);
+                dbDirty = false;
+            } else {
+                mark_db_dirty();
+            }
+            budget_enforce(&budget, pTable);
+        }
+
         if (true != keep_running) {
             printf("Shutting down server...\n");
             break;
@@ -184,6 +463,33 @@ void poll_loop(unsigned short port, Parse_DbHeader_t *dbhdr, Parse_Sensor_t **se
     
     printf("Closing server socket...\n");
     close(listen_fd);
+
+    if (-1 != unix_fd) {
+        close(unix_fd);
+        unlink(pConfig->pUnixPath);
+    }
+
+    if (-1 != udp_fd) {
+        close(udp_fd);
+        printf("UDP ingest: %lu datagrams, %lu readings, %lu malformed, %lu rejected, %u dropped by kernel\n",
+               (unsigned long)udpStats.datagrams, (unsigned long)udpStats.readings,
+               (unsigned long)udpStats.malformed, (unsigned long)udpStats.rejected,
+               udpStats.kernelDrops);
+    }
+
+    // a snapshot in progress is finished, not abandoned
+    snapshot_reap(&snapshot, true);
+    repl_disconnect(&replica);
+
+    if (NULL != shmRing.pShared) {
+        // pick up whatever producers managed to queue before shutdown
+        drain_shm_ring(dbhdr, pTable, dbfd);
+        printf("Shared memory ring dropped %lu readings, skipped %lu corrupt slots\n",
+               (unsigned long)atomic_load(&shmRing.pShared->dropped), (unsigned long)shmRing.corrupt);
+        shmring_close(&shmRing);
+        close(shmMemFd);
+        close(shmEventFd);
+    }
     return;
 }
 
@@ -191,10 +497,242 @@ void poll_loop(unsigned short port, Parse_DbHeader_t *dbhdr, Parse_Sensor_t **se
  * Helper functions
 */
 
-static void handle_client_fsm(Parse_DbHeader_t *dbhdr, Parse_Sensor_t **ppSensors, ClientState_t *client, int dbfd) {
-    // Casting buffer that was already read
+static void accept_client(int listen_fd, uint64_t now) {
+    struct sockaddr_storage client_addr;
+    socklen_t client_len = sizeof(client_addr);
+    struct sockaddr_in *pInAddr = (struct sockaddr_in *)&client_addr;
+    struct timeval sendTimeout = { .tv_sec = REPLY_SEND_TIMEOUT_S, .tv_usec = 0 };
+    int conn_fd, freeSlot;
+
+    if ((conn_fd = accept(listen_fd, (struct sockaddr *)&client_addr, &client_len)) == -1) {
+        perror("accept");
+        return;
+    }
+
+    if (AF_UNIX == client_addr.ss_family) {
+        printf("New local connection on %s\r\n", pSrvConfig->pUnixPath);
+    } else {
+        printf("New connection from %s:%d\r\n", 
+               inet_ntoa(pInAddr->sin_addr), ntohs(pInAddr->sin_port));
+    }
+
+    freeSlot = find_free_slot(clientStates);
+    if (freeSlot == -1) {
+        printf("Server full: closing new connection\r\n");
+        close(conn_fd);
+        return;
+    }
+
+    // a client that stops reading cannot hold the loop up for more than a moment
+    if (-1 == setsockopt(conn_fd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout))) {
+        perror("setsockopt");
+    }
+
+    clientStates[freeSlot].fd = conn_fd;
+    clientStates[freeSlot].state = STATE_HELLO;
+    clientStates[freeSlot].bufLen = 0;
+    clientStates[freeSlot].lastActiveMs = now;
+    clientStates[freeSlot].isLocal = (AF_UNIX == client_addr.ss_family);
+
+    if (0 != pSrvConfig->helloTimeoutSec) {
+        timer_arm(&timerWheel, &clientStates[freeSlot].connTimer, now, pSrvConfig->helloTimeoutSec * 1000ULL);
+    } else if (0 != pSrvConfig->idleTimeoutSec) {
+        timer_arm(&timerWheel, &clientStates[freeSlot].connTimer, now, pSrvConfig->idleTimeoutSec * 1000ULL);
+    }
+
+    printf("Client connected in slot %d with fd %d\r\n", freeSlot, conn_fd);
+
+    return;
+}
+
+static void handle_client_data(Parse_DbHeader_t *dbhdr, Table_t *pTable, ClientState_t *client, int dbfd) {
     DbProtocolHdr_t *hdr = (DbProtocolHdr_t *)client->buffer;
+    bool completed = false;
+    int frameSize;
+
+    // requests behind an export wait until its last byte is out
+    while (-1 != client->fd && -1 == client->exportFd) {
+        frameSize = fsm_frame_size(client->buffer, client->bufLen);
+        if (frameSize < 0) {
+            printf("Malformed request from fd %d\r\n", client->fd);
+            fsm_reply_err(client, hdr);
+            close_client(client);
+            return;
+        }
+
+        if (0 == frameSize || client->bufLen < (size_t)frameSize) {
+            break;
+        }
+
+        handle_client_fsm(dbhdr, pTable, client, hdr, dbfd);
+        completed = true;
+
+        // the reply failed and the client is gone along with its buffer
+        if (-1 == client->fd) {
+            return;
+        }
+
+        // Consume the frame, keep whatever the client pipelined behind it
+        client->bufLen -= frameSize;
+        memmove(client->buffer, client->buffer + frameSize, client->bufLen);
+    }
+
+    if (-1 == client->fd || -1 != client->exportFd || 0 == pSrvConfig->requestTimeoutMs) {
+        return;
+    }
+
+    // The deadline covers one request: restart it whenever a frame completes
+    if (0 == client->bufLen || true == completed) {
+        timer_cancel(&timerWheel, &client->reqTimer);
+    }
+
+    if (0 != client->bufLen && true != timer_isArmed(&client->reqTimer)) {
+        timer_arm(&timerWheel, &client->reqTimer, client->lastActiveMs, pSrvConfig->requestTimeoutMs);
+    }
+
+    return;
+}
+
+static int fsm_frame_size(const char *pData, size_t len) {
+    DbProtocolHdr_t hdr;
+    size_t payload = 0;
+
+    if (len < sizeof(DbProtocolHdr_t)) {
+        return 0;
+    }
+
+    memcpy(&hdr, pData, sizeof(DbProtocolHdr_t));
+    hdr.type = ntohl(hdr.type);
+    hdr.len = ntohs(hdr.len);
+
+    switch (hdr.type) {
+        case MSG_HANDSHAKE_REQ:{
+            payload = hdr.len * sizeof(DbProtocolVer_Req_t);
+            break;
+        }
+        case MSG_SENSOR_LIST_REQ:
+        case MSG_SHM_ATTACH_REQ:
+        case MSG_SNAPSHOT_REQ:
+        case MSG_REPL_STATUS_REQ:{
+            payload = 0;
+            break;
+        }
+        case MSG_SENSOR_ADD_REQ:{
+            payload = hdr.len * sizeof(DbProtocol_SensorAddReq_t);
+            break;
+        }
+        case MSG_SENSOR_DEL_REQ:{
+            payload = hdr.len * sizeof(DbProtocol_SensorDeleteReq_t);
+            break;
+        }
+        case MSG_SENSOR_BATCH_ADD_REQ:{
+            payload = hdr.len * sizeof(DbProtocol_Reading_t);
+            break;
+        }
+        case MSG_SENSOR_LIST_PAGE_REQ:{
+            payload = hdr.len * sizeof(DbProtocol_ListPageReq_t);
+            break;
+        }
+        case MSG_QUERY_VIOLATIONS_REQ:{
+            payload = hdr.len * sizeof(DbProtocol_QueryReq_t);
+            break;
+        }
+        case MSG_AGGREGATE_REQ:{
+            payload = hdr.len * sizeof(DbProtocol_AggregateReq_t);
+            break;
+        }
+        case MSG_SERIES_REQ:{
+            payload = hdr.len * sizeof(DbProtocol_SeriesReq_t);
+            break;
+        }
+        case MSG_SAMPLES_REQ:{
+            payload = hdr.len * sizeof(DbProtocol_SamplesReq_t);
+            break;
+        }
+        case MSG_QUANTILE_REQ:{
+            payload = hdr.len * sizeof(DbProtocol_QuantileReq_t);
+            break;
+        }
+        case MSG_REPLICATE_REQ:{
+            payload = hdr.len * sizeof(DbProtocol_ReplicateReq_t);
+            break;
+        }
+        case MSG_EXPORT_REQ:{
+            payload = hdr.len * sizeof(DbProtocol_ExportReq_t);
+            break;
+        }
+        default:{
+            return -1;
+        }
+    }
+
+    if (sizeof(DbProtocolHdr_t) + payload > BUFF_SIZE) {
+        return -1;
+    }
+
+    return sizeof(DbProtocolHdr_t) + payload;
+}
+
+static void close_client(ClientState_t *client) {
+    timer_cancel(&timerWheel, &client->connTimer);
+    timer_cancel(&timerWheel, &client->reqTimer);
+
+    close(client->fd);
+    client->fd = -1;
+    client->state = STATE_DISCONNECTED;
+    client->bufLen = 0;
+    client->isReplica = false;
+    free(client->pReplFrame);
+    client->pReplFrame = NULL;
+    client->replLen = 0;
+    client->replSent = 0;
+    if (-1 != client->exportFd) {
+        finish_export(client);
+    }
+    printf("Client disconnected\n");
+
+    return;
+}
+
+static void on_conn_timeout(Timer_Node_t *pNode, void *pArg) {
+    ClientState_t *client = (ClientState_t *)pArg;
+    uint64_t now = timer_nowMs();
+    uint64_t idleMs = pSrvConfig->idleTimeoutSec * 1000ULL;
+
+    if (STATE_HELLO == client->state && 0 != pSrvConfig->helloTimeoutSec) {
+        printf("Handshake timeout on fd %d\r\n", client->fd);
+        close_client(client);
+        return;
+    }
+
+    if (0 == idleMs) {
+        return;
+    }
 
+    // Reads only stamp lastActiveMs, the timer is pushed back lazily here
+    if (now - client->lastActiveMs < idleMs) {
+        timer_arm(&timerWheel, pNode, now, idleMs - (now - client->lastActiveMs));
+        return;
+    }
+
+    printf("Idle timeout on fd %d\r\n", client->fd);
+    close_client(client);
+
+    return;
+}
+
+static void on_request_timeout(Timer_Node_t *pNode, void *pArg) {
+    ClientState_t *client = (ClientState_t *)pArg;
+    DbProtocolHdr_t hdr = {0};
+
+    printf("Request timeout on fd %d\r\n", client->fd);
+    fsm_reply_err(client, &hdr);
+    close_client(client);
+
+    return;
+}
+
+static void handle_client_fsm(Parse_DbHeader_t *dbhdr, Table_t *pTable, ClientState_t *client, DbProtocolHdr_t *hdr, int dbfd) {
     // Unpack
     hdr->type = ntohl(hdr->type);
     hdr->len = ntohs(hdr->len);
@@ -218,36 +756,113 @@ static void handle_client_fsm(Parse_DbHeader_t *dbhdr, Parse_Sensor_t **ppSensor
         fsm_reply_hello(client, hdr);
         client->state = STATE_MSG;
         printf("Client promoted to STATE_MSG\r\n");
+
+        // Handshake done, from now on only the idle timeout applies
+        if (0 != pSrvConfig->idleTimeoutSec) {
+            timer_arm(&timerWheel, &client->connTimer, client->lastActiveMs, pSrvConfig->idleTimeoutSec * 1000ULL);
+        } else {
+            timer_cancel(&timerWheel, &client->connTimer);
+        }
+        return;
     }
 
     if (STATE_MSG == client->state) {
+        // a replica only changes through the stream from its primary
+        if (NULL != pSrvConfig->pPrimary &&
+            (MSG_SENSOR_ADD_REQ == hdr->type || MSG_SENSOR_BATCH_ADD_REQ == hdr->type ||
+             MSG_SENSOR_DEL_REQ == hdr->type || MSG_SHM_ATTACH_REQ == hdr->type)) {
+            printf("Replica refused a write, send it to the primary\r\n");
+            fsm_reply_err(client, hdr);
+            return;
+        }
+
         if (MSG_SENSOR_ADD_REQ == hdr->type) {
-            DbProtocol_SensorAddReq_t *sensor = (DbProtocolVer_Req_t *)&hdr[1];
+            DbProtocol_SensorAddReq_t *sensor = (DbProtocol_SensorAddReq_t *)&hdr[1];
+            sensor->data[sizeof(sensor->data) - 1] = '\0';
 
             printf("Adding sensor: %s\r\n", sensor->data);
-            if (STATUS_SUCCESS != parse_addSensor(dbhdr, ppSensors, sensor->data)) {
+            if (STATUS_SUCCESS != parse_addSensor(dbhdr, pTable, (char *)sensor->data)) {
                 fsm_reply_err(client, hdr);
                 return;
             } else {
+                // the change is in memory either way, only a logged one is acknowledged
+                mark_db_dirty();
+                if (STATUS_SUCCESS != wal_commit(pWal)) {
+                    fsm_reply_err(client, hdr);
+                    return;
+                }
                 fsm_reply_add(client, hdr);
-                parse_outputFile(dbfd, dbhdr, *ppSensors);
             }
         }
         
+        if (MSG_SENSOR_BATCH_ADD_REQ == hdr->type) {
+            fsm_reply_batch_add(client, dbhdr, pTable, hdr);
+        }
+
         if (MSG_SENSOR_LIST_REQ == hdr->type) {
             printf("Listing all sensors\r\n");
-            fsm_reply_list(client, dbhdr, ppSensors);
+            fsm_reply_list(client, dbhdr, pTable);
+        }
+
+        if (MSG_SENSOR_LIST_PAGE_REQ == hdr->type) {
+            fsm_reply_list_page(client, dbhdr, pTable, hdr);
+        }
+
+        if (MSG_QUERY_VIOLATIONS_REQ == hdr->type) {
+            fsm_reply_query(client, pTable, hdr);
+        }
+
+        if (MSG_AGGREGATE_REQ == hdr->type) {
+            fsm_reply_aggregate(client, pTable, hdr);
+        }
+
+        if (MSG_SERIES_REQ == hdr->type) {
+            fsm_reply_series(client, pTable, hdr);
+        }
+
+        if (MSG_SAMPLES_REQ == hdr->type) {
+            fsm_reply_samples(client, pTable, hdr);
+        }
+
+        if (MSG_QUANTILE_REQ == hdr->type) {
+            fsm_reply_quantile(client, pTable, hdr);
+        }
+
+        if (MSG_SNAPSHOT_REQ == hdr->type) {
+            fsm_reply_snapshot(client, dbhdr, pTable, hdr);
+        }
+
+        if (MSG_REPLICATE_REQ == hdr->type) {
+            fsm_reply_replicate(client, hdr);
+        }
+
+        if (MSG_REPL_STATUS_REQ == hdr->type) {
+            fsm_reply_repl_status(client, hdr);
+        }
+
+        if (MSG_EXPORT_REQ == hdr->type) {
+            fsm_reply_export(client, hdr);
+        }
+
+        if (MSG_SHM_ATTACH_REQ == hdr->type) {
+            printf("Attaching shared memory producer\r\n");
+            fsm_reply_shm_attach(client, hdr);
         }
 
         if (MSG_SENSOR_DEL_REQ == hdr->type) {
             DbProtocol_SensorDeleteReq_t *sensor = (DbProtocol_SensorDeleteReq_t *)&hdr[1];
+            sensor->sensorId[sizeof(sensor->sensorId) - 1] = '\0';
             printf("Deleting sensor: %s\n", sensor->sensorId);
-            if (STATUS_SUCCESS != parse_removeSensor(dbhdr, ppSensors, (char *)sensor->sensorId)) {
+            if (STATUS_SUCCESS != parse_removeSensor(dbhdr, pTable, (char *)sensor->sensorId)) {
                 fsm_reply_err(client, hdr);
                 return;
             } else {
+                mark_db_dirty();
+                if (STATUS_SUCCESS != wal_commit(pWal)) {
+                    fsm_reply_err(client, hdr);
+                    return;
+                }
                 fsm_reply_delete(client, hdr);
-                parse_outputFile(dbfd, dbhdr, *ppSensors);
             }
         }
     }
@@ -280,91 +895,1274 @@ static void fsm_reply_add(ClientState_t *client, DbProtocolHdr_t *hdr) {
     return;
 }
 
-static void fsm_reply_list(ClientState_t *client, Parse_DbHeader_t *dbhdr, Parse_Sensor_t **sensors) {
-    DbProtocolHdr_t *hdr = (DbProtocolHdr_t*)client->buffer;
+static void fsm_reply_list(ClientState_t *client, Parse_DbHeader_t *dbhdr, Table_t *pTable) {
+    // Own scratch space: client->buffer may still hold pipelined requests
+    char txBuf[sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_SensorListResp_t)] = {0};
+    DbProtocolHdr_t *hdr = (DbProtocolHdr_t*)txBuf;
     DbProtocol_SensorListResp_t *resp = (DbProtocol_SensorListResp_t *)&hdr[1];
-    unsigned int temp;
-    int i = 0;
-    
+    uint32_t count = pTable->count;
+    uint32_t i = 0;
+
+    // the frame length is 16 bits, larger tables are read with list pages
+    if (count > 0xFFFF) {
+        count = 0xFFFF;
+    }
+
     hdr->type = htonl(MSG_SENSOR_LIST_RESP);
-    hdr->len = htons(dbhdr->count);
+    hdr->len = htons(count);
     write(client->fd, hdr, sizeof(DbProtocolHdr_t));
 
-    for (; i < dbhdr->count; i++) {
-        strncpy(resp->sensorId, (*sensors)[i].sensorId, sizeof(resp->sensorId));
-        strncpy(resp->sensorType, (*sensors)[i].sensorType, sizeof(resp->sensorType));
-        resp->i2cAddr = (*sensors)[i].i2cAddr;
-        resp->timestamp = htonl((*sensors)[i].timestamp);
-        
-        temp = htonl(*(unsigned int*)&(*sensors)[i].readingValue);
-        resp->readingValue = *(float*)&temp;
-        
-        resp->flags = (*sensors)[i].flags;
-        strncpy(resp->location, (*sensors)[i].location, sizeof(resp->location));
-        
-        temp = htonl(*(unsigned int*)&(*sensors)[i].minThreshold);
-        resp->minThreshold = *(float*)&temp;
-        
-        temp = htonl(*(unsigned int*)&(*sensors)[i].maxThreshold);
-        resp->maxThreshold = *(float*)&temp;
-        
+    for (; i < count; i++) {
+        fill_list_resp(resp, pTable, i);
         write(client->fd, resp, sizeof(DbProtocol_SensorListResp_t));
     }
 
     return;
 }
 
-static void fsm_reply_delete(ClientState_t *client, DbProtocolHdr_t *hdr) {
-    hdr->type = htonl(MSG_SENSOR_DEL_RESP);
-    hdr->len = htons(0);
-    write(client->fd, hdr, sizeof(DbProtocolHdr_t));
+static void fsm_reply_list_page(ClientState_t *client, Parse_DbHeader_t *dbhdr, Table_t *pTable, DbProtocolHdr_t *hdr) {
+    char txBuf[sizeof(DbProtocolHdr_t) + LIST_PAGE_MAX * sizeof(DbProtocol_SensorListResp_t)];
+    DbProtocolHdr_t *resp = (DbProtocolHdr_t *)txBuf;
+    DbProtocol_SensorListResp_t *records = (DbProtocol_SensorListResp_t *)&resp[1];
+    DbProtocol_ListPageReq_t *req = (DbProtocol_ListPageReq_t *)&hdr[1];
+    uint32_t offset = 0;
+    uint32_t limit = 0;
+    uint32_t n = 0;
 
-    return;
-}
+    if (1 != hdr->len) {
+        fsm_reply_err(client, hdr);
+        return;
+    }
 
-static void handle_signal(int sig) {
-    printf("Received signal %d, shutting down...\r\n", sig);
-    keep_running = false;
+    offset = ntohl(req->offset);
+    limit = ntohl(req->limit);
+    if (limit > LIST_PAGE_MAX) {
+        limit = LIST_PAGE_MAX;
+    }
+
+    // one write per page instead of one per record
+    for (; n < limit && offset + n < pTable->count; n++) {
+        fill_list_resp(&records[n], pTable, offset + n);
+    }
+
+    resp->type = htonl(MSG_SENSOR_LIST_PAGE_RESP);
+    resp->len = htons(n);
+    reply_write(client, txBuf, sizeof(DbProtocolHdr_t) + n * sizeof(DbProtocol_SensorListResp_t));
 
     return;
 }
 
-static int setup_server_socket(unsigned short port) {
-    int listen_fd;
-    struct sockaddr_in server_addr;
-    int opt = 1;
+static void fsm_reply_query(ClientState_t *client, Table_t *pTable, DbProtocolHdr_t *hdr) {
+    static char txBuf[sizeof(DbProtocolHdr_t) + LIST_PAGE_MAX * sizeof(DbProtocol_SensorListResp_t)];
+    DbProtocolHdr_t *resp = (DbProtocolHdr_t *)txBuf;
+    DbProtocol_SensorListResp_t *records = (DbProtocol_SensorListResp_t *)&resp[1];
+    DbProtocol_QueryReq_t *req = (DbProtocol_QueryReq_t *)&hdr[1];
+    size_t words = filter_bitmapWords(pTable->count);
+    uint64_t *pGrown = NULL;
+    uint64_t bits = 0;
+    uint64_t startUs = 0;
+    uint32_t matches = 0;
+    uint32_t skip = 0;
+    uint32_t row = 0;
+    uint32_t n = 0;
+    size_t w = 0;
+    unsigned int temp = 0;
+    int typeCode = -1;
+    int locationCode = -1;
 
-    // Create new socket for listening
-    if ((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        perror("socket");
-        exit(EXIT_FAILURE);
+    if (1 != hdr->len) {
+        fsm_reply_err(client, hdr);
+        return;
     }
 
-    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        perror("setsockopt");
-        close(listen_fd);
-        exit(EXIT_FAILURE);
+    req->sensorType[sizeof(req->sensorType) - 1] = '\0';
+    req->location[sizeof(req->location) - 1] = '\0';
+    req->mode = ntohl(req->mode);
+    memcpy(&temp, &req->lo, sizeof(temp));
+    temp = ntohl(temp);
+    memcpy(&req->lo, &temp, sizeof(temp));
+    memcpy(&temp, &req->hi, sizeof(temp));
+    temp = ntohl(temp);
+    memcpy(&req->hi, &temp, sizeof(temp));
+    req->offset = ntohl(req->offset);
+    req->limit = ntohl(req->limit);
+    if (req->limit > LIST_PAGE_MAX) {
+        req->limit = LIST_PAGE_MAX;
     }
 
-    // Prepare server addr
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(port);
-
-    /* Bind socket to port */
-    if (bind(listen_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        perror("bind");
-        close(listen_fd);
-        exit(EXIT_FAILURE);
+    if (QUERY_VIOLATIONS != req->mode && QUERY_RANGE != req->mode && QUERY_MATCH != req->mode) {
+        fsm_reply_err(client, hdr);
+        return;
     }
 
-    // Listen for incoming connections (max 15)
-    if (listen(listen_fd, 15) < 0) {
-        perror("listen");
-        close(listen_fd);
-        exit(EXIT_FAILURE);
+    // violations are kept up to date at ingest, no scan needed
+    if (QUERY_VIOLATIONS == req->mode) {
+        // the alert set is small, compare codes instead of building a bitmap
+        if ('\0' != req->sensorType[0]) {
+            typeCode = dict_find(&pTable->types, req->sensorType);
+        }
+        if ('\0' != req->location[0]) {
+            locationCode = dict_find(&pTable->locations, req->location);
+        }
+
+        skip = req->offset;
+        for (w = 0; w < pTable->alertCount && n < req->limit; w++) {
+            row = pTable->pAlertRows[w];
+            if ((pTable->pFlags[row] & req->flagsMask) != req->flagsValue ||
+                ('\0' != req->sensorType[0] && pTable->pTypeCode[row] != typeCode) ||
+                ('\0' != req->location[0] && pTable->pLocationCode[row] != locationCode)) {
+                continue;
+            }
+            if (0 != skip) {
+                skip--;
+                continue;
+            }
+            fill_list_resp(&records[n++], pTable, row);
+        }
+
+        if (true == pSrvConfig->verbose) {
+            printf("Query returned %u of %u violating sensors\r\n", n, pTable->alertCount);
+        }
+        resp->type = htonl(MSG_QUERY_VIOLATIONS_RESP);
+        resp->len = htons(n);
+        reply_write(client, txBuf, sizeof(DbProtocolHdr_t) + n * sizeof(DbProtocol_SensorListResp_t));
+        return;
+    }
+
+    if (words > queryBitmapWords) {
+        pGrown = realloc(pQueryBitmap, words * sizeof(uint64_t));
+        if (NULL == pGrown) {
+            printf("Realloc failed to expand query bitmap\r\n");
+            fsm_reply_err(client, hdr);
+            return;
+        }
+        pQueryBitmap = pGrown;
+        queryBitmapWords = words;
+    }
+
+    startUs = timer_nowUs();
+    matches = filter_select(pTable, req, pQueryBitmap);
+    if (true == pSrvConfig->verbose) {
+        printf("Query matched %u of %u sensors in %lu us (%s)\r\n", matches, pTable->count,
+               (unsigned long)(timer_nowUs() - startUs), filter_kernels()->pName);
+    }
+
+    // walk the selection, whole words at a time while skipping to the offset
+    skip = req->offset;
+    for (; w < words && n < req->limit; w++) {
+        bits = pQueryBitmap[w];
+        if (skip >= (uint32_t)__builtin_popcountll(bits)) {
+            skip -= __builtin_popcountll(bits);
+            continue;
+        }
+
+        while (0 != bits && n < req->limit) {
+            if (0 != skip) {
+                skip--;
+            } else {
+                fill_list_resp(&records[n++], pTable, w * FILTER_WORD_BITS + __builtin_ctzll(bits));
+            }
+            bits &= bits - 1;
+        }
+    }
+
+    resp->type = htonl(MSG_QUERY_VIOLATIONS_RESP);
+    resp->len = htons(n);
+    reply_write(client, txBuf, sizeof(DbProtocolHdr_t) + n * sizeof(DbProtocol_SensorListResp_t));
+
+    return;
+}
+
+static void fsm_reply_aggregate(ClientState_t *client, Table_t *pTable, DbProtocolHdr_t *hdr) {
+    DbProtocol_AggregateReq_t *req = (DbProtocol_AggregateReq_t *)&hdr[1];
+    DbProtocol_AggregateResp_t *records = NULL;
+    const Aggregate_Group_t *pGroup = NULL;
+    DbProtocolHdr_t *resp = NULL;
+    char *txBuf = NULL;
+    size_t txLen = 0;
+    uint64_t startUs = 0;
+    uint64_t sumBits = 0;
+    unsigned int temp = 0;
+    float avg = 0.0f;
+    uint32_t i = 0;
+
+    if (1 != hdr->len) {
+        fsm_reply_err(client, hdr);
+        return;
+    }
+
+    req->sensorType[sizeof(req->sensorType) - 1] = '\0';
+    req->location[sizeof(req->location) - 1] = '\0';
+    req->groupBy = ntohl(req->groupBy);
+    req->fromTs = ntohl(req->fromTs);
+    req->toTs = ntohl(req->toTs);
+
+    startUs = timer_nowUs();
+    if (STATUS_SUCCESS != aggregate_run(&aggState, pTable, req) || aggState.count > 0xFFFF) {
+        fsm_reply_err(client, hdr);
+        return;
+    }
+    if (true == pSrvConfig->verbose) {
+        printf("Aggregated %u sensors into %u groups in %lu us\r\n", pTable->count, aggState.count,
+               (unsigned long)(timer_nowUs() - startUs));
+    }
+
+    txLen = sizeof(DbProtocolHdr_t) + aggState.count * sizeof(DbProtocol_AggregateResp_t);
+    txBuf = calloc(1, txLen);
+    if (NULL == txBuf) {
+        printf("Malloc failed\r\n");
+        fsm_reply_err(client, hdr);
+        return;
+    }
+
+    resp = (DbProtocolHdr_t *)txBuf;
+    records = (DbProtocol_AggregateResp_t *)&resp[1];
+    resp->type = htonl(MSG_AGGREGATE_RESP);
+    resp->len = htons(aggState.count);
+
+    for (; i < aggState.count; i++) {
+        pGroup = &aggState.pGroups[i];
+        strncpy(records[i].key, pGroup->pKey, sizeof(records[i].key) - 1);
+        records[i].count = htonl(pGroup->count);
+
+        memcpy(&temp, &pGroup->min, sizeof(temp));
+        temp = htonl(temp);
+        memcpy(&records[i].min, &temp, sizeof(temp));
+
+        memcpy(&temp, &pGroup->max, sizeof(temp));
+        temp = htonl(temp);
+        memcpy(&records[i].max, &temp, sizeof(temp));
+
+        avg = (float)(pGroup->sum / pGroup->count);
+        memcpy(&temp, &avg, sizeof(temp));
+        temp = htonl(temp);
+        memcpy(&records[i].avg, &temp, sizeof(temp));
+
+        memcpy(&sumBits, &pGroup->sum, sizeof(sumBits));
+        records[i].sum = htobe64(sumBits);
+    }
+
+    reply_write(client, txBuf, txLen);
+    free(txBuf);
+
+    return;
+}
+
+static void fsm_reply_series(ClientState_t *client, Table_t *pTable, DbProtocolHdr_t *hdr) {
+    static char txBuf[sizeof(DbProtocolHdr_t) + SERIES_MAX_POINTS * sizeof(DbProtocol_SeriesPoint_t)];
+    static Rollup_Bucket_t buckets[SERIES_MAX_POINTS];
+    DbProtocol_SeriesReq_t *req = (DbProtocol_SeriesReq_t *)&hdr[1];
+    DbProtocolHdr_t *resp = (DbProtocolHdr_t *)txBuf;
+    DbProtocol_SeriesPoint_t *points = (DbProtocol_SeriesPoint_t *)&resp[1];
+    uint64_t startUs = 0;
+    uint64_t sumBits = 0;
+    uint32_t width = 0;
+    uint32_t read = 0;
+    uint32_t n = 0;
+    uint32_t i = 0;
+    unsigned int temp = 0;
+    int row = -1;
+
+    if (1 != hdr->len) {
+        fsm_reply_err(client, hdr);
+        return;
+    }
+
+    req->sensorId[sizeof(req->sensorId) - 1] = '\0';
+    req->fromTs = ntohl(req->fromTs);
+    req->toTs = ntohl(req->toTs);
+    req->points = ntohl(req->points);
+    if (0 == req->toTs) {
+        req->toTs = UINT32_MAX;
+    }
+    if (req->points > SERIES_MAX_POINTS) {
+        req->points = SERIES_MAX_POINTS;
+    }
+
+    row = table_find(pTable, req->sensorId);
+    if (-1 == row) {
+        fsm_reply_err(client, hdr);
+        return;
+    }
+
+    startUs = timer_nowUs();
+    n = rollup_query(&pTable->pRollup[row], req->fromTs, req->toTs, req->points, buckets, &width, &read);
+    if (true == pSrvConfig->verbose) {
+        printf("Series of %s: %u points of %us from %u rollup buckets in %lu us\r\n", req->sensorId, n, width, read,
+               (unsigned long)(timer_nowUs() - startUs));
+    }
+
+    memset(points, 0, n * sizeof(DbProtocol_SeriesPoint_t));
+    for (; i < n; i++) {
+        points[i].start = htonl(buckets[i].start);
+        points[i].width = htonl(width);
+        points[i].count = htonl(buckets[i].count);
+
+        memcpy(&temp, &buckets[i].min, sizeof(temp));
+        temp = htonl(temp);
+        memcpy(&points[i].min, &temp, sizeof(temp));
+
+        memcpy(&temp, &buckets[i].max, sizeof(temp));
+        temp = htonl(temp);
+        memcpy(&points[i].max, &temp, sizeof(temp));
+
+        memcpy(&sumBits, &buckets[i].sum, sizeof(sumBits));
+        points[i].sum = htobe64(sumBits);
+    }
+
+    resp->type = htonl(MSG_SERIES_RESP);
+    resp->len = htons(n);
+    reply_write(client, txBuf, sizeof(DbProtocolHdr_t) + n * sizeof(DbProtocol_SeriesPoint_t));
+
+    return;
+}
+
+static void fsm_reply_samples(ClientState_t *client, Table_t *pTable, DbProtocolHdr_t *hdr) {
+    static char txBuf[sizeof(DbProtocolHdr_t) + SERIES_MAX_POINTS * sizeof(DbProtocol_Sample_t)];
+    static History_Sample_t picked[SERIES_MAX_POINTS];
+    DbProtocol_SamplesReq_t *req = (DbProtocol_SamplesReq_t *)&hdr[1];
+    DbProtocolHdr_t *resp = (DbProtocolHdr_t *)txBuf;
+    DbProtocol_Sample_t *samples = (DbProtocol_Sample_t *)&resp[1];
+    const History_Sample_t *pIn = NULL;
+    History_Series_t *pSeries = NULL;
+    uint64_t startUs = 0;
+    uint32_t first = 0;
+    uint32_t count = 0;
+    uint32_t n = 0;
+    uint32_t i = 0;
+    unsigned int temp = 0;
+    int gathered = 0;
+    int row = -1;
+
+    if (1 != hdr->len) {
+        fsm_reply_err(client, hdr);
+        return;
+    }
+
+    req->sensorId[sizeof(req->sensorId) - 1] = '\0';
+    req->fromTs = ntohl(req->fromTs);
+    req->toTs = ntohl(req->toTs);
+    req->points = ntohl(req->points);
+    req->method = ntohl(req->method);
+    if (0 == req->toTs) {
+        req->toTs = UINT32_MAX;
+    }
+    if (req->points > SERIES_MAX_POINTS) {
+        req->points = SERIES_MAX_POINTS;
+    }
+
+    row = table_find(pTable, req->sensorId);
+    if (-1 == row || (SAMPLES_LTTB != req->method && SAMPLES_MINMAX != req->method)) {
+        fsm_reply_err(client, hdr);
+        return;
+    }
+
+    startUs = timer_nowUs();
+    pSeries = &pTable->pHistory[row];
+    pSeries->referenced = true;
+    count = history_range(pSeries, req->fromTs, req->toTs, &first);
+    pIn = &pSeries->pSamples[first];
+
+    // the part of the range that was evicted comes back from the segments
+    if (req->fromTs < pSeries->warmFrom) {
+        gathered = gather_cold_samples(pSeries, req->sensorId, req->fromTs, req->toTs, first, count);
+        if (gathered < 0) {
+            fsm_reply_err(client, hdr);
+            return;
+        }
+        pIn = pColdSamples;
+        count = (uint32_t)gathered;
+    }
+
+    if (SAMPLES_LTTB == req->method) {
+        n = history_lttb(pIn, count, req->points, picked);
+    } else {
+        n = history_minMax(pIn, count, req->points, picked);
+    }
+    if (true == pSrvConfig->verbose) {
+        printf("Samples of %s: %u of %u readings in %lu us\r\n", req->sensorId, n, count,
+               (unsigned long)(timer_nowUs() - startUs));
+    }
+
+    for (; i < n; i++) {
+        samples[i].timestamp = htonl(picked[i].timestamp);
+        memcpy(&temp, &picked[i].value, sizeof(temp));
+        temp = htonl(temp);
+        memcpy(&samples[i].value, &temp, sizeof(temp));
+    }
+
+    resp->type = htonl(MSG_SAMPLES_RESP);
+    resp->len = htons(n);
+    reply_write(client, txBuf, sizeof(DbProtocolHdr_t) + n * sizeof(DbProtocol_Sample_t));
+
+    return;
+}
+
+static int gather_cold_samples(History_Series_t *pSeries, const char *pSensorId, uint32_t fromTs, uint32_t toTs,
+                               uint32_t first, uint32_t count) {
+    History_Sample_t *pGrown = NULL;
+    uint32_t coldTo = (toTs < pSeries->warmFrom - 1) ? toTs : pSeries->warmFrom - 1;
+    uint32_t cold = 0;
+    uint32_t stored = 0;
+    uint32_t i = 0;
+
+    if (STATUS_SUCCESS != parse_readSamples(pSegmentStore, pSensorId, fromTs, coldTo, &pColdSamples, &cold, &coldCapacity)) {
+        return -1;
+    }
+    stored = cold;
+
+    if (cold + pSeries->lateCount + count > coldCapacity) {
+        pGrown = realloc(pColdSamples, (cold + pSeries->lateCount + count) * sizeof(History_Sample_t));
+        if (NULL == pGrown) {
+            printf("Realloc failed to gather stored readings\r\n");
+            return -1;
+        }
+        pColdSamples = pGrown;
+        coldCapacity = cold + pSeries->lateCount + count;
+    }
+
+    // late readings older than memory that the next flush has yet to write
+    for (; i < pSeries->lateCount; i++) {
+        if (pSeries->pLate[i].timestamp >= fromTs && pSeries->pLate[i].timestamp <= coldTo) {
+            pColdSamples[cold++] = pSeries->pLate[i];
+        }
+    }
+    if (cold != stored) {
+        history_sort(pColdSamples, cold);
+    }
+
+    memcpy(&pColdSamples[cold], &pSeries->pSamples[first], count * sizeof(History_Sample_t));
+
+    return (int)(cold + count);
+}
+
+static void fsm_reply_quantile(ClientState_t *client, Table_t *pTable, DbProtocolHdr_t *hdr) {
+    char txBuf[sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_QuantileResp_t)] = {0};
+    DbProtocol_QuantileReq_t *req = (DbProtocol_QuantileReq_t *)&hdr[1];
+    DbProtocolHdr_t *resp = (DbProtocolHdr_t *)txBuf;
+    DbProtocol_QuantileResp_t *result = (DbProtocol_QuantileResp_t *)&resp[1];
+    Sketch_t merged = {0};
+    size_t words = filter_bitmapWords(pTable->count);
+    uint64_t *pGrown = NULL;
+    uint64_t bits = 0;
+    uint64_t startUs = 0;
+    uint32_t buckets = 0;
+    uint32_t read = 0;
+    uint32_t readings = 0;
+    uint32_t sensors = 0;
+    uint32_t row = 0;
+    uint32_t i = 0;
+    size_t w = 0;
+    unsigned int temp = 0;
+    int status = STATUS_SUCCESS;
+    int found = -1;
+    float value = 0.0f;
+
+    if (1 != hdr->len) {
+        fsm_reply_err(client, hdr);
+        return;
+    }
+
+    req->sensorId[sizeof(req->sensorId) - 1] = '\0';
+    req->sensorType[sizeof(req->sensorType) - 1] = '\0';
+    req->location[sizeof(req->location) - 1] = '\0';
+    req->fromTs = ntohl(req->fromTs);
+    req->toTs = ntohl(req->toTs);
+    req->count = ntohl(req->count);
+    if (0 == req->toTs) {
+        req->toTs = UINT32_MAX;
+    }
+    if (0 == req->count || req->count > QUANTILE_MAX) {
+        fsm_reply_err(client, hdr);
+        return;
+    }
+    for (i = 0; i < req->count; i++) {
+        memcpy(&temp, &req->quantiles[i], sizeof(temp));
+        temp = ntohl(temp);
+        memcpy(&req->quantiles[i], &temp, sizeof(temp));
+    }
+
+    startUs = timer_nowUs();
+    if ('\0' != req->sensorId[0]) {
+        found = table_find(pTable, req->sensorId);
+        if (-1 == found) {
+            fsm_reply_err(client, hdr);
+            return;
+        }
+        status = sketch_seriesQuery(&pTable->pSketch[found], req->fromTs, req->toTs, &merged, &read);
+        buckets = read;
+        sensors = (0 != read) ? 1 : 0;
+    } else if ('\0' != req->sensorType[0] || '\0' != req->location[0]) {
+        if (words > queryBitmapWords) {
+            pGrown = realloc(pQueryBitmap, words * sizeof(uint64_t));
+            if (NULL == pGrown) {
+                printf("Realloc failed to expand query bitmap\r\n");
+                fsm_reply_err(client, hdr);
+                return;
+            }
+            pQueryBitmap = pGrown;
+            queryBitmapWords = words;
+        }
+
+        filter_match(pTable, req->sensorType, req->location, 0, 0, pQueryBitmap);
+        for (w = 0; w < words && STATUS_SUCCESS == status; w++) {
+            for (bits = pQueryBitmap[w]; 0 != bits && STATUS_SUCCESS == status; bits &= bits - 1) {
+                row = w * FILTER_WORD_BITS + __builtin_ctzll(bits);
+                status = sketch_seriesQuery(&pTable->pSketch[row], req->fromTs, req->toTs, &merged, &read);
+                buckets += read;
+                sensors += (0 != read) ? 1 : 0;
+            }
+        }
+    } else {
+        for (row = 0; row < pTable->count && STATUS_SUCCESS == status; row++) {
+            status = sketch_seriesQuery(&pTable->pSketch[row], req->fromTs, req->toTs, &merged, &read);
+            buckets += read;
+            sensors += (0 != read) ? 1 : 0;
+        }
+    }
+
+    if (STATUS_SUCCESS != status) {
+        printf("Realloc failed to merge quantile sketches\r\n");
+        sketch_free(&merged);
+        fsm_reply_err(client, hdr);
+        return;
+    }
+
+    readings = merged.count;
+    for (i = 0; i < req->count; i++) {
+        value = sketch_quantile(&merged, req->quantiles[i]);
+        memcpy(&temp, &value, sizeof(temp));
+        temp = htonl(temp);
+        memcpy(&result->values[i], &temp, sizeof(temp));
+    }
+    sketch_free(&merged);
+    if (true == pSrvConfig->verbose) {
+        printf("Quantiles over %u readings of %u sensors from %u sketches in %lu us\r\n", readings, sensors, buckets,
+               (unsigned long)(timer_nowUs() - startUs));
+    }
+
+    result->readings = htonl(readings);
+    result->sensors = htonl(sensors);
+    resp->type = htonl(MSG_QUANTILE_RESP);
+    resp->len = htons(1);
+    reply_write(client, txBuf, sizeof(txBuf));
+
+    return;
+}
+
+static void fill_list_resp(DbProtocol_SensorListResp_t *resp, const Table_t *pTable, uint32_t row) {
+    const Table_Cold_t *pCold = &pTable->pCold[row];
+    unsigned int temp;
+
+    memset(resp, 0, sizeof(DbProtocol_SensorListResp_t));
+    strncpy(resp->sensorId, pCold->sensorId, sizeof(resp->sensorId));
+    strncpy(resp->sensorType, table_typeName(pTable, row), sizeof(resp->sensorType) - 1);
+    resp->i2cAddr = pCold->i2cAddr;
+    resp->timestamp = htonl(pTable->pTimestamp[row]);
+
+    temp = htonl(*(unsigned int*)&pTable->pReading[row]);
+    resp->readingValue = *(float*)&temp;
+
+    resp->flags = pTable->pFlags[row];
+    strncpy(resp->location, table_locationName(pTable, row), sizeof(resp->location) - 1);
+
+    temp = htonl(*(unsigned int*)&pTable->pMinThreshold[row]);
+    resp->minThreshold = *(float*)&temp;
+
+    temp = htonl(*(unsigned int*)&pTable->pMaxThreshold[row]);
+    resp->maxThreshold = *(float*)&temp;
+
+    return;
+}
+
+static void fsm_reply_batch_add(ClientState_t *client, Parse_DbHeader_t *dbhdr, Table_t *pTable, DbProtocolHdr_t *hdr) {
+    DbProtocol_Reading_t *readings = (DbProtocol_Reading_t *)&hdr[1];
+    uint16_t applied = 0;
+    int i = 0;
+
+    for (; i < hdr->len; i++) {
+        reading_ntoh(&readings[i]);
+        if (STATUS_SUCCESS == parse_addReading(dbhdr, pTable, &readings[i])) {
+            applied++;
+        }
+    }
+
+    if (0 != applied) {
+        mark_db_dirty();
+        if (STATUS_SUCCESS != wal_commit(pWal)) {
+            fsm_reply_err(client, hdr);
+            return;
+        }
+    }
+
+    // len carries how many readings were accepted
+    hdr->type = htonl(MSG_SENSOR_BATCH_ADD_RESP);
+    hdr->len = htons(applied);
+    reply_write(client, hdr, sizeof(DbProtocolHdr_t));
+
+    return;
+}
+
+static int reply_write(ClientState_t *client, const void *pData, size_t len) {
+    const char *pByte = (const char *)pData;
+    ssize_t sent = 0;
+
+    // a short send means the socket filled up, SO_SNDTIMEO bounds the wait for the rest
+    while (0 != len) {
+        sent = send(client->fd, pByte, len, MSG_NOSIGNAL);
+        if (sent < 0 && EINTR == errno) {
+            continue;
+        }
+        if (sent <= 0) {
+            printf("Failed to send a reply to fd %d: %s\r\n", client->fd, (0 == sent) ? "closed" : strerror(errno));
+            close_client(client);
+            return STATUS_ERROR;
+        }
+        pByte += sent;
+        len -= sent;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static void mark_db_dirty(void) {
+    dbDirty = true;
+
+    if (0 != pSrvConfig->flushIntervalMs && true != timer_isArmed(&flushTimer)) {
+        timer_arm(&timerWheel, &flushTimer, timer_nowMs(), pSrvConfig->flushIntervalMs);
+    }
+
+    return;
+}
+
+static void on_flush_timeout(Timer_Node_t *pNode, void *pArg) {
+    flushDue = true;
+
+    return;
+}
+
+static void on_seal_timeout(Timer_Node_t *pNode, void *pArg) {
+    sealDue = true;
+
+    return;
+}
+
+static void on_retention_timeout(Timer_Node_t *pNode, void *pArg) {
+    retention_start(&retentionSweep, &pSrvConfig->retention, (uint32_t)time(NULL));
+
+    return;
+}
+
+static void fsm_reply_delete(ClientState_t *client, DbProtocolHdr_t *hdr) {
+    hdr->type = htonl(MSG_SENSOR_DEL_RESP);
+    hdr->len = htons(0);
+    write(client->fd, hdr, sizeof(DbProtocolHdr_t));
+
+    return;
+}
+
+static void fsm_reply_shm_attach(ClientState_t *client, DbProtocolHdr_t *hdr) {
+    struct msghdr msg = {0};
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+    int fds[2] = { shmMemFd, shmEventFd };
+
+    // descriptors can only travel over a unix domain socket
+    if (NULL == shmRing.pShared || true != client->isLocal) {
+        fsm_reply_err(client, hdr);
+        return;
+    }
+
+    hdr->type = htonl(MSG_SHM_ATTACH_RESP);
+    hdr->len = htons(0);
+
+    iov.iov_base = hdr;
+    iov.iov_len = sizeof(DbProtocolHdr_t);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    memset(&ctrl, 0, sizeof(ctrl));
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(client->fd, &msg, 0) < 0) {
+        perror("sendmsg");
+    }
+
+    return;
+}
+
+static int setup_shm_ring(unsigned int slots) {
+    if (STATUS_SUCCESS != shmring_create(slots, &shmRing, &shmMemFd)) {
+        return STATUS_ERROR;
+    }
+
+    shmEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (-1 == shmEventFd) {
+        perror("eventfd");
+        shmring_close(&shmRing);
+        close(shmMemFd);
+        shmMemFd = -1;
+        return STATUS_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static void drain_shm_ring(Parse_DbHeader_t *dbhdr, Table_t *pTable, int dbfd) {
+    DbProtocol_Reading_t reading;
+    int drained = 0;
+
+    // bounded batch so sockets and timers are not starved
+    while (drained < SHM_DRAIN_BUDGET && true == shmring_pop(&shmRing, &reading)) {
+        parse_addReading(dbhdr, pTable, &reading);
+        drained++;
+    }
+
+    if (0 != drained) {
+        mark_db_dirty();
+    }
+
+    // only sleep on the doorbell once the ring is really empty
+    shmBacklog = (SHM_DRAIN_BUDGET == drained) || (true != shmring_park(&shmRing));
+
+    return;
+}
+
+static void drain_udp_socket(int udp_fd, Parse_DbHeader_t *dbhdr, Table_t *pTable, int dbfd) {
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iovs[UDP_BATCH];
+    union {
+        char buf[CMSG_SPACE(sizeof(uint32_t))];
+        struct cmsghdr align;
+    } ctrl[UDP_BATCH];
+    struct cmsghdr *cmsg;
+    int applied = 0;
+    int rounds = 0;
+    int received = 0;
+    int i = 0;
+
+    do {
+        memset(msgs, 0, sizeof(msgs));
+        for (i = 0; i < UDP_BATCH; i++) {
+            iovs[i].iov_base = udpBuffers[i];
+            iovs[i].iov_len = UDP_DGRAM_MAX;
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = ctrl[i].buf;
+            msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i].buf);
+        }
+
+        received = recvmmsg(udp_fd, msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+        if (received < 0) {
+            if (EAGAIN != errno && EWOULDBLOCK != errno) {
+                perror("recvmmsg");
+            }
+            break;
+        }
+
+        for (i = 0; i < received; i++) {
+            udpStats.datagrams++;
+
+            // the kernel reports its running drop count with each datagram
+            for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); NULL != cmsg; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+                if (SOL_SOCKET == cmsg->cmsg_level && SO_RXQ_OVFL == cmsg->cmsg_type) {
+                    memcpy(&udpStats.kernelDrops, CMSG_DATA(cmsg), sizeof(uint32_t));
+                }
+            }
+
+            if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                udpStats.malformed++;
+                continue;
+            }
+
+            applied += apply_udp_datagram(dbhdr, pTable, udpBuffers[i], msgs[i].msg_len);
+        }
+
+        rounds++;
+    } while (UDP_BATCH == received && rounds < UDP_ROUNDS);
+
+    if (0 != applied) {
+        mark_db_dirty();
+    }
+
+    return;
+}
+
+static int apply_udp_datagram(Parse_DbHeader_t *dbhdr, Table_t *pTable, const char *pData, size_t len) {
+    DbProtocol_UdpHdr_t hdr;
+    DbProtocol_Reading_t reading;
+    int applied = 0;
+    int i = 0;
+
+    if (len < sizeof(DbProtocol_UdpHdr_t)) {
+        udpStats.malformed++;
+        return 0;
+    }
+
+    memcpy(&hdr, pData, sizeof(hdr));
+    hdr.magic = ntohl(hdr.magic);
+    hdr.version = ntohs(hdr.version);
+    hdr.count = ntohs(hdr.count);
+
+    if (UDP_MAGIC != hdr.magic || PROTOCOL_VER != hdr.version ||
+        len != sizeof(DbProtocol_UdpHdr_t) + hdr.count * sizeof(DbProtocol_Reading_t)) {
+        udpStats.malformed++;
+        return 0;
+    }
+
+    for (i = 0; i < hdr.count; i++) {
+        memcpy(&reading, pData + sizeof(hdr) + i * sizeof(reading), sizeof(reading));
+        reading_ntoh(&reading);
+
+        if (STATUS_SUCCESS != parse_addReading(dbhdr, pTable, &reading)) {
+            udpStats.rejected++;
+            continue;
+        }
+        udpStats.readings++;
+        applied++;
+    }
+
+    return applied;
+}
+
+static void handle_signal(int sig) {
+    printf("Received signal %d, shutting down...\r\n", sig);
+    keep_running = false;
+
+    return;
+}
+
+static void handle_snapshot_signal(int sig) {
+    if (SIGUSR1 == sig) {
+        snapshotRequested = 1;
+    }
+
+    return;
+}
+
+static int start_snapshot(Parse_DbHeader_t *dbhdr, Table_t *pTable) {
+    // everything the child sees has to be in the log before the position is named
+    if (STATUS_SUCCESS != wal_commit(pWal)) {
+        return STATUS_ERROR;
+    }
+
+    return snapshot_start(&snapshot, pSrvConfig->pDbPath, dbhdr, pTable, pWal->seq);
+}
+
+static void fsm_reply_snapshot(ClientState_t *client, Parse_DbHeader_t *dbhdr, Table_t *pTable, DbProtocolHdr_t *hdr) {
+    // Own scratch space: client->buffer may still hold pipelined requests
+    char txBuf[sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_SnapshotResp_t)] = {0};
+    DbProtocolHdr_t *respHdr = (DbProtocolHdr_t *)txBuf;
+    DbProtocol_SnapshotResp_t *resp = (DbProtocol_SnapshotResp_t *)&respHdr[1];
+
+    if (STATUS_SUCCESS != start_snapshot(dbhdr, pTable)) {
+        fsm_reply_err(client, hdr);
+        return;
+    }
+
+    respHdr->type = htonl(MSG_SNAPSHOT_RESP);
+    respHdr->len = htons(1);
+    resp->seq = htobe64(snapshot.seq);
+    resp->pid = htonl((uint32_t)snapshot.pid);
+    reply_write(client, txBuf, sizeof(txBuf));
+
+    return;
+}
+
+static void fsm_reply_replicate(ClientState_t *client, DbProtocolHdr_t *hdr) {
+    DbProtocol_ReplicateReq_t *req = (DbProtocol_ReplicateReq_t *)&hdr[1];
+    uint64_t afterSeq = 0;
+    uint64_t head = pWal->seq - pWal->pendingCount;
+
+    if (1 != hdr->len) {
+        fsm_reply_err(client, hdr);
+        return;
+    }
+
+    afterSeq = be64toh(req->afterSeq);
+    if (NULL != pSrvConfig->pPrimary || 0 == pWal->backlogCapacity || true != wal_backlogHas(pWal, afterSeq)) {
+        printf("Cannot stream the log after sequence %llu to fd %d, the backlog starts after %llu and ends at %llu\r\n",
+               (unsigned long long)afterSeq, client->fd,
+               (unsigned long long)(head - pWal->backlogCount), (unsigned long long)head);
+        fsm_reply_err(client, hdr);
+        return;
+    }
+
+    client->pReplFrame = malloc(BUFF_SIZE);
+    if (NULL == client->pReplFrame) {
+        printf("Malloc failed for a replication frame\r\n");
+        fsm_reply_err(client, hdr);
+        return;
+    }
+
+    client->isReplica = true;
+    client->replSeq = afterSeq;
+    client->replLen = 0;
+    client->replSent = 0;
+    // a quiet primary is no reason to drop its replicas
+    timer_cancel(&timerWheel, &client->connTimer);
+    printf("Replica on fd %d streaming after sequence %llu\r\n", client->fd, (unsigned long long)afterSeq);
+
+    return;
+}
+
+static void fsm_reply_repl_status(ClientState_t *client, DbProtocolHdr_t *hdr) {
+    // Own scratch space: client->buffer may still hold pipelined requests
+    char txBuf[sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_ReplStatusResp_t)] = {0};
+    DbProtocolHdr_t *resp = (DbProtocolHdr_t *)txBuf;
+    DbProtocol_ReplStatusResp_t *status = (DbProtocol_ReplStatusResp_t *)&resp[1];
+    uint32_t peers = 0;
+    int i = 0;
+
+    if (NULL != pSrvConfig->pPrimary) {
+        status->role = htonl(REPL_ROLE_REPLICA);
+        status->primarySeq = htobe64(replica.primarySeq);
+        peers = (-1 != replica.fd) ? 1 : 0;
+    } else {
+        status->role = htonl(REPL_ROLE_PRIMARY);
+        status->primarySeq = htobe64(pWal->seq);
+        for (; i < MAX_CLIENTS; i++) {
+            if (-1 != clientStates[i].fd && true == clientStates[i].isReplica) {
+                peers++;
+            }
+        }
+    }
+    status->seq = htobe64(pWal->seq);
+    status->peers = htonl(peers);
+
+    resp->type = htonl(MSG_REPL_STATUS_RESP);
+    resp->len = htons(1);
+    reply_write(client, txBuf, sizeof(txBuf));
+
+    return;
+}
+
+static void feed_replicas(void) {
+    ClientState_t *client = NULL;
+    DbProtocolHdr_t *hdr = NULL;
+    DbProtocol_ReplicateResp_t *resp = NULL;
+    uint32_t count = 0;
+    ssize_t sent = 0;
+    int frames = 0;
+    int i = 0;
+
+    replBacklog = false;
+    for (; i < MAX_CLIENTS; i++) {
+        client = &clientStates[i];
+        if (-1 == client->fd || true != client->isReplica) {
+            continue;
+        }
+
+        for (frames = 0; frames < REPL_FRAMES_PER_STEP && -1 != client->fd; frames++) {
+            // frame the next records once the previous frame is out
+            if (client->replSent == client->replLen) {
+                if (true != wal_backlogHas(pWal, client->replSeq)) {
+                    printf("Replica on fd %d fell behind the log backlog\r\n", client->fd);
+                    close_client(client);
+                    break;
+                }
+                hdr = (DbProtocolHdr_t *)client->pReplFrame;
+                resp = (DbProtocol_ReplicateResp_t *)&hdr[1];
+                count = wal_backlogRead(pWal, client->replSeq, (Wal_Record_t *)&resp[1], REPL_FRAME_RECORDS);
+                if (0 == count) {
+                    break;
+                }
+                hdr->type = htonl(MSG_REPLICATE_RESP);
+                hdr->len = htons(count);
+                resp->headSeq = htobe64(pWal->seq);
+                client->replSeq += count;
+                client->replLen = sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_ReplicateResp_t) + count * sizeof(Wal_Record_t);
+                client->replSent = 0;
+            }
+
+            sent = send(client->fd, client->pReplFrame + client->replSent, client->replLen - client->replSent,
+                        MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno) {
+                    printf("Replica on fd %d: %s\r\n", client->fd, strerror(errno));
+                    close_client(client);
+                }
+                break;
+            }
+            client->replSent += sent;
+            if (client->replSent < client->replLen) {
+                break;
+            }
+        }
+
+        if (REPL_FRAMES_PER_STEP == frames) {
+            replBacklog = true;
+        }
+    }
+
+    return;
+}
+
+static void on_repl_retry(Timer_Node_t *pNode, void *pArg) {
+    replConnectDue = true;
+
+    return;
+}
+
+static void receive_replication(Parse_DbHeader_t *dbhdr, Table_t *pTable) {
+    uint64_t seq = pWal->seq;
+
+    if (repl_receive(&replica, dbhdr, pTable, pWal) < 0) {
+        repl_disconnect(&replica);
+        // the same record would be refused on every reconnect
+        if (true != replica.refused) {
+            printf("Reconnecting to the primary in %d ms\r\n", REPL_RETRY_MS);
+            timer_arm(&timerWheel, &replRetryTimer, timer_nowMs(), REPL_RETRY_MS);
+        }
+    }
+
+    if (seq != pWal->seq) {
+        mark_db_dirty();
+    }
+
+    return;
+}
+
+static void fsm_reply_export(ClientState_t *client, DbProtocolHdr_t *hdr) {
+    DbProtocol_ExportReq_t *req = (DbProtocol_ExportReq_t *)&hdr[1];
+    // Own scratch space: client->buffer may still hold pipelined requests
+    char txBuf[sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_ExportResp_t)] = {0};
+    DbProtocolHdr_t *respHdr = (DbProtocolHdr_t *)txBuf;
+    DbProtocol_ExportResp_t *resp = (DbProtocol_ExportResp_t *)&respHdr[1];
+    char name[SEGMENT_NAME_LEN];
+    struct stat st;
+    uint64_t seq = 0;
+    uint32_t file = 0;
+    uint32_t start = 0;
+    int index = -1;
+    int fd = -1;
+
+    if (1 != hdr->len) {
+        fsm_reply_err(client, hdr);
+        return;
+    }
+    file = ntohl(req->file);
+    start = ntohl(req->start);
+
+    // only files nothing writes to again: snapshots are replaced by a rename, and so are exported segments
+    if (EXPORT_SNAPSHOT == file) {
+        fd = snapshot_open(pSrvConfig->pDbPath, "", &seq);
+    } else if (EXPORT_SNAPSHOT_ROLLUP == file) {
+        fd = snapshot_open(pSrvConfig->pDbPath, ROLLUP_SUFFIX, &seq);
+    } else if (EXPORT_SNAPSHOT_SKETCH == file) {
+        fd = snapshot_open(pSrvConfig->pDbPath, SKETCH_SUFFIX, &seq);
+    } else if (EXPORT_SEGMENT == file && -1 != (index = segment_find(pSegmentStore, start))) {
+        segment_name(start, false, name);
+        fd = openat(pSegmentStore->dirFd, name, O_RDONLY);
+        // sendfile() queues the file's pages, not copies of them, and they may sit in the socket
+        // after the last call; the next flush compacts into a new file instead of appending here
+        pSegmentStore->pSegments[index].rewrite = true;
+    }
+
+    if (-1 == fd || 0 != fstat(fd, &st)) {
+        printf("Nothing to export for file %u, start %u\r\n", file, start);
+        if (-1 != fd) {
+            close(fd);
+        }
+        fsm_reply_err(client, hdr);
+        return;
+    }
+
+    respHdr->type = htonl(MSG_EXPORT_RESP);
+    respHdr->len = htons(1);
+    resp->size = htobe64((uint64_t)st.st_size);
+    resp->seq = htobe64(seq);
+    // a header cut short would have the client read file bytes as the rest of it
+    if (STATUS_SUCCESS != reply_write(client, txBuf, sizeof(txBuf))) {
+        close(fd);
+        return;
+    }
+
+    client->exportFd = fd;
+    client->exportOffset = 0;
+    client->exportSize = st.st_size;
+    // sendfile() must not block the loop, and a long export is not idleness
+    fcntl(client->fd, F_SETFL, fcntl(client->fd, F_GETFL) | O_NONBLOCK);
+    timer_cancel(&timerWheel, &client->connTimer);
+    timer_cancel(&timerWheel, &client->reqTimer);
+    printf("Exporting %lld bytes to fd %d\r\n", (long long)st.st_size, client->fd);
+
+    return;
+}
+
+static void feed_exports(Parse_DbHeader_t *dbhdr, Table_t *pTable, int dbfd) {
+    ClientState_t *client = NULL;
+    size_t budget = 0;
+    ssize_t sent = 0;
+    int i = 0;
+
+    exportBacklog = false;
+    for (; i < MAX_CLIENTS; i++) {
+        client = &clientStates[i];
+        if (-1 == client->fd || -1 == client->exportFd) {
+            continue;
+        }
+
+        // the kernel moves the pages from the page cache to the socket, nothing is copied here
+        for (budget = EXPORT_STEP_BYTES; 0 != budget && client->exportOffset < client->exportSize; budget -= sent) {
+            sent = sendfile(client->fd, client->exportFd, &client->exportOffset,
+                            ((size_t)(client->exportSize - client->exportOffset) < budget) ?
+                            (size_t)(client->exportSize - client->exportOffset) : budget);
+            if (sent <= 0) {
+                break;
+            }
+        }
+
+        if (sent < 0 && EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno) {
+            printf("Export to fd %d: %s\r\n", client->fd, strerror(errno));
+            close_client(client);
+            continue;
+        }
+        if (0 == sent && client->exportOffset < client->exportSize) {
+            // the file cannot shrink under the descriptor, but the promised size must be met
+            printf("Export to fd %d ended early at byte %lld\r\n", client->fd, (long long)client->exportOffset);
+            close_client(client);
+            continue;
+        }
+
+        if (client->exportOffset < client->exportSize) {
+            exportBacklog = exportBacklog || (0 == budget);
+            continue;
+        }
+
+        printf("Export to fd %d done\r\n", client->fd);
+        finish_export(client);
+        fcntl(client->fd, F_SETFL, fcntl(client->fd, F_GETFL) & ~O_NONBLOCK);
+        client->lastActiveMs = timer_nowMs();
+        if (0 != pSrvConfig->idleTimeoutSec) {
+            timer_arm(&timerWheel, &client->connTimer, client->lastActiveMs, pSrvConfig->idleTimeoutSec * 1000ULL);
+        }
+        handle_client_data(dbhdr, pTable, client, dbfd);
+    }
+
+    return;
+}
+
+static void finish_export(ClientState_t *client) {
+    close(client->exportFd);
+    client->exportFd = -1;
+
+    return;
+}
+
+static int setup_server_socket(unsigned short port) {
+    int listen_fd;
+    struct sockaddr_in server_addr;
+    int opt = 1;
+
+    // Create new socket for listening
+    if ((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt");
+        close(listen_fd);
+        exit(EXIT_FAILURE);
+    }
+
+    // Prepare server addr
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
+
+    /* Bind socket to port */
+    if (bind(listen_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        perror("bind");
+        close(listen_fd);
+        exit(EXIT_FAILURE);
+    }
+
+    // Listen for incoming connections (max 15)
+    if (listen(listen_fd, 15) < 0) {
+        perror("listen");
+        close(listen_fd);
+        exit(EXIT_FAILURE);
     }
     
     return listen_fd;
 }
+
+static int setup_unix_socket(const char *pPath) {
+    int listen_fd;
+    struct sockaddr_un server_addr;
+
+    if (strlen(pPath) >= sizeof(server_addr.sun_path)) {
+        printf("Unix socket path too long: %s\r\n", pPath);
+        exit(EXIT_FAILURE);
+    }
+
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    // Remove a stale socket left behind by a previous run
+    unlink(pPath);
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sun_family = AF_UNIX;
+    strncpy(server_addr.sun_path, pPath, sizeof(server_addr.sun_path) - 1);
+
+    if (bind(listen_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        perror("bind");
+        close(listen_fd);
+        exit(EXIT_FAILURE);
+    }
+
+    if (listen(listen_fd, 15) < 0) {
+        perror("listen");
+        close(listen_fd);
+        exit(EXIT_FAILURE);
+    }
+
+    return listen_fd;
+}
+
+static int setup_udp_socket(unsigned short port) {
+    int udp_fd;
+    struct sockaddr_in server_addr;
+    int opt = 1;
+    int rcvbuf = 4 * 1024 * 1024;
+
+    if ((udp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0)) < 0) {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    // Bursts are absorbed by the socket queue, overflow is counted not silent
+    setsockopt(udp_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (setsockopt(udp_fd, SOL_SOCKET, SO_RXQ_OVFL, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt");
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
+
+    if (bind(udp_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        perror("bind");
+        close(udp_fd);
+        exit(EXIT_FAILURE);
+    }
+
+    return udp_fd;
+}
\ No newline at end of file
@@ -0,0 +1,875 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "table.h"
+
+#define TABLE_FNV_OFFSET    0xcbf29ce484222325ULL
+#define TABLE_FNV_PRIME     0x100000001b3ULL
+
+/* Private function prototypes -----------------------------------------------*/
+// grow every column to hold at least capacity rows
+static int table_grow(Table_t *pTable, uint32_t capacity);
+// rebuild the sensorId index with the given number of slots
+static int table_rehash(Table_t *pTable, uint32_t slots);
+// index slot holding row, or the empty slot where id would go
+static uint32_t table_slot(const Table_t *pTable, const char *pSensorId, uint64_t hash);
+// index slot that points at row
+static uint32_t table_slotOfRow(const Table_t *pTable, uint32_t row);
+// delete an index slot keeping every probe chain intact
+static void table_unindex(Table_t *pTable, uint32_t slot);
+// bitmap of rows for a code, growing the per code array as needed
+static Bitmap_t *table_codeRows(Table_CodeIndex_t *pIndex, uint16_t code);
+// add a row to, or drop it from, every secondary index it belongs to
+static int table_postRow(Table_t *pTable, uint32_t row, bool add);
+// move the bitmaps of a shard code index into the table's
+static int table_mergeCodes(Table_CodeIndex_t *pIndex, Table_CodeIndex_t *pShardIndex);
+// release the bitmaps of a code index
+static void table_freeCodes(Table_CodeIndex_t *pIndex);
+// start the rollup, history and sketch of a row empty
+static void table_clearSeries(Table_t *pTable, uint32_t row);
+// bytes of the saved form of a code index
+static size_t table_codesBytes(const Table_CodeIndex_t *pIndex);
+// load a saved code index, STATUS_ERROR if it is malformed
+static int table_loadCodes(Table_CodeIndex_t *pIndex, uint32_t codes, const uint8_t *pIn, size_t len, size_t *pUsed);
+
+/**
+ * @brief  Allocate an empty table
+ * @param pTable: [out] Table to initialize
+ * @param capacity: [in] Number of rows to reserve
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int table_init(Table_t *pTable, uint32_t capacity)
+{
+    memset(pTable, 0, sizeof(Table_t));
+
+    if (capacity < TABLE_INITIAL_CAPACITY) {
+        capacity = TABLE_INITIAL_CAPACITY;
+    }
+
+    if (STATUS_SUCCESS != table_grow(pTable, capacity) ||
+        STATUS_SUCCESS != dict_init(&pTable->types, TABLE_TYPE_LEN, DICT_MAX_CODES) ||
+        STATUS_SUCCESS != dict_init(&pTable->locations, TABLE_LOCATION_LEN, DICT_MAX_CODES) ||
+        STATUS_SUCCESS != dict_init(&pTable->removed, sizeof(pTable->pCold[0].sensorId), DICT_NO_LIMIT)) {
+        table_free(pTable);
+        return STATUS_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Release all columns of a table
+ * @param pTable: [in] Table to release
+ */
+void table_free(Table_t *pTable)
+{
+    uint32_t i = 0;
+
+    free(pTable->pTimestamp);
+    free(pTable->pReading);
+    free(pTable->pMinThreshold);
+    free(pTable->pMaxThreshold);
+    free(pTable->pFlags);
+    free(pTable->pTypeCode);
+    free(pTable->pLocationCode);
+    free(pTable->pCold);
+    free(pTable->pIdHash);
+    free(pTable->pIndex);
+    free(pTable->pAlertRows);
+    free(pTable->pAlertPos);
+    for (i = 0; NULL != pTable->pRollup && i < pTable->count; i++) {
+        rollup_free(&pTable->pRollup[i]);
+        history_free(&pTable->pHistory[i]);
+        sketch_seriesFree(&pTable->pSketch[i]);
+    }
+    free(pTable->pRollup);
+    free(pTable->pHistory);
+    free(pTable->pSketch);
+    table_freeCodes(&pTable->typeIndex);
+    table_freeCodes(&pTable->locationIndex);
+    for (i = 0; i < TABLE_FLAG_BITS; i++) {
+        bitmap_free(&pTable->flagIndex[i]);
+    }
+    dict_free(&pTable->types);
+    dict_free(&pTable->locations);
+    dict_free(&pTable->removed);
+    memset(pTable, 0, sizeof(Table_t));
+
+    return;
+}
+
+/**
+ * @brief  Hash a sensor ID (64-bit FNV-1a)
+ * @param pSensorId: [in] NUL terminated sensor ID
+ * @return hash value
+ */
+uint64_t table_hashId(const char *pSensorId)
+{
+    uint64_t hash = TABLE_FNV_OFFSET;
+
+    while ('\0' != *pSensorId) {
+        hash ^= (unsigned char)*pSensorId++;
+        hash *= TABLE_FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief  Find a sensor by ID
+ * @param pTable: [in] Table to search
+ * @param pSensorId: [in] Sensor ID to search for
+ * @return Row of the sensor if found, -1 otherwise
+ */
+int table_find(const Table_t *pTable, const char *pSensorId)
+{
+    uint32_t slot = table_slot(pTable, pSensorId, table_hashId(pSensorId));
+
+    return (int)pTable->pIndex[slot] - 1;
+}
+
+/**
+ * @brief  Find a sensor by ID, appending a new row if it is not present
+ * @param pTable: [in] Table to update
+ * @param pSensorId: [in] Sensor ID
+ * @param pCreated: [out] Set to true when a new row was appended, may be NULL
+ * @return Row of the sensor or -1 on allocation failure
+ * @note  New rows are zeroed apart from the sensor ID, the caller fills the columns.
+ *        Type and location start as TABLE_NO_CODE and must be set with
+ *        table_setType() / table_setLocation().
+ */
+int table_insert(Table_t *pTable, const char *pSensorId, bool *pCreated)
+{
+    uint64_t hash = table_hashId(pSensorId);
+    uint32_t slot = table_slot(pTable, pSensorId, hash);
+    uint32_t row = 0;
+
+    if (NULL != pCreated) {
+        *pCreated = false;
+    }
+
+    if (0 != pTable->pIndex[slot]) {
+        return (int)pTable->pIndex[slot] - 1;
+    }
+
+    if (pTable->count == pTable->capacity) {
+        if (STATUS_SUCCESS != table_grow(pTable, pTable->capacity * 2)) {
+            printf("Realloc failed to expand sensor table\r\n");
+            return -1;
+        }
+        // the index was rebuilt, find the empty slot again
+        slot = table_slot(pTable, pSensorId, hash);
+    }
+
+    row = pTable->count++;
+    pTable->pTimestamp[row] = 0;
+    pTable->pReading[row] = 0.0f;
+    pTable->pMinThreshold[row] = 0.0f;
+    pTable->pMaxThreshold[row] = 0.0f;
+    pTable->pFlags[row] = 0;
+    pTable->pTypeCode[row] = TABLE_NO_CODE;
+    pTable->pLocationCode[row] = TABLE_NO_CODE;
+    memset(&pTable->pCold[row], 0, sizeof(Table_Cold_t));
+    strncpy(pTable->pCold[row].sensorId, pSensorId, sizeof(pTable->pCold[row].sensorId) - 1);
+    pTable->pIdHash[row] = hash;
+    memset(&pTable->pRollup[row], 0, sizeof(Rollup_Sensor_t));
+    memset(&pTable->pHistory[row], 0, sizeof(History_Series_t));
+    memset(&pTable->pSketch[row], 0, sizeof(Sketch_Series_t));
+    pTable->pAlertPos[row] = TABLE_NO_ALERT;
+    pTable->pIndex[slot] = row + 1;
+
+    if (NULL != pCreated) {
+        *pCreated = true;
+    }
+
+    return (int)row;
+}
+
+/**
+ * @brief  Remove a row from the table
+ * @param pTable: [in] Table to update
+ * @param row: [in] Row to remove
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  O(1): the last row is moved into the hole, so row order is not preserved.
+ *        After the call, row holds what used to be row count (if any).
+ */
+int table_remove(Table_t *pTable, uint32_t row)
+{
+    uint32_t last = 0;
+
+    if (row >= pTable->count) {
+        return STATUS_ERROR;
+    }
+
+    // a failure past the first index update would leave the indexes out of step with the rows
+    if (-1 == dict_intern(&pTable->removed, pTable->pCold[row].sensorId)) {
+        return STATUS_ERROR;
+    }
+    if (STATUS_SUCCESS != table_postRow(pTable, row, false)) {
+        return STATUS_ERROR;
+    }
+    table_unindex(pTable, table_slotOfRow(pTable, row));
+    table_setAlert(pTable, row, false);
+    rollup_free(&pTable->pRollup[row]);
+    history_free(&pTable->pHistory[row]);
+    sketch_seriesFree(&pTable->pSketch[row]);
+
+    last = --pTable->count;
+    if (row != last) {
+        if (STATUS_SUCCESS != table_postRow(pTable, last, false)) {
+            return STATUS_ERROR;
+        }
+        pTable->pIndex[table_slotOfRow(pTable, last)] = row + 1;
+        pTable->pTimestamp[row] = pTable->pTimestamp[last];
+        pTable->pReading[row] = pTable->pReading[last];
+        pTable->pMinThreshold[row] = pTable->pMinThreshold[last];
+        pTable->pMaxThreshold[row] = pTable->pMaxThreshold[last];
+        pTable->pFlags[row] = pTable->pFlags[last];
+        pTable->pTypeCode[row] = pTable->pTypeCode[last];
+        pTable->pLocationCode[row] = pTable->pLocationCode[last];
+        pTable->pCold[row] = pTable->pCold[last];
+        pTable->pIdHash[row] = pTable->pIdHash[last];
+        pTable->pRollup[row] = pTable->pRollup[last];
+        pTable->pHistory[row] = pTable->pHistory[last];
+        pTable->pSketch[row] = pTable->pSketch[last];
+
+        pTable->pAlertPos[row] = pTable->pAlertPos[last];
+        if (TABLE_NO_ALERT != pTable->pAlertPos[row]) {
+            pTable->pAlertRows[pTable->pAlertPos[row]] = row;
+        }
+
+        return table_postRow(pTable, row, true);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Set the sensorType code of a row
+ * @param pTable: [in] Table to update
+ * @param row: [in] Row to update
+ * @param code: [in] Code in the types dictionary
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int table_setType(Table_t *pTable, uint32_t row, uint16_t code)
+{
+    uint16_t old = pTable->pTypeCode[row];
+    Bitmap_t *pRows = NULL;
+
+    if (old == code) {
+        return STATUS_SUCCESS;
+    }
+
+    pRows = table_codeRows(&pTable->typeIndex, code);
+    if (NULL == pRows || STATUS_SUCCESS != bitmap_add(pRows, row)) {
+        printf("Malloc failed to update type index\r\n");
+        return STATUS_ERROR;
+    }
+    if (TABLE_NO_CODE != old) {
+        bitmap_remove(&pTable->typeIndex.pRows[old], row);
+    }
+    pTable->pTypeCode[row] = code;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Set the location code of a row
+ * @param pTable: [in] Table to update
+ * @param row: [in] Row to update
+ * @param code: [in] Code in the locations dictionary
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ */
+int table_setLocation(Table_t *pTable, uint32_t row, uint16_t code)
+{
+    uint16_t old = pTable->pLocationCode[row];
+    Bitmap_t *pRows = NULL;
+
+    if (old == code) {
+        return STATUS_SUCCESS;
+    }
+
+    pRows = table_codeRows(&pTable->locationIndex, code);
+    if (NULL == pRows || STATUS_SUCCESS != bitmap_add(pRows, row)) {
+        printf("Malloc failed to update location index\r\n");
+        return STATUS_ERROR;
+    }
+    if (TABLE_NO_CODE != old) {
+        bitmap_remove(&pTable->locationIndex.pRows[old], row);
+    }
+    pTable->pLocationCode[row] = code;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Set the flags of a row
+ * @param pTable: [in] Table to update
+ * @param row: [in] Row to update
+ * @param flags: [in] SENSOR_FLAG_* bits
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  Only the bitmaps of bits that changed are touched.
+ */
+int table_setFlags(Table_t *pTable, uint32_t row, uint8_t flags)
+{
+    uint8_t changed = pTable->pFlags[row] ^ flags;
+    int status = STATUS_SUCCESS;
+    uint32_t bit = 0;
+
+    for (; 0 != changed; changed &= changed - 1) {
+        bit = __builtin_ctz(changed);
+        if (0 != (flags & (1U << bit))) {
+            status = bitmap_add(&pTable->flagIndex[bit], row);
+        } else {
+            status = bitmap_remove(&pTable->flagIndex[bit], row);
+        }
+        if (STATUS_SUCCESS != status) {
+            printf("Malloc failed to update flag index\r\n");
+            return STATUS_ERROR;
+        }
+        pTable->pFlags[row] ^= 1U << bit;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Get the sensorType of a row
+ * @param pTable: [in] Table
+ * @param row: [in] Row
+ * @return string owned by the types dictionary
+ */
+const char *table_typeName(const Table_t *pTable, uint32_t row)
+{
+    return dict_string(&pTable->types, pTable->pTypeCode[row]);
+}
+
+/**
+ * @brief  Get the location of a row
+ * @param pTable: [in] Table
+ * @param row: [in] Row
+ * @return string owned by the locations dictionary
+ */
+const char *table_locationName(const Table_t *pTable, uint32_t row)
+{
+    return dict_string(&pTable->locations, pTable->pLocationCode[row]);
+}
+
+/**
+ * @brief  Track whether a row is outside its thresholds
+ * @param pTable: [in] Table to update
+ * @param row: [in] Row to update
+ * @param alert: [in] true if the row is in violation
+ * @note  O(1), the alert set stays dense so listing it costs O(violations).
+ */
+void table_setAlert(Table_t *pTable, uint32_t row, bool alert)
+{
+    uint32_t pos = pTable->pAlertPos[row];
+    uint32_t last = 0;
+
+    if (true == alert && TABLE_NO_ALERT == pos) {
+        pTable->pAlertPos[row] = pTable->alertCount;
+        pTable->pAlertRows[pTable->alertCount++] = row;
+    } else if (true != alert && TABLE_NO_ALERT != pos) {
+        last = pTable->pAlertRows[--pTable->alertCount];
+        pTable->pAlertRows[pos] = last;
+        pTable->pAlertPos[last] = pos;
+        pTable->pAlertPos[row] = TABLE_NO_ALERT;
+    }
+
+    return;
+}
+
+/**
+ * @brief  Start an empty shard
+ * @param pShard: [out] Shard
+ * @param first: [in] Row the run of the shard starts at
+ */
+void table_shardInit(Table_Shard_t *pShard, uint32_t first)
+{
+    memset(pShard, 0, sizeof(Table_Shard_t));
+    pShard->first = first;
+
+    return;
+}
+
+/**
+ * @brief  Index the next row of a shard
+ * @param pShard: [in] Shard, its run grows by one row
+ * @param pTable: [in] Table whose columns already hold the row
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  Touches only the shard, so threads may index disjoint runs of
+ *        the same table at once.
+ */
+int table_shardAdd(Table_Shard_t *pShard, const Table_t *pTable)
+{
+    uint32_t row = pShard->first + pShard->count;
+    uint8_t flags = pTable->pFlags[row];
+    Bitmap_t *pTypeRows = table_codeRows(&pShard->typeIndex, pTable->pTypeCode[row]);
+    Bitmap_t *pLocationRows = table_codeRows(&pShard->locationIndex, pTable->pLocationCode[row]);
+
+    if (NULL == pTypeRows || NULL == pLocationRows ||
+        STATUS_SUCCESS != bitmap_add(pTypeRows, row) || STATUS_SUCCESS != bitmap_add(pLocationRows, row)) {
+        return STATUS_ERROR;
+    }
+    for (; 0 != flags; flags &= flags - 1) {
+        if (STATUS_SUCCESS != bitmap_add(&pShard->flagIndex[__builtin_ctz(flags)], row)) {
+            return STATUS_ERROR;
+        }
+    }
+    pShard->count++;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Release the indexes of a shard
+ * @param pShard: [in] Shard
+ */
+void table_shardFree(Table_Shard_t *pShard)
+{
+    uint32_t i = 0;
+
+    table_freeCodes(&pShard->typeIndex);
+    table_freeCodes(&pShard->locationIndex);
+    for (; i < TABLE_FLAG_BITS; i++) {
+        bitmap_free(&pShard->flagIndex[i]);
+    }
+    memset(pShard, 0, sizeof(Table_Shard_t));
+
+    return;
+}
+
+/**
+ * @brief  Append the run of a shard to the table
+ * @param pTable: [in] Table, its count must be the first row of the shard
+ * @param pShard: [in] Shard, emptied on success
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  The ID hashes are taken from pIdHash, so the only work left per
+ *        row is probing the index. The rollup, history and sketch columns
+ *        start empty, the caller adds the rows to the alert set.
+ */
+int table_merge(Table_t *pTable, Table_Shard_t *pShard)
+{
+    uint32_t row = pShard->first;
+    uint32_t end = pShard->first + pShard->count;
+    uint32_t slot = 0;
+    uint32_t i = 0;
+
+    if (pTable->count != pShard->first || end > pTable->capacity) {
+        return STATUS_ERROR;
+    }
+
+    for (; row < end; row++) {
+        slot = table_slot(pTable, pTable->pCold[row].sensorId, pTable->pIdHash[row]);
+        if (0 != pTable->pIndex[slot]) {
+            printf("Duplicate sensor ID %s\r\n", pTable->pCold[row].sensorId);
+            return STATUS_ERROR;
+        }
+        pTable->pIndex[slot] = row + 1;
+        table_clearSeries(pTable, row);
+        pTable->count++;
+    }
+
+    if (STATUS_SUCCESS != table_mergeCodes(&pTable->typeIndex, &pShard->typeIndex) ||
+        STATUS_SUCCESS != table_mergeCodes(&pTable->locationIndex, &pShard->locationIndex)) {
+        return STATUS_ERROR;
+    }
+    for (i = 0; i < TABLE_FLAG_BITS; i++) {
+        if (STATUS_SUCCESS != bitmap_merge(&pTable->flagIndex[i], &pShard->flagIndex[i])) {
+            return STATUS_ERROR;
+        }
+    }
+    table_shardFree(pShard);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Get the size of the saved indexes of a table
+ * @param pTable: [in] Table
+ * @return bytes table_saveIndex() writes
+ */
+size_t table_indexBytes(const Table_t *pTable)
+{
+    size_t bytes = 4 * sizeof(uint32_t);
+    uint32_t i = 0;
+
+    bytes += (size_t)pTable->count * sizeof(uint64_t);
+    bytes += (((size_t)pTable->indexMask + 1) * sizeof(uint32_t) + 7) & ~(size_t)7;
+    bytes += table_codesBytes(&pTable->typeIndex);
+    bytes += table_codesBytes(&pTable->locationIndex);
+    for (; i < TABLE_FLAG_BITS; i++) {
+        bytes += bitmap_savedBytes(&pTable->flagIndex[i]);
+    }
+
+    return bytes;
+}
+
+/**
+ * @brief  Serialize the indexes of a table
+ * @param pTable: [in] Table
+ * @param pOut: [out] table_indexBytes() bytes, host byte order
+ * @note  Layout: row count, index slots, type and location code counts, the
+ *        ID hash column, the ID index padded to 8 bytes, then every bitmap
+ *        of the type, location and flag indexes in that order.
+ */
+void table_saveIndex(const Table_t *pTable, uint8_t *pOut)
+{
+    uint32_t counts[4] = { pTable->count, pTable->indexMask + 1, pTable->typeIndex.count, pTable->locationIndex.count };
+    size_t bytes = ((size_t)pTable->indexMask + 1) * sizeof(uint32_t);
+    uint32_t i = 0;
+
+    memcpy(pOut, counts, sizeof(counts));
+    pOut += sizeof(counts);
+    memcpy(pOut, pTable->pIdHash, (size_t)pTable->count * sizeof(uint64_t));
+    pOut += (size_t)pTable->count * sizeof(uint64_t);
+    memset(pOut, 0, (bytes + 7) & ~(size_t)7);
+    memcpy(pOut, pTable->pIndex, bytes);
+    pOut += (bytes + 7) & ~(size_t)7;
+
+    for (i = 0; i < pTable->typeIndex.count; i++) {
+        pOut += bitmap_save(&pTable->typeIndex.pRows[i], pOut);
+    }
+    for (i = 0; i < pTable->locationIndex.count; i++) {
+        pOut += bitmap_save(&pTable->locationIndex.pRows[i], pOut);
+    }
+    for (i = 0; i < TABLE_FLAG_BITS; i++) {
+        pOut += bitmap_save(&pTable->flagIndex[i], pOut);
+    }
+
+    return;
+}
+
+/**
+ * @brief  Adopt saved indexes
+ * @param pTable: [in] Empty table whose columns already hold count rows
+ * @param count: [in] Number of rows
+ * @param pIn: [in] Output of table_saveIndex(), e.g. a mapped file
+ * @param len: [in] Bytes at pIn
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  The ID index is copied as is, so the table must have been sized
+ *        for the capacity it was saved at. The rollup, history and sketch
+ *        columns start empty, the caller adds the rows to the alert set.
+ */
+int table_loadIndex(Table_t *pTable, uint32_t count, const uint8_t *pIn, size_t len)
+{
+    uint32_t counts[4];
+    size_t bytes = 0;
+    size_t used = 0;
+    uint32_t row = 0;
+    uint32_t i = 0;
+
+    if (0 != pTable->count || count > pTable->capacity || len < sizeof(counts)) {
+        return STATUS_ERROR;
+    }
+    memcpy(counts, pIn, sizeof(counts));
+    pIn += sizeof(counts);
+    len -= sizeof(counts);
+    if (counts[0] != count || counts[1] != pTable->indexMask + 1) {
+        return STATUS_ERROR;
+    }
+
+    bytes = (size_t)count * sizeof(uint64_t);
+    if (len < bytes) {
+        return STATUS_ERROR;
+    }
+    memcpy(pTable->pIdHash, pIn, bytes);
+    pIn += bytes;
+    len -= bytes;
+
+    bytes = ((size_t)counts[1] * sizeof(uint32_t) + 7) & ~(size_t)7;
+    if (len < bytes) {
+        return STATUS_ERROR;
+    }
+    memcpy(pTable->pIndex, pIn, (size_t)counts[1] * sizeof(uint32_t));
+    pIn += bytes;
+    len -= bytes;
+
+    if (STATUS_SUCCESS != table_loadCodes(&pTable->typeIndex, counts[2], pIn, len, &used)) {
+        return STATUS_ERROR;
+    }
+    pIn += used;
+    len -= used;
+    if (STATUS_SUCCESS != table_loadCodes(&pTable->locationIndex, counts[3], pIn, len, &used)) {
+        return STATUS_ERROR;
+    }
+    pIn += used;
+    len -= used;
+    for (; i < TABLE_FLAG_BITS; i++) {
+        bitmap_free(&pTable->flagIndex[i]);
+        used = bitmap_load(&pTable->flagIndex[i], pIn, len);
+        if (0 == used) {
+            return STATUS_ERROR;
+        }
+        pIn += used;
+        len -= used;
+    }
+
+    for (; row < count; row++) {
+        table_clearSeries(pTable, row);
+    }
+    pTable->count = count;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Helper functions
+ */
+
+static int table_grow(Table_t *pTable, uint32_t capacity)
+{
+    void *p = NULL;
+
+#define TABLE_GROW_COLUMN(column) \
+    p = realloc(pTable->column, (size_t)capacity * sizeof(*pTable->column)); \
+    if (NULL == p) { \
+        return STATUS_ERROR; \
+    } \
+    pTable->column = p;
+
+    TABLE_GROW_COLUMN(pTimestamp)
+    TABLE_GROW_COLUMN(pReading)
+    TABLE_GROW_COLUMN(pMinThreshold)
+    TABLE_GROW_COLUMN(pMaxThreshold)
+    TABLE_GROW_COLUMN(pFlags)
+    TABLE_GROW_COLUMN(pTypeCode)
+    TABLE_GROW_COLUMN(pLocationCode)
+    TABLE_GROW_COLUMN(pCold)
+    TABLE_GROW_COLUMN(pIdHash)
+    TABLE_GROW_COLUMN(pRollup)
+    TABLE_GROW_COLUMN(pHistory)
+    TABLE_GROW_COLUMN(pSketch)
+    TABLE_GROW_COLUMN(pAlertRows)
+    TABLE_GROW_COLUMN(pAlertPos)
+
+#undef TABLE_GROW_COLUMN
+
+    pTable->capacity = capacity;
+
+    // keep the index at most half full
+    return table_rehash(pTable, capacity * 2);
+}
+
+static int table_rehash(Table_t *pTable, uint32_t slots)
+{
+    uint32_t *pIndex = NULL;
+    uint32_t slot = 0;
+    uint32_t row = 0;
+    uint32_t size = 1;
+
+    while (size < slots) {
+        size <<= 1;
+    }
+
+    pIndex = calloc(size, sizeof(uint32_t));
+    if (NULL == pIndex) {
+        return STATUS_ERROR;
+    }
+
+    for (; row < pTable->count; row++) {
+        slot = pTable->pIdHash[row] & (size - 1);
+        while (0 != pIndex[slot]) {
+            slot = (slot + 1) & (size - 1);
+        }
+        pIndex[slot] = row + 1;
+    }
+
+    free(pTable->pIndex);
+    pTable->pIndex = pIndex;
+    pTable->indexMask = size - 1;
+
+    return STATUS_SUCCESS;
+}
+
+static uint32_t table_slot(const Table_t *pTable, const char *pSensorId, uint64_t hash)
+{
+    uint32_t slot = hash & pTable->indexMask;
+    uint32_t row = 0;
+
+    while (0 != pTable->pIndex[slot]) {
+        row = pTable->pIndex[slot] - 1;
+        if (pTable->pIdHash[row] == hash &&
+            0 == strncmp(pTable->pCold[row].sensorId, pSensorId, sizeof(pTable->pCold[row].sensorId) - 1)) {
+            break;
+        }
+        slot = (slot + 1) & pTable->indexMask;
+    }
+
+    return slot;
+}
+
+static uint32_t table_slotOfRow(const Table_t *pTable, uint32_t row)
+{
+    uint32_t slot = pTable->pIdHash[row] & pTable->indexMask;
+
+    while (pTable->pIndex[slot] != row + 1) {
+        slot = (slot + 1) & pTable->indexMask;
+    }
+
+    return slot;
+}
+
+static void table_unindex(Table_t *pTable, uint32_t slot)
+{
+    uint32_t next = slot;
+    uint32_t home = 0;
+
+    // backward shift deletion, no tombstones
+    for (;;) {
+        next = (next + 1) & pTable->indexMask;
+        if (0 == pTable->pIndex[next]) {
+            break;
+        }
+
+        home = pTable->pIdHash[pTable->pIndex[next] - 1] & pTable->indexMask;
+        // leave entries whose home lies cyclically in (slot, next]
+        if (((next - home) & pTable->indexMask) < ((next - slot) & pTable->indexMask)) {
+            continue;
+        }
+
+        pTable->pIndex[slot] = pTable->pIndex[next];
+        slot = next;
+    }
+
+    pTable->pIndex[slot] = 0;
+
+    return;
+}
+
+static Bitmap_t *table_codeRows(Table_CodeIndex_t *pIndex, uint16_t code)
+{
+    Bitmap_t *pRows = NULL;
+    uint32_t count = (0 == pIndex->count) ? 16 : pIndex->count;
+
+    if (code < pIndex->count) {
+        return &pIndex->pRows[code];
+    }
+
+    while (count <= code) {
+        count *= 2;
+    }
+
+    pRows = realloc(pIndex->pRows, count * sizeof(Bitmap_t));
+    if (NULL == pRows) {
+        return NULL;
+    }
+    memset(&pRows[pIndex->count], 0, (count - pIndex->count) * sizeof(Bitmap_t));
+    pIndex->pRows = pRows;
+    pIndex->count = count;
+
+    return &pRows[code];
+}
+
+static int table_postRow(Table_t *pTable, uint32_t row, bool add)
+{
+    Bitmap_t *pSets[2 + TABLE_FLAG_BITS];
+    uint16_t typeCode = pTable->pTypeCode[row];
+    uint16_t locationCode = pTable->pLocationCode[row];
+    uint8_t flags = pTable->pFlags[row];
+    uint32_t n = 0;
+    uint32_t i = 0;
+
+    if (TABLE_NO_CODE != typeCode) {
+        pSets[n++] = table_codeRows(&pTable->typeIndex, typeCode);
+    }
+    if (TABLE_NO_CODE != locationCode) {
+        pSets[n++] = table_codeRows(&pTable->locationIndex, locationCode);
+    }
+    for (; 0 != flags; flags &= flags - 1) {
+        pSets[n++] = &pTable->flagIndex[__builtin_ctz(flags)];
+    }
+
+    for (i = 0; i < n; i++) {
+        if (NULL == pSets[i] ||
+            STATUS_SUCCESS != ((true == add) ? bitmap_add(pSets[i], row) : bitmap_remove(pSets[i], row))) {
+            printf("Malloc failed to update secondary index\r\n");
+            return STATUS_ERROR;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static int table_mergeCodes(Table_CodeIndex_t *pIndex, Table_CodeIndex_t *pShardIndex)
+{
+    Bitmap_t *pRows = NULL;
+    uint32_t code = 0;
+
+    for (; code < pShardIndex->count; code++) {
+        if (0 == pShardIndex->pRows[code].cardinality) {
+            continue;
+        }
+        pRows = table_codeRows(pIndex, code);
+        if (NULL == pRows || STATUS_SUCCESS != bitmap_merge(pRows, &pShardIndex->pRows[code])) {
+            printf("Malloc failed to merge secondary index\r\n");
+            return STATUS_ERROR;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static void table_freeCodes(Table_CodeIndex_t *pIndex)
+{
+    uint32_t i = 0;
+
+    for (; i < pIndex->count; i++) {
+        bitmap_free(&pIndex->pRows[i]);
+    }
+    free(pIndex->pRows);
+
+    return;
+}
+
+static void table_clearSeries(Table_t *pTable, uint32_t row)
+{
+    memset(&pTable->pRollup[row], 0, sizeof(Rollup_Sensor_t));
+    memset(&pTable->pHistory[row], 0, sizeof(History_Series_t));
+    memset(&pTable->pSketch[row], 0, sizeof(Sketch_Series_t));
+    pTable->pAlertPos[row] = TABLE_NO_ALERT;
+
+    return;
+}
+
+static size_t table_codesBytes(const Table_CodeIndex_t *pIndex)
+{
+    size_t bytes = 0;
+    uint32_t i = 0;
+
+    for (; i < pIndex->count; i++) {
+        bytes += bitmap_savedBytes(&pIndex->pRows[i]);
+    }
+
+    return bytes;
+}
+
+static int table_loadCodes(Table_CodeIndex_t *pIndex, uint32_t codes, const uint8_t *pIn, size_t len, size_t *pUsed)
+{
+    size_t used = 0;
+    uint32_t i = 0;
+
+    table_freeCodes(pIndex);
+    memset(pIndex, 0, sizeof(Table_CodeIndex_t));
+    *pUsed = 0;
+    if (0 == codes) {
+        return STATUS_SUCCESS;
+    }
+
+    pIndex->pRows = calloc(codes, sizeof(Bitmap_t));
+    if (NULL == pIndex->pRows) {
+        return STATUS_ERROR;
+    }
+    pIndex->count = codes;
+
+    for (; i < codes; i++) {
+        used = bitmap_load(&pIndex->pRows[i], pIn + *pUsed, len - *pUsed);
+        if (0 == used) {
+            return STATUS_ERROR;
+        }
+        *pUsed += used;
+    }
+
+    return STATUS_SUCCESS;
+}
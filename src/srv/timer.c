@@ -0,0 +1,256 @@
+#include <time.h>
+#include "timer.h"
+
+/* Private function prototypes -----------------------------------------------*/
+// link node into the slot matching its expiry
+static void timer_place(Timer_Wheel_t *pWheel, Timer_Node_t *pNode);
+// unlink node from whatever slot it is in
+static void timer_unlink(Timer_Node_t *pNode);
+// move all timers of a higher level slot down the hierarchy
+static void timer_cascade(Timer_Wheel_t *pWheel, int level, int index);
+
+/**
+  * @brief  Read the monotonic clock
+  * @retval current time in milliseconds
+  */
+uint64_t timer_nowMs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+  * @brief  Read the monotonic clock with microsecond resolution
+  * @retval current time in microseconds
+  */
+uint64_t timer_nowUs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+  * @brief  Initialize a hierarchical timing wheel
+  * @param pWheel: [in] wheel to initialize
+  * @param nowMs: [in] current time in milliseconds
+  */
+void timer_init(Timer_Wheel_t *pWheel, uint64_t nowMs) {
+    int level = 0;
+    int slot = 0;
+
+    for (; level < TIMER_LEVELS; level++) {
+        for (slot = 0; slot < TIMER_SLOTS; slot++) {
+            pWheel->slots[level][slot].pNext = &pWheel->slots[level][slot];
+            pWheel->slots[level][slot].pPrev = &pWheel->slots[level][slot];
+        }
+    }
+
+    pWheel->now = nowMs / TIMER_TICK_MS;
+    pWheel->pending = 0;
+
+    return;
+}
+
+/**
+  * @brief  Prepare a timer node
+  * @param pNode: [in] node to initialize
+  * @param pCallback: [in] function to call on expiry
+  * @param pArg: [in] user argument passed to the callback
+  */
+void timer_initNode(Timer_Node_t *pNode, Timer_Callback_t pCallback, void *pArg) {
+    pNode->pNext = NULL;
+    pNode->pPrev = NULL;
+    pNode->expires = 0;
+    pNode->pCallback = pCallback;
+    pNode->pArg = pArg;
+
+    return;
+}
+
+/**
+  * @brief  Check whether a node is linked into a wheel
+  * @param pNode: [in] node to check
+  * @retval true if armed
+  */
+bool timer_isArmed(const Timer_Node_t *pNode) {
+    return NULL != pNode->pNext;
+}
+
+/**
+  * @brief  Arm a timer, replacing any previous expiry
+  * @param pWheel: [in] wheel to use
+  * @param pNode: [in] node to arm
+  * @param nowMs: [in] current time in milliseconds
+  * @param timeoutMs: [in] relative timeout in milliseconds
+  * @note  O(1): the node is linked into a single slot.
+  */
+void timer_arm(Timer_Wheel_t *pWheel, Timer_Node_t *pNode, uint64_t nowMs, uint64_t timeoutMs) {
+    uint64_t expires = (nowMs + timeoutMs + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+
+    timer_cancel(pWheel, pNode);
+
+    // never schedule into a tick that was already processed
+    if (expires <= pWheel->now) {
+        expires = pWheel->now + 1;
+    }
+
+    pNode->expires = expires;
+    timer_place(pWheel, pNode);
+    pWheel->pending++;
+
+    return;
+}
+
+/**
+  * @brief  Disarm a timer
+  * @param pWheel: [in] wheel the node belongs to
+  * @param pNode: [in] node to disarm
+  */
+void timer_cancel(Timer_Wheel_t *pWheel, Timer_Node_t *pNode) {
+    if (true != timer_isArmed(pNode)) {
+        return;
+    }
+
+    timer_unlink(pNode);
+    pWheel->pending--;
+
+    return;
+}
+
+/**
+  * @brief  Advance the wheel and fire expired timers
+  * @param pWheel: [in] wheel to advance
+  * @param nowMs: [in] current time in milliseconds
+  * @retval number of timers fired
+  * @note  Callbacks may re-arm or cancel any node, including their own.
+  */
+int timer_advance(Timer_Wheel_t *pWheel, uint64_t nowMs) {
+    uint64_t target = nowMs / TIMER_TICK_MS;
+    Timer_Node_t *pHead = NULL;
+    Timer_Node_t *pNode = NULL;
+    int fired = 0;
+    int level = 0;
+    int index = 0;
+
+    while (pWheel->now < target) {
+        // skip idle stretches in one step
+        if (0 == pWheel->pending) {
+            pWheel->now = target;
+            break;
+        }
+
+        pWheel->now++;
+        index = pWheel->now & TIMER_SLOT_MASK;
+
+        // lower level wrapped around, pull down the next slot of each upper level
+        for (level = 1; level < TIMER_LEVELS && 0 == index; level++) {
+            index = (pWheel->now >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+            timer_cascade(pWheel, level, index);
+        }
+
+        pHead = &pWheel->slots[0][pWheel->now & TIMER_SLOT_MASK];
+        while (pHead->pNext != pHead) {
+            pNode = pHead->pNext;
+            timer_unlink(pNode);
+            pWheel->pending--;
+            fired++;
+
+            if (NULL != pNode->pCallback) {
+                pNode->pCallback(pNode, pNode->pArg);
+            }
+        }
+    }
+
+    return fired;
+}
+
+/**
+  * @brief  Compute how long the event loop may sleep
+  * @param pWheel: [in] wheel to inspect
+  * @param nowMs: [in] current time in milliseconds
+  * @retval milliseconds until the next expiry or cascade, -1 if nothing is armed
+  */
+int timer_nextTimeoutMs(Timer_Wheel_t *pWheel, uint64_t nowMs) {
+    uint64_t tick = pWheel->now;
+    uint64_t wakeMs = 0;
+    Timer_Node_t *pHead = NULL;
+
+    if (0 == pWheel->pending) {
+        return -1;
+    }
+
+    // look for the first populated level 0 slot before the next cascade
+    do {
+        tick++;
+        pHead = &pWheel->slots[0][tick & TIMER_SLOT_MASK];
+        if (pHead->pNext != pHead) {
+            break;
+        }
+    } while (0 != (tick & TIMER_SLOT_MASK));
+
+    wakeMs = tick * TIMER_TICK_MS;
+    if (wakeMs <= nowMs) {
+        return 0;
+    }
+
+    return (int)(wakeMs - nowMs);
+}
+
+/**
+ * Helper functions
+ */
+
+static void timer_place(Timer_Wheel_t *pWheel, Timer_Node_t *pNode) {
+    uint64_t delta = pNode->expires - pWheel->now;
+    uint64_t expires = pNode->expires;
+    Timer_Node_t *pHead = NULL;
+    int level = 0;
+
+    for (; level < TIMER_LEVELS - 1; level++) {
+        if (delta < ((uint64_t)1 << ((level + 1) * TIMER_SLOT_BITS))) {
+            break;
+        }
+    }
+
+    // clamp to the wheel horizon, the node gets re-cascaded until it is due
+    if (delta >= ((uint64_t)1 << (TIMER_LEVELS * TIMER_SLOT_BITS))) {
+        expires = pWheel->now + ((uint64_t)1 << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1;
+    }
+
+    pHead = &pWheel->slots[level][(expires >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK];
+    pNode->pPrev = pHead->pPrev;
+    pNode->pNext = pHead;
+    pHead->pPrev->pNext = pNode;
+    pHead->pPrev = pNode;
+
+    return;
+}
+
+static void timer_unlink(Timer_Node_t *pNode) {
+    pNode->pPrev->pNext = pNode->pNext;
+    pNode->pNext->pPrev = pNode->pPrev;
+    pNode->pNext = NULL;
+    pNode->pPrev = NULL;
+
+    return;
+}
+
+static void timer_cascade(Timer_Wheel_t *pWheel, int level, int index) {
+    Timer_Node_t *pHead = &pWheel->slots[level][index];
+    Timer_Node_t *pNode = NULL;
+
+    while (pHead->pNext != pHead) {
+        pNode = pHead->pNext;
+        timer_unlink(pNode);
+        if (pNode->expires <= pWheel->now) {
+            pNode->expires = pWheel->now;
+        }
+        timer_place(pWheel, pNode);
+    }
+
+    return;
+}
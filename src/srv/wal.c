@@ -0,0 +1,298 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include "wal.h"
+#include "reading.h"
+#include "checksum.h"
+
+/* Private function prototypes -----------------------------------------------*/
+// checksum of a record in network byte order
+static uint32_t wal_checksum(const Wal_Record_t *pRecord);
+
+/**
+ * @brief  Prepare a log
+ * @param pWal: [out] Log
+ * @param fd: [in] Log file, opened read/write
+ * @param seq: [in] Last sequence number the database already holds
+ */
+void wal_init(Wal_t *pWal, int fd, uint64_t seq)
+{
+    memset(pWal, 0, sizeof(Wal_t));
+    pWal->fd = fd;
+    pWal->seq = seq;
+
+    return;
+}
+
+/**
+ * @brief  Release the buffer of a log
+ * @param pWal: [in] Log
+ */
+void wal_free(Wal_t *pWal)
+{
+    free(pWal->pPending);
+    pWal->pPending = NULL;
+    pWal->pendingCount = 0;
+    pWal->pendingCapacity = 0;
+    free(pWal->pBacklog);
+    pWal->pBacklog = NULL;
+    pWal->backlogCapacity = 0;
+    pWal->backlogCount = 0;
+
+    return;
+}
+
+/**
+ * @brief  Read the next record of the log file
+ * @param pWal: [in] Log, numbering continues after the records read
+ * @param pRecord: [out] Record in host byte order
+ * @return false at the end of the file, or at a record cut short or damaged
+ *         by a crash, which ends the log
+ */
+bool wal_read(Wal_t *pWal, Wal_Record_t *pRecord)
+{
+    if (sizeof(Wal_Record_t) != pread(pWal->fd, pRecord, sizeof(Wal_Record_t), (off_t)pWal->readOffset) ||
+        true != wal_decode(pRecord)) {
+        return false;
+    }
+    pWal->readOffset += sizeof(Wal_Record_t);
+
+    if (pRecord->seq > pWal->seq) {
+        pWal->seq = pRecord->seq;
+    }
+
+    return true;
+}
+
+/**
+ * @brief  Cut the log file after the records read so far
+ * @param pWal: [in] Log
+ * @note  Drops a torn tail, new records are appended after the intact ones.
+ */
+void wal_truncateRead(Wal_t *pWal)
+{
+    if (0 != ftruncate(pWal->fd, (off_t)pWal->readOffset)) {
+        perror("ftruncate");
+    }
+    lseek(pWal->fd, 0, SEEK_END);
+
+    return;
+}
+
+/**
+ * @brief  Log one mutation
+ * @param pWal: [in] Log
+ * @param type: [in] Kind of mutation
+ * @param pReading: [in] Reading in host byte order, for WAL_REMOVE only the ID is used
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  Nothing reaches the file before wal_commit().
+ */
+int wal_append(Wal_t *pWal, Wal_Type_e type, const DbProtocol_Reading_t *pReading)
+{
+    Wal_Record_t *pRecord = NULL;
+    uint32_t capacity = 0;
+
+    if (pWal->pendingCount == pWal->pendingCapacity) {
+        capacity = (0 == pWal->pendingCapacity) ? WAL_INITIAL_RECORDS : pWal->pendingCapacity * 2;
+        pRecord = realloc(pWal->pPending, capacity * sizeof(Wal_Record_t));
+        if (NULL == pRecord) {
+            printf("Realloc failed to log a change\r\n");
+            return STATUS_ERROR;
+        }
+        pWal->pPending = pRecord;
+        pWal->pendingCapacity = capacity;
+    }
+
+    pRecord = &pWal->pPending[pWal->pendingCount++];
+    memset(pRecord, 0, sizeof(Wal_Record_t));
+    pRecord->seq = htobe64(++pWal->seq);
+    pRecord->type = htonl(type);
+    if (WAL_REMOVE == type) {
+        memcpy(pRecord->reading.sensorId, pReading->sensorId, sizeof(pRecord->reading.sensorId));
+    } else {
+        pRecord->reading = *pReading;
+        reading_hton(&pRecord->reading);
+    }
+    pRecord->checksum = htonl(wal_checksum(pRecord));
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Write the buffered records
+ * @param pWal: [in] Log
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  Group commit: one write and one fdatasync() cover every change
+ *        buffered since the last commit, which is a request about to be
+ *        answered or an event loop iteration of UDP, ring and replicated
+ *        readings. A change is only acknowledged once it is on disk. A
+ *        failed commit cuts the file back to where it was and keeps the
+ *        records buffered for the next one, only written records reach
+ *        the backlog.
+ */
+int wal_commit(Wal_t *pWal)
+{
+    size_t bytes = (size_t)pWal->pendingCount * sizeof(Wal_Record_t);
+    ssize_t written = 0;
+    off_t offset = 0;
+    uint64_t seq = 0;
+    uint32_t i = 0;
+
+    if (0 == pWal->pendingCount) {
+        return STATUS_SUCCESS;
+    }
+
+    if (pWal->fd < 0) {
+        return STATUS_ERROR;
+    }
+
+    offset = lseek(pWal->fd, 0, SEEK_CUR);
+    if (offset < 0) {
+        perror("lseek");
+        return STATUS_ERROR;
+    }
+
+    // a torn record would end the replay before every record behind it
+    written = write(pWal->fd, pWal->pPending, bytes);
+    if ((ssize_t)bytes != written || 0 != fdatasync(pWal->fd)) {
+        printf("Failed to log %u changes: %s\r\n", pWal->pendingCount,
+               ((ssize_t)bytes == written || written < 0) ? strerror(errno) : "short write");
+        if (0 != ftruncate(pWal->fd, offset)) {
+            perror("ftruncate");
+        }
+        lseek(pWal->fd, offset, SEEK_SET);
+        return STATUS_ERROR;
+    }
+
+    for (; 0 != pWal->backlogCapacity && i < pWal->pendingCount; i++) {
+        seq = be64toh(pWal->pPending[i].seq);
+        pWal->pBacklog[seq % pWal->backlogCapacity] = pWal->pPending[i];
+    }
+    pWal->backlogCount += pWal->pendingCount;
+    if (pWal->backlogCount > pWal->backlogCapacity) {
+        pWal->backlogCount = pWal->backlogCapacity;
+    }
+    pWal->pendingCount = 0;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Empty the log after a checkpoint
+ * @param pWal: [in] Log
+ * @note  Records a failed commit left buffered are older than the
+ *        checkpoint, replay skips them once they are written.
+ */
+void wal_checkpoint(Wal_t *pWal)
+{
+    if (pWal->fd < 0) {
+        return;
+    }
+
+    if (0 != ftruncate(pWal->fd, 0)) {
+        perror("ftruncate");
+    }
+    lseek(pWal->fd, 0, SEEK_SET);
+    pWal->readOffset = 0;
+
+    return;
+}
+
+/**
+ * @brief  Keep recently committed records in memory
+ * @param pWal: [in] Log
+ * @param records: [in] Records to keep, 0 keeps none
+ * @return STATUS_SUCCESS or STATUS_ERROR
+ * @note  Sequence numbers have no gaps, so record seq lives in slot
+ *        seq % records and a replica position is looked up directly.
+ */
+int wal_backlogInit(Wal_t *pWal, uint32_t records)
+{
+    free(pWal->pBacklog);
+    pWal->pBacklog = NULL;
+    pWal->backlogCapacity = 0;
+    pWal->backlogCount = 0;
+
+    if (0 == records) {
+        return STATUS_SUCCESS;
+    }
+
+    pWal->pBacklog = malloc((size_t)records * sizeof(Wal_Record_t));
+    if (NULL == pWal->pBacklog) {
+        printf("Malloc failed to keep a log backlog\r\n");
+        return STATUS_ERROR;
+    }
+    pWal->backlogCapacity = records;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief  Check that a replica can continue from a position
+ * @param pWal: [in] Log
+ * @param afterSeq: [in] Last record the replica holds
+ * @return true when afterSeq is at most the last committed record and no
+ *         committed record after it has left the backlog
+ */
+bool wal_backlogHas(const Wal_t *pWal, uint64_t afterSeq)
+{
+    uint64_t head = pWal->seq - pWal->pendingCount;
+
+    return afterSeq <= head && head - afterSeq <= pWal->backlogCount;
+}
+
+/**
+ * @brief  Copy committed records from the backlog
+ * @param pWal: [in] Log
+ * @param afterSeq: [in] Last record the reader holds, wal_backlogHas() must be true
+ * @param pOut: [out] Records in network byte order
+ * @param max: [in] Room at pOut
+ * @return number of records copied, 0 when the reader is up to date
+ */
+uint32_t wal_backlogRead(const Wal_t *pWal, uint64_t afterSeq, Wal_Record_t *pOut, uint32_t max)
+{
+    uint64_t head = pWal->seq - pWal->pendingCount;
+    uint32_t n = 0;
+
+    for (; n < max && afterSeq + n < head; n++) {
+        pOut[n] = pWal->pBacklog[(afterSeq + n + 1) % pWal->backlogCapacity];
+    }
+
+    return n;
+}
+
+/**
+ * @brief  Verify a record and convert it to host byte order
+ * @param pRecord: [in] Record as stored or received, converted in place
+ * @return false if the checksum does not match, the record is left as is
+ */
+bool wal_decode(Wal_Record_t *pRecord)
+{
+    if (ntohl(pRecord->checksum) != wal_checksum(pRecord)) {
+        return false;
+    }
+
+    pRecord->seq = be64toh(pRecord->seq);
+    pRecord->type = ntohl(pRecord->type);
+    pRecord->checksum = ntohl(pRecord->checksum);
+    reading_ntoh(&pRecord->reading);
+
+    return true;
+}
+
+/**
+ * Helper functions
+ */
+
+static uint32_t wal_checksum(const Wal_Record_t *pRecord)
+{
+    Wal_Record_t record = *pRecord;
+
+    record.checksum = 0;
+
+    return checksum_crc32c(CHECKSUM_SEED, &record, sizeof(record));
+}
@@ -0,0 +1,18 @@
+#ifndef _CHECK_H
+#define _CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Minimal assertions for the behaviour checks in tests/, each program stops
+ * at the first failed check and exits non-zero so `make test` stops too.
+ */
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\r\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+#endif /* _CHECK_H */
@@ -0,0 +1,318 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <endian.h>
+#include <netinet/in.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "common.h"
+#include "reading.h"
+#include "check.h"
+
+/*
+ * Requests pipelined behind an export: a client that keeps sending while
+ * the server streams a snapshot to it fills its request buffer long before
+ * the file is out. The server must hold those requests, not drop the
+ * client, and answer every one of them in order once the export is done.
+ * Runs bin/telemetry_srv on a scratch database.
+ */
+
+#define SERVER_PATH     "bin/telemetry_srv"
+#define SENSORS         60000
+// requests behind the export, more bytes than a client buffer holds
+#define PIPELINED       700
+#define WAIT_MS         5000
+
+/* Private function prototypes -----------------------------------------------*/
+// start the server on a fresh database in dir, returns its pid
+static pid_t start_server(const char *pDir, unsigned short port);
+// connect and handshake, rcvBuf 0 keeps the default receive buffer
+static int connect_server(unsigned short port, int rcvBuf);
+// send a request without payload or with one
+static void send_request(int fd, DbProtocol_e type, uint16_t len, const void *pPayload, size_t bytes);
+// read exactly len bytes
+static void read_full(int fd, void *pBuf, size_t len);
+// read a response header in host byte order
+static void read_header(int fd, DbProtocolHdr_t *pHdr);
+// ask for the snapshot, returns its size once the server has one to export
+static uint64_t wait_snapshot(int fd);
+// a port nothing listens on right now
+static unsigned short free_port(void);
+// nftw() callback removing the scratch directory
+static int remove_entry(const char *pPath, const struct stat *pStat, int flag, struct FTW *pFtw);
+
+int main(void)
+{
+    char dir[] = "/tmp/telemetry_test_export.XXXXXX";
+    char buff[BUFF_SIZE];
+    char pipeline[sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_ExportReq_t) + PIPELINED * sizeof(DbProtocolHdr_t)];
+    DbProtocolHdr_t *pReq = (DbProtocolHdr_t *)pipeline;
+    DbProtocol_Reading_t readings[BATCH_MAX_READINGS];
+    DbProtocol_ExportReq_t exportReq = {0};
+    DbProtocol_ExportResp_t exportResp;
+    DbProtocol_ReplStatusResp_t status;
+    DbProtocolHdr_t hdr;
+    unsigned short port = 0;
+    uint64_t size = 0;
+    uint64_t got = 0;
+    uint32_t sent = 0;
+    uint32_t n = 0;
+    uint32_t i = 0;
+    time_t now = time(NULL);
+    pid_t pid = -1;
+    int fd = -1;
+
+    signal(SIGPIPE, SIG_IGN);
+    CHECK(NULL != mkdtemp(dir));
+    port = free_port();
+    pid = start_server(dir, port);
+
+    // enough sensors that the snapshot outgrows the socket buffers
+    fd = connect_server(port, 0);
+    for (sent = 0; sent < SENSORS; sent += n) {
+        n = (SENSORS - sent > BATCH_MAX_READINGS) ? BATCH_MAX_READINGS : SENSORS - sent;
+        memset(readings, 0, sizeof(readings));
+        for (i = 0; i < n; i++) {
+            snprintf(readings[i].sensorId, sizeof(readings[i].sensorId), "sensor-%u", sent + i);
+            strcpy(readings[i].sensorType, "temp");
+            readings[i].timestamp = (uint32_t)now;
+            readings[i].readingValue = 1.5f;
+            reading_hton(&readings[i]);
+        }
+        send_request(fd, MSG_SENSOR_BATCH_ADD_REQ, n, readings, n * sizeof(DbProtocol_Reading_t));
+        read_header(fd, &hdr);
+        CHECK(MSG_SENSOR_BATCH_ADD_RESP == hdr.type && n == hdr.len);
+    }
+
+    send_request(fd, MSG_SNAPSHOT_REQ, 0, NULL, 0);
+    read_header(fd, &hdr);
+    CHECK(MSG_SNAPSHOT_RESP == hdr.type && 1 == hdr.len);
+    read_full(fd, buff, sizeof(DbProtocol_SnapshotResp_t));
+    size = wait_snapshot(fd);
+    close(fd);
+
+    // the export request and everything behind it go out at once, and a small receive
+    // buffer keeps the export going for several loop iterations while they wait
+    fd = connect_server(port, BUFF_SIZE);
+    memset(pipeline, 0, sizeof(pipeline));
+    pReq->type = htonl(MSG_EXPORT_REQ);
+    pReq->len = htons(1);
+    exportReq.file = htonl(EXPORT_SNAPSHOT);
+    memcpy(&pReq[1], &exportReq, sizeof(exportReq));
+    pReq = (DbProtocolHdr_t *)(pipeline + sizeof(DbProtocolHdr_t) + sizeof(DbProtocol_ExportReq_t));
+    for (i = 0; i < PIPELINED; i++) {
+        pReq[i].type = htonl(MSG_REPL_STATUS_REQ);
+    }
+    CHECK((ssize_t)sizeof(pipeline) == send(fd, pipeline, sizeof(pipeline), 0));
+    usleep(200 * 1000);
+
+    read_header(fd, &hdr);
+    CHECK(MSG_EXPORT_RESP == hdr.type && 1 == hdr.len);
+    read_full(fd, &exportResp, sizeof(exportResp));
+    CHECK(size == be64toh(exportResp.size));
+    for (got = 0; got < size; got += n) {
+        n = (size - got > sizeof(buff)) ? sizeof(buff) : (uint32_t)(size - got);
+        read_full(fd, buff, n);
+    }
+
+    // every pipelined request is answered, in order, on the same connection
+    for (i = 0; i < PIPELINED; i++) {
+        read_header(fd, &hdr);
+        CHECK(MSG_REPL_STATUS_RESP == hdr.type && 1 == hdr.len);
+        read_full(fd, &status, sizeof(status));
+        CHECK(SENSORS == be64toh(status.seq));
+    }
+    close(fd);
+
+    kill(pid, SIGTERM);
+    CHECK(pid == waitpid(pid, NULL, 0));
+    nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    printf("test_export: ok\r\n");
+
+    return 0;
+}
+
+/**
+ * Helper functions
+ */
+
+static pid_t start_server(const char *pDir, unsigned short port)
+{
+    char dbPath[64];
+    char logPath[64];
+    char portArg[8];
+    pid_t pid = -1;
+    int logFd = -1;
+
+    snprintf(dbPath, sizeof(dbPath), "%s/a.db", pDir);
+    snprintf(logPath, sizeof(logPath), "%s/server.log", pDir);
+    snprintf(portArg, sizeof(portArg), "%u", port);
+
+    pid = fork();
+    CHECK(-1 != pid);
+    if (0 == pid) {
+        // a failed check exits the test, the server goes with it
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        logFd = open(logPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (-1 != logFd) {
+            dup2(logFd, STDOUT_FILENO);
+            dup2(logFd, STDERR_FILENO);
+        }
+        execl(SERVER_PATH, SERVER_PATH, "-n", "-f", dbPath, "-p", portArg, (char *)NULL);
+        _exit(127);
+    }
+
+    return pid;
+}
+
+static int connect_server(unsigned short port, int rcvBuf)
+{
+    struct sockaddr_in serverInfo = {0};
+    struct timeval timeout = { .tv_sec = WAIT_MS / 1000, .tv_usec = 0 };
+    DbProtocolVer_Req_t ver = { .version = htons(PROTOCOL_VER) };
+    DbProtocolVer_Resp_t verResp;
+    DbProtocolHdr_t hdr;
+    int tries = 0;
+    int fd = -1;
+
+    serverInfo.sin_family = AF_INET;
+    serverInfo.sin_port = htons(port);
+    serverInfo.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    // the server may still be loading
+    for (tries = 0; tries < WAIT_MS / 50; tries++) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        CHECK(-1 != fd);
+        if (0 != rcvBuf) {
+            CHECK(0 == setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvBuf, sizeof(rcvBuf)));
+        }
+        CHECK(0 == setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)));
+        if (0 == connect(fd, (struct sockaddr *)&serverInfo, sizeof(serverInfo))) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+        usleep(50 * 1000);
+    }
+    CHECK(-1 != fd);
+
+    send_request(fd, MSG_HANDSHAKE_REQ, 1, &ver, sizeof(ver));
+    read_header(fd, &hdr);
+    CHECK(MSG_HANDSHAKE_RESP == hdr.type && 1 == hdr.len);
+    read_full(fd, &verResp, sizeof(verResp));
+
+    return fd;
+}
+
+static void send_request(int fd, DbProtocol_e type, uint16_t len, const void *pPayload, size_t bytes)
+{
+    char txBuf[BUFF_SIZE];
+    DbProtocolHdr_t *hdr = (DbProtocolHdr_t *)txBuf;
+
+    CHECK(sizeof(DbProtocolHdr_t) + bytes <= sizeof(txBuf));
+    memset(hdr, 0, sizeof(DbProtocolHdr_t));
+    hdr->type = htonl(type);
+    hdr->len = htons(len);
+    if (0 != bytes) {
+        memcpy(&hdr[1], pPayload, bytes);
+    }
+
+    CHECK((ssize_t)(sizeof(DbProtocolHdr_t) + bytes) == send(fd, txBuf, sizeof(DbProtocolHdr_t) + bytes, 0));
+
+    return;
+}
+
+static void read_full(int fd, void *pBuf, size_t len)
+{
+    char *pByte = pBuf;
+    ssize_t n = 0;
+
+    while (0 != len) {
+        n = recv(fd, pByte, len, 0);
+        if (n < 0 && EINTR == errno) {
+            continue;
+        }
+        // a timeout or a hangup before the whole response is a failure
+        CHECK(n > 0);
+        pByte += n;
+        len -= n;
+    }
+
+    return;
+}
+
+static void read_header(int fd, DbProtocolHdr_t *pHdr)
+{
+    read_full(fd, pHdr, sizeof(DbProtocolHdr_t));
+    pHdr->type = ntohl(pHdr->type);
+    pHdr->len = ntohs(pHdr->len);
+
+    return;
+}
+
+static uint64_t wait_snapshot(int fd)
+{
+    DbProtocol_ExportReq_t req = { .file = htonl(EXPORT_SNAPSHOT) };
+    DbProtocol_ExportResp_t resp;
+    DbProtocolHdr_t hdr;
+    char buff[BUFF_SIZE];
+    uint64_t size = 0;
+    uint64_t got = 0;
+    size_t n = 0;
+    int tries = 0;
+
+    // the snapshot is written by a child process, exports are refused until it is done
+    for (tries = 0; tries < WAIT_MS / 50; tries++) {
+        send_request(fd, MSG_EXPORT_REQ, 1, &req, sizeof(req));
+        read_header(fd, &hdr);
+        if (MSG_EXPORT_RESP == hdr.type) {
+            break;
+        }
+        CHECK(MSG_ERROR == hdr.type);
+        usleep(50 * 1000);
+    }
+    CHECK(MSG_EXPORT_RESP == hdr.type);
+
+    read_full(fd, &resp, sizeof(resp));
+    size = be64toh(resp.size);
+    for (got = 0; got < size; got += n) {
+        n = (size - got > sizeof(buff)) ? sizeof(buff) : (size_t)(size - got);
+        read_full(fd, buff, n);
+    }
+    // larger than a socket buffer can grow to, or the export would not stall
+    CHECK(size > 4 * 1024 * 1024);
+
+    return size;
+}
+
+static unsigned short free_port(void)
+{
+    struct sockaddr_in addr = {0};
+    socklen_t len = sizeof(addr);
+    unsigned short port = 0;
+    int fd = -1;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(-1 != fd);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(0 == bind(fd, (struct sockaddr *)&addr, sizeof(addr)));
+    CHECK(0 == getsockname(fd, (struct sockaddr *)&addr, &len));
+    port = ntohs(addr.sin_port);
+    close(fd);
+
+    return port;
+}
+
+static int remove_entry(const char *pPath, const struct stat *pStat, int flag, struct FTW *pFtw)
+{
+    return remove(pPath);
+}
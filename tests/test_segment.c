@@ -0,0 +1,178 @@
+#include <endian.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "parse.h"
+#include "check.h"
+
+/*
+ * Segment blocks a checkpoint appended before its database was renamed into
+ * place: a start at an older checkpoint drops them, the log replays their
+ * readings, while blocks of the committed checkpoint are loaded. Compaction
+ * keeps uncommitted blocks after the committed ones, and version 1 files
+ * are still read.
+ */
+
+#define SENSOR_ID   "sensor-segment"
+// a whole segment's worth of seconds past the epoch
+#define DAY_START   (SEGMENT_WIDTH * 19000u)
+
+/* Private function prototypes -----------------------------------------------*/
+// a table holding the test sensor, returns its row
+static uint32_t make_table(Table_t *pTable);
+// load the segments like a start at checkpoint seq, returns the readings of the test sensor
+static uint32_t load_readings(const char *pDir, uint64_t seq, uint32_t *pSegments);
+// a descriptor of its own, duplicates would share the offset the catalog scan leaves behind
+static int open_dir(const char *pDir);
+// version of the segment file holding DAY_START
+static uint16_t file_version(int dirFd);
+
+int main(void)
+{
+    char dir[] = "/tmp/telemetry_test_segment.XXXXXX";
+    Parse_SegmentHeader_t header;
+    Parse_HistoryBlock_t block;
+    Parse_HistorySample_t records[2];
+    Segment_Store_t store;
+    Table_t table;
+    Budget_t budget;
+    char name[SEGMENT_NAME_LEN];
+    uint32_t segments = 0;
+    uint32_t row = 0;
+    int dirFd = -1;
+    int fd = -1;
+
+    CHECK(NULL != mkdtemp(dir));
+    dirFd = open_dir(dir);
+
+    // checkpoint 4 seals two readings, checkpoint 5 appends a third and never commits
+    row = make_table(&table);
+    segment_init(&store, open_dir(dir));
+    CHECK(STATUS_SUCCESS == history_add(&table.pHistory[row], DAY_START + 10, 1.0f));
+    CHECK(STATUS_SUCCESS == history_add(&table.pHistory[row], DAY_START + 20, 2.0f));
+    CHECK(STATUS_SUCCESS == parse_outputSegments(&store, &table, 0, 4));
+    CHECK(STATUS_SUCCESS == history_add(&table.pHistory[row], DAY_START + 30, 3.0f));
+    CHECK(STATUS_SUCCESS == parse_outputSegments(&store, &table, 0, 5));
+    segment_free(&store);
+    table_free(&table);
+    CHECK(SEGMENT_VERSION == file_version(dirFd));
+
+    // the database holds checkpoint 4, the third reading comes back from the log instead
+    CHECK(2 == load_readings(dir, 4, &segments));
+    CHECK(1 == segments);
+    CHECK(2 == load_readings(dir, 5, &segments));
+
+    // a compaction while checkpoint 5 is written keeps its late reading apart, after the committed block
+    row = make_table(&table);
+    segment_init(&store, open_dir(dir));
+    budget_init(&budget, 0);
+    CHECK(STATUS_SUCCESS == parse_readSegments(&store, &table, &budget, 4));
+    CHECK(STATUS_SUCCESS == history_add(&table.pHistory[row], DAY_START + 5, 0.5f));
+    CHECK(STATUS_SUCCESS == parse_outputSegments(&store, &table, 0, 5));
+    store.pSegments[0].rewrite = true;
+    CHECK(STATUS_SUCCESS == parse_outputSegments(&store, &table, 0, 5));
+    segment_free(&store);
+    table_free(&table);
+    CHECK(2 == load_readings(dir, 4, &segments));
+
+    // once the database of checkpoint 5 is in place its blocks count
+    row = make_table(&table);
+    segment_init(&store, open_dir(dir));
+    CHECK(STATUS_SUCCESS == parse_readSegments(&store, &table, &budget, 4));
+    CHECK(STATUS_SUCCESS == history_add(&table.pHistory[row], DAY_START + 30, 3.0f));
+    CHECK(STATUS_SUCCESS == parse_outputSegments(&store, &table, 0, 5));
+    segment_free(&store);
+    table_free(&table);
+    CHECK(3 == load_readings(dir, 5, &segments));
+    CHECK(3 == load_readings(dir, 5, &segments));
+
+    // a version 1 file has no checkpoints, its blocks are loaded and the file is converted
+    memset(&header, 0, sizeof(header));
+    header.magic = htonl(SEGMENT_MAGIC);
+    header.version = htons(SEGMENT_VERSION_V1);
+    header.start = htonl(DAY_START);
+    header.width = htonl(SEGMENT_WIDTH);
+    memset(&block, 0, sizeof(block));
+    strncpy(block.sensorId, SENSOR_ID, sizeof(block.sensorId) - 1);
+    block.count = htonl(2);
+    memset(records, 0, sizeof(records));
+    records[0].timestamp = htonl(DAY_START + 40);
+    records[1].timestamp = htonl(DAY_START + 50);
+    segment_name(DAY_START, false, name);
+    fd = openat(dirFd, name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CHECK(-1 != fd);
+    CHECK(sizeof(header) == write(fd, &header, sizeof(header)));
+    CHECK(sizeof(block) == write(fd, &block, sizeof(block)));
+    CHECK(sizeof(records) == write(fd, records, sizeof(records)));
+    close(fd);
+    CHECK(2 == load_readings(dir, 0, &segments));
+    CHECK(SEGMENT_VERSION == file_version(dirFd));
+    CHECK(2 == load_readings(dir, 0, &segments));
+
+    unlinkat(dirFd, name, 0);
+    close(dirFd);
+    rmdir(dir);
+
+    printf("test_segment: ok\r\n");
+
+    return 0;
+}
+
+/**
+ * Helper functions
+ */
+static uint32_t make_table(Table_t *pTable)
+{
+    bool created = false;
+    int row = -1;
+
+    CHECK(STATUS_SUCCESS == table_init(pTable, 16));
+    row = table_insert(pTable, SENSOR_ID, &created);
+    CHECK(-1 != row && true == created);
+
+    return (uint32_t)row;
+}
+
+static uint32_t load_readings(const char *pDir, uint64_t seq, uint32_t *pSegments)
+{
+    Segment_Store_t store;
+    Table_t table;
+    Budget_t budget;
+    uint32_t row = make_table(&table);
+    uint32_t count = 0;
+
+    budget_init(&budget, 0);
+    segment_init(&store, open_dir(pDir));
+    CHECK(STATUS_SUCCESS == parse_readSegments(&store, &table, &budget, seq));
+    count = table.pHistory[row].count;
+    *pSegments = store.count;
+    segment_free(&store);
+    table_free(&table);
+
+    return count;
+}
+
+static int open_dir(const char *pDir)
+{
+    int fd = open(pDir, O_RDONLY | O_DIRECTORY);
+
+    CHECK(-1 != fd);
+
+    return fd;
+}
+
+static uint16_t file_version(int dirFd)
+{
+    Parse_SegmentHeader_t header;
+    char name[SEGMENT_NAME_LEN];
+    int fd = -1;
+
+    segment_name(DAY_START, false, name);
+    fd = openat(dirFd, name, O_RDONLY);
+    CHECK(-1 != fd);
+    CHECK(sizeof(header) == read(fd, &header, sizeof(header)));
+    close(fd);
+
+    return ntohs(header.version);
+}
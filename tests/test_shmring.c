@@ -0,0 +1,122 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "shmring.h"
+#include "check.h"
+
+/*
+ * Bounds of the shared memory ring: every producer can write the whole
+ * mapping, so whatever it puts into head, the slot count, slot sequences
+ * or strings must not move the server outside the ring or stall it, and
+ * it cannot resize the memfd under the server's mapping.
+ */
+
+#define SLOTS       16
+
+/* Private function prototypes -----------------------------------------------*/
+// push one reading named after value
+static void push_reading(ShmRing_t *pRing, int eventFd, uint32_t value);
+
+int main(void)
+{
+    ShmRing_Consumer_t consumer;
+    ShmRing_t *pProducer = NULL;
+    DbProtocol_Reading_t reading;
+    uint64_t head = 0;
+    uint32_t i = 0;
+    int eventFd = -1;
+    int memFd = -1;
+
+    eventFd = eventfd(0, EFD_NONBLOCK);
+    CHECK(-1 != eventFd);
+    CHECK(STATUS_SUCCESS == shmring_create(SLOTS, &consumer, &memFd));
+    pProducer = shmring_map(memFd);
+    CHECK(NULL != pProducer);
+
+    // readings come out in order
+    push_reading(pProducer, eventFd, 1);
+    push_reading(pProducer, eventFd, 2);
+    CHECK(true == shmring_pop(&consumer, &reading) && 1.0f == reading.readingValue);
+    CHECK(true == shmring_pop(&consumer, &reading) && 2.0f == reading.readingValue);
+    CHECK(false == shmring_pop(&consumer, &reading));
+    CHECK(true == shmring_park(&consumer));
+
+    // a producer rewriting head and the slot count does not move the consumer
+    head = atomic_load(&pProducer->head);
+    atomic_store(&pProducer->head, UINT64_MAX - 3);
+    pProducer->slots = 0xFFFFFFF0;
+    CHECK(false == shmring_pop(&consumer, &reading));
+    pProducer->slots = SLOTS;
+    push_reading(pProducer, eventFd, 3);
+    CHECK(true == shmring_pop(&consumer, &reading) && 3.0f == reading.readingValue);
+    CHECK(head + 1 == atomic_load(&pProducer->head));
+
+    // a slot sequence that is neither free nor published is skipped once
+    push_reading(pProducer, eventFd, 4);
+    push_reading(pProducer, eventFd, 5);
+    atomic_store(&pProducer->ring[consumer.head & (SLOTS - 1)].seq, 0xDEADBEEF);
+    CHECK(true == shmring_pop(&consumer, &reading) && 5.0f == reading.readingValue);
+    CHECK(1 == consumer.corrupt);
+    CHECK(false == shmring_pop(&consumer, &reading));
+
+    // a whole lap of garbage is handed back without spinning; the consumer is then
+    // a lap ahead of tail and serves again once producers claim from its head
+    for (i = 0; i < SLOTS; i++) {
+        atomic_store(&pProducer->ring[i].seq, 0xDEADBEEF + i);
+    }
+    CHECK(false == shmring_park(&consumer));
+    CHECK(false == shmring_pop(&consumer, &reading));
+    CHECK(1 + SLOTS == consumer.corrupt);
+    CHECK(true == shmring_park(&consumer));
+    atomic_store(&pProducer->tail, consumer.head);
+    push_reading(pProducer, eventFd, 6);
+    CHECK(true == shmring_pop(&consumer, &reading) && 6.0f == reading.readingValue);
+
+    // strings without a terminator are cut at their field
+    memset(&reading, 'A', sizeof(reading));
+    reading.readingValue = 7.0f;
+    CHECK(STATUS_SUCCESS == shmring_push(pProducer, &reading, eventFd));
+    memset(&reading, 0, sizeof(reading));
+    CHECK(true == shmring_pop(&consumer, &reading) && 7.0f == reading.readingValue);
+    CHECK(sizeof(reading.sensorId) - 1 == strlen(reading.sensorId));
+    CHECK(sizeof(reading.sensorType) - 1 == strlen(reading.sensorType));
+
+    // the memfd cannot be resized or unsealed, so the mapping never loses its pages
+    CHECK(-1 == ftruncate(memFd, 0));
+    CHECK(-1 == ftruncate(memFd, 1 << 20));
+    CHECK(-1 == fcntl(memFd, F_ADD_SEALS, F_SEAL_WRITE));
+    push_reading(pProducer, eventFd, 8);
+    CHECK(true == shmring_pop(&consumer, &reading) && 8.0f == reading.readingValue);
+
+    // a producer refuses a ring whose slot count is not a power of two
+    pProducer->slots = SLOTS - 1;
+    CHECK(NULL == shmring_map(memFd));
+    pProducer->slots = SLOTS;
+
+    shmring_unmap(pProducer);
+    shmring_close(&consumer);
+    close(memFd);
+    close(eventFd);
+    printf("test_shmring: ok\r\n");
+
+    return 0;
+}
+
+/**
+ * Helper functions
+ */
+
+static void push_reading(ShmRing_t *pRing, int eventFd, uint32_t value)
+{
+    DbProtocol_Reading_t reading;
+
+    memset(&reading, 0, sizeof(reading));
+    snprintf(reading.sensorId, sizeof(reading.sensorId), "s%u", value);
+    strcpy(reading.sensorType, "temp");
+    reading.readingValue = (float)value;
+    CHECK(STATUS_SUCCESS == shmring_push(pRing, &reading, eventFd));
+
+    return;
+}
@@ -0,0 +1,174 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "wal.h"
+#include "checksum.h"
+#include "check.h"
+
+/*
+ * Replay of the mutation log after a crash: a record cut short by the crash
+ * or damaged on disk ends the log, the intact records before it are
+ * replayed, and logging carries on numbering after them. A commit that
+ * cannot write every record leaves no torn record behind.
+ */
+
+#define RECORDS     5
+
+/* Private function prototypes -----------------------------------------------*/
+// log count readings numbered after seq, the file is replaced
+static void write_log(const char *pPath, uint64_t seq, uint32_t count);
+// replay the log like a restart does, returns how many records were intact
+static uint32_t replay_log(const char *pPath, Wal_t *pWal, int *pFd);
+
+int main(void)
+{
+    char dir[] = "/tmp/telemetry_test_wal.XXXXXX";
+    char path[64];
+    Wal_Record_t record;
+    DbProtocol_Reading_t reading;
+    struct rlimit limit;
+    struct rlimit saved;
+    struct stat st;
+    Wal_t wal;
+    int fd = -1;
+
+    checksum_init();
+    CHECK(NULL != mkdtemp(dir));
+    snprintf(path, sizeof(path), "%s/a.db%s", dir, WAL_SUFFIX);
+
+    // an intact log replays every record with its payload
+    write_log(path, 0, RECORDS);
+    fd = open(path, O_RDWR);
+    CHECK(-1 != fd);
+    wal_init(&wal, fd, 0);
+    CHECK(true == wal_read(&wal, &record));
+    CHECK(1 == record.seq && WAL_ADD == record.type);
+    CHECK(0 == strcmp("s0", record.reading.sensorId) && 0.0f == record.reading.readingValue);
+    CHECK(true == wal_read(&wal, &record));
+    CHECK(2 == record.seq && 0 == strcmp("s1", record.reading.sensorId) && 1.0f == record.reading.readingValue);
+    wal_free(&wal);
+    close(fd);
+    CHECK(RECORDS == replay_log(path, &wal, &fd));
+    CHECK(RECORDS == wal.seq);
+    wal_free(&wal);
+    close(fd);
+
+    // a crash in the middle of a write leaves a torn record at the end
+    write_log(path, 0, RECORDS);
+    CHECK(0 == truncate(path, 3 * sizeof(Wal_Record_t) + 50));
+    CHECK(3 == replay_log(path, &wal, &fd));
+    CHECK(3 == wal.seq);
+    CHECK(0 == stat(path, &st) && 3 * sizeof(Wal_Record_t) == (size_t)st.st_size);
+
+    // the next record continues after the intact ones, not after the torn one
+    memset(&reading, 0, sizeof(reading));
+    strcpy(reading.sensorId, "after");
+    CHECK(STATUS_SUCCESS == wal_append(&wal, WAL_ADD, &reading));
+    CHECK(STATUS_SUCCESS == wal_commit(&wal));
+    wal_free(&wal);
+    close(fd);
+    CHECK(4 == replay_log(path, &wal, &fd));
+    CHECK(4 == wal.seq);
+    wal_free(&wal);
+    close(fd);
+
+    // a flipped bit fails the CRC and ends the log there
+    write_log(path, 0, RECORDS);
+    fd = open(path, O_RDWR);
+    CHECK(-1 != fd);
+    CHECK(1 == pwrite(fd, "X", 1, sizeof(Wal_Record_t) + offsetof(Wal_Record_t, reading) + 1));
+    close(fd);
+    CHECK(1 == replay_log(path, &wal, &fd));
+    CHECK(0 == stat(path, &st) && sizeof(Wal_Record_t) == (size_t)st.st_size);
+    wal_free(&wal);
+    close(fd);
+
+    // after a checkpoint the log numbers on from the database's sequence
+    write_log(path, 40, 2);
+    CHECK(2 == replay_log(path, &wal, &fd));
+    CHECK(42 == wal.seq);
+    wal_free(&wal);
+    close(fd);
+
+    // a write cut short is taken back, the records wait for the next commit
+    write_log(path, 0, RECORDS);
+    CHECK(RECORDS == replay_log(path, &wal, &fd));
+    CHECK(STATUS_SUCCESS == wal_backlogInit(&wal, 16));
+    CHECK(STATUS_SUCCESS == wal_append(&wal, WAL_ADD, &reading));
+    CHECK(STATUS_SUCCESS == wal_append(&wal, WAL_ADD, &reading));
+    signal(SIGXFSZ, SIG_IGN);
+    CHECK(0 == getrlimit(RLIMIT_FSIZE, &saved));
+    limit = saved;
+    limit.rlim_cur = (RECORDS + 1) * sizeof(Wal_Record_t) + 50;
+    CHECK(0 == setrlimit(RLIMIT_FSIZE, &limit));
+    CHECK(STATUS_ERROR == wal_commit(&wal));
+    CHECK(0 == setrlimit(RLIMIT_FSIZE, &saved));
+    CHECK(2 == wal.pendingCount && 0 == wal.backlogCount);
+    CHECK(0 == stat(path, &st) && RECORDS * sizeof(Wal_Record_t) == (size_t)st.st_size);
+    CHECK(STATUS_SUCCESS == wal_commit(&wal));
+    CHECK(0 == wal.pendingCount && 2 == wal.backlogCount);
+    wal_free(&wal);
+    close(fd);
+    CHECK(RECORDS + 2 == replay_log(path, &wal, &fd));
+    CHECK(RECORDS + 2 == wal.seq);
+    wal_free(&wal);
+    close(fd);
+
+    unlink(path);
+    rmdir(dir);
+    printf("test_wal: ok\r\n");
+
+    return 0;
+}
+
+/**
+ * Helper functions
+ */
+
+static void write_log(const char *pPath, uint64_t seq, uint32_t count)
+{
+    DbProtocol_Reading_t reading;
+    Wal_t wal;
+    uint32_t i = 0;
+    int fd = -1;
+
+    fd = open(pPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    CHECK(-1 != fd);
+    wal_init(&wal, fd, seq);
+
+    for (; i < count; i++) {
+        memset(&reading, 0, sizeof(reading));
+        snprintf(reading.sensorId, sizeof(reading.sensorId), "s%u", i);
+        strcpy(reading.sensorType, "temp");
+        reading.timestamp = 1700000000 + i;
+        reading.readingValue = (float)i;
+        CHECK(STATUS_SUCCESS == wal_append(&wal, WAL_ADD, &reading));
+    }
+    CHECK(STATUS_SUCCESS == wal_commit(&wal));
+
+    wal_free(&wal);
+    close(fd);
+
+    return;
+}
+
+static uint32_t replay_log(const char *pPath, Wal_t *pWal, int *pFd)
+{
+    Wal_Record_t record;
+    uint32_t count = 0;
+
+    *pFd = open(pPath, O_RDWR);
+    CHECK(-1 != *pFd);
+    wal_init(pWal, *pFd, 0);
+
+    while (true == wal_read(pWal, &record)) {
+        count++;
+    }
+    wal_truncateRead(pWal);
+
+    return count;
+}